@@ -15,6 +15,9 @@ enum {
 
 int range_enc_determine_range(const int *arfcns, int size, int *f0_out);
 int range_enc_arfcns(const int rng, const int *arfcns, int sze, int *out, int idx);
+int range_enc_arfcns_iter(const int rng, const int *arfcns, int sze, int *out);
+int range_enc_arfcns_cached(const int rng, const int *arfcns, int sze, int *out);
+void range_enc_memo_flush(void);
 int range_enc_find_index(const int rng, const int *arfcns, int size);
 int range_enc_filter_arfcns(const int rng, int *arfcns, const int sze, const int f0, int *f0_included);
 
@@ -45,6 +45,8 @@ struct sccp_connections;
 struct bsc_nat_parsed;
 struct bsc_nat;
 struct bsc_nat_ussd_con;
+struct bsc_nat_worker;
+struct bsc_nat_workers;
 
 enum {
 	NAT_CON_TYPE_NONE,
@@ -106,16 +108,23 @@ struct bsc_connection {
 	struct osmo_timer_list ping_timeout;
 	struct osmo_timer_list pong_timeout;
 
-	/* mgcp related code */
-	char *_endpoint_status;
+	/* mgcp related code, one bit per timeslot of each multiplex */
+	uint32_t *_endpoint_status;
 	int number_multiplexes;
 	int max_endpoints;
 	int last_endpoint;
+	/* the bsc_endpoint's with a transaction on this BSC */
+	struct llist_head mgcp_endpoints;
 
 	/* track the pending commands for this BSC */
 	struct llist_head cmd_pending;
 	int last_id;
 
+	/* the shard the SCCP connections of this BSC are kept in */
+	struct bsc_nat_shard *shard;
+	/* the worker thread reading the BSC or NULL for the select loop */
+	struct bsc_nat_worker *worker;
+
 	/* a back pointer */
 	struct bsc_nat *nat;
 };
@@ -192,8 +201,11 @@ struct bsc_endpoint {
 	int transaction_state;
 	/* the pending transaction id */
 	char *transaction_id;
-	/* the bsc we are talking to */
+	/* the bsc we are talking to and the entry in its list */
 	struct bsc_connection *bsc;
+	struct llist_head bsc_entry;
+	/* the connection the MSC assigned this endpoint to */
+	struct sccp_connections *con;
 };
 
 /**
@@ -245,6 +257,19 @@ struct bsc_nat_acc_lst_entry {
 	regex_t imsi_deny_re;
 };
 
+/**
+ * The BSC connections are spread over shards. Each shard owns a part
+ * of the SCCP reference space, the patched references of its
+ * connections are congruent to its number modulo the number of shards.
+ */
+struct bsc_nat_shard {
+	int nr;
+	/* the SCCP connections of the BSCs of this shard */
+	struct llist_head sccp_connections;
+	/* the last patched reference handed out */
+	uint32_t last_ref;
+};
+
 /**
  * the structure of the "nat" network
  */
@@ -252,6 +277,15 @@ struct bsc_nat {
 	/* active SCCP connections that need patching */
 	struct llist_head sccp_connections;
 
+	/* the partitions of the SCCP connections */
+	struct bsc_nat_shard *shards;
+	int num_shards;
+	int next_shard;
+
+	/* the threads reading the BSCs, none reads them in the select loop */
+	int num_workers;
+	struct bsc_nat_workers *workers;
+
 	/* active BSC connections that need patching */
 	struct llist_head bsc_connections;
 
@@ -349,6 +383,22 @@ struct bsc_connection *bsc_connection_alloc(struct bsc_nat *nat);
 void bsc_nat_set_msc_ip(struct bsc_nat *bsc, const char *ip);
 
 void sccp_connection_destroy(struct sccp_connections *);
+int bsc_nat_set_shards(struct bsc_nat *nat, int num_shards);
+
+/**
+ * The worker threads receive from the BSCs and queue the frames to the
+ * select loop, the callbacks are called there. A frame is a msgb like
+ * the one of ipa_msg_recv(), the error is its return value.
+ */
+typedef void (*bsc_nat_worker_msg_cb)(struct bsc_connection *, struct msgb *);
+typedef void (*bsc_nat_worker_error_cb)(struct bsc_connection *, int error);
+int bsc_nat_workers_start(struct bsc_nat *nat, bsc_nat_worker_msg_cb msg_cb,
+			  bsc_nat_worker_error_cb error_cb);
+void bsc_nat_workers_stop(struct bsc_nat *nat);
+int bsc_nat_workers_dispatch(struct bsc_nat *nat);
+int bsc_nat_worker_add(struct bsc_connection *bsc);
+/* the worker stops reading the BSC and its queued frames are dropped */
+void bsc_nat_worker_del(struct bsc_connection *bsc);
 void bsc_close_connection(struct bsc_connection *);
 
 const char *bsc_con_type_to_string(int type);
@@ -356,6 +406,7 @@ const char *bsc_con_type_to_string(int type);
 /**
  * parse the given message into the above structure
  */
+int bsc_nat_parse_into(struct msgb *msg, struct bsc_nat_parsed *parsed);
 struct bsc_nat_parsed *bsc_nat_parse(struct msgb *msg);
 
 /**
@@ -389,6 +440,7 @@ struct sccp_connections *bsc_nat_find_con_by_bsc(struct bsc_nat *, struct sccp_s
  * MGCP/Audio handling
  */
 int bsc_mgcp_nr_multiplexes(int max_endpoints);
+int bsc_mgcp_endpoint_in_use(struct bsc_connection *bsc, int endpoint);
 int bsc_write_mgcp(struct bsc_connection *bsc, const uint8_t *data, unsigned int length);
 int bsc_mgcp_assign_patch(struct sccp_connections *, struct msgb *msg);
 void bsc_mgcp_init(struct sccp_connections *);
@@ -397,7 +449,12 @@ void bsc_mgcp_free_endpoints(struct bsc_nat *nat);
 int bsc_mgcp_nat_init(struct bsc_nat *nat);
 
 struct sccp_connections *bsc_mgcp_find_con(struct bsc_nat *, int endpoint_number);
-struct msgb *bsc_mgcp_rewrite(char *input, int length, int endp, const char *ip, int port);
+void bsc_mgcp_set_msc_endp(struct sccp_connections *, int endpoint_number);
+struct msgb *bsc_mgcp_rewrite(const char *input, int length, int endp, const char *ip, int port);
+/* the length of the output or -1, the output may be the input */
+int bsc_mgcp_rewrite_buf(const char *input, int length, char *output, int size,
+			 int endp, const char *ip, int port);
+/* takes the msg, it is rewritten in place and queued */
 void bsc_mgcp_forward(struct bsc_connection *bsc, struct msgb *msg);
 
 void bsc_mgcp_clear_endpoints_for(struct bsc_connection *bsc);
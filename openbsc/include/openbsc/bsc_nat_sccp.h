@@ -24,6 +24,8 @@
 
 #include <osmocom/sccp/sccp_types.h>
 
+struct gsm48_hdr;
+
 /*
  * For the NAT we will need to analyze and later patch
  * the received message. This would require us to parse
@@ -55,6 +57,16 @@ struct bsc_nat_parsed {
 
 	/* the gsm0808 message type */
 	int gsm_type;
+
+	/* the DTAP, unpacked on the first bsc_unpack_dtap */
+	int dtap_unpacked;
+	struct gsm48_hdr *dtap_hdr;
+	uint32_t dtap_len;
+
+	/* decoded from the header of the DTAP when it is unpacked */
+	uint8_t dtap_proto;
+	uint8_t dtap_ti;
+	uint8_t dtap_msg_type;
 };
 
 /*
@@ -64,6 +76,8 @@ struct bsc_nat_parsed {
  */
 struct sccp_connections {
 	struct llist_head list_entry;
+	/* in the list of the shard of the BSC */
+	struct llist_head shard_entry;
 
 	struct bsc_connection *bsc;
 	struct bsc_msc_connection *msc_con;
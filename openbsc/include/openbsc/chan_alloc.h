@@ -59,6 +59,7 @@ struct pchan_load {
 
 void bts_chan_load(struct pchan_load *cl, const struct gsm_bts *bts);
 void network_chan_load(struct pchan_load *pl, struct gsm_network *net);
+unsigned int bts_tch_total(struct gsm_bts *bts);
 
 int trx_is_usable(struct gsm_bts_trx *trx);
 
@@ -106,6 +106,35 @@ struct gprs_llc_params {
 	uint16_t kU;
 };
 
+/* largest window size (k) we accept for acknowledged operation */
+#define GPRS_LLC_ABM_MAX_K	64
+
+/* Section 8.6: state of the acknowledged operation of a LLE, allocated
+ * when the LLE enters ABM */
+struct gprs_llc_abm {
+	/* I frames sent but not yet acknowledged, by N(S) modulo k */
+	struct msgb *tx_frames[GPRS_LLC_ABM_MAX_K];
+	/* overflow counter used to cipher them */
+	uint32_t tx_oc[GPRS_LLC_ABM_MAX_K];
+	/* when they were (re)transmitted last, counting transmissions */
+	uint32_t tx_stamp[GPRS_LLC_ABM_MAX_K];
+	uint32_t tx_count;
+	/* I frames waiting for the window to open */
+	struct llist_head tx_queue;
+	unsigned int tx_queue_len;
+	/* I frames received out of sequence, by N(S) modulo k */
+	struct msgb *rx_frames[GPRS_LLC_ABM_MAX_K];
+	/* the peer has sent RNR */
+	int peer_busy;
+
+	struct {
+		unsigned long tx_frames;
+		unsigned long retransmissions;
+		unsigned long rx_frames;
+		unsigned long rx_duplicates;
+	} stats;
+};
+
 /* Section 4.7.1: Logical Link Entity: One per DLCI (TLLI + SAPI) */
 struct gprs_llc_lle {
 	struct llist_head list;
@@ -129,6 +158,8 @@ struct gprs_llc_lle {
 	/* Overflow Counter for ABM */
 	uint32_t oc_i_send;
 	uint32_t oc_i_recv;
+	/* IOV-I of ABM, sent by the SGSN in the XID of SABM or UA */
+	uint32_t iov_i;
 
 	/* Overflow Counter for unconfirmed transfer */
 	uint32_t oc_ui_send;
@@ -137,12 +168,27 @@ struct gprs_llc_lle {
 	unsigned int retrans_ctr;
 
 	struct gprs_llc_params params;
+
+	/* only while in ABM or establishing it */
+	struct gprs_llc_abm *abm;
 };
 
 #define NUM_SAPIS	16
 
+struct gprs_llc_llme;
+
+/* entry in the TLLI hash table of gprs_llc.c */
+struct gprs_llc_tlli_node {
+	struct llist_head list;
+	struct gprs_llc_llme *llme;
+	uint32_t tlli;
+};
+
 struct gprs_llc_llme {
 	struct llist_head list;
+	/* hash entries for the current and the old TLLI */
+	struct gprs_llc_tlli_node tlli_node;
+	struct gprs_llc_tlli_node old_tlli_node;
 
 	enum gprs_llc_llme_state state;
 
@@ -161,6 +207,9 @@ struct gprs_llc_llme {
 
 extern struct llist_head gprs_llc_llmes;
 
+/* lookup LLC Entity by (TLLI, SAPI), creating the LLME if needed */
+struct gprs_llc_lle *gprs_lle_get_or_create(uint32_t tlli, uint8_t sapi);
+
 /* BSSGP-UL-UNITDATA.ind */
 int gprs_llc_rcvmsg(struct msgb *msg, struct tlv_parsed *tv);
 
@@ -168,6 +217,17 @@ int gprs_llc_rcvmsg(struct msgb *msg, struct tlv_parsed *tv);
 int gprs_llc_tx_ui(struct msgb *msg, uint8_t sapi, int command,
 		   void *mmctx);
 
+/* LL-ESTABLISH.req: enter ABM on a SAPI supporting acknowledged
+ * operation */
+int gprs_llc_establish(struct gprs_llc_lle *lle);
+
+/* LL-RELEASE.req: leave ABM */
+int gprs_llc_release(struct gprs_llc_lle *lle);
+
+/* LL-DATA.req: send msg in acknowledged operation, the LLE must be in
+ * ABM.  Takes ownership of msg. */
+int gprs_llc_tx_i(struct gprs_llc_lle *lle, struct msgb *msg, void *mmctx);
+
 /* Chapter 7.2.1.2 LLGMM-RESET.req */
 int gprs_llgmm_reset(struct gprs_llc_llme *llme);
 
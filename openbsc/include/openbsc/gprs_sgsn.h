@@ -44,6 +44,9 @@ enum gprs_pdp_ctx {
 	PDP_CTR_PKTS_UDATA_OUT,
 	PDP_CTR_BYTES_UDATA_IN,
 	PDP_CTR_BYTES_UDATA_OUT,
+	PDP_CTR_PKTS_DL_QUEUED,
+	PDP_CTR_PKTS_DL_DROPPED,
+	PDP_CTR_PKTS_UDATA_OTHER_ADDR,
 };
 
 enum gprs_t3350_mode {
@@ -96,6 +99,9 @@ struct sgsn_mm_ctx {
 	uint8_t			radio_prio_sms;
 
 	struct llist_head	pdp_list;
+	/* the PDP contexts of pdp_list by NSAPI and by transaction ID */
+	struct sgsn_pdp_ctx	*pdp_by_nsapi[16];
+	struct sgsn_pdp_ctx	*pdp_by_ti[16];
 
 	/* Additional bits not present in the GSM TS */
 	struct gprs_llc_llme	*llme;
@@ -146,6 +152,7 @@ struct sgsn_pdp_ctx {
 	struct llist_head	g_list;	/* list_head for global list */
 	struct sgsn_mm_ctx	*mm;	/* back pointer to MM CTX */
 	struct sgsn_ggsn_ctx	*ggsn;	/* which GGSN serves this PDP */
+	struct llist_head	ggsn_list; /* list_head for ggsn->pdp_list */
 	struct rate_ctr_group	*ctrg;
 
 	//unsigned int		id;
@@ -163,6 +170,8 @@ struct sgsn_pdp_ctx {
 	//uint32_t		qos_profile_req;
 	//uint32_t		qos_profile_neg;
 	uint8_t			radio_prio;
+	/* negotiated reliability class, 2 uses LLC acknowledged mode */
+	uint8_t			reliab_class;
 	uint32_t		tx_npdu_nr;
 	uint32_t		rx_npdu_nr;
 	uint32_t		tx_gtp_snd;
@@ -173,6 +182,12 @@ struct sgsn_pdp_ctx {
 	struct osmo_timer_list	timer;
 	unsigned int		T;		/* Txxxx number */
 	unsigned int		num_T_exp;	/* number of consecutive T expirations */
+
+	/* downlink N-PDUs held while the MS is suspended and paged */
+	struct llist_head	dl_queue;
+	unsigned int		dl_queue_len;
+	unsigned int		dl_queue_bytes;
+	struct osmo_timer_list	dl_timer;
 };
 
 
@@ -186,27 +201,47 @@ struct sgsn_pdp_ctx *sgsn_pdp_ctx_by_tid(const struct sgsn_mm_ctx *mm,
 struct sgsn_pdp_ctx *sgsn_pdp_ctx_alloc(struct sgsn_mm_ctx *mm,
 					uint8_t nsapi);
 void sgsn_pdp_ctx_free(struct sgsn_pdp_ctx *pdp);
+/* set the transaction ID of a PDP context */
+void sgsn_pdp_ctx_set_ti(struct sgsn_pdp_ctx *pdp, uint8_t ti);
+/* set the GGSN serving a PDP context */
+void sgsn_pdp_ctx_set_ggsn(struct sgsn_pdp_ctx *pdp,
+			   struct sgsn_ggsn_ctx *ggsn);
 
 
 struct sgsn_ggsn_ctx {
 	struct llist_head list;
+	struct llist_head id_hash;
+	struct llist_head addr_hash;
 	uint32_t id;
 	unsigned int gtp_version;
 	struct in_addr remote_addr;
 	int remote_restart_ctr;
 	struct gsn_t *gsn;
+	/* PDP contexts served by this GGSN */
+	struct llist_head pdp_list;
 };
 struct sgsn_ggsn_ctx *sgsn_ggsn_ctx_alloc(uint32_t id);
 struct sgsn_ggsn_ctx *sgsn_ggsn_ctx_by_id(uint32_t id);
 struct sgsn_ggsn_ctx *sgsn_ggsn_ctx_by_addr(struct in_addr *addr);
 struct sgsn_ggsn_ctx *sgsn_ggsn_ctx_find_alloc(uint32_t id);
+/* set the remote address of a GGSN and update the address hash */
+void sgsn_ggsn_ctx_set_addr(struct sgsn_ggsn_ctx *ggc,
+			    const struct in_addr *addr);
+
+#define GSM48_MAX_APN_LEN	102	/* 10.5.6.1 */
 
 struct apn_ctx {
 	struct llist_head list;
+	struct llist_head hash;
 	struct sgsn_ggsn_ctx *ggsn;
 	char *name;
 	char *description;
 };
+struct apn_ctx *apn_ctx_alloc(const char *ap_name);
+struct apn_ctx *apn_ctx_by_name(const char *name);
+struct apn_ctx *apn_ctx_find_alloc(const char *name);
+/* look up an APN context by the Access Point Name IE of a PDP request */
+struct apn_ctx *apn_ctx_by_ie(const uint8_t *apn, unsigned int len);
 
 extern struct llist_head sgsn_mm_ctxts;
 extern struct llist_head sgsn_ggsn_ctxts;
@@ -84,13 +84,22 @@ struct gsm_anchor_operation {
 /* Maximum size of the averaging window for neighbor cells */
 #define MAX_WIN_NEIGH_AVG	10
 
-/* processed neighbor measurements for one cell */
-struct neigh_meas_proc {
-	uint16_t arfcn;
-	uint8_t bsic;
-	uint8_t rxlev[MAX_WIN_NEIGH_AVG];
+/* ARFCN and BSIC of a tracked neighbor packed into one key, 0 = unused */
+#define NEIGH_MEAS_KEY(arfcn, bsic)	(0x80000000 | ((arfcn) << 8) | (bsic))
+#define NEIGH_MEAS_KEY_ARFCN(key)	(((key) >> 8) & 0x3ff)
+#define NEIGH_MEAS_KEY_BSIC(key)	((key) & 0x3f)
+
+/* processed neighbor measurements for all cells tracked on one lchan.
+ * This is kept as a structure of arrays indexed by the neighbor slot so
+ * that matching and best cell selection are plain loops over the slots. */
+struct neigh_meas_tbl {
+	uint32_t key[MAX_NEIGH_MEAS];
+	uint8_t last_seen_nr[MAX_NEIGH_MEAS];
+	/* number of measurement reports accounted for */
 	unsigned int rxlev_cnt;
-	uint8_t last_seen_nr;
+	/* running rxlev sum of each slot after rxlev_cnt reports, kept in
+	 * a ring so the sum over the last N reports is one subtraction */
+	uint16_t rxlev_sum[MAX_WIN_NEIGH_AVG+1][MAX_NEIGH_MEAS];
 };
 
 /* the per subscriber data for lchan */
@@ -131,6 +140,17 @@ struct gsm_subscriber_connection {
 #include "gsm_data_shared.h"
 
 
+/* Reasons for a handover decision */
+enum handover_reason {
+	HO_REASON_INTERFERENCE,
+	HO_REASON_BAD_QUALITY,
+	HO_REASON_LOW_LEVEL,
+	HO_REASON_MAX_DISTANCE,
+	HO_REASON_POWER_BUDGET,
+	HO_REASON_CONGESTION,
+	_NUM_HO_REASON
+};
+
 /* Some statistics of our network */
 struct gsmnet_stats {
 	struct {
@@ -143,6 +163,9 @@ struct gsmnet_stats {
 		struct osmo_counter *timeout;		/* T3103 timeout */
 		struct osmo_counter *completed;	/* HO COMPL received */
 		struct osmo_counter *failed;		/* HO FAIL received */
+		/* outcome per reason of the decision, see enum handover_reason */
+		struct osmo_counter *reason_completed[_NUM_HO_REASON];
+		struct osmo_counter *reason_failed[_NUM_HO_REASON];
 	} handover;
 	struct {
 		struct osmo_counter *attach;
@@ -181,6 +204,14 @@ struct gsmnet_stats {
 		struct osmo_counter *oml_fail;
 		struct osmo_counter *rsl_fail;
 	} bts;
+	struct {
+		struct osmo_counter *rx;
+		struct osmo_counter *tx;
+		/* recv and send calls on the socket */
+		struct osmo_counter *rx_calls;
+		struct osmo_counter *tx_calls;
+		struct osmo_counter *voice_dropped;
+	} mncc;
 };
 
 enum gsm_auth_policy {
@@ -189,6 +220,14 @@ enum gsm_auth_policy {
 	GSM_AUTH_POLICY_TOKEN, /* accept first, send token per sms, then revoke authorization */
 };
 
+/* which voice frame goes when the MNCC socket queue is full */
+enum mncc_sock_drop {
+	MNCC_SOCK_DROP_NEWEST,
+	MNCC_SOCK_DROP_OLDEST,
+};
+
+#define MNCC_SOCK_QUEUE_DEFAULT	2048
+
 #define GSM_T3101_DEFAULT 10
 #define GSM_T3105_DEFAULT 40
 #define GSM_T3113_DEFAULT 60
@@ -220,6 +259,15 @@ struct gsm_network {
 		unsigned int pwr_hysteresis;	/* dBm */
 		/* maximum distacne before we try a handover */
 		unsigned int max_distance;	/* TA values */
+
+		/* 1: decide per measurement report, 2: decide for all
+		 * lchans of a BTS at once and balance congested cells */
+		int algorithm;
+		/* how often the lchans of each BTS are checked (algorithm 2) */
+		unsigned int batch_interval;	/* seconds */
+		struct osmo_timer_list batch_timer;
+		/* percentage of TCH to keep free before we balance load */
+		unsigned int congestion_min_free;
 	} handover;
 
 	struct gsmnet_stats stats;
@@ -228,6 +276,11 @@ struct gsm_network {
 	struct mncc_sock_state *mncc_state;
 	int (*mncc_recv) (struct gsm_network *net, struct msgb *msg);
 	struct llist_head upqueue;
+	struct {
+		/* voice frames are dropped above this depth of the queues */
+		unsigned int queue_limit;
+		enum mncc_sock_drop voice_drop;
+	} mncc_sock;
 	struct llist_head trans_list;
 	struct bsc_api *bsc_api;
 
@@ -233,11 +233,13 @@ struct gsm_lchan {
 	uint8_t error_cause;
 
 	/* table of neighbor cell measurements */
-	struct neigh_meas_proc neigh_meas[MAX_NEIGH_MEAS];
+	struct neigh_meas_tbl neigh_meas;
 
 	/* cache of last measurement reports on this lchan */
 	struct gsm_meas_rep meas_rep[6];
 	int meas_rep_idx;
+	/* running sums over the measurement reports */
+	struct meas_rep_sums meas_sums;
 
 	/* GSM Random Access data */
 	struct gsm48_req_ref *rqd_ref;
@@ -517,6 +519,28 @@ enum neigh_list_manual_mode {
 	NL_MODE_MANUAL_SI5SEP = 2, /* SI2 and SI5 have separate neighbor lists */
 };
 
+/* frequency lists of the SI, each encoded from one bitvec */
+enum si_freq_list {
+	SI_FREQ_LIST_CELL_ALLOC,
+	SI_FREQ_LIST_SI2,
+	SI_FREQ_LIST_SI2bis,
+	SI_FREQ_LIST_SI2ter,
+	SI_FREQ_LIST_SI5,
+	SI_FREQ_LIST_SI5bis,
+	SI_FREQ_LIST_SI5ter,
+	_NUM_SI_FREQ_LIST
+};
+
+/* last encoding of a frequency list and the inputs it was encoded from */
+struct si_freq_list_cache {
+	int valid;
+	enum gsm_band band;
+	int pgsm;
+	uint8_t arfcns[1024/8];
+	uint8_t chan_list[16];
+	int rc;
+};
+
 enum bts_loc_fix {
 	BTS_LOC_FIX_INVALID = 0,
 	BTS_LOC_FIX_2D = 1,
@@ -703,9 +727,16 @@ struct gsm_bts {
 
 	/* do we use static (user-defined) system information messages? (bitmask) */
 	uint32_t si_mode_static;
+	/* length of the SI in si_buf */
+	uint8_t si_len[_MAX_SYSINFO_TYPE];
+	/* frequency lists are only re-encoded if their inputs changed */
+	struct si_freq_list_cache si_freq_cache[_NUM_SI_FREQ_LIST];
 
 	/* exclude the BTS from the global RF Lock handling */
 	int excl_from_rf_lock;
+
+	/* number of TCH/F and TCH/H lchans currently allocated */
+	unsigned int tch_used;
 #endif /* ROLE_BSC */
 	void *role;
 };
@@ -5,8 +5,10 @@ struct gsm_subscriber_connection;
 
 /* Hand over the specified logical channel to the specified new BTS.
  * This is the main entry point for the actual handover algorithm,
- * after it has decided it wants to initiate HO to a specific BTS */
-int bsc_handover_start(struct gsm_lchan *old_lchan, struct gsm_bts *bts);
+ * after it has decided it wants to initiate HO to a specific BTS.
+ * The reason is an enum handover_reason, or -1 for a manual handover */
+int bsc_handover_start(struct gsm_lchan *old_lchan, struct gsm_bts *bts,
+		       int reason);
 
 /* clear any operation for this connection */
 void bsc_clear_handover(struct gsm_subscriber_connection *conn, int free_lchan);
@@ -69,8 +69,24 @@ enum meas_rep_field {
 	MEAS_REP_UL_RXLEV_SUB,
 	MEAS_REP_UL_RXQUAL_FULL,
 	MEAS_REP_UL_RXQUAL_SUB,
+	_NUM_MEAS_REP_FIELD
 };
 
+/* maximum number of reports we can average over */
+#define MAX_WIN_MEAS_REP_AVG	10
+
+/* running sums of every field over the reports of one lchan.  sum[n] is
+ * the sum up to report number n modulo the ring size, so the sum over
+ * the last N reports is the difference of two entries. */
+struct meas_rep_sums {
+	unsigned int num;
+	uint16_t sum[MAX_WIN_MEAS_REP_AVG+1][_NUM_MEAS_REP_FIELD];
+};
+
+/* account a freshly parsed report in the running sums */
+void meas_rep_sums_add(struct meas_rep_sums *sums,
+		       const struct gsm_meas_rep *rep);
+
 /* obtain an average over the last 'num' fields in the meas reps */
 int get_meas_rep_avg(const struct gsm_lchan *lchan,
 		     enum meas_rep_field field, unsigned int num);
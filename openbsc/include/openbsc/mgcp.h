@@ -64,6 +64,8 @@ static inline int rtp_calculate_port(int multiplex, int base)
 struct mgcp_endpoint;
 struct mgcp_config;
 struct mgcp_trunk_config;
+struct mgcp_jitter_wheel;
+struct mgcp_capture_writer;
 
 #define MGCP_ENDP_CRCX 1
 #define MGCP_ENDP_DLCX 2
@@ -118,6 +120,14 @@ struct mgcp_trunk_config {
 
 	int omit_rtcp;
 
+	/* transcode in the MGW if the BTS and network codecs differ */
+	int internal_transcoding;
+
+	/* re-time the audio of the BTS, the depth is in 20ms frames */
+	int jitter_buffer;
+	int jitter_min_frames;
+	int jitter_max_frames;
+
 	/* spec handling */
 	int force_realloc;
 
@@ -159,6 +169,16 @@ struct mgcp_config {
 	struct mgcp_trunk_config trunk;
 	struct llist_head trunks;
 
+	/* schedules the jitter buffers of all endpoints */
+	struct mgcp_jitter_wheel *jitter_wheel;
+
+	/* writes the taps to files, bounded to capture_queue_kb */
+	struct mgcp_capture_writer *capture_writer;
+	int capture_queue_kb;
+
+	/* a CSV line with the quality of each call is appended to it */
+	char *quality_file;
+
 	/* only used for start with a static configuration */
 	int last_net_port;
 	int last_bts_port;
@@ -172,6 +192,8 @@ int mgcp_endpoints_allocate(struct mgcp_trunk_config *cfg);
 void mgcp_free_endp(struct mgcp_endpoint *endp);
 int mgcp_reset_transcoder(struct mgcp_config *cfg);
 void mgcp_format_stats(struct mgcp_endpoint *endp, char *stats, size_t size);
+int mgcp_format_quality_header(char *msg, size_t size);
+int mgcp_format_quality(struct mgcp_endpoint *endp, char *msg, size_t size);
 
 /*
  * format helper functions
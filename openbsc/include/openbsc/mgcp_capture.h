@@ -0,0 +1,107 @@
+/* Capture of the MGCP taps to pcap and rtpdump files */
+
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef OPENBSC_MGCP_CAPTURE_H
+#define OPENBSC_MGCP_CAPTURE_H
+
+#include <stdio.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+
+#include <osmocom/core/linuxlist.h>
+
+struct mgcp_config;
+struct mgcp_endpoint;
+struct mgcp_rtp_end;
+struct mgcp_capture_writer;
+
+/* the default bound of the queue of the writer thread */
+#define MGCP_CAPTURE_QUEUE_KB	1024
+
+enum mgcp_capture_format {
+	MGCP_CAPTURE_PCAP,
+	MGCP_CAPTURE_RTPDUMP,
+};
+
+/* updated under the lock of the writer, see mgcp_capture_get_stats() */
+struct mgcp_capture_stats {
+	unsigned long packets;
+	unsigned long errors;
+	/* did not fit into the queue */
+	unsigned long dropped;
+};
+
+/*
+ * A file of one tap of a call.  It is opened from the main thread and
+ * closed by the writer once the queued packets are written.
+ */
+struct mgcp_capture {
+	struct llist_head entry;
+	struct mgcp_capture_writer *writer;
+
+	enum mgcp_capture_format format;
+	char *filename;
+	FILE *file;
+	struct timeval start;
+
+	/* the far end of the tap and if the packets come from it */
+	struct mgcp_rtp_end *peer;
+	struct in_addr local_addr;
+	int incoming;
+
+	/* only touched by the writer, the counts of the current batch */
+	int dirty;
+	struct llist_head dirty_entry;
+	unsigned long batch_packets;
+	unsigned long batch_errors;
+
+	struct mgcp_capture_stats stats;
+};
+
+/* open a file for the packets of the tap, writes the file header */
+struct mgcp_capture *mgcp_capture_open(struct mgcp_endpoint *endp, int tap,
+				       enum mgcp_capture_format format,
+				       const char *filename);
+/* hand the file to the writer to be closed after the queued packets */
+void mgcp_capture_close(struct mgcp_capture *cap);
+
+/* queue a packet, it is dropped if the writer fell behind */
+int mgcp_capture_put(struct mgcp_capture *cap, const char *data, int len);
+
+/* a consistent copy of the counters */
+void mgcp_capture_get_stats(struct mgcp_capture *cap,
+			    struct mgcp_capture_stats *stats);
+
+/*
+ * queue a line to be appended to a text file by the writer, the header
+ * is written first if the file is empty.  The packets of the stats are
+ * the lines written.
+ */
+int mgcp_capture_put_line(struct mgcp_config *cfg, const char *filename,
+			  const char *header, const char *line);
+void mgcp_capture_get_line_stats(struct mgcp_config *cfg,
+				 struct mgcp_capture_stats *stats);
+
+/* wait until the writer wrote everything that was queued */
+void mgcp_capture_sync(struct mgcp_config *cfg);
+/* stop the writer thread after it wrote everything */
+void mgcp_capture_stop(struct mgcp_config *cfg);
+/* close the files of all endpoints, write them out and stop the writer */
+void mgcp_capture_shutdown(struct mgcp_config *cfg);
+
+#endif
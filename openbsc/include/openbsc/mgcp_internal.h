@@ -40,6 +40,30 @@ enum mgcp_trunk_type {
 	MGCP_TRUNK_E1,
 };
 
+#define MGCP_QUALITY_BUCKETS	8
+
+/*
+ * Histograms of the quality of a RTP stream, a value goes into the
+ * first bucket whose edge is above it and the last bucket is open.
+ */
+struct mgcp_rtp_quality {
+	uint32_t last_arrival;
+	int32_t transit;
+	/* RFC 3550 interarrival jitter in 1/16 ms */
+	uint32_t jitter;
+
+	/* inter-arrival time and jitter in ms */
+	uint32_t iat[MGCP_QUALITY_BUCKETS];
+	uint32_t jitter_hist[MGCP_QUALITY_BUCKETS];
+	/* the sequence number advance, 0 for reordered or repeated */
+	uint32_t seq_gap[MGCP_QUALITY_BUCKETS];
+	uint32_t ssrc_changes;
+};
+
+extern const uint16_t mgcp_quality_iat_edges[MGCP_QUALITY_BUCKETS - 1];
+extern const uint16_t mgcp_quality_jitter_edges[MGCP_QUALITY_BUCKETS - 1];
+extern const uint16_t mgcp_quality_gap_edges[MGCP_QUALITY_BUCKETS - 1];
+
 struct mgcp_rtp_state {
 	int initialized;
 	int patch;
@@ -56,6 +80,8 @@ struct mgcp_rtp_state {
 	int32_t  timestamp_offset;
 	uint32_t jitter;
 	int32_t transit;
+
+	struct mgcp_rtp_quality quality;
 };
 
 struct mgcp_rtp_end {
@@ -70,6 +96,8 @@ struct mgcp_rtp_end {
 	/* per endpoint data */
 	int payload_type;
 	char *fmtp_extra;
+	/* a=ptime of the session description in ms, 0 without it */
+	unsigned int packet_duration_ms;
 
 	/*
 	 * Each end has a socket...
@@ -94,6 +122,21 @@ enum {
 struct mgcp_rtp_tap {
 	int enabled;
 	struct sockaddr_in forward;
+	/* written to a file instead of forwarded */
+	struct mgcp_capture *capture;
+};
+
+/* RFC 3435 3.2.1.2 limits transaction ids to nine digits, we are a bit
+ * more tolerant */
+#define MGCP_TRANS_MAX		32
+#define MGCP_TRANS_CACHE_SIZE	8
+
+struct mgcp_trans_cache_entry {
+	char trans[MGCP_TRANS_MAX + 1];
+	/* a re-transmission is the identical command */
+	uint32_t cmd_hash;
+	char *response;
+	unsigned int response_len;
 };
 
 struct mgcp_endpoint {
@@ -121,6 +164,12 @@ struct mgcp_endpoint {
 	struct mgcp_rtp_end trans_net;
 	int is_transcoded;
 
+	/* in-process transcoding, see mgcp_transcode.c */
+	struct mgcp_transcoding *transcoding;
+
+	/* re-timing of the audio from the BTS, see mgcp_jitter.c */
+	struct mgcp_jitter_buffer *jitter_buffer;
+
 	/* sequence bits */
 	struct mgcp_rtp_state net_state;
 	struct mgcp_rtp_state bts_state;
@@ -128,9 +177,9 @@ struct mgcp_endpoint {
 	/* SSRC/seq/ts patching for loop */
 	int allow_patch;
 
-	/* fields for re-transmission */
-	char *last_trans;
-	char *last_response;
+	/* responses of the recent transactions, for re-transmissions */
+	struct mgcp_trans_cache_entry trans_cache[MGCP_TRANS_CACHE_SIZE];
+	unsigned int trans_cache_next;
 
 	/* tap for the endpoint */
 	struct mgcp_rtp_tap taps[MGCP_TAP_COUNT];
@@ -143,6 +192,51 @@ struct mgcp_msg_ptr {
 	unsigned int length;
 };
 
+/* a parameter line of a command, e.g. "C: 4a84ad5d" */
+struct mgcp_param {
+	struct mgcp_msg_ptr name;
+	struct mgcp_msg_ptr value;
+};
+
+#define MGCP_MAX_PARAMS		16
+
+/*
+ * A MGCP message parsed in one pass.  Nothing is copied or modified, all
+ * fields point into data.
+ */
+struct mgcp_parsed {
+	const char *data;
+	unsigned int len;
+
+	/* a response has a code, a command a verb and an endpoint */
+	int code;
+	struct mgcp_msg_ptr verb;
+	struct mgcp_msg_ptr trans;
+	struct mgcp_msg_ptr endp;
+
+	struct mgcp_param params[MGCP_MAX_PARAMS];
+	unsigned int num_params;
+
+	/* session description, audio_port is -1 without a m=audio line */
+	struct mgcp_msg_ptr sdp;
+	int audio_port;
+	int audio_payload;
+	struct mgcp_msg_ptr audio_name;
+	/* a=ptime in ms, 0 without it */
+	unsigned int audio_ptime;
+	struct mgcp_msg_ptr conn_addr;
+};
+
+#define MGCP_PTR(msg, ptr) ((msg)->data + (ptr).start)
+
+/*
+ * Parse len octets of data, it does not need to be NUL terminated.
+ * Returns 1 for a response, 0 for a command with a valid status line and
+ * a negative value otherwise.  The transaction id of an incomplete status
+ * line is empty.
+ */
+int mgcp_parse(struct mgcp_parsed *msg, const char *data, unsigned int len);
+
 int mgcp_send_dummy(struct mgcp_endpoint *endp);
 int mgcp_bind_bts_rtp_port(struct mgcp_endpoint *endp, int rtp_port);
 int mgcp_bind_net_rtp_port(struct mgcp_endpoint *endp, int rtp_port);
@@ -162,6 +256,11 @@ struct mgcp_trunk_config *mgcp_trunk_num(struct mgcp_config *cfg, int index);
 void mgcp_state_calc_loss(struct mgcp_rtp_state *s, struct mgcp_rtp_end *,
 			uint32_t *expected, int *loss);
 uint32_t mgcp_state_calc_jitter(struct mgcp_rtp_state *);
+uint32_t get_current_ts(void);
+
+/* count a packet of a stream, first for its first packet */
+void mgcp_quality_count(struct mgcp_rtp_quality *q, int first, int new_ssrc,
+			uint16_t udelta, uint32_t arrival_time, uint32_t timestamp);
 
 
 #endif
@@ -0,0 +1,125 @@
+/* Adaptive jitter buffer of the MGCP Media Gateway */
+
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef OPENBSC_MGCP_JITTER_H
+#define OPENBSC_MGCP_JITTER_H
+
+#include <stdint.h>
+
+#include <osmocom/core/linuxlist.h>
+#include <osmocom/core/timer.h>
+
+struct msgb;
+struct mgcp_config;
+struct mgcp_endpoint;
+
+/* packets held per endpoint, a power of two */
+#define MGCP_JB_SIZE		64
+/* a buffer is served every 20ms, the default ptime */
+#define MGCP_JB_FRAME_MS	20
+/* the ptimes we play out, other ones fall back to the default */
+#define MGCP_JB_MIN_FRAME_MS	10
+#define MGCP_JB_MAX_FRAME_MS	200
+/* all buffers share one timer, a slot is served every 5ms */
+#define MGCP_JB_WHEEL_SLOTS	4
+
+typedef int (*mgcp_jitter_output)(struct mgcp_endpoint *endp, char *data, int len);
+
+struct mgcp_jitter_stats {
+	unsigned long received;
+	unsigned long emitted;
+	/* arrived after their playout time */
+	unsigned long late;
+	unsigned long duplicates;
+	/* missing packets replaced by the previous one */
+	unsigned long concealed;
+	/* dropped to bring the delay back to the target */
+	unsigned long discarded;
+	unsigned long underruns;
+	unsigned long resyncs;
+};
+
+struct mgcp_jitter_buffer {
+	/* in a slot of the wheel */
+	struct llist_head entry;
+
+	struct mgcp_endpoint *endp;
+	mgcp_jitter_output output;
+
+	struct msgb *packets[MGCP_JB_SIZE];
+	unsigned int count;
+	/* the last emitted packet, for the concealment */
+	struct msgb *last;
+
+	int started;
+	int buffering;
+	uint32_t ssrc;
+	uint16_t play_seq;
+	uint16_t max_seq;
+	/* the frames leave with their own sequence on the playout clock */
+	uint16_t out_seq;
+	uint32_t out_ts;
+	/* the next frame starts a talkspurt */
+	int marker;
+
+	/* the packetization of the BTS in ms and in 8kHz RTP ticks */
+	int frame_ms;
+	uint32_t frame_ts;
+	/* wheel time of the last service, playout time not used yet */
+	uint32_t served_ms;
+	int due_ms;
+
+	/* depth in frames */
+	int min_depth;
+	int max_depth;
+	int target;
+
+	/* RFC 3550 interarrival jitter in 1/16 ms */
+	uint32_t jitter;
+	int32_t transit;
+
+	struct mgcp_jitter_stats stats;
+};
+
+struct mgcp_jitter_wheel {
+	struct osmo_timer_list timer;
+	/* when the next slot is due, in get_current_ts() milliseconds */
+	uint32_t next;
+	/* the time the wheel turned, including the slots skipped */
+	uint32_t clock_ms;
+
+	struct llist_head slots[MGCP_JB_WHEEL_SLOTS];
+	unsigned int current;
+	unsigned int count;
+};
+
+struct mgcp_jitter_buffer *mgcp_jitter_alloc(struct mgcp_endpoint *endp,
+					     mgcp_jitter_output output);
+void mgcp_jitter_free(struct mgcp_jitter_buffer *jb);
+
+/* queue a RTP packet that arrived at arrival_ms, returns 0 if it was kept */
+int mgcp_jitter_put(struct mgcp_jitter_buffer *jb, const char *data, int len,
+		    uint32_t arrival_ms);
+
+/* the packets between the playout point and the newest one */
+unsigned int mgcp_jitter_depth(struct mgcp_jitter_buffer *jb);
+
+/* serve the buffers of the current slot, normally done by the timer */
+void mgcp_jitter_wheel_advance(struct mgcp_jitter_wheel *wheel);
+
+#endif
@@ -0,0 +1,91 @@
+/* In-process transcoding of the MGCP Media Gateway */
+
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef OPENBSC_MGCP_TRANSCODE_H
+#define OPENBSC_MGCP_TRANSCODE_H
+
+#include <stdint.h>
+
+struct mgcp_endpoint;
+
+enum mgcp_codec {
+	MGCP_CODEC_UNKNOWN,
+	MGCP_CODEC_PCMU,
+	MGCP_CODEC_PCMA,
+	MGCP_CODEC_GSM_FR,
+	MGCP_CODEC_GSM_EFR,
+};
+
+/* 20ms of audio at 8kHz */
+#define MGCP_TRANSCODE_FRAME_SAMPLES	160
+/* the largest packet we transcode, 240ms */
+#define MGCP_TRANSCODE_MAX_SAMPLES	(12 * MGCP_TRANSCODE_FRAME_SAMPLES)
+/* the CPU time is measured for one packet out of this many */
+#define MGCP_TRANSCODE_CPU_SAMPLE	16
+
+struct mgcp_transcode_stats {
+	/* speech frames of the source and of the destination codec */
+	unsigned long frames_in;
+	unsigned long frames_out;
+	/* packets that could not be transcoded and were dropped */
+	unsigned long dropped;
+	/* CPU time spent in the codecs, extrapolated from the samples */
+	uint64_t cpu_ns;
+};
+
+/* one direction of a call */
+struct mgcp_transcode_path {
+	enum mgcp_codec src;
+	enum mgcp_codec dst;
+	void *decoder;
+	void *encoder;
+	unsigned int cpu_sample;
+	struct mgcp_transcode_stats stats;
+};
+
+struct mgcp_transcoding {
+	struct mgcp_transcode_path to_bts;
+	struct mgcp_transcode_path to_net;
+};
+
+enum mgcp_codec mgcp_codec_from_name(const char *name, unsigned int len);
+enum mgcp_codec mgcp_codec_from_payload(int payload_type, const char *name,
+					unsigned int len);
+const char *mgcp_codec_name(enum mgcp_codec codec);
+int mgcp_codec_is_supported(enum mgcp_codec codec);
+
+/*
+ * Transcode between the codec of the BTS and the one of the network with
+ * a packetization of ptime ms (0 when unknown), returns 0 when no
+ * transcoding is needed.
+ */
+int mgcp_transcoding_setup(struct mgcp_endpoint *endp,
+			   enum mgcp_codec bts, enum mgcp_codec net,
+			   unsigned int ptime);
+void mgcp_transcoding_free(struct mgcp_endpoint *endp);
+
+/*
+ * Transcode the RTP packet of len octets in data that is sent to the
+ * BTS or to the network.  The packet with the same header is written to
+ * out, returns its length or a negative value to drop the packet.
+ */
+int mgcp_transcoding_process_rtp(struct mgcp_endpoint *endp, int to_bts,
+				 const char *data, int len,
+				 char *out, int out_size);
+
+#endif
@@ -31,6 +31,7 @@
 
 struct gsm_network;
 struct msgb;
+struct vty;
 
 
 /* One end of a call */
@@ -187,5 +188,9 @@ int int_mncc_recv(struct gsm_network *net, struct msgb *msg);
 int mncc_sock_from_cc(struct gsm_network *net, struct msgb *msg);
 
 int mncc_sock_init(struct gsm_network *gsmnet);
+/* use a connected socket, e.g. one end of a socketpair */
+int mncc_sock_attach(struct gsm_network *net, int fd);
+/* the depth and the latency of the queue towards the MNCC application */
+void mncc_sock_stats(struct gsm_network *net, struct vty *vty);
 
 #endif
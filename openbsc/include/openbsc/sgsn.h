@@ -6,6 +6,8 @@
 
 #include <osmocom/gprs/gprs_ns.h>
 #include <openbsc/gprs_sgsn.h>
+#include <openbsc/gprs_llc.h>
+#include <openbsc/sgsn_gtpu.h>
 
 struct sgsn_config {
 	/* parsed from config file */
@@ -23,7 +25,8 @@ struct sgsn_instance {
 	/* File descriptor wrappers for LibGTP */
 	struct osmo_fd gtp_fd0;
 	struct osmo_fd gtp_fd1c;
-	struct osmo_fd gtp_fd1u;
+	/* GTP-U is handled by ourselves, not by libgtp */
+	struct gtpu_ep gtpu;
 	/* Timer for libGTP */
 	struct osmo_timer_list gtp_timer;
 	/* GSN instance for libgtp */
@@ -49,10 +52,24 @@ struct sgsn_pdp_ctx *sgsn_create_pdp_ctx(struct sgsn_ggsn_ctx *ggsn,
 					 struct tlv_parsed *tp);
 int sgsn_delete_pdp_ctx(struct sgsn_pdp_ctx *pctx);
 
+/* gprs_sgsn.c */
+
+/* Send a downlink N-PDU from the GGSN to the MS or hold it while the MS
+ * is suspended, takes ownership of msg */
+int sgsn_rx_gtp_data(struct sgsn_pdp_ctx *pdp, struct msgb *msg);
+/* Send the downlink N-PDUs held for a MS that was suspended or paged */
+void sgsn_mm_dl_flush(struct sgsn_mm_ctx *mm);
+/* Drop the downlink N-PDUs held for a PDP context */
+void sgsn_pdp_dl_purge(struct sgsn_pdp_ctx *pdp);
+/* N-PDUs held in all downlink queues */
+extern struct osmo_counter *sgsn_dl_queue_depth;
+
 /* gprs_sndcp.c */
 
-/* Entry point for the SNSM-ACTIVATE.indication */
-int sndcp_sm_activate_ind(struct gprs_llc_lle *lle, uint8_t nsapi);
+/* Entry point for the SNSM-ACTIVATE.indication, acked selects the
+ * acknowledged operation over LLC ABM */
+int sndcp_sm_activate_ind(struct gprs_llc_lle *lle, uint8_t nsapi,
+			  int acked);
 /* Entry point for the SNSM-DEACTIVATE.indication */
 int sndcp_sm_deactivate_ind(struct gprs_llc_lle *lle, uint8_t nsapi);
 /* Called by SNDCP when it has received/re-assembled a N-PDU */
@@ -62,5 +79,14 @@ int sndcp_unitdata_req(struct msgb *msg, struct gprs_llc_lle *lle, uint8_t nsapi
 			void *mmcontext);
 int sndcp_llunitdata_ind(struct msgb *msg, struct gprs_llc_lle *lle,
 			 uint8_t *hdr, uint16_t len);
+/* LL-DATA.ind: a SN-DATA PDU received in acknowledged operation */
+int sndcp_lldata_ind(struct msgb *msg, struct gprs_llc_lle *lle,
+		     uint8_t *hdr, uint16_t len);
+/* Negotiate the SNDCP XID parameters of a LL-XID.ind, returns the
+ * length of the response parameters written to resp */
+int sndcp_llxid_ind(struct gprs_llc_lle *lle, const uint8_t *req,
+		    unsigned int req_len, uint8_t *resp, unsigned int resp_max);
+/* LL-ESTABLISH and LL-RELEASE .ind/.conf of a LLE */
+int sndcp_rx_llc_prim(struct gprs_llc_lle *lle, enum gprs_llc_primitive prim);
 
 #endif
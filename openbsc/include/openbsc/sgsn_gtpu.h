@@ -0,0 +1,63 @@
+#ifndef _SGSN_GTPU_H
+#define _SGSN_GTPU_H
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include <osmocom/core/msgb.h>
+#include <osmocom/core/select.h>
+#include <osmocom/core/timer.h>
+
+/* GTP-U (3GPP TS 29.281) user plane of the SGSN.  G-PDUs bypass libgtp
+ * and are received and sent in batches. */
+
+#define GTPU_PORT		2152
+/* datagrams per recvmmsg() / sendmmsg() */
+#define GTPU_BATCH		32
+/* maximum T-PDU we send */
+#define GTPU_MAX_PDU		1520
+/* received T-PDUs leave room for the SNDCP, LLC, BSSGP and NS headers */
+#define GTPU_RX_HEADROOM	128
+
+struct gtpu_batch;
+
+struct gtpu_ep {
+	struct osmo_fd ofd;
+	/* Recovery IE of our Echo Responses */
+	uint8_t restart_ctr;
+
+	/* called for each G-PDU, msg holds the T-PDU and is owned by the
+	 * callee from now on */
+	int (*rx_cb)(struct gtpu_ep *ep, const struct sockaddr_in *from,
+		     uint32_t teid, struct msgb *msg);
+	void *data;
+
+	struct gtpu_batch *batch;
+	/* sends the pending G-PDUs on the next select loop iteration */
+	struct osmo_timer_list tx_timer;
+
+	struct {
+		unsigned long rx_pkts;
+		unsigned long rx_calls;
+		unsigned long rx_dropped;
+		unsigned long tx_pkts;
+		unsigned long tx_calls;
+		unsigned long tx_dropped;
+	} stats;
+};
+
+/* Take over the GTP-U socket fd and register it with the select loop */
+int gtpu_ep_init(void *ctx, struct gtpu_ep *ep, int fd);
+
+/* Read one batch of datagrams from the socket */
+int gtpu_rx(struct gtpu_ep *ep);
+
+/* Queue a G-PDU, it is sent when the batch is full or the select loop
+ * runs next.  A negative seq omits the sequence number. */
+int gtpu_tx(struct gtpu_ep *ep, const struct sockaddr_in *to, uint32_t teid,
+	    int seq, const uint8_t *data, unsigned int len);
+
+/* Send all queued G-PDUs now */
+int gtpu_tx_flush(struct gtpu_ep *ep);
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef _SLHC_H
+#define _SLHC_H
+
+#include <stdint.h>
+
+/* RFC 1144 TCP/IP header compression */
+
+#define SLHC_MAX_SLOTS		16
+/* maximum IPv4 + TCP header length */
+#define SLHC_MAX_HDR		120
+
+enum slhc_type {
+	SLHC_TYPE_IP,
+	SLHC_TYPE_UNCOMPRESSED_TCP,
+	SLHC_TYPE_COMPRESSED_TCP,
+};
+
+struct slhc_cstate {
+	/* last use for LRU replacement (compressor only) */
+	uint32_t lru;
+	/* length of IP + TCP header, 0 if unused */
+	uint8_t hlen;
+	uint8_t hdr[SLHC_MAX_HDR];
+};
+
+struct slhc {
+	unsigned int num_slots;
+
+	/* compressor */
+	struct slhc_cstate tx[SLHC_MAX_SLOTS];
+	uint8_t tx_last;
+	uint32_t tx_clock;
+
+	/* decompressor */
+	struct slhc_cstate rx[SLHC_MAX_SLOTS];
+	uint8_t rx_last;
+	int rx_toss;
+};
+
+void slhc_init(struct slhc *comp, unsigned int num_slots);
+
+/* Compress the header of the IP packet in pkt in place.  Returns the
+ * packet type and sets *hdr to the (possibly moved) start of the
+ * packet, which ends at pkt + len in any case. */
+enum slhc_type slhc_compress(struct slhc *comp, uint8_t *pkt,
+			     unsigned int len, uint8_t **hdr);
+
+/* Restore the IP packet of the given type from in to out, which must
+ * have room for in_len + SLHC_MAX_HDR bytes.  Returns the length of
+ * the IP packet, or a negative value if it has to be discarded. */
+int slhc_uncompress(struct slhc *comp, enum slhc_type type,
+		    const uint8_t *in, unsigned int in_len, uint8_t *out);
+
+/* Signal a lost packet to the decompressor */
+void slhc_toss(struct slhc *comp);
+
+#endif
@@ -4,7 +4,10 @@
 #include <osmocom/gsm/sysinfo.h>
 
 struct gsm_bts;
+struct gsm_bts_trx;
 
 int gsm_generate_si(struct gsm_bts *bts, enum osmo_sysinfo_type type);
+int gsm_bts_trx_set_system_infos(struct gsm_bts_trx *trx);
+int gsm_bts_set_system_infos(struct gsm_bts *bts);
 
 #endif
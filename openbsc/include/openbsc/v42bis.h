@@ -0,0 +1,67 @@
+#ifndef _V42BIS_H
+#define _V42BIS_H
+
+#include <stdint.h>
+
+/* ITU-T V.42bis data compression, as used by SNDCP (3GPP TS 44.065) */
+
+/* limits of the P1 (number of codewords) and P2 (maximum string
+ * length) parameters we accept */
+#define V42BIS_MIN_CODEWORDS	512
+#define V42BIS_MAX_CODEWORDS	4096
+#define V42BIS_MIN_STRING	6
+#define V42BIS_MAX_STRING	250
+
+struct v42bis_node {
+	uint16_t parent;
+	uint16_t child;
+	uint16_t sibling;
+	uint8_t byte;
+	/* length of the string, 0 for unused nodes */
+	uint8_t depth;
+};
+
+struct v42bis_dict {
+	/* P1 and P2 */
+	unsigned int n2;
+	unsigned int n7;
+	/* maximum codeword size */
+	unsigned int n1;
+
+	/* next dictionary entry, codeword size and STEPUP threshold */
+	unsigned int c1;
+	unsigned int c2;
+	unsigned int c3;
+
+	struct v42bis_node *nodes;
+};
+
+struct v42bis_comp {
+	struct v42bis_dict dict;
+	/* the string matched so far (compressor) or the last string
+	 * received (decompressor), 0 for none */
+	uint16_t string;
+	uint32_t bits;
+	unsigned int num_bits;
+};
+
+struct v42bis {
+	struct v42bis_comp tx;
+	struct v42bis_comp rx;
+};
+
+/* Allocate both directions of a V.42bis entity as a talloc child of
+ * ctx.  p1 and p2 are clamped to the limits above. */
+struct v42bis *v42bis_alloc(void *ctx, unsigned int p1, unsigned int p2);
+
+/* Compress one N-PDU and flush, out must have room for 2 * len + 32
+ * bytes.  Returns the compressed length. */
+int v42bis_compress(struct v42bis *v, const uint8_t *in, unsigned int len,
+		    uint8_t *out, unsigned int out_max);
+
+/* Decompress one flushed N-PDU.  Returns the decompressed length, or a
+ * negative value on errors. */
+int v42bis_decompress(struct v42bis *v, const uint8_t *in, unsigned int len,
+		      uint8_t *out, unsigned int out_max);
+
+#endif
@@ -59,8 +59,41 @@ static const uint32_t tbl_crc24[256] = {
 
 #define INIT_CRC24	0xffffff
 
+/* tbl_crc24_slice[n][b] is the CRC of byte b followed by n zero bytes,
+ * used to process eight bytes per iteration */
+static uint32_t tbl_crc24_slice[8][256];
+static int tbl_crc24_slice_init;
+
+static void crc24_slice_init(void)
+{
+	unsigned int i, n;
+
+	for (i = 0; i < 256; i++) {
+		tbl_crc24_slice[0][i] = tbl_crc24[i];
+		for (n = 1; n < 8; n++) {
+			uint32_t c = tbl_crc24_slice[n - 1][i];
+			tbl_crc24_slice[n][i] = (c >> 8) ^ tbl_crc24[c & 0xff];
+		}
+	}
+	tbl_crc24_slice_init = 1;
+}
+
 uint32_t crc24_calc(uint32_t fcs, uint8_t *cp, unsigned int len)
 {
+	const uint32_t (*t)[256] = tbl_crc24_slice;
+
+	if (!tbl_crc24_slice_init)
+		crc24_slice_init();
+
+	while (len >= 8) {
+		fcs = t[7][(fcs ^ cp[0]) & 0xff] ^
+		      t[6][((fcs >> 8) ^ cp[1]) & 0xff] ^
+		      t[5][((fcs >> 16) ^ cp[2]) & 0xff] ^
+		      t[4][cp[3]] ^ t[3][cp[4]] ^ t[2][cp[5]] ^
+		      t[1][cp[6]] ^ t[0][cp[7]];
+		cp += 8;
+		len -= 8;
+	}
 	while (len--)
 		fcs = (fcs >> 8) ^ tbl_crc24[(fcs ^ *cp++) & 0xff];
 	return fcs;
@@ -42,6 +42,12 @@
 struct gbprox_peer {
 	struct llist_head list;
 
+	/* entries in the hash tables below */
+	struct llist_head bvci_list;
+	struct llist_head nsvc_list;
+	struct llist_head ra_list;
+	struct llist_head la_list;
+
 	/* NS-VC over which we send/receive data to this BVC */
 	struct gprs_nsvc *nsvc;
 
@@ -56,11 +62,50 @@ struct gbprox_peer {
 /* Linked list of all Gb peers (except SGSN) */
 static LLIST_HEAD(gbprox_bts_peers);
 
+/* Gb peers hashed by BVCI, NS-VC, Routeing Area and Location Area.  The
+ * NS-VC is hashed by its pointer, libgb changes the NSEI of a known NS-VC
+ * on NS-RESET. */
+#define GBPROX_HASH_BITS	8
+static struct llist_head peers_by_bvci[1 << GBPROX_HASH_BITS];
+static struct llist_head peers_by_nsvc[1 << GBPROX_HASH_BITS];
+static struct llist_head peers_by_ra[1 << GBPROX_HASH_BITS];
+static struct llist_head peers_by_la[1 << GBPROX_HASH_BITS];
+
+static struct llist_head *peer_hash_bucket(struct llist_head *table,
+					   uint32_t key)
+{
+	struct llist_head *bucket;
+
+	bucket = &table[(key ^ (key >> GBPROX_HASH_BITS)) &
+			((1 << GBPROX_HASH_BITS) - 1)];
+	if (!bucket->next)
+		INIT_LLIST_HEAD(bucket);
+
+	return bucket;
+}
+
+/* hash the first len octets of a RA or LA */
+static uint32_t area_hash(const uint8_t *area, unsigned int len)
+{
+	uint32_t hash = 0;
+
+	while (len--)
+		hash = hash * 31 + *area++;
+	return hash;
+}
+
+static uint32_t nsvc_hash(const struct gprs_nsvc *nsvc)
+{
+	/* the low bits are the same for all allocations */
+	return (uintptr_t) nsvc / sizeof(void *);
+}
+
 /* Find the gbprox_peer by its BVCI */
 static struct gbprox_peer *peer_by_bvci(uint16_t bvci)
 {
 	struct gbprox_peer *peer;
-	llist_for_each_entry(peer, &gbprox_bts_peers, list) {
+	llist_for_each_entry(peer, peer_hash_bucket(peers_by_bvci, bvci),
+			     bvci_list) {
 		if (peer->bvci == bvci)
 			return peer;
 	}
@@ -70,7 +115,9 @@ static struct gbprox_peer *peer_by_bvci(uint16_t bvci)
 static struct gbprox_peer *peer_by_nsvc(struct gprs_nsvc *nsvc)
 {
 	struct gbprox_peer *peer;
-	llist_for_each_entry(peer, &gbprox_bts_peers, list) {
+	llist_for_each_entry(peer, peer_hash_bucket(peers_by_nsvc,
+						    nsvc_hash(nsvc)),
+			     nsvc_list) {
 		if (peer->nsvc == nsvc)
 			return peer;
 	}
@@ -81,7 +128,9 @@ static struct gbprox_peer *peer_by_nsvc(struct gprs_nsvc *nsvc)
 static struct gbprox_peer *peer_by_rac(const uint8_t *ra)
 {
 	struct gbprox_peer *peer;
-	llist_for_each_entry(peer, &gbprox_bts_peers, list) {
+	llist_for_each_entry(peer, peer_hash_bucket(peers_by_ra,
+						    area_hash(ra, 6)),
+			     ra_list) {
 		if (!memcmp(peer->ra, ra, 6))
 			return peer;
 	}
@@ -92,14 +141,29 @@ static struct gbprox_peer *peer_by_rac(const uint8_t *ra)
 static struct gbprox_peer *peer_by_lac(const uint8_t *la)
 {
 	struct gbprox_peer *peer;
-	llist_for_each_entry(peer, &gbprox_bts_peers, list) {
+	llist_for_each_entry(peer, peer_hash_bucket(peers_by_la,
+						    area_hash(la, 5)),
+			     la_list) {
 		if (!memcmp(peer->ra, la, 5))
 			return peer;
 	}
 	return NULL;
 }
 
-static struct gbprox_peer *peer_alloc(uint16_t bvci)
+/* set the Routeing Area of a peer and re-hash it */
+static void peer_set_ra(struct gbprox_peer *peer, const uint8_t *ra)
+{
+	memcpy(peer->ra, ra, sizeof(peer->ra));
+
+	llist_del(&peer->ra_list);
+	llist_add(&peer->ra_list,
+		  peer_hash_bucket(peers_by_ra, area_hash(peer->ra, 6)));
+	llist_del(&peer->la_list);
+	llist_add(&peer->la_list,
+		  peer_hash_bucket(peers_by_la, area_hash(peer->ra, 5)));
+}
+
+static struct gbprox_peer *peer_alloc(uint16_t bvci, struct gprs_nsvc *nsvc)
 {
 	struct gbprox_peer *peer;
 
@@ -108,7 +172,15 @@ static struct gbprox_peer *peer_alloc(uint16_t bvci)
 		return NULL;
 
 	peer->bvci = bvci;
+	peer->nsvc = nsvc;
 	llist_add(&peer->list, &gbprox_bts_peers);
+	llist_add(&peer->bvci_list, peer_hash_bucket(peers_by_bvci, bvci));
+	llist_add(&peer->nsvc_list,
+		  peer_hash_bucket(peers_by_nsvc, nsvc_hash(nsvc)));
+	llist_add(&peer->ra_list,
+		  peer_hash_bucket(peers_by_ra, area_hash(peer->ra, 6)));
+	llist_add(&peer->la_list,
+		  peer_hash_bucket(peers_by_la, area_hash(peer->ra, 5)));
 
 	return peer;
 }
@@ -116,43 +188,47 @@ static struct gbprox_peer *peer_alloc(uint16_t bvci)
 static void peer_free(struct gbprox_peer *peer)
 {
 	llist_del(&peer->list);
+	llist_del(&peer->bvci_list);
+	llist_del(&peer->nsvc_list);
+	llist_del(&peer->ra_list);
+	llist_del(&peer->la_list);
 	talloc_free(peer);
 }
 
-/* FIXME: this needs to go to libosmocore/msgb.c */
-static struct msgb *msgb_copy(const struct msgb *msg, const char *name)
+/* headroom for the NS header prepended by gprs_ns_sendmsg() */
+#define GBPROX_NS_HEADROOM	32
+
+/* Create the message to be relayed.  The NS layer frees the received
+ * message once we return and gprs_ns_sendmsg() frees the one it sends,
+ * so we cannot pass it on as is.  Only the BSSGP PDU is copied, the old
+ * NS header is replaced by gprs_ns_sendmsg() anyway. */
+static struct msgb *gbprox_relay_msg(const struct msgb *msg, const char *name)
 {
 	struct libgb_msgb_cb *old_cb, *new_cb;
 	struct msgb *new_msg;
+	uint8_t *bssgph = msgb_bssgph(msg);
+	unsigned int len = msg->tail - bssgph;
 
-	new_msg = msgb_alloc(msg->data_len, name);
+	new_msg = msgb_alloc_headroom(GBPROX_NS_HEADROOM + len,
+				      GBPROX_NS_HEADROOM, name);
 	if (!new_msg)
 		return NULL;
 
-	/* copy data */
-	memcpy(new_msg->_data, msg->_data, new_msg->data_len);
-
-	/* copy header */
-	new_msg->len = msg->len;
-	new_msg->data += msg->data - msg->_data;
-	new_msg->head += msg->head - msg->_data;
-	new_msg->tail += msg->tail - msg->_data;
-
-	new_msg->l1h = new_msg->_data + (msg->l1h - msg->_data);
-	new_msg->l2h = new_msg->_data + (msg->l2h - msg->_data);
-	new_msg->l3h = new_msg->_data + (msg->l3h - msg->_data);
-	new_msg->l4h = new_msg->_data + (msg->l4h - msg->_data);
+	memcpy(msgb_put(new_msg, len), bssgph, len);
 
 	/* copy GB specific data */
 	old_cb = LIBGB_MSGB_CB(msg);
 	new_cb = LIBGB_MSGB_CB(new_msg);
 
-	new_cb->bssgph = new_msg->_data + (old_cb->bssgph - msg->_data);
-	new_cb->llch = new_msg->_data + (old_cb->llch - msg->_data);
-
-	/* bssgp_cell_id is a pointer into the old msgb, so we need to make
-	 * it a pointer into the new msgb */
-	new_cb->bssgp_cell_id = new_msg->_data + (old_cb->bssgp_cell_id - msg->_data);
+	new_cb->bssgph = new_msg->data;
+	/* the LLC PDU and Cell Identifier are pointers into the BSSGP PDU
+	 * of the old msgb, so we need to make them pointers into the new
+	 * msgb */
+	if (old_cb->llch >= bssgph && old_cb->llch < msg->tail)
+		new_cb->llch = new_msg->data + (old_cb->llch - bssgph);
+	if (old_cb->bssgp_cell_id >= bssgph && old_cb->bssgp_cell_id < msg->tail)
+		new_cb->bssgp_cell_id = new_msg->data +
+					(old_cb->bssgp_cell_id - bssgph);
 	new_cb->nsei = old_cb->nsei;
 	new_cb->bvci = old_cb->bvci;
 	new_cb->tlli = old_cb->tlli;
@@ -160,19 +236,13 @@ static struct msgb *msgb_copy(const struct msgb *msg, const char *name)
 	return new_msg;
 }
 
-/* strip off the NS header */
-static void strip_ns_hdr(struct msgb *msg)
-{
-	int strip_len = msgb_bssgph(msg) - msg->data;
-	msgb_pull(msg, strip_len);
-}
-
 /* feed a message down the NS-VC associated with the specified peer */
 static int gbprox_relay2sgsn(struct msgb *old_msg, uint16_t ns_bvci)
 {
-	/* create a copy of the message so the old one can
-	 * be free()d safely when we return from gbprox_rcvmsg() */
-	struct msgb *msg = msgb_copy(old_msg, "msgb_relay2sgsn");
+	struct msgb *msg = gbprox_relay_msg(old_msg, "msgb_relay2sgsn");
+
+	if (!msg)
+		return -ENOMEM;
 
 	DEBUGP(DGPRS, "NSEI=%u proxying BTS->SGSN (NS_BVCI=%u, NSEI=%u)\n",
 		msgb_nsei(msg), ns_bvci, gbcfg.nsip_sgsn_nsei);
@@ -180,8 +250,6 @@ static int gbprox_relay2sgsn(struct msgb *old_msg, uint16_t ns_bvci)
 	msgb_bvci(msg) = ns_bvci;
 	msgb_nsei(msg) = gbcfg.nsip_sgsn_nsei;
 
-	strip_ns_hdr(msg);
-
 	return gprs_ns_sendmsg(bssgp_nsi, msg);
 }
 
@@ -189,9 +257,10 @@ static int gbprox_relay2sgsn(struct msgb *old_msg, uint16_t ns_bvci)
 static int gbprox_relay2peer(struct msgb *old_msg, struct gbprox_peer *peer,
 			  uint16_t ns_bvci)
 {
-	/* create a copy of the message so the old one can
-	 * be free()d safely when we return from gbprox_rcvmsg() */
-	struct msgb *msg = msgb_copy(old_msg, "msgb_relay2peer");
+	struct msgb *msg = gbprox_relay_msg(old_msg, "msgb_relay2peer");
+
+	if (!msg)
+		return -ENOMEM;
 
 	DEBUGP(DGPRS, "NSEI=%u proxying SGSN->BSS (NS_BVCI=%u, NSEI=%u)\n",
 		msgb_nsei(msg), ns_bvci, peer->nsvc->nsei);
@@ -199,9 +268,6 @@ static int gbprox_relay2peer(struct msgb *old_msg, struct gbprox_peer *peer,
 	msgb_bvci(msg) = ns_bvci;
 	msgb_nsei(msg) = peer->nsvc->nsei;
 
-	/* Strip the old NS header, it will be replaced with a new one */
-	strip_ns_hdr(msg);
-
 	return gprs_ns_sendmsg(bssgp_nsi, msg);
 }
 
@@ -292,8 +358,7 @@ static int gbprox_rx_sig_from_bss(struct msgb *msg, struct gprs_nsvc *nsvc,
 		from_peer = peer_by_nsvc(nsvc);
 		if (!from_peer)
 			goto err_no_peer;
-		memcpy(from_peer->ra, TLVP_VAL(&tp, BSSGP_IE_ROUTEING_AREA),
-			sizeof(from_peer->ra));
+		peer_set_ra(from_peer, TLVP_VAL(&tp, BSSGP_IE_ROUTEING_AREA));
 		gsm48_parse_ra(&raid, from_peer->ra);
 		LOGP(DGPRS, LOGL_INFO, "NSEI=%u BSSGP SUSPEND/RESUME "
 			"RAC snooping: RAC %u-%u-%u-%u behind BVCI=%u, "
@@ -323,8 +388,7 @@ static int gbprox_rx_sig_from_bss(struct msgb *msg, struct gprs_nsvc *nsvc,
 				LOGP(DGPRS, LOGL_INFO, "Allocationg new peer for "
 				     "BVCI=%u via NSVCI=%u/NSEI=%u\n", bvci,
 				     nsvc->nsvci, nsvc->nsei);
-				from_peer = peer_alloc(bvci);
-				from_peer->nsvc = nsvc;
+				from_peer = peer_alloc(bvci, nsvc);
 			}
 			if (TLVP_PRESENT(&tp, BSSGP_IE_CELL_ID)) {
 				struct gprs_ra_id raid;
@@ -332,9 +396,8 @@ static int gbprox_rx_sig_from_bss(struct msgb *msg, struct gprs_nsvc *nsvc,
 				 * PDU, this means we can extend our local
 				 * state information about this particular cell
 				 * */
-				memcpy(from_peer->ra,
-					TLVP_VAL(&tp, BSSGP_IE_CELL_ID),
-					sizeof(from_peer->ra));
+				peer_set_ra(from_peer,
+					    TLVP_VAL(&tp, BSSGP_IE_CELL_ID));
 				gsm48_parse_ra(&raid, from_peer->ra);
 				LOGP(DGPRS, LOGL_INFO, "NSEI=%u/BVCI=%u "
 				     "Cell ID %u-%u-%u-%u\n", nsvc->nsei,
@@ -565,8 +628,7 @@ int gbprox_rcvmsg(struct msgb *msg, struct gprs_nsvc *nsvc, uint16_t ns_bvci)
 			LOGP(DGPRS, LOGL_INFO, "Allocationg new peer for "
 			     "BVCI=%u via NSVC=%u/NSEI=%u\n", ns_bvci,
 			     nsvc->nsvci, nsvc->nsei);
-			peer = peer_alloc(ns_bvci);
-			peer->nsvc = nsvc;
+			peer = peer_alloc(ns_bvci, nsvc);
 		}
 		if (peer->blocked) {
 			LOGP(DGPRS, LOGL_NOTICE, "Dropping PDU for "
@@ -1000,7 +1000,12 @@ static int gsm48_rx_gmm_ra_upd_req(struct sgsn_mm_ctx *mmctx, struct msgb *msg,
 	mmctx->mm_state = GMM_REGISTERED_NORMAL;
 
 	/* Send RA UPDATE ACCEPT */
-	return gsm48_tx_gmm_ra_upd_ack(mmctx);
+	rc = gsm48_tx_gmm_ra_upd_ack(mmctx);
+
+	/* and the downlink data held while the MS was suspended */
+	sgsn_mm_dl_flush(mmctx);
+
+	return rc;
 }
 
 static int gsm48_rx_gmm_status(struct sgsn_mm_ctx *mmctx, struct msgb *msg)
@@ -1190,6 +1195,7 @@ static void msgb_put_pdp_addr_ppp(struct msgb *msg)
 int gsm48_tx_gsm_act_pdp_acc(struct sgsn_pdp_ctx *pdp)
 {
 	struct msgb *msg = gsm48_msgb_alloc();
+	struct gsm48_qos qos = default_qos;
 	struct gsm48_hdr *gh;
 	uint8_t transaction_id = pdp->ti ^ 0x8; /* flip */
 
@@ -1206,7 +1212,9 @@ int gsm48_tx_gsm_act_pdp_acc(struct sgsn_pdp_ctx *pdp)
 
 	/* FIXME: copy QoS parameters from original request */
 	//msgb_lv_put(msg, pdp->lib->qos_neg.l, pdp->lib->qos_neg.v);
-	msgb_lv_put(msg, sizeof(default_qos), (uint8_t *)&default_qos);
+	if (pdp->reliab_class)
+		qos.reliab_class = pdp->reliab_class;
+	msgb_lv_put(msg, sizeof(qos), (uint8_t *)&qos);
 
 	/* Radio priority 10.5.7.2 */
 	msgb_v_put(msg, pdp->lib->radio_pri);
@@ -1301,6 +1309,17 @@ int gsm48_tx_gsm_deact_pdp_acc(struct sgsn_pdp_ctx *pdp)
 	return _gsm48_tx_gsm_deact_pdp_acc(pdp->mm, pdp->ti);
 }
 
+/* 10.5.6.5: reliability classes 1 and 2 use LLC acknowledged mode, we
+ * grant class 2 as our GTP-U is unacknowledged anyway */
+static uint8_t negotiate_reliab_class(const uint8_t *req_qos, uint8_t len)
+{
+	uint8_t req = len ? req_qos[0] & 0x07 : 0;
+
+	if (req == 1 || req == GSM48_QOS_RC_LLC_ACK_RLC_ACK_DATA_PROT)
+		return GSM48_QOS_RC_LLC_ACK_RLC_ACK_DATA_PROT;
+	return default_qos.reliab_class;
+}
+
 /* Section 9.5.1: Activate PDP Context Request */
 static int gsm48_rx_gsm_act_pdp_req(struct sgsn_mm_ctx *mmctx,
 				    struct msgb *msg)
@@ -1371,9 +1390,6 @@ static int gsm48_rx_gsm_act_pdp_req(struct sgsn_mm_ctx *mmctx,
 	tp.lv[OSMO_IE_GSM_REQ_PDP_ADDR].len = req_pdpa_len;
 	tp.lv[OSMO_IE_GSM_REQ_PDP_ADDR].val = req_pdpa;
 
-	/* FIXME:  determine GGSN based on APN and subscription options */
-	if (TLVP_PRESENT(&tp, GSM48_IE_GSM_APN)) {}
-
 	/* Check if NSAPI is out of range (TS 04.65 / 7.2) */
 	if (act_req->req_nsapi < 5 || act_req->req_nsapi > 15) {
 		/* Send reject with GSM_CAUSE_INV_MAND_INFO */
@@ -1403,7 +1419,19 @@ static int gsm48_rx_gsm_act_pdp_req(struct sgsn_mm_ctx *mmctx,
 	 * for re-transmissions */
 	rate_ctr_inc(&mmctx->ctrg->ctr[GMM_CTR_PDP_CTX_ACT]);
 
-	ggsn = sgsn_ggsn_ctx_by_id(0);
+	/* determine the GGSN by the APN, GGSN 0 serves all others.
+	 * FIXME: subscription options */
+	ggsn = NULL;
+	if (TLVP_PRESENT(&tp, GSM48_IE_GSM_APN)) {
+		struct apn_ctx *actx;
+
+		actx = apn_ctx_by_ie(TLVP_VAL(&tp, GSM48_IE_GSM_APN),
+				     TLVP_LEN(&tp, GSM48_IE_GSM_APN));
+		if (actx)
+			ggsn = actx->ggsn;
+	}
+	if (!ggsn)
+		ggsn = sgsn_ggsn_ctx_by_id(0);
 	if (!ggsn) {
 		LOGP(DGPRS, LOGL_ERROR, "No GGSN context 0 found!\n");
 		return -EIO;
@@ -1415,7 +1443,8 @@ static int gsm48_rx_gsm_act_pdp_req(struct sgsn_mm_ctx *mmctx,
 
 	/* Store SAPI and Transaction Identifier */
 	pdp->sapi = act_req->req_llc_sapi;
-	pdp->ti = transaction_id;
+	sgsn_pdp_ctx_set_ti(pdp, transaction_id);
+	pdp->reliab_class = negotiate_reliab_class(req_qos, req_qos_len);
 
 	return 0;
 }
@@ -1622,5 +1651,6 @@ int gprs_gmm_rx_resume(struct gprs_ra_id *raid, uint32_t tlli,
 
 	/* Transition from SUSPENDED to NORMAL */
 	mmctx->mm_state = GMM_REGISTERED_NORMAL;
+	sgsn_mm_dl_flush(mmctx);
 	return 0;
 }
@@ -21,6 +21,7 @@
 
 #include <errno.h>
 #include <stdint.h>
+#include <string.h>
 
 #include <osmocom/core/msgb.h>
 #include <osmocom/core/linuxlist.h>
@@ -61,7 +62,7 @@ static int _bssgp_tx_dl_ud(struct msgb *msg, struct sgsn_mm_ctx *mmctx)
 
 
 /* Section 8.9.9 LLC layer parameter default values */
-static const struct gprs_llc_params llc_default_params[] = {
+static const struct gprs_llc_params llc_default_params[NUM_SAPIS] = {
 	[1] = {
 		.t200_201	= 5,
 		.n200		= 3,
@@ -131,6 +132,11 @@ static const struct gprs_llc_params llc_default_params[] = {
 LLIST_HEAD(gprs_llc_llmes);
 void *llc_tall_ctx;
 
+static void t200_expired(void *data);
+static void t201_expired(void *data);
+static int llc_tx_sabm(struct gprs_llc_lle *lle);
+static void llc_abm_free(struct gprs_llc_lle *lle);
+
 /* If the TLLI is foreign, return its local version */
 static inline uint32_t tlli_foreign2local(uint32_t tlli)
 {
@@ -146,16 +152,59 @@ static inline uint32_t tlli_foreign2local(uint32_t tlli)
 	return new_tlli;
 }
 
+/* LLMEs hashed by their current and old TLLI */
+#define LLME_HASH_BITS	10
+static struct llist_head llme_tlli_hash[1 << LLME_HASH_BITS];
+
+static struct llist_head *llme_hash_bucket(uint32_t tlli)
+{
+	struct llist_head *bucket;
+
+	/* the lower bits of a TLLI are derived from the P-TMSI */
+	bucket = &llme_tlli_hash[(tlli ^ (tlli >> LLME_HASH_BITS)) &
+				 (ARRAY_SIZE(llme_tlli_hash) - 1)];
+	if (!bucket->next)
+		INIT_LLIST_HEAD(bucket);
+
+	return bucket;
+}
+
+static void llme_hash_tlli(struct gprs_llc_llme *llme,
+			   struct gprs_llc_tlli_node *node, uint32_t tlli)
+{
+	if (node->llme) {
+		llist_del(&node->list);
+		node->llme = NULL;
+	}
+
+	if (tlli == 0xffffffff)
+		return;
+
+	node->llme = llme;
+	node->tlli = tlli;
+	llist_add(&node->list, llme_hash_bucket(tlli));
+}
+
+/* set current and old TLLI of a LLME and update the hash table */
+static void llme_set_tlli(struct gprs_llc_llme *llme,
+			  uint32_t tlli, uint32_t old_tlli)
+{
+	llme->tlli = tlli;
+	llme->old_tlli = old_tlli;
+	llme_hash_tlli(llme, &llme->tlli_node, tlli);
+	llme_hash_tlli(llme, &llme->old_tlli_node, old_tlli);
+}
+
 /* lookup LLC Entity based on DLCI (TLLI+SAPI tuple) */
 static struct gprs_llc_lle *lle_by_tlli_sapi(uint32_t tlli, uint8_t sapi)
 {
-	struct gprs_llc_llme *llme;
+	struct gprs_llc_tlli_node *node;
 
 	tlli = tlli_foreign2local(tlli);
 
-	llist_for_each_entry(llme, &gprs_llc_llmes, list) {
-		if (llme->tlli == tlli || llme->old_tlli == tlli)
-			return &llme->lle[sapi];
+	llist_for_each_entry(node, llme_hash_bucket(tlli), list) {
+		if (node->tlli == tlli)
+			return &node->llme->lle[sapi];
 	}
 	return NULL;
 }
@@ -167,6 +216,10 @@ static void lle_init(struct gprs_llc_llme *llme, uint8_t sapi)
 	lle->llme = llme;
 	lle->sapi = sapi;
 	lle->state = GPRS_LLES_UNASSIGNED;
+	lle->t200.cb = t200_expired;
+	lle->t200.data = lle;
+	lle->t201.cb = t201_expired;
+	lle->t201.data = lle;
 
 	/* Initialize according to parameters */
 	memcpy(&lle->params, &llc_default_params[sapi], sizeof(lle->params));
@@ -181,8 +234,7 @@ static struct gprs_llc_llme *llme_alloc(uint32_t tlli)
 	if (!llme)
 		return NULL;
 
-	llme->tlli = tlli;
-	llme->old_tlli = 0xffffffff;
+	llme_set_tlli(llme, tlli, 0xffffffff);
 	llme->state = GPRS_LLMS_UNASSIGNED;
 
 	for (i = 0; i < ARRAY_SIZE(llme->lle); i++)
@@ -193,8 +245,34 @@ static struct gprs_llc_llme *llme_alloc(uint32_t tlli)
 	return llme;
 }
 
+struct gprs_llc_lle *gprs_lle_get_or_create(uint32_t tlli, uint8_t sapi)
+{
+	struct gprs_llc_llme *llme;
+	struct gprs_llc_lle *lle;
+
+	lle = lle_by_tlli_sapi(tlli, sapi);
+	if (lle)
+		return lle;
+
+	LOGP(DLLC, LOGL_ERROR, "LLC: unknown TLLI 0x%08x, "
+		"creating LLME on the fly\n", tlli);
+	llme = llme_alloc(tlli);
+	if (!llme)
+		return NULL;
+
+	return &llme->lle[sapi];
+}
+
 static void llme_free(struct gprs_llc_llme *llme)
 {
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(llme->lle); i++) {
+		llc_abm_free(&llme->lle[i]);
+		osmo_timer_del(&llme->lle[i].t200);
+	}
+
+	llme_set_tlli(llme, 0xffffffff, 0xffffffff);
 	llist_del(&llme->list);
 	talloc_free(llme);
 }
@@ -234,13 +312,17 @@ struct gprs_llc_hdr_parsed {
 	uint8_t sapi;
 	uint8_t is_cmd:1,
 		 ack_req:1,
-		 is_encrypted:1;
+		 is_encrypted:1,
+		 is_i:1;
 	uint32_t seq_rx;
 	uint32_t seq_tx;
 	uint32_t fcs;
 	uint32_t fcs_calc;
 	uint8_t *data;
 	uint16_t data_len;
+	/* SACK bitmap of I+S and S frames */
+	uint8_t *sack;
+	uint8_t sack_len;
 	uint16_t crc_length;
 	enum gprs_llc_cmd cmd;
 };
@@ -250,6 +332,31 @@ struct gprs_llc_hdr_parsed {
 #define N202		4
 #define CRC24_LENGTH	3
 
+/* supervisory function bits S1 S2, 6.4.2 */
+#define LLC_S_RR	0
+#define LLC_S_ACK	1
+#define LLC_S_RNR	2
+#define LLC_S_SACK	3
+
+/* Section 6.2.3 Table 2: only the SNDCP SAPIs support ABM */
+static int llc_sapi_has_abm(uint8_t sapi)
+{
+	switch (sapi) {
+	case GPRS_SAPI_SNDCP3:
+	case GPRS_SAPI_SNDCP5:
+	case GPRS_SAPI_SNDCP9:
+	case GPRS_SAPI_SNDCP11:
+		return 1;
+	}
+	return 0;
+}
+
+/* distance from sequence number b up to a, modulo 512 */
+static inline uint16_t llc_seq_diff(uint16_t a, uint16_t b)
+{
+	return (a - b) & 0x1ff;
+}
+
 static int gprs_llc_fcs(uint8_t *data, unsigned int len)
 {
 	uint32_t fcs_calc;
@@ -261,41 +368,21 @@ static int gprs_llc_fcs(uint8_t *data, unsigned int len)
 	return fcs_calc;
 }
 
-static void t200_expired(void *data)
+/* XOR the cipher keystream onto the frame, one machine word at a time */
+static void llc_xor_keystream(uint8_t *data, const uint8_t *ks,
+			      unsigned int len)
 {
-	struct gprs_llc_lle *lle = data;
-
-	/* 8.5.1.3: Expiry of T200 */
-
-	if (lle->retrans_ctr >= lle->params.n200) {
-		/* FIXME: LLGM-STATUS-IND, LL-RELEASE-IND/CNF */
-		lle->state = GPRS_LLES_ASSIGNED_ADM;
-	}
-
-	switch (lle->state) {
-	case GPRS_LLES_LOCAL_EST:
-		/* FIXME: retransmit SABM */
-		/* FIXME: re-start T200 */
-		lle->retrans_ctr++;
-		break;
-	case GPRS_LLES_LOCAL_REL:
-		/* FIXME: retransmit DISC */
-		/* FIXME: re-start T200 */
-		lle->retrans_ctr++;
-		break;
-	}
-
-}
-
-static void t201_expired(void *data)
-{
-	struct gprs_llc_lle *lle = data;
-
-	if (lle->retrans_ctr < lle->params.n200) {
-		/* FIXME: transmit apropriate supervisory frame (8.6.4.1) */
-		/* FIXME: set timer T201 */
-		lle->retrans_ctr++;
+	unsigned long d, k;
+	unsigned int i = 0;
+
+	for (; i + sizeof(d) <= len; i += sizeof(d)) {
+		memcpy(&d, data + i, sizeof(d));
+		memcpy(&k, ks + i, sizeof(k));
+		d ^= k;
+		memcpy(data + i, &d, sizeof(d));
 	}
+	for (; i < len; i++)
+		data[i] ^= ks[i];
 }
 
 int gprs_llc_tx_u(struct msgb *msg, uint8_t sapi, int command,
@@ -335,16 +422,29 @@ int gprs_llc_tx_u(struct msgb *msg, uint8_t sapi, int command,
 	return _bssgp_tx_dl_ud(msg, NULL);
 }
 
-/* Send XID response to LLE */
-static int gprs_llc_tx_xid(struct gprs_llc_lle *lle, struct msgb *msg,
-			   int command)
+/* Send a U frame of a LLE, msg holds the information field or is NULL */
+static int llc_tx_u_lle(struct gprs_llc_lle *lle, struct msgb *msg,
+			int command, enum gprs_llc_u_cmd u_cmd, int pf_bit)
 {
+	if (!msg) {
+		msg = msgb_alloc_headroom(256, 128, "LLC_U");
+		if (!msg)
+			return -ENOMEM;
+	}
+
 	/* copy identifiers from LLE to ensure lower layers can route */
 	msgb_tlli(msg) = lle->llme->tlli;
 	msgb_bvci(msg) = lle->llme->bvci;
 	msgb_nsei(msg) = lle->llme->nsei;
 
-	return gprs_llc_tx_u(msg, lle->sapi, command, GPRS_LLC_U_XID, 1);
+	return gprs_llc_tx_u(msg, lle->sapi, command, u_cmd, pf_bit);
+}
+
+/* Send XID response to LLE */
+static int gprs_llc_tx_xid(struct gprs_llc_lle *lle, struct msgb *msg,
+			   int command)
+{
+	return llc_tx_u_lle(lle, msg, command, GPRS_LLC_U_XID, 1);
 }
 
 /* Transmit a UI frame over the given SAPI */
@@ -361,14 +461,9 @@ int gprs_llc_tx_ui(struct msgb *msg, uint8_t sapi, int command,
 	/* Identifiers from UP: (TLLI, SAPI) + (BVCI, NSEI) */
 
 	/* look-up or create the LL Entity for this (TLLI, SAPI) tuple */
-	lle = lle_by_tlli_sapi(msgb_tlli(msg), sapi);
-	if (!lle) {
-		struct gprs_llc_llme *llme;
-		LOGP(DLLC, LOGL_ERROR, "LLC TX: unknown TLLI 0x%08x, "
-			"creating LLME on the fly\n", msgb_tlli(msg));
-		llme = llme_alloc(msgb_tlli(msg));
-		lle = &llme->lle[sapi];
-	}
+	lle = gprs_lle_get_or_create(msgb_tlli(msg), sapi);
+	if (!lle)
+		return -ENOMEM;
 
 	if (msg->len > lle->params.n201_u) {
 		LOGP(DLLC, LOGL_ERROR, "Cannot Tx %u bytes (N201-U=%u)\n",
@@ -419,7 +514,7 @@ int gprs_llc_tx_ui(struct msgb *msg, uint8_t sapi, int command,
 		uint16_t crypt_len = (fcs + 3) - (llch + 3);
 		uint8_t cipher_out[GSM0464_CIPH_MAX_BLOCK];
 		uint32_t iv;
-		int rc, i;
+		int rc;
 		uint64_t kc = *(uint64_t *)&lle->llme->kc;
 
 		/* Compute the 'Input' Paraemeter */
@@ -434,8 +529,7 @@ int gprs_llc_tx_ui(struct msgb *msg, uint8_t sapi, int command,
 		}
 
 		/* XOR the cipher output with the information field + FCS */
-		for (i = 0; i < crypt_len; i++)
-			*(llch + 3 + i) ^= cipher_out[i];
+		llc_xor_keystream(llch + 3, cipher_out, crypt_len);
 
 		/* Mark frame as encrypted */
 		ctrl[1] |= 0x02;
@@ -476,17 +570,106 @@ static int msgb_put_xid_par(struct msgb *msg, uint8_t type, uint8_t length, uint
 	return length + header_len;
 }
 
+/* Negotiate the XID parameters between cur and end (8.5.3) and write
+ * our response parameters to resp */
+static void llc_xid_negotiate(struct gprs_llc_lle *lle, uint8_t *cur,
+			      uint8_t *end, struct msgb *resp)
+{
+	/* echo our parameters, but let SNDCP negotiate its own
+	 * ones in the layer-3 parameters */
+	while (cur < end) {
+		uint8_t type, len, hdr_len;
+		uint8_t *val;
+
+		type = (cur[0] >> 2) & 0x1f;
+		if (cur[0] & 0x80) {
+			if (cur + 1 >= end)
+				break;
+			len = ((cur[0] & 3) << 6) | (cur[1] >> 2);
+			hdr_len = 2;
+		} else {
+			len = cur[0] & 3;
+			hdr_len = 1;
+		}
+		if (cur + hdr_len + len > end)
+			break;
+		val = cur + hdr_len;
+
+		switch (type) {
+		case GPRS_LLC_XID_T_L3_PAR: {
+			uint8_t l3_resp[255];
+			int rc;
+
+			rc = sndcp_llxid_ind(lle, val, len,
+					     l3_resp, sizeof(l3_resp));
+			if (rc > 0)
+				msgb_put_xid_par(resp, type, rc, l3_resp);
+			break;
+		}
+		case GPRS_LLC_XID_T_kD:
+		case GPRS_LLC_XID_T_kU: {
+			/* we cannot hold larger windows */
+			uint8_t k = len == 1 ? val[0] : 0;
+
+			if (!llc_sapi_has_abm(lle->sapi) || !k)
+				break;
+			if (k > GPRS_LLC_ABM_MAX_K)
+				k = GPRS_LLC_ABM_MAX_K;
+			if (type == GPRS_LLC_XID_T_kD)
+				lle->params.kD = k;
+			else
+				lle->params.kU = k;
+			msgb_put_xid_par(resp, type, 1, &k);
+			break;
+		}
+		case GPRS_LLC_XID_T_IOV_I:
+			if (!llc_sapi_has_abm(lle->sapi) || len != 4)
+				break;
+			lle->iov_i = (val[0] << 24) | (val[1] << 16) |
+				     (val[2] << 8) | val[3];
+			memcpy(msgb_put(resp, hdr_len + len), cur,
+			       hdr_len + len);
+			break;
+		case GPRS_LLC_XID_T_N201_I:
+		case GPRS_LLC_XID_T_mD:
+		case GPRS_LLC_XID_T_mU: {
+			uint16_t v = len == 2 ? (val[0] << 8) | val[1] : 0;
+
+			if (!llc_sapi_has_abm(lle->sapi) || !v)
+				break;
+			if (type == GPRS_LLC_XID_T_N201_I)
+				lle->params.n201_i = v;
+			else if (type == GPRS_LLC_XID_T_mD)
+				lle->params.mD = v;
+			else
+				lle->params.mU = v;
+			memcpy(msgb_put(resp, hdr_len + len), cur,
+			       hdr_len + len);
+			break;
+		}
+		default:
+			memcpy(msgb_put(resp, hdr_len + len), cur,
+			       hdr_len + len);
+			break;
+		}
+
+		cur += hdr_len + len;
+	}
+}
+
 static void rx_llc_xid(struct gprs_llc_lle *lle,
 			struct gprs_llc_hdr_parsed *gph)
 {
 	/* FIXME: 8.5.3.3: check if XID is invalid */
 	if (gph->is_cmd) {
-		/* FIXME: implement XID negotiation using SNDCP */
 		struct msgb *resp;
-		uint8_t *xid;
+
 		resp = msgb_alloc_headroom(4096, 1024, "LLC_XID");
-		xid = msgb_put(resp, gph->data_len);
-		memcpy(xid, gph->data, gph->data_len);
+		if (!resp)
+			return;
+
+		llc_xid_negotiate(lle, gph->data, gph->data + gph->data_len,
+				  resp);
 		gprs_llc_tx_xid(lle, resp, 0);
 	} else {
 		/* FIXME: if we had sent a XID reset, send
@@ -495,6 +678,630 @@ static void rx_llc_xid(struct gprs_llc_lle *lle,
 	}
 }
 
+/* Section 8.6: Acknowledged operation */
+
+/* the window size we use for a negotiated k */
+static unsigned int llc_window(uint16_t k)
+{
+	if (k < 1)
+		return 1;
+	if (k > GPRS_LLC_ABM_MAX_K)
+		return GPRS_LLC_ABM_MAX_K;
+	return k;
+}
+
+/* select a new IOV-I and append it to the XID of a SABM or UA, it is
+ * only needed to cipher I frames */
+static void llc_xid_put_iov_i(struct gprs_llc_lle *lle, struct msgb *msg)
+{
+	uint8_t val[4];
+
+	if (lle->llme->algo == GPRS_ALGO_GEA0)
+		return;
+
+	lle->iov_i = rand();
+	val[0] = lle->iov_i >> 24;
+	val[1] = lle->iov_i >> 16;
+	val[2] = lle->iov_i >> 8;
+	val[3] = lle->iov_i;
+	msgb_put_xid_par(msg, GPRS_LLC_XID_T_IOV_I, sizeof(val), val);
+}
+
+/* LL-ESTABLISH and LL-RELEASE .ind/.conf to the layer 3 of the SAPI */
+static void llc_prim_ind(struct gprs_llc_lle *lle,
+			 enum gprs_llc_primitive prim)
+{
+	switch (lle->sapi) {
+	case GPRS_SAPI_SNDCP3:
+	case GPRS_SAPI_SNDCP5:
+	case GPRS_SAPI_SNDCP9:
+	case GPRS_SAPI_SNDCP11:
+		sndcp_rx_llc_prim(lle, prim);
+		break;
+	}
+}
+
+static void llc_abm_free(struct gprs_llc_lle *lle)
+{
+	struct gprs_llc_abm *abm = lle->abm;
+	struct msgb *msg;
+	unsigned int i;
+
+	osmo_timer_del(&lle->t201);
+	if (!abm)
+		return;
+
+	for (i = 0; i < GPRS_LLC_ABM_MAX_K; i++) {
+		if (abm->tx_frames[i])
+			msgb_free(abm->tx_frames[i]);
+		if (abm->rx_frames[i])
+			msgb_free(abm->rx_frames[i]);
+	}
+	while ((msg = msgb_dequeue(&abm->tx_queue)))
+		msgb_free(msg);
+
+	talloc_free(abm);
+	lle->abm = NULL;
+}
+
+/* 8.5.1: (re-)establishment resets the state variables and discards
+ * unacknowledged I frames, frames not sent yet remain queued */
+static int llc_abm_start(struct gprs_llc_lle *lle)
+{
+	struct gprs_llc_abm *abm = lle->abm;
+	unsigned int i;
+
+	if (!abm) {
+		abm = talloc_zero(lle->llme, struct gprs_llc_abm);
+		if (!abm)
+			return -ENOMEM;
+		INIT_LLIST_HEAD(&abm->tx_queue);
+		lle->abm = abm;
+	}
+
+	for (i = 0; i < GPRS_LLC_ABM_MAX_K; i++) {
+		if (abm->tx_frames[i])
+			msgb_free(abm->tx_frames[i]);
+		abm->tx_frames[i] = NULL;
+		if (abm->rx_frames[i])
+			msgb_free(abm->rx_frames[i]);
+		abm->rx_frames[i] = NULL;
+	}
+	abm->peer_busy = 0;
+	osmo_timer_del(&lle->t201);
+
+	lle->v_sent = lle->v_ack = lle->v_recv = 0;
+	lle->oc_i_send = lle->oc_i_recv = 0;
+	lle->retrans_ctr = 0;
+
+	return 0;
+}
+
+/* return to ADM, discarding all I frames */
+static void llc_abm_stop(struct gprs_llc_lle *lle)
+{
+	osmo_timer_del(&lle->t200);
+	llc_abm_free(lle);
+	lle->state = GPRS_LLES_ASSIGNED_ADM;
+}
+
+/* the overflow counter of a received I frame, it may be just before or
+ * after a wrap of V(R) */
+static uint32_t llc_rx_oc_i(struct gprs_llc_lle *lle, uint16_t ns)
+{
+	if (llc_seq_diff(ns, lle->v_recv) < llc_window(lle->params.kU))
+		return lle->oc_i_recv + (ns < lle->v_recv ? 512 : 0);
+	return lle->oc_i_recv - (ns > lle->v_recv ? 512 : 0);
+}
+
+/* append the FCS to the frame starting at llch */
+static void llc_put_fcs(struct msgb *msg, uint8_t *llch)
+{
+	uint8_t *fcs;
+	uint32_t fcs_calc;
+
+	fcs = msgb_put(msg, 3);
+	fcs_calc = gprs_llc_fcs(llch, fcs - llch);
+	fcs[0] = fcs_calc & 0xff;
+	fcs[1] = (fcs_calc >> 8) & 0xff;
+	fcs[2] = (fcs_calc >> 16) & 0xff;
+}
+
+static int llc_tx_lle(struct gprs_llc_lle *lle, struct msgb *msg,
+		      void *mmctx)
+{
+	msgb_tlli(msg) = lle->llme->tlli;
+	msgb_bvci(msg) = lle->llme->bvci;
+	msgb_nsei(msg) = lle->llme->nsei;
+
+	/* Send BSSGP-DL-UNITDATA.req */
+	return _bssgp_tx_dl_ud(msg, mmctx);
+}
+
+/* (re)transmit the I frame with N(S) = ns, 6.3.5.2 */
+static int llc_tx_i_frame(struct gprs_llc_lle *lle, uint16_t ns,
+			  int ack_req, void *mmctx)
+{
+	struct gprs_llc_abm *abm = lle->abm;
+	struct msgb *info = abm->tx_frames[ns % GPRS_LLC_ABM_MAX_K];
+	uint16_t nr = lle->v_recv;
+	struct msgb *msg;
+	uint8_t *llch;
+
+	msg = msgb_alloc_headroom(info->len + 256, 128, "LLC_I");
+	if (!msg)
+		return -ENOMEM;
+
+	/* I+S format acknowledging with RR, a command of the SGSN */
+	llch = msgb_put(msg, 4);
+	llch[0] = 0x40 | (lle->sapi & 0xf);
+	llch[1] = (ack_req ? 0x40 : 0) | ((ns >> 4) & 0x1f);
+	llch[2] = ((ns & 0xf) << 4) | ((nr >> 6) & 0x7);
+	llch[3] = ((nr & 0x3f) << 2) | LLC_S_RR;
+	memcpy(msgb_put(msg, info->len), info->data, info->len);
+	llc_put_fcs(msg, llch);
+
+	/* encrypt information field + FCS, if needed! */
+	if (lle->llme->algo != GPRS_ALGO_GEA0) {
+		uint16_t crypt_len = msg->tail - (llch + 4);
+		uint8_t cipher_out[GSM0464_CIPH_MAX_BLOCK];
+		uint64_t kc = *(uint64_t *)&lle->llme->kc;
+		uint32_t iv;
+		int rc;
+
+		iv = gprs_cipher_gen_input_i(lle->iov_i, ns,
+				abm->tx_oc[ns % GPRS_LLC_ABM_MAX_K]);
+		rc = gprs_cipher_run(cipher_out, crypt_len, lle->llme->algo,
+				     kc, iv, GPRS_CIPH_SGSN2MS);
+		if (rc < 0) {
+			LOGP(DLLC, LOGL_ERROR, "Error crypting I frame: %d\n",
+			     rc);
+			msgb_free(msg);
+			return rc;
+		}
+		llc_xor_keystream(llch + 4, cipher_out, crypt_len);
+	}
+
+	abm->tx_stamp[ns % GPRS_LLC_ABM_MAX_K] = ++abm->tx_count;
+	abm->stats.tx_frames++;
+	return llc_tx_lle(lle, msg, mmctx);
+}
+
+/* Acknowledge the received I frames with a S frame, with a SACK bitmap
+ * of the frames we hold beyond V(R), 6.3.5.2 */
+static int llc_tx_s_frame(struct gprs_llc_lle *lle, int ack_req)
+{
+	struct gprs_llc_abm *abm = lle->abm;
+	uint8_t bitmap[GPRS_LLC_ABM_MAX_K / 8];
+	unsigned int n, bitmap_len = 0;
+	uint16_t nr = lle->v_recv;
+	struct msgb *msg;
+	uint8_t *llch;
+
+	/* R(n) is set if the I frame N(R)+n was received */
+	memset(bitmap, 0, sizeof(bitmap));
+	for (n = 1; n < GPRS_LLC_ABM_MAX_K; n++) {
+		if (!abm->rx_frames[(nr + n) % GPRS_LLC_ABM_MAX_K])
+			continue;
+		bitmap[(n - 1) / 8] |= 0x80 >> ((n - 1) % 8);
+		bitmap_len = (n - 1) / 8 + 1;
+	}
+
+	msg = msgb_alloc_headroom(256, 128, "LLC_S");
+	if (!msg)
+		return -ENOMEM;
+
+	/* a response of the SGSN */
+	llch = msgb_put(msg, 3);
+	llch[0] = lle->sapi & 0xf;
+	llch[1] = 0x80 | (ack_req ? 0x20 : 0) | ((nr >> 6) & 0x7);
+	llch[2] = ((nr & 0x3f) << 2) | (bitmap_len ? LLC_S_SACK : LLC_S_RR);
+	if (bitmap_len)
+		memcpy(msgb_put(msg, bitmap_len), bitmap, bitmap_len);
+	llc_put_fcs(msg, llch);
+
+	return llc_tx_lle(lle, msg, NULL);
+}
+
+/* send queued I frames as long as the window is open */
+static void llc_tx_pending(struct gprs_llc_lle *lle, void *mmctx)
+{
+	struct gprs_llc_abm *abm = lle->abm;
+	unsigned int k = llc_window(lle->params.kD);
+	struct msgb *msg;
+
+	while (!abm->peer_busy && llc_seq_diff(lle->v_sent, lle->v_ack) < k &&
+	       (msg = msgb_dequeue(&abm->tx_queue))) {
+		uint16_t ns = lle->v_sent;
+		int ack_req;
+
+		abm->tx_queue_len--;
+		abm->tx_frames[ns % GPRS_LLC_ABM_MAX_K] = msg;
+		abm->tx_oc[ns % GPRS_LLC_ABM_MAX_K] = lle->oc_i_send;
+		lle->v_sent = (lle->v_sent + 1) % 512;
+		if (!lle->v_sent)
+			lle->oc_i_send += 512;
+
+		/* ask for an acknowledgement with the last frame we send */
+		ack_req = llist_empty(&abm->tx_queue) ||
+			  llc_seq_diff(lle->v_sent, lle->v_ack) >= k;
+		llc_tx_i_frame(lle, ns, ack_req, mmctx);
+	}
+
+	if (lle->v_sent != lle->v_ack && !osmo_timer_pending(&lle->t201))
+		osmo_timer_schedule(&lle->t201, lle->params.t200_201, 0);
+}
+
+static int llc_sack_bit(struct gprs_llc_hdr_parsed *gph, unsigned int n)
+{
+	if ((n - 1) / 8 >= gph->sack_len)
+		return 0;
+	return gph->sack[(n - 1) / 8] & (0x80 >> ((n - 1) % 8));
+}
+
+/* free an acknowledged I frame, returns when it was sent last */
+static uint32_t llc_tx_frame_acked(struct gprs_llc_abm *abm, uint16_t seq)
+{
+	struct msgb **frame = &abm->tx_frames[seq % GPRS_LLC_ABM_MAX_K];
+
+	if (!*frame)
+		return 0;
+	msgb_free(*frame);
+	*frame = NULL;
+	return abm->tx_stamp[seq % GPRS_LLC_ABM_MAX_K];
+}
+
+/* process N(R) and the selective acknowledgements of an I or S frame */
+static int llc_rx_ack(struct gprs_llc_lle *lle,
+		      struct gprs_llc_hdr_parsed *gph)
+{
+	struct gprs_llc_abm *abm = lle->abm;
+	uint16_t nr = gph->seq_rx;
+	unsigned int n, outstanding, last = 0;
+	uint32_t stamp, newest = 0;
+
+	if (llc_seq_diff(nr, lle->v_ack) >
+	    llc_seq_diff(lle->v_sent, lle->v_ack)) {
+		LOGP(DLLC, LOGL_NOTICE, "TLLI=%08x SAPI=%u: N(R)=%u not in "
+		     "V(A)=%u..V(S)=%u\n", lle->llme->tlli, lle->sapi, nr,
+		     lle->v_ack, lle->v_sent);
+		return -EIO;
+	}
+
+	/* everything before N(R) */
+	for (; lle->v_ack != nr; lle->v_ack = (lle->v_ack + 1) % 512) {
+		stamp = llc_tx_frame_acked(abm, lle->v_ack);
+		if (stamp > newest)
+			newest = stamp;
+	}
+
+	outstanding = llc_seq_diff(lle->v_sent, lle->v_ack);
+	switch (gph->cmd) {
+	case GPRS_LLC_RNR:
+		abm->peer_busy = 1;
+		break;
+	case GPRS_LLC_ACK:
+	case GPRS_LLC_SACK:
+		/* ACK acknowledges N(R)+1, SACK what its bitmap says */
+		for (n = 1; n < outstanding; n++) {
+			if (gph->cmd == GPRS_LLC_ACK ? n != 1 :
+			    !llc_sack_bit(gph, n))
+				continue;
+			stamp = llc_tx_frame_acked(abm, (nr + n) % 512);
+			if (stamp > newest)
+				newest = stamp;
+		}
+		/* fall through */
+	default:
+		abm->peer_busy = 0;
+		break;
+	}
+
+	/* frames sent before one that got through are lost, send them
+	 * again and ask for an acknowledgement with the last one */
+	for (n = 0; n < outstanding; n++) {
+		uint16_t i = (nr + n) % GPRS_LLC_ABM_MAX_K;
+
+		if (abm->tx_frames[i] && abm->tx_stamp[i] < newest)
+			last = n + 1;
+	}
+	for (n = 0; n < last; n++) {
+		uint16_t i = (nr + n) % GPRS_LLC_ABM_MAX_K;
+
+		if (!abm->tx_frames[i] || abm->tx_stamp[i] >= newest)
+			continue;
+		llc_tx_i_frame(lle, (nr + n) % 512, n + 1 == last, NULL);
+		abm->stats.retransmissions++;
+	}
+
+	if (newest)
+		lle->retrans_ctr = 0;
+	if (lle->v_ack == lle->v_sent)
+		osmo_timer_del(&lle->t201);
+	else if (newest)
+		osmo_timer_schedule(&lle->t201, lle->params.t200_201, 0);
+
+	return 0;
+}
+
+/* LL-UNITDATA.ind / LL-DATA.ind to the layer 3 of the SAPI */
+static int llc_data_ind(struct gprs_llc_lle *lle, struct msgb *msg,
+			uint8_t *data, uint16_t len, int acked)
+{
+	int rc;
+
+	msgb_gmmh(msg) = data;
+	switch (lle->sapi) {
+	case GPRS_SAPI_GMM:
+		/* send LL_UNITDATA_IND to GMM */
+		rc = gsm0408_gprs_rcvmsg(msg, lle->llme);
+		break;
+	case GPRS_SAPI_SNDCP3:
+	case GPRS_SAPI_SNDCP5:
+	case GPRS_SAPI_SNDCP9:
+	case GPRS_SAPI_SNDCP11:
+		/* send LL_DATA_IND/LL_UNITDATA_IND to SNDCP */
+		if (acked)
+			rc = sndcp_lldata_ind(msg, lle, data, len);
+		else
+			rc = sndcp_llunitdata_ind(msg, lle, data, len);
+		break;
+	case GPRS_SAPI_SMS:
+		/* FIXME */
+	case GPRS_SAPI_TOM2:
+	case GPRS_SAPI_TOM8:
+		/* FIXME: send LL_DATA_IND/LL_UNITDATA_IND to TOM */
+	default:
+		LOGP(DLLC, LOGL_NOTICE, "Unsupported SAPI %u\n", lle->sapi);
+		rc = -EINVAL;
+		break;
+	}
+
+	return rc;
+}
+
+static void llc_v_recv_inc(struct gprs_llc_lle *lle)
+{
+	lle->v_recv = (lle->v_recv + 1) % 512;
+	if (!lle->v_recv)
+		lle->oc_i_recv += 512;
+}
+
+/* pass received I frames up in sequence, 8.6.2 */
+static void llc_rx_i(struct gprs_llc_lle *lle, struct gprs_llc_hdr_parsed *gph,
+		     struct msgb *msg)
+{
+	struct gprs_llc_abm *abm = lle->abm;
+	uint16_t ns = gph->seq_tx;
+	uint16_t d = llc_seq_diff(ns, lle->v_recv);
+	struct msgb **slot = &abm->rx_frames[ns % GPRS_LLC_ABM_MAX_K];
+	struct msgb *held;
+
+	if (d >= llc_window(lle->params.kU) || (d && *slot)) {
+		/* we have it already, our acknowledgement was lost */
+		abm->stats.rx_duplicates++;
+		llc_tx_s_frame(lle, 0);
+		return;
+	}
+	abm->stats.rx_frames++;
+
+	if (d) {
+		/* hold it until the frames before it have arrived */
+		held = msgb_alloc(gph->data_len + 1, "LLC_I_rx");
+		if (!held)
+			return;
+		memcpy(msgb_put(held, gph->data_len), gph->data,
+		       gph->data_len);
+		msgb_tlli(held) = msgb_tlli(msg);
+		msgb_bvci(held) = msgb_bvci(msg);
+		msgb_nsei(held) = msgb_nsei(msg);
+		*slot = held;
+	} else {
+		llc_data_ind(lle, msg, gph->data, gph->data_len, 1);
+		llc_v_recv_inc(lle);
+
+		slot = &abm->rx_frames[lle->v_recv % GPRS_LLC_ABM_MAX_K];
+		while ((held = *slot)) {
+			*slot = NULL;
+			llc_data_ind(lle, held, held->data, held->len, 1);
+			msgb_free(held);
+			llc_v_recv_inc(lle);
+			slot = &abm->rx_frames[lle->v_recv %
+					       GPRS_LLC_ABM_MAX_K];
+		}
+	}
+
+	if (gph->ack_req)
+		llc_tx_s_frame(lle, 0);
+}
+
+static void llc_rx_i_s(struct gprs_llc_lle *lle,
+		       struct gprs_llc_hdr_parsed *gph, struct msgb *msg)
+{
+	if (lle->state != GPRS_LLES_ABM) {
+		/* 8.6.? the peer believes we are in ABM, tell it we are not */
+		if (gph->is_cmd && lle->state != GPRS_LLES_LOCAL_REL)
+			llc_tx_u_lle(lle, NULL, 0, GPRS_LLC_U_DM_RESP, 1);
+		return;
+	}
+
+	if (llc_rx_ack(lle, gph) < 0)
+		return;
+
+	if (gph->is_i)
+		llc_rx_i(lle, gph, msg);
+	else if (gph->ack_req)
+		llc_tx_s_frame(lle, 0);
+
+	/* the window may have opened */
+	llc_tx_pending(lle, NULL);
+}
+
+/* 8.5.1.2: establishment requested by the MS */
+static void llc_rx_sabm(struct gprs_llc_lle *lle,
+			struct gprs_llc_hdr_parsed *gph)
+{
+	struct msgb *resp;
+
+	if (!llc_sapi_has_abm(lle->sapi) ||
+	    lle->state == GPRS_LLES_UNASSIGNED) {
+		llc_tx_u_lle(lle, NULL, 0, GPRS_LLC_U_DM_RESP, 1);
+		return;
+	}
+
+	resp = msgb_alloc_headroom(4096, 1024, "LLC_UA");
+	if (!resp)
+		return;
+
+	/* the XID parameters in the SABM are answered in the UA */
+	if (gph->data)
+		llc_xid_negotiate(lle, gph->data, gph->data + gph->data_len,
+				  resp);
+	llc_xid_put_iov_i(lle, resp);
+
+	osmo_timer_del(&lle->t200);
+	if (llc_abm_start(lle) < 0) {
+		msgb_free(resp);
+		return;
+	}
+	lle->state = GPRS_LLES_ABM;
+	llc_tx_u_lle(lle, resp, 0, GPRS_LLC_U_UA_RESP, 1);
+	llc_prim_ind(lle, LL_ESTABLISH_IND);
+
+	llc_tx_pending(lle, NULL);
+}
+
+/* 8.5.1.3: Expiry of T200 */
+static void t200_expired(void *data)
+{
+	struct gprs_llc_lle *lle = data;
+
+	if (lle->retrans_ctr >= lle->params.n200) {
+		int est = lle->state == GPRS_LLES_LOCAL_EST;
+
+		LOGP(DLLC, LOGL_NOTICE, "TLLI=%08x SAPI=%u: no response to "
+		     "%s, returning to ADM\n", lle->llme->tlli, lle->sapi,
+		     est ? "SABM" : "DISC");
+		/* FIXME: LLGM-STATUS-IND */
+		llc_abm_stop(lle);
+		llc_prim_ind(lle, est ? LL_RELEASE_IND : LL_RELEASE_CONF);
+		return;
+	}
+
+	switch (lle->state) {
+	case GPRS_LLES_LOCAL_EST:
+		llc_tx_sabm(lle);
+		break;
+	case GPRS_LLES_LOCAL_REL:
+		llc_tx_u_lle(lle, NULL, 1, GPRS_LLC_U_DISC_CMD, 1);
+		break;
+	default:
+		return;
+	}
+	lle->retrans_ctr++;
+	osmo_timer_schedule(&lle->t200, lle->params.t200_201, 0);
+}
+
+/* 8.6.4.1: Expiry of T201, waiting for acknowledgement */
+static void t201_expired(void *data)
+{
+	struct gprs_llc_lle *lle = data;
+	struct gprs_llc_abm *abm = lle->abm;
+
+	if (!abm || lle->state != GPRS_LLES_ABM || lle->v_ack == lle->v_sent)
+		return;
+
+	if (lle->retrans_ctr >= lle->params.n200) {
+		LOGP(DLLC, LOGL_NOTICE, "TLLI=%08x SAPI=%u: I frames not "
+		     "acknowledged, returning to ADM\n", lle->llme->tlli,
+		     lle->sapi);
+		llc_abm_stop(lle);
+		llc_prim_ind(lle, LL_RELEASE_IND);
+		return;
+	}
+
+	/* send the oldest unacknowledged I frame again and ask for an
+	 * acknowledgement */
+	if (abm->tx_frames[lle->v_ack % GPRS_LLC_ABM_MAX_K]) {
+		llc_tx_i_frame(lle, lle->v_ack, 1, NULL);
+		abm->stats.retransmissions++;
+	} else
+		llc_tx_s_frame(lle, 1);
+	lle->retrans_ctr++;
+	osmo_timer_schedule(&lle->t201, lle->params.t200_201, 0);
+}
+
+/* the SABM carries the IOV-I, a retransmission selects a new one */
+static int llc_tx_sabm(struct gprs_llc_lle *lle)
+{
+	struct msgb *msg;
+
+	msg = msgb_alloc_headroom(256, 128, "LLC_SABM");
+	if (!msg)
+		return -ENOMEM;
+	llc_xid_put_iov_i(lle, msg);
+
+	return llc_tx_u_lle(lle, msg, 1, GPRS_LLC_U_SABM_CMD, 1);
+}
+
+int gprs_llc_establish(struct gprs_llc_lle *lle)
+{
+	int rc;
+
+	if (!llc_sapi_has_abm(lle->sapi) ||
+	    lle->state == GPRS_LLES_UNASSIGNED)
+		return -EINVAL;
+
+	rc = llc_abm_start(lle);
+	if (rc < 0)
+		return rc;
+
+	lle->state = GPRS_LLES_LOCAL_EST;
+	osmo_timer_schedule(&lle->t200, lle->params.t200_201, 0);
+
+	return llc_tx_sabm(lle);
+}
+
+int gprs_llc_release(struct gprs_llc_lle *lle)
+{
+	if (lle->state != GPRS_LLES_ABM && lle->state != GPRS_LLES_LOCAL_EST)
+		return -EINVAL;
+
+	/* 8.5.2: frames not acknowledged yet are discarded */
+	llc_abm_free(lle);
+	lle->retrans_ctr = 0;
+	lle->state = GPRS_LLES_LOCAL_REL;
+	osmo_timer_schedule(&lle->t200, lle->params.t200_201, 0);
+
+	return llc_tx_u_lle(lle, NULL, 1, GPRS_LLC_U_DISC_CMD, 1);
+}
+
+int gprs_llc_tx_i(struct gprs_llc_lle *lle, struct msgb *msg, void *mmctx)
+{
+	if (!lle->abm || (lle->state != GPRS_LLES_ABM &&
+			  lle->state != GPRS_LLES_LOCAL_EST)) {
+		LOGP(DLLC, LOGL_ERROR, "TLLI=%08x SAPI=%u: LL-DATA.req "
+		     "without ABM\n", lle->llme->tlli, lle->sapi);
+		msgb_free(msg);
+		return -ENOTCONN;
+	}
+	if (msg->len > lle->params.n201_i) {
+		LOGP(DLLC, LOGL_ERROR, "Cannot Tx %u bytes (N201-I=%u)\n",
+			msg->len, lle->params.n201_i);
+		msgb_free(msg);
+		return -EFBIG;
+	}
+
+	msgb_enqueue(&lle->abm->tx_queue, msg);
+	lle->abm->tx_queue_len++;
+
+	/* queued frames are sent once the link is established */
+	if (lle->state == GPRS_LLES_ABM)
+		llc_tx_pending(lle, mmctx);
+
+	return 0;
+}
+
 static void gprs_llc_hdr_dump(struct gprs_llc_hdr_parsed *gph)
 {
 	DEBUGP(DLLC, "LLC SAPI=%u %c %c FCS=0x%06x",
@@ -509,38 +1316,58 @@ static void gprs_llc_hdr_dump(struct gprs_llc_hdr_parsed *gph)
 
 	DEBUGPC(DLLC, "\n");
 }
+
 static int gprs_llc_hdr_rx(struct gprs_llc_hdr_parsed *gph,
-			   struct gprs_llc_lle *lle)
+			   struct gprs_llc_lle *lle, struct msgb *msg)
 {
 	switch (gph->cmd) {
 	case GPRS_LLC_SABM: /* Section 6.4.1.1 */
-		lle->v_sent = lle->v_ack = lle->v_recv = 0;
-		if (lle->state == GPRS_LLES_ASSIGNED_ADM) {
-			/* start re-establishment (8.7.1) */
-		}
-		lle->state = GPRS_LLES_REMOTE_EST;
-		/* FIXME: Send UA */
-		lle->state = GPRS_LLES_ABM;
-		/* FIXME: process data */
+		llc_rx_sabm(lle, gph);
 		break;
 	case GPRS_LLC_DISC: /* Section 6.4.1.2 */
-		/* FIXME: Send UA */
+		if (lle->state == GPRS_LLES_UNASSIGNED ||
+		    lle->state == GPRS_LLES_ASSIGNED_ADM) {
+			llc_tx_u_lle(lle, NULL, 0, GPRS_LLC_U_DM_RESP, 1);
+			break;
+		}
 		/* terminate ABM */
-		lle->state = GPRS_LLES_ASSIGNED_ADM;
+		llc_abm_stop(lle);
+		llc_tx_u_lle(lle, NULL, 0, GPRS_LLC_U_UA_RESP, 1);
+		llc_prim_ind(lle, LL_RELEASE_IND);
 		break;
 	case GPRS_LLC_UA: /* Section 6.4.1.3 */
-		if (lle->state == GPRS_LLES_LOCAL_EST)
+		if (lle->state == GPRS_LLES_LOCAL_EST) {
+			osmo_timer_del(&lle->t200);
+			lle->retrans_ctr = 0;
 			lle->state = GPRS_LLES_ABM;
+			llc_prim_ind(lle, LL_ESTABLISH_CONF);
+			llc_tx_pending(lle, NULL);
+		} else if (lle->state == GPRS_LLES_LOCAL_REL) {
+			llc_abm_stop(lle);
+			llc_prim_ind(lle, LL_RELEASE_CONF);
+		}
 		break;
 	case GPRS_LLC_DM: /* Section 6.4.1.4: ABM cannot be performed */
-		if (lle->state == GPRS_LLES_LOCAL_EST)
-			lle->state = GPRS_LLES_ASSIGNED_ADM;
+		if (lle->state == GPRS_LLES_LOCAL_REL) {
+			llc_abm_stop(lle);
+			llc_prim_ind(lle, LL_RELEASE_CONF);
+		} else if (lle->state == GPRS_LLES_LOCAL_EST ||
+			   lle->state == GPRS_LLES_ABM) {
+			llc_abm_stop(lle);
+			llc_prim_ind(lle, LL_RELEASE_IND);
+		}
 		break;
 	case GPRS_LLC_FRMR: /* Section 6.4.1.5 */
 		break;
 	case GPRS_LLC_XID: /* Section 6.4.1.6 */
 		rx_llc_xid(lle, gph);
 		break;
+	case GPRS_LLC_RR: /* Section 6.4.2 */
+	case GPRS_LLC_ACK:
+	case GPRS_LLC_RNR:
+	case GPRS_LLC_SACK:
+		llc_rx_i_s(lle, gph, msg);
+		break;
 	case GPRS_LLC_UI:
 		if (gprs_llc_is_retransmit(gph->seq_tx, lle->vu_recv)) {
 			LOGP(DLLC, LOGL_NOTICE,
@@ -606,6 +1433,7 @@ static int gprs_llc_hdr_parse(struct gprs_llc_hdr_parsed *ghp,
 		/* I (Information transfer + Supervisory) format */
 		uint8_t k;
 
+		ghp->is_i = 1;
 		ghp->data = ctrl + 3;
 
 		if (ctrl[0] & 0x40)
@@ -628,11 +1456,16 @@ static int gprs_llc_hdr_parse(struct gprs_llc_hdr_parsed *ghp,
 			ghp->cmd = GPRS_LLC_RNR;
 			break;
 		case 3:
+			/* K+1 octets of bitmap follow */
 			ghp->cmd = GPRS_LLC_SACK;
 			k = ctrl[3] & 0x1f;
-			ghp->data += 1 + k;
+			ghp->sack = ctrl + 4;
+			ghp->sack_len = k + 1;
+			ghp->data += 1 + k + 1;
 			break;
 		}
+		if (ghp->data > llc_hdr + len - 3)
+			return -EIO;
 		ghp->data_len = (llc_hdr + len - 3) - ghp->data;
 	} else if ((ctrl[0] & 0xc0) == 0x80) {
 		/* S (Supervisory) format */
@@ -655,7 +1488,12 @@ static int gprs_llc_hdr_parse(struct gprs_llc_hdr_parsed *ghp,
 			ghp->cmd = GPRS_LLC_RNR;
 			break;
 		case 3:
+			/* the bitmap fills the rest of the frame */
 			ghp->cmd = GPRS_LLC_SACK;
+			ghp->sack = ctrl + 2;
+			if (ghp->sack > llc_hdr + len - 3)
+				return -EIO;
+			ghp->sack_len = (llc_hdr + len - 3) - ghp->sack;
 			break;
 		}
 	} else if ((ctrl[0] & 0xe0) == 0xc0) {
@@ -697,6 +1535,11 @@ static int gprs_llc_hdr_parse(struct gprs_llc_hdr_parsed *ghp,
 			break;
 		case GPRS_LLC_U_SABM_CMD:
 			ghp->cmd = GPRS_LLC_SABM;
+			/* may carry XID parameters */
+			if (len > 2 + CRC24_LENGTH) {
+				ghp->data = ctrl + 1;
+				ghp->data_len = (llc_hdr + len - 3) - ghp->data;
+			}
 			break;
 		case GPRS_LLC_U_FRMR_RESP:
 			ghp->cmd = GPRS_LLC_FRMR;
@@ -711,12 +1554,6 @@ static int gprs_llc_hdr_parse(struct gprs_llc_hdr_parsed *ghp,
 		}
 	}
 
-	/* FIXME: parse sack frame */
-	if (ghp->cmd == GPRS_LLC_SACK) {
-		LOGP(DLLC, LOGL_NOTICE, "Unsupported SACK frame\n");
-		return -EIO;
-	}
-
 	return 0;
 }
 
@@ -772,14 +1609,16 @@ int gprs_llc_rcvmsg(struct msgb *msg, struct tlv_parsed *tv)
 		}
 	}
 
-	/* decrypt information field + FCS, if needed! */
-	if (llhp.is_encrypted) {
+	/* decrypt information field + FCS, if needed!  I frames have no
+	 * E bit, they are ciphered once the LLME has a key. */
+	if (llhp.is_encrypted ||
+	    (llhp.is_i && lle->llme->algo != GPRS_ALGO_GEA0)) {
 		uint32_t iov_ui = 0; /* FIXME: randomly select for TLLI */
 		uint16_t crypt_len = llhp.data_len + 3;
 		uint8_t cipher_out[GSM0464_CIPH_MAX_BLOCK];
 		uint32_t iv;
 		uint64_t kc = *(uint64_t *)&lle->llme->kc;
-		int rc, i;
+		int rc;
 
 		if (lle->llme->algo == GPRS_ALGO_GEA0) {
 			LOGP(DLLC, LOGL_NOTICE, "encrypted frame for LLC that "
@@ -787,8 +1626,12 @@ int gprs_llc_rcvmsg(struct msgb *msg, struct tlv_parsed *tv)
 			return 0;
 		}
 
-		iv = gprs_cipher_gen_input_ui(iov_ui, lle->sapi, llhp.seq_tx,
-						lle->oc_ui_recv);
+		if (llhp.is_i)
+			iv = gprs_cipher_gen_input_i(lle->iov_i, llhp.seq_tx,
+					llc_rx_oc_i(lle, llhp.seq_tx));
+		else
+			iv = gprs_cipher_gen_input_ui(iov_ui, lle->sapi,
+					llhp.seq_tx, lle->oc_ui_recv);
 		rc = gprs_cipher_run(cipher_out, crypt_len, lle->llme->algo,
 				     kc, iv, GPRS_CIPH_MS2SGSN);
 		if (rc < 0) {
@@ -798,9 +1641,8 @@ int gprs_llc_rcvmsg(struct msgb *msg, struct tlv_parsed *tv)
 		}
 
 		/* XOR the cipher output with the information field + FCS */
-		for (i = 0; i < crypt_len; i++)
-			*(llhp.data + i) ^= cipher_out[i];
-	} else {
+		llc_xor_keystream(llhp.data, cipher_out, crypt_len);
+	} else if (llhp.cmd == GPRS_LLC_UI) {
 		if (lle->llme->algo != GPRS_ALGO_GEA0) {
 			LOGP(DLLC, LOGL_NOTICE, "unencrypted frame for LLC "
 				"that is supposed to be encrypted. Dropping.\n");
@@ -820,36 +1662,13 @@ int gprs_llc_rcvmsg(struct msgb *msg, struct tlv_parsed *tv)
 	lle->llme->nsei = msgb_nsei(msg);
 
 	/* Receive and Process the actual LLC frame */
-	rc = gprs_llc_hdr_rx(&llhp, lle);
+	rc = gprs_llc_hdr_rx(&llhp, lle, msg);
 	if (rc < 0)
 		return rc;
 
-	/* llhp.data is only set when we need to send LL_[UNIT]DATA_IND up */
-	if (llhp.data) {
-		msgb_gmmh(msg) = llhp.data;
-		switch (llhp.sapi) {
-		case GPRS_SAPI_GMM:
-			/* send LL_UNITDATA_IND to GMM */
-			rc = gsm0408_gprs_rcvmsg(msg, lle->llme);
-			break;
-		case GPRS_SAPI_SNDCP3:
-		case GPRS_SAPI_SNDCP5:
-		case GPRS_SAPI_SNDCP9:
-		case GPRS_SAPI_SNDCP11:
-			/* send LL_DATA_IND/LL_UNITDATA_IND to SNDCP */
-			rc = sndcp_llunitdata_ind(msg, lle, llhp.data, llhp.data_len);
-			break;
-		case GPRS_SAPI_SMS:
-			/* FIXME */
-		case GPRS_SAPI_TOM2:
-		case GPRS_SAPI_TOM8:
-			/* FIXME: send LL_DATA_IND/LL_UNITDATA_IND to TOM */
-		default:
-			LOGP(DLLC, LOGL_NOTICE, "Unsupported SAPI %u\n", llhp.sapi);
-			rc = -EINVAL;
-			break;
-		}
-	}
+	/* I frames have been passed up in sequence by now */
+	if (llhp.data && llhp.cmd == GPRS_LLC_UI)
+		rc = llc_data_ind(lle, msg, llhp.data, llhp.data_len, 0);
 
 	return rc;
 }
@@ -873,18 +1692,17 @@ int gprs_llgmm_assign(struct gprs_llc_llme *llme,
 		 * old is unassigned.  Only TLLI new shall be accepted when
 		 * received from peer. */
 		if (llme->old_tlli != 0xffffffff) {
-			llme->old_tlli = 0xffffffff;
-			llme->tlli = new_tlli;
+			llme_set_tlli(llme, new_tlli, 0xffffffff);
 		} else {
 			/* If TLLI old == 0xffffffff was assigned to LLME, then this is
 			 * TLLI assignmemt according to 8.3.1 */
-			llme->old_tlli = 0xffffffff;
-			llme->tlli = new_tlli;
+			llme_set_tlli(llme, new_tlli, 0xffffffff);
 			llme->state = GPRS_LLMS_ASSIGNED;
 			/* 8.5.3.1 For all LLE's */
 			for (i = 0; i < ARRAY_SIZE(llme->lle); i++) {
 				struct gprs_llc_lle *l = &llme->lle[i];
 				l->vu_send = l->vu_recv = 0;
+				llc_abm_stop(l);
 				l->retrans_ctr = 0;
 				l->state = GPRS_LLES_ASSIGNED_ADM;
 				/* FIXME Set parameters according to table 9 */
@@ -894,8 +1712,7 @@ int gprs_llgmm_assign(struct gprs_llc_llme *llme,
 		/* TLLI Change 8.3.2 */
 		/* Both TLLI Old and TLLI New are assigned; use New when
 		 * (re)transmitting.  Accept toth Old and New on Rx */
-		llme->old_tlli = llme->tlli;
-		llme->tlli = new_tlli;
+		llme_set_tlli(llme, new_tlli, llme->tlli);
 		llme->state = GPRS_LLMS_ASSIGNED;
 	} else if (old_tlli != 0xffffffff && new_tlli == 0xffffffff) {
 		/* TLLI Unassignment 8.3.3) */
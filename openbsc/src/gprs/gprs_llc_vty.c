@@ -62,6 +62,14 @@ static void vty_dump_lle(struct vty *vty, struct gprs_llc_lle *lle)
 		"mU=%u, kD=%u, kU=%u%s", par->t200_201, par->n200,
 		par->n201_u, par->n201_i, par->mD, par->mU, par->kD,
 		par->kU, VTY_NEWLINE);
+	if (lle->abm)
+		vty_out(vty, "  I frames: %lu sent, %lu retransmitted, %lu "
+			"received, %lu duplicates, %u queued%s",
+			lle->abm->stats.tx_frames,
+			lle->abm->stats.retransmissions,
+			lle->abm->stats.rx_frames,
+			lle->abm->stats.rx_duplicates,
+			lle->abm->tx_queue_len, VTY_NEWLINE);
 }
 
 static uint8_t valid_sapis[] = { 1, 2, 3, 5, 7, 8, 9, 11 };
@@ -20,22 +20,28 @@
  */
 
 #include <stdint.h>
+#include <string.h>
+#include <errno.h>
 
 #include <osmocom/core/linuxlist.h>
 #include <osmocom/core/talloc.h>
 #include <osmocom/core/timer.h>
 #include <osmocom/core/rate_ctr.h>
+#include <osmocom/core/statistics.h>
 #include <osmocom/core/backtrace.h>
 #include <osmocom/gprs/gprs_ns.h>
 #include <osmocom/gprs/gprs_bssgp.h>
 
 #include <openbsc/gsm_subscriber.h>
 #include <openbsc/debug.h>
+#include <openbsc/gprs_llc.h>
 #include <openbsc/gprs_sgsn.h>
 #include <openbsc/sgsn.h>
 #include <openbsc/gsm_04_08_gprs.h>
 #include <openbsc/gprs_gmm.h>
 
+#include <pdp.h>
+
 extern struct sgsn_instance *sgsn;
 
 LLIST_HEAD(sgsn_mm_ctxts);
@@ -69,6 +75,9 @@ static const struct rate_ctr_desc pdpctx_ctr_description[] = {
 	{ "udata.packets.out",	"User Data  Messages (Out)" },
 	{ "udata.bytes.in",	"User Data  Bytes    ( In)" },
 	{ "udata.bytes.out",	"User Data  Bytes    (Out)" },
+	{ "dl.queued",		"Downlink Queued N-PDUs   " },
+	{ "dl.dropped",		"Downlink Dropped N-PDUs  " },
+	{ "udata.other.addr",	"G-PDUs From Other Address" },
 };
 
 static const struct rate_ctr_group_desc pdpctx_ctrg_desc = {
@@ -196,26 +205,20 @@ void sgsn_mm_ctx_free(struct sgsn_mm_ctx *mm)
 struct sgsn_pdp_ctx *sgsn_pdp_ctx_by_nsapi(const struct sgsn_mm_ctx *mm,
 					   uint8_t nsapi)
 {
-	struct sgsn_pdp_ctx *pdp;
+	if (nsapi >= ARRAY_SIZE(mm->pdp_by_nsapi))
+		return NULL;
 
-	llist_for_each_entry(pdp, &mm->pdp_list, list) {
-		if (pdp->nsapi == nsapi)
-			return pdp;
-	}
-	return NULL;
+	return mm->pdp_by_nsapi[nsapi];
 }
 
 /* look up PDP context by MM context and transaction ID */
 struct sgsn_pdp_ctx *sgsn_pdp_ctx_by_tid(const struct sgsn_mm_ctx *mm,
 					 uint8_t tid)
 {
-	struct sgsn_pdp_ctx *pdp;
+	if (tid >= ARRAY_SIZE(mm->pdp_by_ti))
+		return NULL;
 
-	llist_for_each_entry(pdp, &mm->pdp_list, list) {
-		if (pdp->ti == tid)
-			return pdp;
-	}
-	return NULL;
+	return mm->pdp_by_ti[tid];
 }
 
 /* you don't want to use this directly, call sgsn_create_pdp_ctx() */
@@ -224,6 +227,9 @@ struct sgsn_pdp_ctx *sgsn_pdp_ctx_alloc(struct sgsn_mm_ctx *mm,
 {
 	struct sgsn_pdp_ctx *pdp;
 
+	if (nsapi >= ARRAY_SIZE(mm->pdp_by_nsapi))
+		return NULL;
+
 	pdp = sgsn_pdp_ctx_by_nsapi(mm, nsapi);
 	if (pdp)
 		return NULL;
@@ -235,19 +241,53 @@ struct sgsn_pdp_ctx *sgsn_pdp_ctx_alloc(struct sgsn_mm_ctx *mm,
 	pdp->mm = mm;
 	pdp->nsapi = nsapi;
 	pdp->ctrg = rate_ctr_group_alloc(pdp, &pdpctx_ctrg_desc, nsapi);
+	INIT_LLIST_HEAD(&pdp->dl_queue);
+	if (!sgsn_dl_queue_depth)
+		sgsn_dl_queue_depth = osmo_counter_alloc("sgsn.dl_queue.depth");
+	INIT_LLIST_HEAD(&pdp->ggsn_list);
 	llist_add(&pdp->list, &mm->pdp_list);
 	llist_add(&pdp->g_list, &sgsn_pdp_ctxts);
+	mm->pdp_by_nsapi[nsapi] = pdp;
 
 	return pdp;
 }
 
-#include <pdp.h>
+void sgsn_pdp_ctx_set_ti(struct sgsn_pdp_ctx *pdp, uint8_t ti)
+{
+	struct sgsn_mm_ctx *mm = pdp->mm;
+
+	if (pdp->ti < ARRAY_SIZE(mm->pdp_by_ti) &&
+	    mm->pdp_by_ti[pdp->ti] == pdp)
+		mm->pdp_by_ti[pdp->ti] = NULL;
+
+	pdp->ti = ti;
+	if (ti < ARRAY_SIZE(mm->pdp_by_ti))
+		mm->pdp_by_ti[ti] = pdp;
+}
+
+void sgsn_pdp_ctx_set_ggsn(struct sgsn_pdp_ctx *pdp,
+			   struct sgsn_ggsn_ctx *ggsn)
+{
+	llist_del_init(&pdp->ggsn_list);
+
+	pdp->ggsn = ggsn;
+	if (ggsn)
+		llist_add(&pdp->ggsn_list, &ggsn->pdp_list);
+}
+
 /* you probably want to call sgsn_delete_pdp_ctx() instead */
 void sgsn_pdp_ctx_free(struct sgsn_pdp_ctx *pdp)
 {
+	sgsn_pdp_dl_purge(pdp);
 	rate_ctr_group_free(pdp->ctrg);
 	llist_del(&pdp->list);
 	llist_del(&pdp->g_list);
+	llist_del(&pdp->ggsn_list);
+	if (pdp->mm->pdp_by_nsapi[pdp->nsapi] == pdp)
+		pdp->mm->pdp_by_nsapi[pdp->nsapi] = NULL;
+	if (pdp->ti < ARRAY_SIZE(pdp->mm->pdp_by_ti) &&
+	    pdp->mm->pdp_by_ti[pdp->ti] == pdp)
+		pdp->mm->pdp_by_ti[pdp->ti] = NULL;
 
 	/* _if_ we still have a library handle, at least set it to NULL
 	 * to avoid any dereferences of the now-deleted PDP context from
@@ -266,6 +306,25 @@ void sgsn_pdp_ctx_free(struct sgsn_pdp_ctx *pdp)
 
 /* GGSN contexts */
 
+/* GGSN contexts hashed by their number and by their address */
+#define GGSN_HASH_BITS	4
+static struct llist_head ggsn_id_hash[1 << GGSN_HASH_BITS];
+static struct llist_head ggsn_addr_hash[1 << GGSN_HASH_BITS];
+
+static struct llist_head *ggsn_hash_bucket(struct llist_head *hash,
+					   uint32_t key)
+{
+	struct llist_head *bucket;
+
+	key ^= key >> 16;
+	key ^= key >> 8;
+	bucket = &hash[key & ((1 << GGSN_HASH_BITS) - 1)];
+	if (!bucket->next)
+		INIT_LLIST_HEAD(bucket);
+
+	return bucket;
+}
+
 struct sgsn_ggsn_ctx *sgsn_ggsn_ctx_alloc(uint32_t id)
 {
 	struct sgsn_ggsn_ctx *ggc;
@@ -279,7 +338,11 @@ struct sgsn_ggsn_ctx *sgsn_ggsn_ctx_alloc(uint32_t id)
 	ggc->remote_restart_ctr = -1;
 	/* if we are called from config file parse, this gsn doesn't exist yet */
 	ggc->gsn = sgsn->gsn;
+	INIT_LLIST_HEAD(&ggc->pdp_list);
 	llist_add(&ggc->list, &sgsn_ggsn_ctxts);
+	llist_add(&ggc->id_hash, ggsn_hash_bucket(ggsn_id_hash, id));
+	llist_add(&ggc->addr_hash, ggsn_hash_bucket(ggsn_addr_hash,
+						    ggc->remote_addr.s_addr));
 
 	return ggc;
 }
@@ -288,7 +351,8 @@ struct sgsn_ggsn_ctx *sgsn_ggsn_ctx_by_id(uint32_t id)
 {
 	struct sgsn_ggsn_ctx *ggc;
 
-	llist_for_each_entry(ggc, &sgsn_ggsn_ctxts, list) {
+	llist_for_each_entry(ggc, ggsn_hash_bucket(ggsn_id_hash, id),
+			     id_hash) {
 		if (id == ggc->id)
 			return ggc;
 	}
@@ -299,13 +363,23 @@ struct sgsn_ggsn_ctx *sgsn_ggsn_ctx_by_addr(struct in_addr *addr)
 {
 	struct sgsn_ggsn_ctx *ggc;
 
-	llist_for_each_entry(ggc, &sgsn_ggsn_ctxts, list) {
+	llist_for_each_entry(ggc, ggsn_hash_bucket(ggsn_addr_hash,
+						   addr->s_addr), addr_hash) {
 		if (!memcmp(addr, &ggc->remote_addr, sizeof(*addr)))
 			return ggc;
 	}
 	return NULL;
 }
 
+void sgsn_ggsn_ctx_set_addr(struct sgsn_ggsn_ctx *ggc,
+			    const struct in_addr *addr)
+{
+	llist_del(&ggc->addr_hash);
+	ggc->remote_addr = *addr;
+	llist_add(&ggc->addr_hash, ggsn_hash_bucket(ggsn_addr_hash,
+						    addr->s_addr));
+}
+
 
 struct sgsn_ggsn_ctx *sgsn_ggsn_ctx_find_alloc(uint32_t id)
 {
@@ -319,15 +393,35 @@ struct sgsn_ggsn_ctx *sgsn_ggsn_ctx_find_alloc(uint32_t id)
 
 /* APN contexts */
 
-#if 0
+/* APN contexts hashed by their name */
+#define APN_HASH_BITS	6
+static struct llist_head apn_hash[1 << APN_HASH_BITS];
+
+static struct llist_head *apn_hash_bucket(const char *name)
+{
+	struct llist_head *bucket;
+	uint32_t h = 0;
+
+	while (*name)
+		h = h * 31 + (uint8_t) *name++;
+	bucket = &apn_hash[(h ^ (h >> APN_HASH_BITS)) &
+			   (ARRAY_SIZE(apn_hash) - 1)];
+	if (!bucket->next)
+		INIT_LLIST_HEAD(bucket);
+
+	return bucket;
+}
+
 struct apn_ctx *apn_ctx_alloc(const char *ap_name)
 {
 	struct apn_ctx *actx;
 
-	actx = talloc_zero(talloc_bsc_ctx, struct apn_ctx);
+	actx = talloc_zero(tall_bsc_ctx, struct apn_ctx);
 	if (!actx)
 		return NULL;
 	actx->name = talloc_strdup(actx, ap_name);
+	llist_add(&actx->list, &sgsn_apn_ctxts);
+	llist_add(&actx->hash, apn_hash_bucket(actx->name));
 
 	return actx;
 }
@@ -336,7 +430,7 @@ struct apn_ctx *apn_ctx_by_name(const char *name)
 {
 	struct apn_ctx *actx;
 
-	llist_for_each_entry(actx, &sgsn_apn_ctxts, list) {
+	llist_for_each_entry(actx, apn_hash_bucket(name), hash) {
 		if (!strcmp(name, actx->name))
 			return actx;
 	}
@@ -353,7 +447,30 @@ struct apn_ctx *apn_ctx_find_alloc(const char *name)
 
 	return actx;
 }
-#endif
+
+/* look up an APN as encoded in the Access Point Name IE, where each label
+ * is preceded by its length instead of a dot */
+struct apn_ctx *apn_ctx_by_ie(const uint8_t *apn, unsigned int len)
+{
+	char name[GSM48_MAX_APN_LEN+1];
+	unsigned int i = 0;
+
+	if (len == 0 || len > GSM48_MAX_APN_LEN)
+		return NULL;
+
+	memcpy(name, apn, len);
+	name[len] = '\0';
+
+	while (i < len) {
+		unsigned int step = apn[i];
+		if (step == 0 || i + step >= len)
+			return NULL;
+		name[i] = '.';
+		i += step+1;
+	}
+
+	return apn_ctx_by_name(name+1);
+}
 
 uint32_t sgsn_alloc_ptmsi(void)
 {
@@ -387,18 +504,178 @@ static void drop_one_pdp(struct sgsn_pdp_ctx *pdp)
  * ottherwise lost state (recovery procedure) */
 int drop_all_pdp_for_ggsn(struct sgsn_ggsn_ctx *ggsn)
 {
-	struct sgsn_mm_ctx *mm;
+	struct sgsn_pdp_ctx *pdp, *pdp2;
 	int num = 0;
 
-	llist_for_each_entry(mm, &sgsn_mm_ctxts, list) {
-		struct sgsn_pdp_ctx *pdp;
-		llist_for_each_entry(pdp, &mm->pdp_list, list) {
-			if (pdp->ggsn == ggsn) {
-				drop_one_pdp(pdp);
-				num++;
-			}
-		}
+	/* drop_one_pdp() may free the PDP context */
+	llist_for_each_entry_safe(pdp, pdp2, &ggsn->pdp_list, ggsn_list) {
+		drop_one_pdp(pdp);
+		num++;
 	}
 
 	return num;
 }
+
+/* Downlink N-PDUs are held while the MS is suspended and paged, up to
+ * this much memory per PDP context and for at most this long */
+#define SGSN_DL_QUEUE_MAX_BYTES		(64 * 1024)
+#define SGSN_DL_QUEUE_MAX_SECS		10
+
+/* total number of N-PDUs queued in all PDP contexts */
+struct osmo_counter *sgsn_dl_queue_depth;
+
+/* the queue limit is on memory, a small N-PDU still holds a whole
+ * buffer from the GTP socket */
+static unsigned int dl_msg_truesize(const struct msgb *msg)
+{
+	return sizeof(*msg) + msg->data_len;
+}
+
+static int sgsn_pdp_dl_tx(struct sgsn_pdp_ctx *pdp, struct msgb *msg)
+{
+	struct sgsn_mm_ctx *mm = pdp->mm;
+	unsigned int len = msg->len;
+
+	/* the MS may have moved to another cell while it was suspended */
+	msgb_tlli(msg) = mm->tlli;
+	msgb_bvci(msg) = mm->bvci;
+	msgb_nsei(msg) = mm->nsei;
+
+	rate_ctr_inc(&pdp->ctrg->ctr[PDP_CTR_PKTS_UDATA_OUT]);
+	rate_ctr_add(&pdp->ctrg->ctr[PDP_CTR_BYTES_UDATA_OUT], len);
+	rate_ctr_inc(&mm->ctrg->ctr[GMM_CTR_PKTS_UDATA_OUT]);
+	rate_ctr_add(&mm->ctrg->ctr[GMM_CTR_BYTES_UDATA_OUT], len);
+
+	return sndcp_unitdata_req(msg, &mm->llme->lle[pdp->sapi],
+				  pdp->nsapi, mm);
+}
+
+static void sgsn_pdp_dl_flush(struct sgsn_pdp_ctx *pdp)
+{
+	struct msgb *msg;
+
+	osmo_timer_del(&pdp->dl_timer);
+
+	while ((msg = msgb_dequeue(&pdp->dl_queue))) {
+		pdp->dl_queue_len--;
+		pdp->dl_queue_bytes -= dl_msg_truesize(msg);
+		osmo_counter_dec(sgsn_dl_queue_depth);
+		sgsn_pdp_dl_tx(pdp, msg);
+	}
+}
+
+void sgsn_mm_dl_flush(struct sgsn_mm_ctx *mm)
+{
+	struct sgsn_pdp_ctx *pdp;
+
+	llist_for_each_entry(pdp, &mm->pdp_list, list) {
+		if (llist_empty(&pdp->dl_queue))
+			continue;
+		LOGP(DGPRS, LOGL_INFO, "TLLI=%08x NSAPI=%u: Sending %u "
+		     "queued N-PDUs (%u bytes)\n", mm->tlli, pdp->nsapi,
+		     pdp->dl_queue_len, pdp->dl_queue_bytes);
+		sgsn_pdp_dl_flush(pdp);
+	}
+}
+
+void sgsn_pdp_dl_purge(struct sgsn_pdp_ctx *pdp)
+{
+	struct msgb *msg;
+
+	osmo_timer_del(&pdp->dl_timer);
+
+	while ((msg = msgb_dequeue(&pdp->dl_queue))) {
+		rate_ctr_inc(&pdp->ctrg->ctr[PDP_CTR_PKTS_DL_DROPPED]);
+		osmo_counter_dec(sgsn_dl_queue_depth);
+		msgb_free(msg);
+	}
+	pdp->dl_queue_len = 0;
+	pdp->dl_queue_bytes = 0;
+}
+
+static void sgsn_pdp_dl_timer_cb(void *data)
+{
+	struct sgsn_pdp_ctx *pdp = data;
+
+	LOGP(DGPRS, LOGL_NOTICE, "TLLI=%08x NSAPI=%u: MS did not respond "
+	     "to paging, dropping %u queued N-PDUs\n", pdp->mm->tlli,
+	     pdp->nsapi, pdp->dl_queue_len);
+	sgsn_pdp_dl_purge(pdp);
+}
+
+/* initiate PS PAGING procedure */
+static int sgsn_tx_paging_ps(struct sgsn_mm_ctx *mm)
+{
+	struct bssgp_paging_info pinfo;
+
+	memset(&pinfo, 0, sizeof(pinfo));
+	pinfo.mode = BSSGP_PAGING_PS;
+	pinfo.scope = BSSGP_PAGING_BVCI;
+	pinfo.bvci = mm->bvci;
+	pinfo.imsi = mm->imsi;
+	pinfo.ptmsi = &mm->p_tmsi;
+	pinfo.drx_params = mm->drx_parms;
+	pinfo.qos[0] = 0; // FIXME
+	rate_ctr_inc(&mm->ctrg->ctr[GMM_CTR_PAGING_PS]);
+	return bssgp_tx_paging(mm->nsei, 0, &pinfo);
+}
+
+/* Hold a downlink N-PDU until the MS responds to paging */
+static int sgsn_pdp_dl_enqueue(struct sgsn_pdp_ctx *pdp, struct msgb *msg)
+{
+	int first = llist_empty(&pdp->dl_queue);
+	unsigned int size = dl_msg_truesize(msg);
+
+	if (pdp->dl_queue_bytes + size > SGSN_DL_QUEUE_MAX_BYTES) {
+		LOGP(DGPRS, LOGL_INFO, "TLLI=%08x NSAPI=%u: Downlink queue "
+		     "full, dropping N-PDU\n", pdp->mm->tlli, pdp->nsapi);
+		rate_ctr_inc(&pdp->ctrg->ctr[PDP_CTR_PKTS_DL_DROPPED]);
+		msgb_free(msg);
+		return -ENOBUFS;
+	}
+
+	msgb_enqueue(&pdp->dl_queue, msg);
+	pdp->dl_queue_len++;
+	pdp->dl_queue_bytes += size;
+	osmo_counter_inc(sgsn_dl_queue_depth);
+	rate_ctr_inc(&pdp->ctrg->ctr[PDP_CTR_PKTS_DL_QUEUED]);
+
+	/* page once per queue, the MS has until the timer expires */
+	if (first) {
+		pdp->dl_timer.cb = sgsn_pdp_dl_timer_cb;
+		pdp->dl_timer.data = pdp;
+		osmo_timer_schedule(&pdp->dl_timer, SGSN_DL_QUEUE_MAX_SECS, 0);
+		sgsn_tx_paging_ps(pdp->mm);
+	}
+
+	return 0;
+}
+
+int sgsn_rx_gtp_data(struct sgsn_pdp_ctx *pdp, struct msgb *msg)
+{
+	struct sgsn_mm_ctx *mm = pdp->mm;
+
+	if (!mm) {
+		LOGP(DGPRS, LOGL_ERROR, "PDP context without MM context!\n");
+		msgb_free(msg);
+		return -EIO;
+	}
+
+	switch (mm->mm_state) {
+	case GMM_REGISTERED_SUSPENDED:
+		return sgsn_pdp_dl_enqueue(pdp, msg);
+	case GMM_REGISTERED_NORMAL:
+		break;
+	default:
+		LOGP(DGPRS, LOGL_ERROR, "GTP DATA IND for TLLI %08X in state "
+			"%u\n", mm->tlli, mm->mm_state);
+		msgb_free(msg);
+		return -1;
+	}
+
+	/* keep the order if the MS was resumed without flushing */
+	if (!llist_empty(&pdp->dl_queue))
+		sgsn_pdp_dl_flush(pdp);
+
+	return sgsn_pdp_dl_tx(pdp, msg);
+}
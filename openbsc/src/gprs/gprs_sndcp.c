@@ -22,6 +22,7 @@
 
 #include <errno.h>
 #include <stdint.h>
+#include <string.h>
 
 #include <osmocom/core/msgb.h>
 #include <osmocom/core/linuxlist.h>
@@ -64,45 +65,84 @@ struct sndcp_udata_hdr {
 
 static void *tall_sndcp_ctx;
 
-/* A fragment queue entry, containing one framgent of a N-PDU */
-struct defrag_queue_entry {
-	struct llist_head list;
-	/* segment number of this fragment */
-	uint32_t seg_nr;
-	/* length of the data area of this fragment */
-	uint32_t data_len;
-	/* pointer to the data of this fragment */
-	uint8_t *data;
-};
-
 LLIST_HEAD(gprs_sndcp_entities);
 
-/* Enqueue a fragment into the defragment queue */
+/* maximum size of a N-PDU, 6.7.1 */
+#define SNDCP_MAX_NPDU		1520
+/* maximum size of a reassembled SN-PDU, leaves room for V.42bis to
+ * expand an incompressible N-PDU */
+#define SNDCP_DEFRAG_MAX	(2 * SNDCP_MAX_NPDU)
+/* how long we wait for the missing segments of a N-PDU */
+#define SNDCP_DEFRAG_TIMEOUT_SECS	5
+
+static void defrag_reset(struct gprs_sndcp_entity *sne)
+{
+	struct defrag_state *defrag = &sne->defrag;
+
+	osmo_timer_del(&defrag->timer);
+	defrag->no_more = defrag->highest_seg = defrag->seg_have = 0;
+	defrag->next_seg = 0;
+	defrag->tot_len = defrag->contig_len = defrag->spill_len = 0;
+}
+
+/* Discard the segments of an incomplete N-PDU */
+static void defrag_drop(struct gprs_sndcp_entity *sne, const char *reason)
+{
+	LOGP(DSNDCP, LOGL_INFO, "TLLI=0x%08x NSAPI=%u: Dropping SN-PDU %u "
+	     "%s (%04x)\n", sne->lle->llme->tlli, sne->nsapi,
+	     sne->defrag.npdu, reason, sne->defrag.seg_have);
+	defrag_reset(sne);
+	/* the header decompressor must not rely on it */
+	if (sne->slhc)
+		slhc_toss(sne->slhc);
+}
+
+static void defrag_timer_cb(void *data)
+{
+	struct gprs_sndcp_entity *sne = data;
+
+	defrag_drop(sne, "after reassembly timeout");
+}
+
+/* Copy a segment into the reassembly buffer.  The NS layer frees the
+ * message after we return, so we cannot keep a reference to it. */
 static int defrag_enqueue(struct gprs_sndcp_entity *sne, uint8_t seg_nr,
 			  uint8_t *data, uint32_t data_len)
 {
-	struct defrag_queue_entry *dqe;
+	struct defrag_state *defrag = &sne->defrag;
+	uint8_t *spill = defrag->buf + SNDCP_DEFRAG_MAX;
 
-	dqe = talloc_zero(tall_sndcp_ctx, struct defrag_queue_entry);
-	if (!dqe)
-		return -ENOMEM;
-	dqe->data = talloc_zero_size(dqe, data_len);
-	if (!dqe->data) {
-		talloc_free(dqe);
-		return -ENOMEM;
+	if (defrag->tot_len + data_len > SNDCP_DEFRAG_MAX) {
+		defrag_drop(sne, "exceeding the maximum size");
+		return -EMSGSIZE;
 	}
-	dqe->seg_nr = seg_nr;
-	dqe->data_len = data_len;
 
-	llist_add(&dqe->list, &sne->defrag.frag_list);
+	if (seg_nr == defrag->next_seg) {
+		memcpy(defrag->buf + defrag->contig_len, data, data_len);
+		defrag->contig_len += data_len;
+		defrag->next_seg++;
 
-	if (seg_nr > sne->defrag.highest_seg)
-		sne->defrag.highest_seg = seg_nr;
+		/* move segments that were waiting for this one in place */
+		while (defrag->seg_have & (1 << defrag->next_seg)) {
+			unsigned int off = defrag->seg[defrag->next_seg].off;
+			unsigned int len = defrag->seg[defrag->next_seg].len;
+
+			memcpy(defrag->buf + defrag->contig_len, spill + off, len);
+			defrag->contig_len += len;
+			defrag->next_seg++;
+		}
+	} else {
+		defrag->seg[seg_nr].off = defrag->spill_len;
+		defrag->seg[seg_nr].len = data_len;
+		memcpy(spill + defrag->spill_len, data, data_len);
+		defrag->spill_len += data_len;
+	}
 
-	sne->defrag.seg_have |= (1 << seg_nr);
-	sne->defrag.tot_len += data_len;
+	if (seg_nr > defrag->highest_seg)
+		defrag->highest_seg = seg_nr;
 
-	memcpy(dqe->data, data, data_len);
+	defrag->seg_have |= (1 << seg_nr);
+	defrag->tot_len += data_len;
 
 	return 0;
 }
@@ -110,80 +150,112 @@ static int defrag_enqueue(struct gprs_sndcp_entity *sne, uint8_t seg_nr,
 /* return if we have all segments of this N-PDU */
 static int defrag_have_all_segments(struct gprs_sndcp_entity *sne)
 {
-	uint32_t seg_needed = 0;
-	unsigned int i;
-
-	/* create a bitmask of needed segments */
-	for (i = 0; i <= sne->defrag.highest_seg; i++)
-		seg_needed |= (1 << i);
-
-	if (seg_needed == sne->defrag.seg_have)
-		return 1;
-
-	return 0;
+	return sne->defrag.no_more &&
+		sne->defrag.next_seg > sne->defrag.highest_seg;
 }
 
-static struct defrag_queue_entry *defrag_get_seg(struct gprs_sndcp_entity *sne,
-						 uint32_t seg_nr)
+/* Undo protocol control information compression and hand the N-PDU to
+ * the SGSN core, which then forwards it to the correct GTP tunnel + GGSN
+ * via gtp_data_req() */
+static int sndcp_rx_npdu(struct gprs_sndcp_entity *sne, struct msgb *msg,
+			 uint8_t pcomp, uint8_t dcomp,
+			 uint8_t *npdu, unsigned int npdu_len)
 {
-	struct defrag_queue_entry *dqe;
+	uint8_t dbuf[SNDCP_MAX_NPDU];
+	uint8_t buf[SNDCP_MAX_NPDU + SLHC_MAX_HDR];
+	enum slhc_type type;
+	int rc;
 
-	llist_for_each_entry(dqe, &sne->defrag.frag_list, list) {
-		if (dqe->seg_nr == seg_nr) {
-			llist_del(&dqe->list);
-			return dqe;
+	/* data compression was applied last */
+	if (dcomp) {
+		if (!sne->v42bis || dcomp != sne->dcomp ||
+		    !(sne->dcomp_dir & SNDCP_DCOMP_DIR_UL)) {
+			LOGP(DSNDCP, LOGL_ERROR, "TLLI=0x%08x NSAPI=%u: DCOMP "
+				"%u without negotiated data compression\n",
+				sne->lle->llme->tlli, sne->nsapi, dcomp);
+			return -EIO;
+		}
+		rc = v42bis_decompress(sne->v42bis, npdu, npdu_len,
+				       dbuf, sizeof(dbuf));
+		if (rc < 0) {
+			LOGP(DSNDCP, LOGL_ERROR, "TLLI=0x%08x NSAPI=%u: "
+				"V.42bis decompression failed: %d\n",
+				sne->lle->llme->tlli, sne->nsapi, rc);
+			return rc;
 		}
+		sne->dcomp_stats.rx_bytes_in += npdu_len;
+		sne->dcomp_stats.rx_bytes_out += rc;
+		npdu = dbuf;
+		npdu_len = rc;
 	}
-	return NULL;
-}
-
-/* Perform actual defragmentation and create an output packet */
-static int defrag_segments(struct gprs_sndcp_entity *sne)
-{
-	struct msgb *msg;
-	unsigned int seg_nr;
-	uint8_t *npdu;
 
-	LOGP(DSNDCP, LOGL_DEBUG, "TLLI=0x%08x NSAPI=%u: Defragment output PDU %u "
-		"num_seg=%u tot_len=%u\n", sne->lle->llme->tlli, sne->nsapi,
-		sne->defrag.npdu, sne->defrag.highest_seg, sne->defrag.tot_len);
-	msg = msgb_alloc_headroom(sne->defrag.tot_len+256, 128, "SNDCP Defrag");
-	if (!msg)
-		return -ENOMEM;
+	if (!pcomp)
+		goto deliver;
 
-	/* FIXME: message headers + identifiers */
+	if (!sne->slhc) {
+		LOGP(DSNDCP, LOGL_ERROR, "TLLI=0x%08x NSAPI=%u: PCOMP %u "
+			"without negotiated header compression\n",
+			sne->lle->llme->tlli, sne->nsapi, pcomp);
+		return -EIO;
+	}
+	if (pcomp == sne->pcomp_utcp)
+		type = SLHC_TYPE_UNCOMPRESSED_TCP;
+	else if (pcomp == sne->pcomp_ctcp)
+		type = SLHC_TYPE_COMPRESSED_TCP;
+	else {
+		LOGP(DSNDCP, LOGL_ERROR, "TLLI=0x%08x NSAPI=%u: Unknown "
+			"PCOMP %u\n", sne->lle->llme->tlli, sne->nsapi, pcomp);
+		return -EIO;
+	}
+	if (npdu_len > SNDCP_MAX_NPDU) {
+		LOGP(DSNDCP, LOGL_ERROR, "TLLI=0x%08x NSAPI=%u: N-PDU too "
+			"long (%u)\n", sne->lle->llme->tlli, sne->nsapi,
+			npdu_len);
+		return -EMSGSIZE;
+	}
 
-	npdu = msg->data;
+	rc = slhc_uncompress(sne->slhc, type, npdu, npdu_len, buf);
+	if (rc < 0) {
+		LOGP(DSNDCP, LOGL_NOTICE, "TLLI=0x%08x NSAPI=%u: Dropping "
+			"N-PDU with undecodable TCP/IP header\n",
+			sne->lle->llme->tlli, sne->nsapi);
+		return rc;
+	}
+	if (type == SLHC_TYPE_COMPRESSED_TCP) {
+		sne->pcomp_stats.rx_pkts++;
+		sne->pcomp_stats.rx_bytes_saved += rc - npdu_len;
+	}
+	npdu = buf;
+	npdu_len = rc;
 
-	for (seg_nr = 0; seg_nr <= sne->defrag.highest_seg; seg_nr++) {
-		struct defrag_queue_entry *dqe;
-		uint8_t *data;
+deliver:
+	return sgsn_rx_sndcp_ud_ind(&sne->ra_id, sne->lle->llme->tlli,
+				    sne->nsapi, msg, npdu_len, npdu);
+}
 
-		dqe = defrag_get_seg(sne, seg_nr);
-		if (!dqe) {
-			LOGP(DSNDCP, LOGL_ERROR, "Segment %u missing\n", seg_nr);
-			msgb_free(msg);
-			return -EIO;
-		}
-		/* actually append the segment to the N-PDU */
-		data = msgb_put(msg, dqe->data_len);
-		memcpy(data, dqe->data, dqe->data_len);
+/* Hand the reassembled N-PDU to the upper layers */
+static int defrag_segments(struct gprs_sndcp_entity *sne, struct msgb *msg)
+{
+	struct defrag_state *defrag = &sne->defrag;
+	unsigned int len = defrag->tot_len;
 
-		/* release memory for the fragment queue entry */
-		talloc_free(dqe);
-	}
+	LOGP(DSNDCP, LOGL_DEBUG, "TLLI=0x%08x NSAPI=%u: Defragment output PDU %u "
+		"num_seg=%u tot_len=%u\n", sne->lle->llme->tlli, sne->nsapi,
+		defrag->npdu, defrag->highest_seg, defrag->tot_len);
 
-	/* FIXME: cancel timer */
+	/* the data stays in the buffer until the next segment arrives */
+	defrag_reset(sne);
+	defrag->last_npdu = defrag->npdu;
+	defrag->last_valid = 1;
 
-	/* actually send the N-PDU to the SGSN core code, which then
-	 * hands it off to the correct GTP tunnel + GGSN via gtp_data_req() */
-	return sgsn_rx_sndcp_ud_ind(&sne->ra_id, sne->lle->llme->tlli,
-				    sne->nsapi, msg, sne->defrag.tot_len, npdu);
+	return sndcp_rx_npdu(sne, msg, defrag->pcomp, defrag->dcomp,
+			     defrag->buf, len);
 }
 
 static int defrag_input(struct gprs_sndcp_entity *sne, struct msgb *msg, uint8_t *hdr,
 			unsigned int len)
 {
+	struct defrag_state *defrag = &sne->defrag;
 	struct sndcp_common_hdr *sch;
 	struct sndcp_comp_hdr *scomph = NULL;
 	struct sndcp_udata_hdr *suh;
@@ -199,6 +271,10 @@ static int defrag_input(struct gprs_sndcp_entity *sne, struct msgb *msg, uint8_t
 		suh = (struct sndcp_udata_hdr *) (hdr + sizeof(struct sndcp_common_hdr));
 
 	data = (uint8_t *)suh + sizeof(struct sndcp_udata_hdr);
+	if (data >= hdr + len) {
+		LOGP(DSNDCP, LOGL_ERROR, "Short SNDCP segment (%u)\n", len);
+		return -EIO;
+	}
 
 	npdu_num = (suh->npdu_high << 8) | suh->npdu_low;
 
@@ -206,36 +282,43 @@ static int defrag_input(struct gprs_sndcp_entity *sne, struct msgb *msg, uint8_t
 		"Length %u %s %s\n", sne->lle->llme->tlli, sne->nsapi, npdu_num,
 		suh->seg_nr, len, sch->first ? "F " : "", sch->more ? "M" : "");
 
-	if (sch->first) {
-		/* first segment of a new packet.  Discard all leftover fragments of
-		 * previous packet */
-		if (!llist_empty(&sne->defrag.frag_list)) {
-			struct defrag_queue_entry *dqe, *dqe2;
-			LOGP(DSNDCP, LOGL_INFO, "TLLI=0x%08x NSAPI=%u: Dropping "
-			     "SN-PDU %u due to insufficient segments (%04x)\n",
-			     sne->lle->llme->tlli, sne->nsapi, sne->defrag.npdu,
-			     sne->defrag.seg_have);
-			llist_for_each_entry_safe(dqe, dqe2, &sne->defrag.frag_list, list) {
-				llist_del(&dqe->list);
-				talloc_free(dqe);
-			}
-		}
+	if (!defrag->buf) {
+		defrag->buf = talloc_size(sne, 2 * SNDCP_DEFRAG_MAX);
+		if (!defrag->buf)
+			return -ENOMEM;
+	}
+
+	if (defrag->last_valid && defrag->last_npdu == npdu_num) {
+		LOGP(DSNDCP, LOGL_INFO, "TLLI=0x%08x NSAPI=%u: Dropping "
+		     "late duplicate segment %u of SN-PDU %u\n",
+		     sne->lle->llme->tlli, sne->nsapi, suh->seg_nr, npdu_num);
+		return 0;
+	}
+
+	/* a segment of a new packet.  Discard all leftover segments of the
+	 * previous packet */
+	if (defrag->seg_have && defrag->npdu != npdu_num)
+		defrag_drop(sne, "due to insufficient segments");
+
+	if (!defrag->seg_have) {
 		/* store the currently de-fragmented PDU number */
-		sne->defrag.npdu = npdu_num;
+		defrag->npdu = npdu_num;
+		osmo_timer_schedule(&defrag->timer,
+				    SNDCP_DEFRAG_TIMEOUT_SECS, 0);
+	}
 
-		/* Re-set fragmentation state */
-		sne->defrag.no_more = sne->defrag.highest_seg = sne->defrag.seg_have = 0;
-		sne->defrag.tot_len = 0;
-		/* FIXME: (re)start timer */
+	if (defrag->seg_have & (1 << suh->seg_nr)) {
+		LOGP(DSNDCP, LOGL_INFO, "TLLI=0x%08x NSAPI=%u: Dropping "
+		     "duplicate segment %u of SN-PDU %u\n", sne->lle->llme->tlli,
+		     sne->nsapi, suh->seg_nr, npdu_num);
+		return 0;
 	}
 
-	if (sne->defrag.npdu != npdu_num) {
-		LOGP(DSNDCP, LOGL_INFO, "Segment for different SN-PDU "
-			"(%u != %u)\n", npdu_num, sne->defrag.npdu);
-		/* FIXME */
+	if (sch->first) {
+		defrag->pcomp = scomph->pcomp;
+		defrag->dcomp = scomph->dcomp;
 	}
 
-	/* FIXME: check if seg_nr already exists */
 	/* make sure to subtract length of SNDCP header from 'len' */
 	rc = defrag_enqueue(sne, suh->seg_nr, data, len - (data - hdr));
 	if (rc < 0)
@@ -244,15 +327,11 @@ static int defrag_input(struct gprs_sndcp_entity *sne, struct msgb *msg, uint8_t
 	if (!sch->more) {
 		/* this is suppsed to be the last segment of the N-PDU, but it
 		 * might well be not the last to arrive */
-		sne->defrag.no_more = 1;
+		defrag->no_more = 1;
 	}
 
-	if (sne->defrag.no_more) {
-		/* we have already received the last segment before, let's check
-		 * if all the previous segments exist */
-		if (defrag_have_all_segments(sne))
-			return defrag_segments(sne);
-	}
+	if (defrag_have_all_segments(sne))
+		return defrag_segments(sne, msg);
 
 	return 0;
 }
@@ -281,9 +360,8 @@ static struct gprs_sndcp_entity *gprs_sndcp_entity_alloc(struct gprs_llc_lle *ll
 	sne->lle = lle;
 	sne->nsapi = nsapi;
 	sne->defrag.timer.data = sne;
-	//sne->fqueue.timer.cb = FIXME;
+	sne->defrag.timer.cb = defrag_timer_cb;
 	sne->rx_state = SNDCP_RX_S_FIRST;
-	INIT_LLIST_HEAD(&sne->defrag.frag_list);
 
 	llist_add(&sne->list, &gprs_sndcp_entities);
 
@@ -291,10 +369,14 @@ static struct gprs_sndcp_entity *gprs_sndcp_entity_alloc(struct gprs_llc_lle *ll
 }
 
 /* Entry point for the SNSM-ACTIVATE.indication */
-int sndcp_sm_activate_ind(struct gprs_llc_lle *lle, uint8_t nsapi)
+int sndcp_sm_activate_ind(struct gprs_llc_lle *lle, uint8_t nsapi,
+			  int acked)
 {
+	struct gprs_sndcp_entity *sne;
+
 	LOGP(DSNDCP, LOGL_INFO, "SNSM-ACTIVATE.ind (lle=%p TLLI=%08x, "
-	     "SAPI=%u, NSAPI=%u)\n", lle, lle->llme->tlli, lle->sapi, nsapi);
+	     "SAPI=%u, NSAPI=%u, %s)\n", lle, lle->llme->tlli, lle->sapi,
+	     nsapi, acked ? "acknowledged" : "unacknowledged");
 
 	if (gprs_sndcp_entity_by_lle(lle, nsapi)) {
 		LOGP(DSNDCP, LOGL_ERROR, "Trying to ACTIVATE "
@@ -303,10 +385,16 @@ int sndcp_sm_activate_ind(struct gprs_llc_lle *lle, uint8_t nsapi)
 		return -EEXIST;
 	}
 
-	if (!gprs_sndcp_entity_alloc(lle, nsapi)) {
+	sne = gprs_sndcp_entity_alloc(lle, nsapi);
+	if (!sne) {
 		LOGP(DSNDCP, LOGL_ERROR, "Out of memory during ACTIVATE\n");
 		return -ENOMEM;
 	}
+	sne->acked = acked;
+
+	/* 6.2.1.1: establish the acknowledged operation of the SAPI */
+	if (acked && lle->state == GPRS_LLES_ASSIGNED_ADM)
+		return gprs_llc_establish(lle);
 
 	return 0;
 }
@@ -315,6 +403,7 @@ int sndcp_sm_activate_ind(struct gprs_llc_lle *lle, uint8_t nsapi)
 int sndcp_sm_deactivate_ind(struct gprs_llc_lle *lle, uint8_t nsapi)
 {
 	struct gprs_sndcp_entity *sne;
+	int acked;
 
 	LOGP(DSNDCP, LOGL_INFO, "SNSM-DEACTIVATE.ind (lle=%p, TLLI=%08x, "
 	     "SAPI=%u, NSAPI=%u)\n", lle, lle->llme->tlli, lle->sapi, nsapi);
@@ -326,11 +415,25 @@ int sndcp_sm_deactivate_ind(struct gprs_llc_lle *lle, uint8_t nsapi)
 		     lle->sapi, nsapi);
 		return -ENOENT;
 	}
+	acked = sne->acked;
 	llist_del(&sne->list);
-	/* frag queue entries are hierarchically allocated, so no need to
-	 * free them explicitly here */
+	osmo_timer_del(&sne->defrag.timer);
+	/* the reassembly buffer is hierarchically allocated, so no need to
+	 * free it explicitly here */
 	talloc_free(sne);
 
+	if (!acked)
+		return 0;
+
+	/* 6.2.2.1: release the acknowledged operation with the last NSAPI
+	 * that uses it */
+	llist_for_each_entry(sne, &gprs_sndcp_entities, list) {
+		if (sne->lle == lle && sne->acked)
+			return 0;
+	}
+	if (lle->state == GPRS_LLES_ABM || lle->state == GPRS_LLES_LOCAL_EST)
+		return gprs_llc_release(lle);
+
 	return 0;
 }
 
@@ -342,6 +445,8 @@ struct sndcp_frag_state {
 
 	struct gprs_sndcp_entity *sne;
 	void *mmcontext;
+	uint8_t pcomp;
+	uint8_t dcomp;
 };
 
 /* returns '1' if there are more fragments to send, '0' if none */
@@ -380,8 +485,8 @@ static int sndcp_send_ud_frag(struct sndcp_frag_state *fs)
 	if (sch->first) {
 		scomph = (struct sndcp_comp_hdr *)
 				msgb_put(fmsg, sizeof(*scomph));
-		scomph->pcomp = 0;
-		scomph->dcomp = 0;
+		scomph->pcomp = fs->pcomp;
+		scomph->dcomp = fs->dcomp;
 	}
 
 	/* append the user-data header */
@@ -437,6 +542,123 @@ static int sndcp_send_ud_frag(struct sndcp_frag_state *fs)
 	return 1;
 }
 
+/* Compress the TCP/IP header of the N-PDU in place, returns the PCOMP
+ * value to be used */
+static uint8_t sndcp_pcomp_tx(struct gprs_sndcp_entity *sne, struct msgb *msg)
+{
+	uint8_t *hdr;
+
+	if (!sne->slhc)
+		return 0;
+
+	switch (slhc_compress(sne->slhc, msg->data, msg->len, &hdr)) {
+	case SLHC_TYPE_UNCOMPRESSED_TCP:
+		return sne->pcomp_utcp;
+	case SLHC_TYPE_COMPRESSED_TCP:
+		sne->pcomp_stats.tx_pkts++;
+		sne->pcomp_stats.tx_bytes_saved += hdr - msg->data;
+		msgb_pull(msg, hdr - msg->data);
+		return sne->pcomp_ctcp;
+	default:
+		return 0;
+	}
+}
+
+/* Compress the N-PDU with V.42bis into a new message that replaces
+ * *msgp, returns the DCOMP value to be used */
+static int sndcp_dcomp_tx(struct gprs_sndcp_entity *sne, struct msgb **msgp)
+{
+	struct msgb *msg = *msgp, *cmsg;
+	unsigned int max_len = 2 * msg->len + 32;
+	int rc;
+
+	if (!sne->v42bis || !(sne->dcomp_dir & SNDCP_DCOMP_DIR_DL))
+		return 0;
+
+	cmsg = msgb_alloc_headroom(max_len + 128, 128, "SNDCP DComp");
+	if (!cmsg)
+		return -ENOMEM;
+	rc = v42bis_compress(sne->v42bis, msg->data, msg->len,
+			     cmsg->data, max_len);
+	if (rc < 0) {
+		msgb_free(cmsg);
+		return rc;
+	}
+	msgb_put(cmsg, rc);
+
+	msgb_tlli(cmsg) = msgb_tlli(msg);
+	msgb_bvci(cmsg) = msgb_bvci(msg);
+	msgb_nsei(cmsg) = msgb_nsei(msg);
+
+	sne->dcomp_stats.tx_bytes_in += msg->len;
+	sne->dcomp_stats.tx_bytes_out += rc;
+
+	msgb_free(msg);
+	*msgp = cmsg;
+
+	return sne->dcomp;
+}
+
+/* Section 5.1.1.5 SN-DATA.req: send the N-PDU in SN-DATA PDUs of at most
+ * N201-I octets, LLC establishes ABM first if needed */
+static int sndcp_data_req(struct gprs_sndcp_entity *sne, struct msgb *msg,
+			  uint8_t pcomp, uint8_t dcomp, void *mmcontext)
+{
+	struct gprs_llc_lle *lle = sne->lle;
+	uint8_t *next = msg->data, *end = msg->data + msg->len;
+	int first = 1, rc = 0;
+
+	if (lle->state == GPRS_LLES_ASSIGNED_ADM) {
+		rc = gprs_llc_establish(lle);
+		if (rc < 0) {
+			msgb_free(msg);
+			return rc;
+		}
+	}
+
+	do {
+		struct sndcp_common_hdr *sch;
+		struct sndcp_comp_hdr *scomph;
+		unsigned int hdr_len = first ? 3 : 1;
+		unsigned int len = end - next;
+		struct msgb *fmsg;
+
+		if (len > lle->params.n201_i - hdr_len)
+			len = lle->params.n201_i - hdr_len;
+
+		fmsg = msgb_alloc(hdr_len + len, "SNDCP Data");
+		if (!fmsg) {
+			rc = -ENOMEM;
+			break;
+		}
+
+		sch = (struct sndcp_common_hdr *) msgb_put(fmsg, sizeof(*sch));
+		sch->nsapi = sne->nsapi;
+		sch->type = 0;
+		sch->first = first;
+		sch->more = next + len < end;
+		if (first) {
+			scomph = (struct sndcp_comp_hdr *)
+					msgb_put(fmsg, sizeof(*scomph));
+			scomph->pcomp = pcomp;
+			scomph->dcomp = dcomp;
+			/* N-PDU number of acknowledged operation */
+			*msgb_put(fmsg, 1) = sne->tx_npdu_ack;
+		}
+		memcpy(msgb_put(fmsg, len), next, len);
+		next += len;
+		first = 0;
+
+		/* LLC queues the I frames until ABM is established */
+		rc = gprs_llc_tx_i(lle, fmsg, mmcontext);
+	} while (rc == 0 && next < end);
+
+	sne->tx_npdu_ack++;
+	msgb_free(msg);
+
+	return rc;
+}
+
 /* Request transmission of a SN-PDU over specified LLC Entity + SAPI */
 int sndcp_unitdata_req(struct msgb *msg, struct gprs_llc_lle *lle, uint8_t nsapi,
 			void *mmcontext)
@@ -446,6 +668,8 @@ int sndcp_unitdata_req(struct msgb *msg, struct gprs_llc_lle *lle, uint8_t nsapi
 	struct sndcp_comp_hdr *scomph;
 	struct sndcp_udata_hdr *suh;
 	struct sndcp_frag_state fs;
+	uint8_t pcomp;
+	int dcomp;
 
 	/* Identifiers from UP: (TLLI, SAPI) + (BVCI, NSEI) */
 
@@ -455,6 +679,15 @@ int sndcp_unitdata_req(struct msgb *msg, struct gprs_llc_lle *lle, uint8_t nsapi
 		return -EIO;
 	}
 
+	/* header compression goes first, data compression on top */
+	pcomp = sndcp_pcomp_tx(sne, msg);
+	dcomp = sndcp_dcomp_tx(sne, &msg);
+	if (dcomp < 0)
+		return dcomp;
+
+	if (sne->acked)
+		return sndcp_data_req(sne, msg, pcomp, dcomp, mmcontext);
+
 	/* Check if we need to fragment this N-PDU into multiple SN-PDUs */
 	if (msg->len > lle->params.n201_u - 
 			(sizeof(*sch) + sizeof(*suh) + sizeof(*scomph))) {
@@ -464,6 +697,8 @@ int sndcp_unitdata_req(struct msgb *msg, struct gprs_llc_lle *lle, uint8_t nsapi
 		fs.next_byte = msg->data;
 		fs.sne = sne;
 		fs.mmcontext = mmcontext;
+		fs.pcomp = pcomp;
+		fs.dcomp = dcomp;
 
 		/* call function to generate and send fragments until all
 		 * of the N-PDU has been sent */
@@ -488,8 +723,8 @@ int sndcp_unitdata_req(struct msgb *msg, struct gprs_llc_lle *lle, uint8_t nsapi
 	sne->tx_npdu_nr = (sne->tx_npdu_nr + 1) % 0xfff;
 
 	scomph = (struct sndcp_comp_hdr *) msgb_push(msg, sizeof(*scomph));
-	scomph->pcomp = 0;
-	scomph->dcomp = 0;
+	scomph->pcomp = pcomp;
+	scomph->dcomp = dcomp;
 
 	/* prepend common SNDCP header */
 	sch = (struct sndcp_common_hdr *) msgb_push(msg, sizeof(*sch));
@@ -544,21 +779,377 @@ int sndcp_llunitdata_ind(struct msgb *msg, struct gprs_llc_lle *lle,
 	if (!sch->first || sch->more)
 		return defrag_input(sne, msg, hdr, len);
 
-	if (scomph && (scomph->pcomp || scomph->dcomp)) {
-		LOGP(DSNDCP, LOGL_ERROR, "We don't support compression yet\n");
-		return -EIO;
-	}
-
 	npdu_num = (suh->npdu_high << 8) | suh->npdu_low;
+	/* the N-PDU numbers came round, a segmented N-PDU with this number
+	 * is no duplicate anymore */
+	if (sne->defrag.last_npdu == npdu_num)
+		sne->defrag.last_valid = 0;
 	npdu = (uint8_t *)suh + sizeof(*suh);
 	npdu_len = (msg->data + msg->len) - npdu;
 	if (npdu_len <= 0) {
 		LOGP(DSNDCP, LOGL_ERROR, "Short SNDCP N-PDU: %d\n", npdu_len);
 		return -EIO;
 	}
-	/* actually send the N-PDU to the SGSN core code, which then
-	 * hands it off to the correct GTP tunnel + GGSN via gtp_data_req() */
-	return sgsn_rx_sndcp_ud_ind(&sne->ra_id, lle->llme->tlli, sne->nsapi, msg, npdu_len, npdu);
+	return sndcp_rx_npdu(sne, msg, scomph->pcomp, scomph->dcomp,
+			     npdu, npdu_len);
+}
+
+static void ack_rx_drop(struct gprs_sndcp_entity *sne, const char *reason)
+{
+	if (!sne->ack_rx.active)
+		return;
+
+	LOGP(DSNDCP, LOGL_INFO, "TLLI=0x%08x NSAPI=%u: Dropping SN-DATA "
+	     "N-PDU %u %s\n", sne->lle->llme->tlli, sne->nsapi,
+	     sne->ack_rx.npdu, reason);
+	sne->ack_rx.active = 0;
+	sne->ack_rx.len = 0;
+}
+
+/* Section 5.1.2.14 LL-DATA.ind: SN-DATA PDU of acknowledged operation,
+ * LLC has delivered it in sequence already */
+int sndcp_lldata_ind(struct msgb *msg, struct gprs_llc_lle *lle,
+		     uint8_t *hdr, uint16_t len)
+{
+	struct gprs_sndcp_entity *sne;
+	struct sndcp_common_hdr *sch = (struct sndcp_common_hdr *)hdr;
+	struct sndcp_comp_hdr *scomph;
+	uint8_t *data;
+	unsigned int data_len;
+	int rc;
+
+	/* octet 1, and for the first segment PCOMP/DCOMP, N-PDU number */
+	if (len < sizeof(*sch) + (sch->first ? sizeof(*scomph) + 1 : 0)) {
+		LOGP(DSNDCP, LOGL_ERROR, "SN-DATA PDU too short (%u)\n", len);
+		return -EIO;
+	}
+	if (sch->type != 0) {
+		LOGP(DSNDCP, LOGL_ERROR, "SN-UNITDATA PDU at data_ind() function\n");
+		return -EINVAL;
+	}
+
+	sne = gprs_sndcp_entity_by_lle(lle, sch->nsapi);
+	if (!sne) {
+		LOGP(DSNDCP, LOGL_ERROR, "Message for non-existing SNDCP Entity "
+			"(lle=%p, TLLI=%08x, SAPI=%u, NSAPI=%u)\n", lle,
+			lle->llme->tlli, lle->sapi, sch->nsapi);
+		return -EIO;
+	}
+	/* frames held for reordering by LLC have no cell identity */
+	if (msgb_bcid(msg))
+		bssgp_parse_cell_id(&sne->ra_id, msgb_bcid(msg));
+
+	if (sch->first) {
+		ack_rx_drop(sne, "without its last segment");
+
+		scomph = (struct sndcp_comp_hdr *) (hdr + 1);
+		data = hdr + 3;
+		data_len = len - 3;
+		/* FIXME: N-PDU number of octet 3 for the data transfer on
+		 * inter-SGSN routing area update */
+		if (!sch->more)
+			return sndcp_rx_npdu(sne, msg, scomph->pcomp,
+					     scomph->dcomp, data, data_len);
+
+		sne->ack_rx.active = 1;
+		sne->ack_rx.npdu = hdr[2];
+		sne->ack_rx.pcomp = scomph->pcomp;
+		sne->ack_rx.dcomp = scomph->dcomp;
+	} else {
+		if (!sne->ack_rx.active) {
+			LOGP(DSNDCP, LOGL_INFO, "TLLI=0x%08x NSAPI=%u: "
+			     "Dropping SN-DATA segment without a first "
+			     "segment\n", lle->llme->tlli, sne->nsapi);
+			return -EIO;
+		}
+		data = hdr + 1;
+		data_len = len - 1;
+	}
+
+	if (sne->ack_rx.len + data_len > SNDCP_DEFRAG_MAX) {
+		ack_rx_drop(sne, "exceeding the maximum size");
+		return -EMSGSIZE;
+	}
+	if (!sne->ack_rx.buf) {
+		sne->ack_rx.buf = talloc_size(sne, SNDCP_DEFRAG_MAX);
+		if (!sne->ack_rx.buf) {
+			ack_rx_drop(sne, "for lack of memory");
+			return -ENOMEM;
+		}
+	}
+	memcpy(sne->ack_rx.buf + sne->ack_rx.len, data, data_len);
+	sne->ack_rx.len += data_len;
+
+	if (sch->more)
+		return 0;
+
+	rc = sndcp_rx_npdu(sne, msg, sne->ack_rx.pcomp, sne->ack_rx.dcomp,
+			   sne->ack_rx.buf, sne->ack_rx.len);
+	sne->ack_rx.active = 0;
+	sne->ack_rx.len = 0;
+
+	return rc;
+}
+
+/* Chapter 6.8: SNDCP XID parameter types */
+enum sndcp_xid_type {
+	SNDCP_XID_VERSION	= 0,
+	SNDCP_XID_DATA_COMP	= 1,
+	SNDCP_XID_PROTO_COMP	= 2,
+};
+
+/* Protocol control information compression algorithms */
+#define SNDCP_PCOMP_RFC1144	0
+#define SNDCP_PCOMP_RFC2507	1
+
+/* Data compression algorithms */
+#define SNDCP_DCOMP_V42BIS	0
+
+/* number of PCOMP / DCOMP values used by a compression algorithm */
+static unsigned int xid_comp_num_values(int data_comp, uint8_t algo)
+{
+	if (data_comp)
+		return algo == 0 ? 1 : 2;
+	return algo == SNDCP_PCOMP_RFC2507 ? 5 : 2;
+}
+
+static struct gprs_sndcp_entity *sne_by_pcomp_entity(struct gprs_llc_lle *lle,
+						     uint8_t entity)
+{
+	struct gprs_sndcp_entity *sne;
+
+	llist_for_each_entry(sne, &gprs_sndcp_entities, list) {
+		if (sne->lle == lle && sne->slhc && sne->pcomp_entity == entity)
+			return sne;
+	}
+	return NULL;
+}
+
+/* Apply a RFC 1144 compression entity to the NSAPIs it was requested
+ * for, returns the NSAPIs for which it is active now.  Without pcomp,
+ * an existing entity is modified. */
+static uint16_t sndcp_xid_rfc1144(struct gprs_llc_lle *lle, uint8_t entity,
+				  const uint8_t *pcomp, uint16_t nsapis,
+				  uint8_t *s0_1)
+{
+	struct gprs_sndcp_entity *sne;
+	uint8_t utcp, ctcp;
+	uint16_t active = 0;
+
+	if (pcomp) {
+		utcp = pcomp[0] >> 4;
+		ctcp = pcomp[0] & 0xf;
+	} else {
+		sne = sne_by_pcomp_entity(lle, entity);
+		if (!sne)
+			return 0;
+		utcp = sne->pcomp_utcp;
+		ctcp = sne->pcomp_ctcp;
+	}
+	if (!utcp || !ctcp || utcp == ctcp)
+		return 0;
+
+	if (*s0_1 > SLHC_MAX_SLOTS - 1)
+		*s0_1 = SLHC_MAX_SLOTS - 1;
+
+	llist_for_each_entry(sne, &gprs_sndcp_entities, list) {
+		if (sne->lle != lle)
+			continue;
+
+		if (!(nsapis & (1 << sne->nsapi))) {
+			/* entity no longer applies to this NSAPI */
+			if (sne->slhc && sne->pcomp_entity == entity) {
+				talloc_free(sne->slhc);
+				sne->slhc = NULL;
+			}
+			continue;
+		}
+
+		if (!sne->slhc) {
+			sne->slhc = talloc_zero(sne, struct slhc);
+			if (!sne->slhc)
+				continue;
+		}
+		slhc_init(sne->slhc, *s0_1 + 1);
+		sne->pcomp_entity = entity;
+		sne->pcomp_utcp = utcp;
+		sne->pcomp_ctcp = ctcp;
+		active |= 1 << sne->nsapi;
+	}
+
+	LOGP(DSNDCP, LOGL_INFO, "TLLI=0x%08x: RFC 1144 entity %u "
+		"PCOMP=%u/%u slots=%u on NSAPIs 0x%04x\n", lle->llme->tlli,
+		entity, utcp, ctcp, *s0_1 + 1, active);
+
+	return active;
+}
+
+static struct gprs_sndcp_entity *sne_by_dcomp_entity(struct gprs_llc_lle *lle,
+						     uint8_t entity)
+{
+	struct gprs_sndcp_entity *sne;
+
+	llist_for_each_entry(sne, &gprs_sndcp_entities, list) {
+		if (sne->lle == lle && sne->v42bis &&
+		    sne->dcomp_entity == entity)
+			return sne;
+	}
+	return NULL;
+}
+
+/* Apply a V.42bis compression entity to the NSAPIs it was requested
+ * for, returns the NSAPIs for which it is active now.  P1 and P2 in par
+ * are limited to what we support, which bounds the dictionary memory.
+ * Without dcomp, an existing entity is modified. */
+static uint16_t sndcp_xid_v42bis(struct gprs_llc_lle *lle, uint8_t entity,
+				 const uint8_t *dcomp, uint16_t nsapis,
+				 uint8_t *par)
+{
+	struct gprs_sndcp_entity *sne;
+	unsigned int p0, p1, p2;
+	uint16_t active = 0;
+	uint8_t value;
+
+	if (dcomp)
+		value = dcomp[0] >> 4;
+	else {
+		sne = sne_by_dcomp_entity(lle, entity);
+		if (!sne)
+			return 0;
+		value = sne->dcomp;
+	}
+
+	p0 = par[0] & 3;
+	p1 = (par[1] << 8) | par[2];
+	p2 = par[3];
+	if (p1 > V42BIS_MAX_CODEWORDS)
+		p1 = V42BIS_MAX_CODEWORDS;
+	if (p2 > V42BIS_MAX_STRING)
+		p2 = V42BIS_MAX_STRING;
+	if (!value || !p0 || p1 < V42BIS_MIN_CODEWORDS ||
+	    p2 < V42BIS_MIN_STRING)
+		return 0;
+	par[1] = p1 >> 8;
+	par[2] = p1 & 0xff;
+	par[3] = p2;
+
+	llist_for_each_entry(sne, &gprs_sndcp_entities, list) {
+		if (sne->lle != lle)
+			continue;
+
+		/* (re)negotiation starts with empty dictionaries */
+		if (sne->v42bis && (sne->dcomp_entity == entity ||
+				    nsapis & (1 << sne->nsapi))) {
+			talloc_free(sne->v42bis);
+			sne->v42bis = NULL;
+		}
+		if (!(nsapis & (1 << sne->nsapi)))
+			continue;
+
+		sne->v42bis = v42bis_alloc(sne, p1, p2);
+		if (!sne->v42bis)
+			continue;
+		sne->dcomp_entity = entity;
+		sne->dcomp = value;
+		sne->dcomp_dir = p0;
+		active |= 1 << sne->nsapi;
+	}
+
+	LOGP(DSNDCP, LOGL_INFO, "TLLI=0x%08x: V.42bis entity %u DCOMP=%u "
+		"P0=%u P1=%u P2=%u on NSAPIs 0x%04x\n", lle->llme->tlli,
+		entity, value, p0, p1, p2, active);
+
+	return active;
+}
+
+/* Negotiate the compression entities of a XID parameter in place.  All
+ * entities we don't support are rejected by clearing their NSAPIs. */
+static void sndcp_xid_comp(struct gprs_llc_lle *lle, int data_comp,
+			   uint8_t *cur, unsigned int len)
+{
+	uint8_t *end = cur + len;
+
+	while (cur < end) {
+		unsigned int hdr_len, ent_len, val_len;
+		uint8_t *body, *nsapis;
+		uint16_t active = 0;
+		int p = cur[0] & 0x80;
+
+		hdr_len = p ? 3 : 2;
+		if (cur + hdr_len > end)
+			break;
+		ent_len = cur[hdr_len - 1];
+		body = cur + hdr_len;
+		if (body + ent_len > end)
+			break;
+
+		val_len = 0;
+		if (p)
+			val_len = (xid_comp_num_values(data_comp,
+						cur[1] & 0x1f) + 1) / 2;
+		if (ent_len < val_len + 2)
+			goto next;
+		nsapis = body + val_len;
+
+		if (!data_comp && ent_len >= val_len + 3 &&
+		    (!p || (cur[1] & 0x1f) == SNDCP_PCOMP_RFC1144))
+			active = sndcp_xid_rfc1144(lle, cur[0] & 0x1f,
+						p ? body : NULL,
+						(nsapis[0] << 8) | nsapis[1],
+						&nsapis[2]);
+		else if (data_comp && ent_len >= val_len + 6 &&
+			 (!p || (cur[1] & 0x1f) == SNDCP_DCOMP_V42BIS))
+			active = sndcp_xid_v42bis(lle, cur[0] & 0x1f,
+						p ? body : NULL,
+						(nsapis[0] << 8) | nsapis[1],
+						&nsapis[2]);
+
+		nsapis[0] = active >> 8;
+		nsapis[1] = active & 0xff;
+next:
+		cur = body + ent_len;
+	}
+}
+
+/* Chapter 6.8: XID parameter negotiation */
+int sndcp_llxid_ind(struct gprs_llc_lle *lle, const uint8_t *req,
+		    unsigned int req_len, uint8_t *resp, unsigned int resp_max)
+{
+	const uint8_t *cur = req, *end = req + req_len;
+	uint8_t *out = resp;
+
+	while (cur + 2 <= end) {
+		uint8_t type = cur[0], len = cur[1];
+
+		if (cur + 2 + len > end)
+			break;
+		if (out + 2 + len > resp + resp_max)
+			break;
+
+		switch (type) {
+		case SNDCP_XID_VERSION:
+			/* we only know version 0 */
+			memcpy(out, cur, 2 + len);
+			if (len)
+				out[2] = 0;
+			out += 2 + len;
+			break;
+		case SNDCP_XID_DATA_COMP:
+		case SNDCP_XID_PROTO_COMP:
+			memcpy(out, cur, 2 + len);
+			sndcp_xid_comp(lle, type == SNDCP_XID_DATA_COMP,
+				       out + 2, len);
+			out += 2 + len;
+			break;
+		default:
+			LOGP(DSNDCP, LOGL_NOTICE, "Ignoring unknown SNDCP "
+				"XID parameter %u\n", type);
+			break;
+		}
+		cur += 2 + len;
+	}
+
+	return out - resp;
 }
 
 /* Section 5.1.2.1 LL-RESET.ind */
@@ -577,44 +1168,38 @@ static int sndcp_ll_status_ind()
 	return 0;
 }
 
-#if 0
-static struct sndcp_state_list {{
-	uint32_t	states;
-	unsigned int	type;
-	int		(*rout)(struct gprs_sndcp_entity *se, struct msgb *msg);
-} sndcp_state_list[] = {
-	{ ALL_STATES,
-	  LL_RESET_IND, sndcp_ll_reset_ind },
-	{ ALL_STATES,
-	  LL_ESTABLISH_IND, sndcp_ll_est_ind },
-	{ SBIT(SNDCP_S_EST_RQD),
-	  LL_ESTABLISH_RESP, sndcp_ll_est_ind },
-	{ SBIT(SNDCP_S_EST_RQD),
-	  LL_ESTABLISH_CONF, sndcp_ll_est_conf },
-	{ SBIT(SNDCP_S_
-};
-
-static int sndcp_rx_llc_prim()
+/* Section 6.2: LL-ESTABLISH and LL-RELEASE of the acknowledged operation.
+ * Both discard a partially received N-PDU.  N-PDUs sent after a release
+ * establish the acknowledged operation again. */
+int sndcp_rx_llc_prim(struct gprs_llc_lle *lle, enum gprs_llc_primitive prim)
 {
-	case LL_ESTABLISH_REQ:
-	case LL_RELEASE_REQ:
-	case LL_XID_REQ:
-	case LL_DATA_REQ:
-	LL_UNITDATA_REQ,	/* TLLI, SN-PDU, Ref, QoS, Radio Prio, Ciph */
+	struct gprs_sndcp_entity *sne;
+	const char *reason;
 
 	switch (prim) {
-	case LL_RESET_IND:
 	case LL_ESTABLISH_IND:
-	case LL_ESTABLISH_RESP:
+		reason = "on re-establishment by the MS";
+		break;
 	case LL_ESTABLISH_CONF:
+		reason = "on establishment";
+		break;
 	case LL_RELEASE_IND:
 	case LL_RELEASE_CONF:
-	case LL_XID_IND:
-	case LL_XID_RESP:
-	case LL_XID_CONF:
-	case LL_DATA_IND:
-	case LL_DATA_CONF:
-	case LL_UNITDATA_IND:
-	case LL_STATUS_IND:
+		reason = "on release";
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	LOGP(DSNDCP, LOGL_INFO, "TLLI=0x%08x SAPI=%u: acknowledged operation "
+	     "%s\n", lle->llme->tlli, lle->sapi,
+	     prim == LL_ESTABLISH_IND || prim == LL_ESTABLISH_CONF ?
+			"established" : "released");
+
+	llist_for_each_entry(sne, &gprs_sndcp_entities, list) {
+		if (sne->lle == lle)
+			ack_rx_drop(sne, reason);
+	}
+
+	return 0;
 }
-#endif
@@ -3,8 +3,16 @@
 
 #include <stdint.h>
 #include <osmocom/core/linuxlist.h>
+#include <osmocom/core/timer.h>
+#include <openbsc/slhc.h>
+#include <openbsc/v42bis.h>
 
-/* A fragment queue header, maintaining list of fragments for one N-PDU */
+/* segment numbers are 4 bits wide */
+#define SNDCP_MAX_SEGS		16
+
+/* Reassembly state for one N-PDU.  Segments are copied into buf as they
+ * arrive: in-order segments directly to their final position, others
+ * to the spill area in the second half of buf until the gap is closed. */
 struct defrag_state {
 	/* PDU number for which the defragmentation state applies */
 	uint16_t npdu;
@@ -16,9 +24,26 @@ struct defrag_state {
 	unsigned int no_more;
 	/* total length of all segments together */
 	unsigned int tot_len;
+	/* PCOMP and DCOMP values of the first segment */
+	uint8_t pcomp;
+	uint8_t dcomp;
+
+	/* segments 0..next_seg-1 are contiguous at the start of buf */
+	uint8_t next_seg;
+	unsigned int contig_len;
+	/* out-of-order segments, indexed by segment number */
+	struct {
+		uint16_t off;
+		uint16_t len;
+	} seg[SNDCP_MAX_SEGS];
+	unsigned int spill_len;
+	/* allocated with the first segmented N-PDU of the entity */
+	uint8_t *buf;
 
-	/* linked list of defrag_queue_entry: one for each fragment  */
-	struct llist_head frag_list;
+	/* the last N-PDU delivered, late duplicates of its segments must
+	 * not start a new reassembly */
+	uint16_t last_npdu;
+	unsigned int last_valid;
 
 	struct osmo_timer_list timer;
 };
@@ -42,12 +67,56 @@ struct gprs_sndcp_entity {
 
 	/* NPDU number for the GTP->SNDCP side */
 	uint16_t tx_npdu_nr;
+
+	/* acknowledged operation over LLC ABM, with its own 8 bit Send
+	 * N-PDU number */
+	int acked;
+	uint8_t tx_npdu_ack;
+	/* reassembly of SN-DATA PDUs, LLC delivers them in sequence */
+	struct {
+		int active;
+		uint8_t npdu;
+		uint8_t pcomp;
+		uint8_t dcomp;
+		unsigned int len;
+		uint8_t *buf;
+	} ack_rx;
 	/* SNDCP eeceiver state */
 	enum sndcp_rx_state rx_state;
 	/* The defragmentation queue */
 	struct defrag_state defrag;
+
+	/* RFC 1144 header compression, NULL unless negotiated by XID */
+	struct slhc *slhc;
+	uint8_t pcomp_entity;
+	/* PCOMP values for uncompressed and compressed TCP */
+	uint8_t pcomp_utcp;
+	uint8_t pcomp_ctcp;
+	struct {
+		unsigned long tx_pkts;
+		unsigned long tx_bytes_saved;
+		unsigned long rx_pkts;
+		unsigned long rx_bytes_saved;
+	} pcomp_stats;
+
+	/* V.42bis data compression, NULL unless negotiated by XID */
+	struct v42bis *v42bis;
+	uint8_t dcomp_entity;
+	uint8_t dcomp;
+	/* P0: directions in which compression is used */
+	uint8_t dcomp_dir;
+	struct {
+		unsigned long tx_bytes_in;
+		unsigned long tx_bytes_out;
+		unsigned long rx_bytes_in;
+		unsigned long rx_bytes_out;
+	} dcomp_stats;
 };
 
+/* V.42bis P0 bits, the MS is the initiator of the XID negotiation */
+#define SNDCP_DCOMP_DIR_UL	0x01
+#define SNDCP_DCOMP_DIR_DL	0x02
+
 extern struct llist_head gprs_sndcp_entities;
 
 #endif	/* INT_SNDCP_H */
@@ -50,6 +50,24 @@ static void vty_dump_sne(struct vty *vty, struct gprs_sndcp_entity *sne)
 	vty_out(vty, "  Defrag: npdu=%u highest_seg=%u seg_have=0x%08x tot_len=%u%s",
 		sne->defrag.npdu, sne->defrag.highest_seg, sne->defrag.seg_have,
 		sne->defrag.tot_len, VTY_NEWLINE);
+	if (sne->slhc)
+		vty_out(vty, "  RFC 1144 entity %u: slots=%u PCOMP=%u/%u "
+			"tx=%lu pkts (%lu bytes saved) "
+			"rx=%lu pkts (%lu bytes saved)%s", sne->pcomp_entity,
+			sne->slhc->num_slots, sne->pcomp_utcp, sne->pcomp_ctcp,
+			sne->pcomp_stats.tx_pkts,
+			sne->pcomp_stats.tx_bytes_saved,
+			sne->pcomp_stats.rx_pkts,
+			sne->pcomp_stats.rx_bytes_saved, VTY_NEWLINE);
+	if (sne->v42bis)
+		vty_out(vty, "  V.42bis entity %u: DCOMP=%u P0=%u P1=%u P2=%u "
+			"tx=%lu->%lu bytes rx=%lu->%lu bytes%s",
+			sne->dcomp_entity, sne->dcomp, sne->dcomp_dir,
+			sne->v42bis->tx.dict.n2, sne->v42bis->tx.dict.n7,
+			sne->dcomp_stats.tx_bytes_in,
+			sne->dcomp_stats.tx_bytes_out,
+			sne->dcomp_stats.rx_bytes_in,
+			sne->dcomp_stats.rx_bytes_out, VTY_NEWLINE);
 }
 
 
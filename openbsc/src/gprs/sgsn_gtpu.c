@@ -0,0 +1,369 @@
+/* GTP-U user plane of the SGSN, as per 3GPP TS 29.281 */
+
+/*
+ * (C) 2026 by the OpenBSC contributors
+ * All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* libgtp reads and sends user plane packets one by one and copies every
+ * T-PDU.  Here the SGSN owns the GTP-U socket: datagrams are read with
+ * recvmmsg() straight into msgbs that have room for our own headers,
+ * and uplink G-PDUs are collected and sent with sendmmsg(). */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <osmocom/core/msgb.h>
+#include <osmocom/core/select.h>
+#include <osmocom/core/talloc.h>
+#include <osmocom/core/timer.h>
+
+#include <openbsc/debug.h>
+#include <openbsc/sgsn_gtpu.h>
+
+#include "../../bscconfig.h"
+
+/* message types, 29.281 Table 6.1-1 */
+#define GTPU_MT_ECHO_REQ	1
+#define GTPU_MT_ECHO_RESP	2
+#define GTPU_MT_GPDU		255
+
+/* flags of octet 1: version 1, protocol type GTP */
+#define GTPU_F_V1		0x30
+#define GTPU_F_E		0x04
+#define GTPU_F_S		0x02
+#define GTPU_F_PN		0x01
+
+#define GTPU_HDR_LEN		8
+#define GTPU_HDR_LEN_OPT	12
+
+#define GTPU_IE_RECOVERY	14
+
+/* largest datagram we receive */
+#define GTPU_RX_SIZE		2048
+
+struct gtpu_batch {
+	/* receive buffers, re-allocated once handed to the user */
+	struct msgb *rx_msg[GTPU_BATCH];
+	struct sockaddr_in rx_addr[GTPU_BATCH];
+	unsigned int rx_len[GTPU_BATCH];
+
+	/* queued G-PDUs */
+	unsigned int tx_num;
+	struct sockaddr_in tx_addr[GTPU_BATCH];
+	unsigned int tx_len[GTPU_BATCH];
+	uint8_t tx_buf[GTPU_BATCH][GTPU_HDR_LEN_OPT + GTPU_MAX_PDU];
+};
+
+static void gtpu_tx_echo_resp(struct gtpu_ep *ep, const uint8_t *req,
+			      const struct sockaddr_in *to)
+{
+	uint8_t resp[GTPU_HDR_LEN_OPT + 2] = {
+		GTPU_F_V1 | GTPU_F_S, GTPU_MT_ECHO_RESP, 0, 6,
+		0, 0, 0, 0,
+		0, 0, 0, 0,
+		GTPU_IE_RECOVERY, ep->restart_ctr,
+	};
+
+	/* the sequence number of the request */
+	if (req[0] & GTPU_F_S) {
+		resp[8] = req[8];
+		resp[9] = req[9];
+	}
+
+	if (sendto(ep->ofd.fd, resp, sizeof(resp), 0,
+		   (const struct sockaddr *) to, sizeof(*to)) < 0)
+		LOGP(DGPRS, LOGL_ERROR, "GTP-U: cannot send Echo Response: "
+		     "%s\n", strerror(errno));
+}
+
+static void gtpu_rx_msg(struct gtpu_ep *ep, struct msgb *msg,
+			const struct sockaddr_in *from)
+{
+	uint8_t *gh = msg->data;
+	unsigned int hlen = GTPU_HDR_LEN, len;
+	uint8_t next;
+
+	if (msg->len < GTPU_HDR_LEN || (gh[0] & 0xf0) != GTPU_F_V1)
+		goto drop;
+
+	/* the length excludes the mandatory header, there may be padding */
+	len = GTPU_HDR_LEN + ((gh[2] << 8) | gh[3]);
+	if (len > msg->len)
+		goto drop;
+	msg->len = len;
+	msg->tail = msg->data + len;
+
+	if (gh[0] & (GTPU_F_E | GTPU_F_S | GTPU_F_PN)) {
+		hlen = GTPU_HDR_LEN_OPT;
+		if (len < hlen)
+			goto drop;
+		/* skip the extension headers */
+		next = (gh[0] & GTPU_F_E) ? gh[hlen - 1] : 0;
+		while (next) {
+			unsigned int ext_len;
+
+			if (hlen >= len)
+				goto drop;
+			ext_len = gh[hlen] * 4;
+			if (!ext_len || hlen + ext_len > len)
+				goto drop;
+			next = gh[hlen + ext_len - 1];
+			hlen += ext_len;
+		}
+	}
+
+	switch (gh[1]) {
+	case GTPU_MT_GPDU:
+		ep->stats.rx_pkts++;
+		msgb_pull(msg, hlen);
+		ep->rx_cb(ep, from, (gh[4] << 24) | (gh[5] << 16) |
+				    (gh[6] << 8) | gh[7], msg);
+		return;
+	case GTPU_MT_ECHO_REQ:
+		gtpu_tx_echo_resp(ep, gh, from);
+		msgb_free(msg);
+		return;
+	default:
+		LOGP(DGPRS, LOGL_NOTICE, "GTP-U message type %u from %s "
+		     "not supported\n", gh[1], inet_ntoa(from->sin_addr));
+		break;
+	}
+
+drop:
+	ep->stats.rx_dropped++;
+	msgb_free(msg);
+}
+
+/* read up to num datagrams into the receive buffers */
+static int gtpu_recv_batch(struct gtpu_ep *ep, unsigned int num)
+{
+	struct gtpu_batch *b = ep->batch;
+	unsigned int i;
+#ifdef HAVE_RECVMMSG
+	struct mmsghdr mmsg[GTPU_BATCH];
+	struct iovec iov[GTPU_BATCH];
+	int rc;
+
+	memset(mmsg, 0, sizeof(mmsg[0]) * num);
+	for (i = 0; i < num; i++) {
+		iov[i].iov_base = b->rx_msg[i]->tail;
+		iov[i].iov_len = msgb_tailroom(b->rx_msg[i]);
+		mmsg[i].msg_hdr.msg_iov = &iov[i];
+		mmsg[i].msg_hdr.msg_iovlen = 1;
+		mmsg[i].msg_hdr.msg_name = &b->rx_addr[i];
+		mmsg[i].msg_hdr.msg_namelen = sizeof(b->rx_addr[i]);
+	}
+
+	rc = recvmmsg(ep->ofd.fd, mmsg, num, MSG_DONTWAIT, NULL);
+	if (rc < 0)
+		return errno == EAGAIN ? 0 : -errno;
+
+	for (i = 0; i < rc; i++) {
+		if (mmsg[i].msg_hdr.msg_flags & MSG_TRUNC)
+			b->rx_len[i] = 0;
+		else
+			b->rx_len[i] = mmsg[i].msg_len;
+	}
+	return rc;
+#else
+	for (i = 0; i < num; i++) {
+		socklen_t addr_len = sizeof(b->rx_addr[i]);
+		int rc;
+
+		rc = recvfrom(ep->ofd.fd, b->rx_msg[i]->tail,
+			      msgb_tailroom(b->rx_msg[i]), MSG_DONTWAIT,
+			      (struct sockaddr *) &b->rx_addr[i], &addr_len);
+		if (rc < 0) {
+			if (i > 0 || errno == EAGAIN)
+				break;
+			return -errno;
+		}
+		b->rx_len[i] = rc;
+	}
+	return i;
+#endif
+}
+
+int gtpu_rx(struct gtpu_ep *ep)
+{
+	struct gtpu_batch *b = ep->batch;
+	unsigned int i, num;
+	int rc;
+
+	for (num = 0; num < GTPU_BATCH; num++) {
+		if (b->rx_msg[num])
+			continue;
+		b->rx_msg[num] = msgb_alloc_headroom(GTPU_RX_HEADROOM +
+						     GTPU_RX_SIZE,
+						     GTPU_RX_HEADROOM, "GTP-U");
+		if (!b->rx_msg[num])
+			break;
+	}
+	if (!num)
+		return -ENOMEM;
+
+	rc = gtpu_recv_batch(ep, num);
+	if (rc <= 0)
+		return rc;
+	ep->stats.rx_calls++;
+
+	for (i = 0; i < rc; i++) {
+		struct msgb *msg = b->rx_msg[i];
+
+		if (!b->rx_len[i]) {
+			ep->stats.rx_dropped++;
+			continue;
+		}
+		b->rx_msg[i] = NULL;
+		msgb_put(msg, b->rx_len[i]);
+		gtpu_rx_msg(ep, msg, &b->rx_addr[i]);
+	}
+
+	return rc;
+}
+
+static int gtpu_fd_cb(struct osmo_fd *ofd, unsigned int what)
+{
+	if (!(what & BSC_FD_READ))
+		return 0;
+
+	return gtpu_rx(ofd->data);
+}
+
+int gtpu_tx_flush(struct gtpu_ep *ep)
+{
+	struct gtpu_batch *b = ep->batch;
+	unsigned int sent = 0, num = b->tx_num;
+#ifdef HAVE_SENDMMSG
+	struct mmsghdr mmsg[GTPU_BATCH];
+	struct iovec iov[GTPU_BATCH];
+	unsigned int i;
+#endif
+	int rc = 0;
+
+	osmo_timer_del(&ep->tx_timer);
+	if (!num)
+		return 0;
+
+#ifdef HAVE_SENDMMSG
+	memset(mmsg, 0, sizeof(mmsg[0]) * num);
+	for (i = 0; i < num; i++) {
+		iov[i].iov_base = b->tx_buf[i];
+		iov[i].iov_len = b->tx_len[i];
+		mmsg[i].msg_hdr.msg_iov = &iov[i];
+		mmsg[i].msg_hdr.msg_iovlen = 1;
+		mmsg[i].msg_hdr.msg_name = &b->tx_addr[i];
+		mmsg[i].msg_hdr.msg_namelen = sizeof(b->tx_addr[i]);
+	}
+
+	while (sent < num) {
+		rc = sendmmsg(ep->ofd.fd, mmsg + sent, num - sent, 0);
+		ep->stats.tx_calls++;
+		if (rc <= 0)
+			break;
+		sent += rc;
+	}
+#else
+	for (sent = 0; sent < num; sent++) {
+		rc = sendto(ep->ofd.fd, b->tx_buf[sent], b->tx_len[sent], 0,
+			    (struct sockaddr *) &b->tx_addr[sent],
+			    sizeof(b->tx_addr[sent]));
+		ep->stats.tx_calls++;
+		if (rc < 0)
+			break;
+	}
+#endif
+
+	if (sent < num)
+		LOGP(DGPRS, LOGL_ERROR, "GTP-U: dropping %u G-PDUs: %s\n",
+		     num - sent, rc < 0 ? strerror(errno) : "not sent");
+
+	ep->stats.tx_pkts += sent;
+	ep->stats.tx_dropped += num - sent;
+	b->tx_num = 0;
+
+	return sent == num ? 0 : -EIO;
+}
+
+static void gtpu_tx_timer_cb(void *data)
+{
+	gtpu_tx_flush(data);
+}
+
+int gtpu_tx(struct gtpu_ep *ep, const struct sockaddr_in *to, uint32_t teid,
+	    int seq, const uint8_t *data, unsigned int len)
+{
+	struct gtpu_batch *b = ep->batch;
+	unsigned int hlen = seq >= 0 ? GTPU_HDR_LEN_OPT : GTPU_HDR_LEN;
+	uint8_t *gh = b->tx_buf[b->tx_num];
+
+	if (len > GTPU_MAX_PDU) {
+		ep->stats.tx_dropped++;
+		return -EMSGSIZE;
+	}
+
+	gh[0] = GTPU_F_V1;
+	gh[1] = GTPU_MT_GPDU;
+	gh[2] = (len + hlen - GTPU_HDR_LEN) >> 8;
+	gh[3] = (len + hlen - GTPU_HDR_LEN) & 0xff;
+	gh[4] = teid >> 24;
+	gh[5] = teid >> 16;
+	gh[6] = teid >> 8;
+	gh[7] = teid;
+	if (seq >= 0) {
+		gh[0] |= GTPU_F_S;
+		gh[8] = seq >> 8;
+		gh[9] = seq;
+		gh[10] = 0;
+		gh[11] = 0;
+	}
+	memcpy(gh + hlen, data, len);
+
+	b->tx_addr[b->tx_num] = *to;
+	b->tx_len[b->tx_num] = hlen + len;
+	if (++b->tx_num == GTPU_BATCH)
+		return gtpu_tx_flush(ep);
+
+	if (!osmo_timer_pending(&ep->tx_timer))
+		osmo_timer_schedule(&ep->tx_timer, 0, 0);
+
+	return 0;
+}
+
+int gtpu_ep_init(void *ctx, struct gtpu_ep *ep, int fd)
+{
+	ep->batch = talloc_zero(ctx, struct gtpu_batch);
+	if (!ep->batch)
+		return -ENOMEM;
+
+	ep->tx_timer.cb = gtpu_tx_timer_cb;
+	ep->tx_timer.data = ep;
+
+	ep->ofd.fd = fd;
+	ep->ofd.when = BSC_FD_READ;
+	ep->ofd.cb = gtpu_fd_cb;
+	ep->ofd.data = ep;
+
+	return osmo_fd_register(&ep->ofd);
+}
@@ -139,7 +139,7 @@ struct sgsn_pdp_ctx *sgsn_create_pdp_ctx(struct sgsn_ggsn_ctx *ggsn,
 	}
 	pdp->priv = pctx;
 	pctx->lib = pdp;
-	pctx->ggsn = ggsn;
+	sgsn_pdp_ctx_set_ggsn(pctx, ggsn);
 
 	//pdp->peer =	/* sockaddr_in of GGSN (receive) */
 	//pdp->ipif =	/* not used by library */
@@ -285,7 +285,9 @@ static int create_pdp_conf(struct pdp_t *pdp, void *cbp, int cause)
 	}
 
 	/* Activate the SNDCP layer */
-	sndcp_sm_activate_ind(&pctx->mm->llme->lle[pctx->sapi], pctx->nsapi);
+	sndcp_sm_activate_ind(&pctx->mm->llme->lle[pctx->sapi], pctx->nsapi,
+			      pctx->reliab_class ==
+				GSM48_QOS_RC_LLC_ACK_RLC_ACK_DATA_PROT);
 
 	/* Send PDP CTX ACT to MS */
 	return gsm48_tx_gsm_act_pdp_acc(pctx);
@@ -412,15 +414,12 @@ static int cb_extheader_ind(struct sockaddr_in *peer)
 	return 0;
 }
 
-/* Called whenever we recive a DATA packet */
+/* Called whenever we recive a GTPv0 DATA packet */
 static int cb_data_ind(struct pdp_t *lib, void *packet, unsigned int len)
 {
-	struct bssgp_paging_info pinfo;
 	struct sgsn_pdp_ctx *pdp;
-	struct sgsn_mm_ctx *mm;
 	struct msgb *msg;
 	uint8_t *ud;
-	int rc;
 
 	DEBUGP(DGPRS, "GTP DATA IND from GGSN, length=%u\n", len);
 
@@ -430,52 +429,70 @@ static int cb_data_ind(struct pdp_t *lib, void *packet, unsigned int len)
 		     "GTP DATA IND from GGSN for unknown PDP\n");
 		return -EIO;
 	}
-	mm = pdp->mm;
-	if (!mm) {
-		LOGP(DGPRS, LOGL_ERROR,
-		     "PDP context (imsi=%s) without MM context!\n", mm->imsi);
-		return -EIO;
-	}
 
 	msg = msgb_alloc_headroom(len+256, 128, "GTP->SNDCP");
 	ud = msgb_put(msg, len);
 	memcpy(ud, packet, len);
 
-	msgb_tlli(msg) = mm->tlli;
-	msgb_bvci(msg) = mm->bvci;
-	msgb_nsei(msg) = mm->nsei;
-
-	switch (mm->mm_state) {
-	case GMM_REGISTERED_SUSPENDED:
-		/* initiate PS PAGING procedure */
-		memset(&pinfo, 0, sizeof(pinfo));
-		pinfo.mode = BSSGP_PAGING_PS;
-		pinfo.scope = BSSGP_PAGING_BVCI;
-		pinfo.bvci = mm->bvci;
-		pinfo.imsi = mm->imsi;
-		pinfo.ptmsi = &mm->p_tmsi;
-		pinfo.drx_params = mm->drx_parms;
-		pinfo.qos[0] = 0; // FIXME
-		rc = bssgp_tx_paging(mm->nsei, 0, &pinfo);
-		rate_ctr_inc(&mm->ctrg->ctr[GMM_CTR_PAGING_PS]);
-		/* FIXME: queue the packet we received from GTP */
-		break;
-	case GMM_REGISTERED_NORMAL:
-		break;
-	default:
-		LOGP(DGPRS, LOGL_ERROR, "GTP DATA IND for TLLI %08X in state "
-			"%u\n", mm->tlli, mm->mm_state);
+	return sgsn_rx_gtp_data(pdp, msg);
+}
+
+static int ggsn_addr_match(const struct ul16_t *addr,
+			   const struct sockaddr_in *from)
+{
+	return addr->l == sizeof(from->sin_addr) &&
+	       !memcmp(addr->v, &from->sin_addr, sizeof(from->sin_addr));
+}
+
+/* Called for every GTPv1 G-PDU, msg already has the headroom for SNDCP
+ * and LLC */
+static int sgsn_gtpu_rx_cb(struct gtpu_ep *ep, const struct sockaddr_in *from,
+			   uint32_t teid, struct msgb *msg)
+{
+	struct pdp_t *lib;
+
+	DEBUGP(DGPRS, "GTP-U G-PDU from GGSN, TEID=0x%08x length=%u\n",
+		teid, msg->len);
+
+	if (pdp_getgtp1(&lib, teid) || !lib->inuse || !lib->priv) {
+		LOGP(DGPRS, LOGL_NOTICE, "GTP-U G-PDU from %s for unknown "
+		     "TEID 0x%08x\n", inet_ntoa(from->sin_addr), teid);
 		msgb_free(msg);
-		return -1;
+		return -EIO;
 	}
+	/* the TEID picks the PDP context, as it does in libgtp.  A GGSN may
+	 * send the user plane from another of its addresses, so the packet
+	 * is only counted, not dropped */
+	if (!ggsn_addr_match(&lib->gsnru, from) &&
+	    !ggsn_addr_match(&lib->gsnrc, from)) {
+		struct sgsn_pdp_ctx *pdp = lib->priv;
+
+		DEBUGP(DGPRS, "GTP-U G-PDU for TEID 0x%08x from other "
+			"address %s\n", teid, inet_ntoa(from->sin_addr));
+		rate_ctr_inc(&pdp->ctrg->ctr[PDP_CTR_PKTS_UDATA_OTHER_ADDR]);
+	}
+
+	return sgsn_rx_gtp_data(lib->priv, msg);
+}
 
-	rate_ctr_inc(&pdp->ctrg->ctr[PDP_CTR_PKTS_UDATA_OUT]);
-	rate_ctr_add(&pdp->ctrg->ctr[PDP_CTR_BYTES_UDATA_OUT], len);
-	rate_ctr_inc(&mm->ctrg->ctr[GMM_CTR_PKTS_UDATA_OUT]);
-	rate_ctr_add(&mm->ctrg->ctr[GMM_CTR_BYTES_UDATA_OUT], len);
+/* Send an uplink N-PDU to the GGSN */
+static int sgsn_tx_gtp_data(struct sgsn_pdp_ctx *pdp, uint8_t *npdu,
+			    uint32_t npdu_len)
+{
+	struct pdp_t *lib = pdp->lib;
+	struct sockaddr_in addr;
+
+	/* GTPv0 stays with libgtp */
+	if (lib->version != 1)
+		return gtp_data_req(pdp->ggsn->gsn, lib, npdu, npdu_len);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(GTPU_PORT);
+	memcpy(&addr.sin_addr, lib->gsnru.v, sizeof(addr.sin_addr));
 
-	return sndcp_unitdata_req(msg, &mm->llme->lle[pdp->sapi],
-				  pdp->nsapi, mm);
+	return gtpu_tx(&sgsn->gtpu, &addr, lib->teid_gn,
+		       lib->gtpsntx++ & 0xffff, npdu, npdu_len);
 }
 
 /* Called by SNDCP when it has received/re-assembled a N-PDU */
@@ -504,12 +521,20 @@ int sgsn_rx_sndcp_ud_ind(struct gprs_ra_id *ra_id, int32_t tlli, uint8_t nsapi,
 		return -EIO;
 	}
 
+	/* uplink data is the response of a suspended MS to our paging */
+	if (mmctx->mm_state == GMM_REGISTERED_SUSPENDED) {
+		LOGP(DGPRS, LOGL_INFO, "TLLI=%08x: Uplink data while "
+		     "suspended, resuming\n", tlli);
+		mmctx->mm_state = GMM_REGISTERED_NORMAL;
+		sgsn_mm_dl_flush(mmctx);
+	}
+
 	rate_ctr_inc(&pdp->ctrg->ctr[PDP_CTR_PKTS_UDATA_IN]);
 	rate_ctr_add(&pdp->ctrg->ctr[PDP_CTR_BYTES_UDATA_IN], npdu_len);
 	rate_ctr_inc(&mmctx->ctrg->ctr[GMM_CTR_PKTS_UDATA_IN]);
 	rate_ctr_add(&mmctx->ctrg->ctr[GMM_CTR_BYTES_UDATA_IN], npdu_len);
 
-	return gtp_data_req(pdp->ggsn->gsn, pdp->lib, npdu, npdu_len);
+	return sgsn_tx_gtp_data(pdp, npdu, npdu_len);
 }
 
 /* libgtp select loop integration */
@@ -528,9 +553,6 @@ static int sgsn_gtp_fd_cb(struct osmo_fd *fd, unsigned int what)
 	case 1:
 		rc = gtp_decaps1c(sgi->gsn);
 		break;
-	case 2:
-		rc = gtp_decaps1u(sgi->gsn);
-		break;
 	default:
 		rc = -EINVAL;
 		break;
@@ -591,12 +613,11 @@ int sgsn_gtp_init(struct sgsn_instance *sgi)
 	if (rc < 0)
 		return rc;
 
-	sgi->gtp_fd1u.fd = gsn->fd1u;
-	sgi->gtp_fd1u.priv_nr = 2;
-	sgi->gtp_fd1u.data = sgi;
-	sgi->gtp_fd1u.when = BSC_FD_READ;
-	sgi->gtp_fd1u.cb = sgsn_gtp_fd_cb;
-	osmo_fd_register(&sgi->gtp_fd1u);
+	/* G-PDUs bypass libgtp, see sgsn_gtpu.c */
+	sgi->gtpu.rx_cb = sgsn_gtpu_rx_cb;
+	sgi->gtpu.data = sgi;
+	sgi->gtpu.restart_ctr = gsn->restart_counter;
+	rc = gtpu_ep_init(sgi, &sgi->gtpu, gsn->fd1u);
 	if (rc < 0)
 		return rc;
 
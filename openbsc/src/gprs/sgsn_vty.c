@@ -25,6 +25,7 @@
 #include <osmocom/core/talloc.h>
 #include <osmocom/core/utils.h>
 #include <osmocom/core/rate_ctr.h>
+#include <osmocom/core/statistics.h>
 
 #include <openbsc/debug.h>
 #include <openbsc/sgsn.h>
@@ -42,11 +43,10 @@
 static struct sgsn_config *g_cfg = NULL;
 
 
-#define GSM48_MAX_APN_LEN	102	/* 10.5.6.1 */
 static char *gprs_apn2str(uint8_t *apn, unsigned int len)
 {
 	static char apnbuf[GSM48_MAX_APN_LEN+1];
-	unsigned int i;
+	unsigned int i = 0;
 
 	if (!apn)
 		return "";
@@ -113,6 +113,7 @@ static struct cmd_node sgsn_node = {
 static int config_write_sgsn(struct vty *vty)
 {
 	struct sgsn_ggsn_ctx *gctx;
+	struct apn_ctx *actx;
 
 	vty_out(vty, "sgsn%s", VTY_NEWLINE);
 
@@ -126,6 +127,12 @@ static int config_write_sgsn(struct vty *vty)
 			gctx->gtp_version, VTY_NEWLINE);
 	}
 
+	llist_for_each_entry(actx, &sgsn_apn_ctxts, list) {
+		if (actx->ggsn)
+			vty_out(vty, " apn %s ggsn %u%s", actx->name,
+				actx->ggsn->id, VTY_NEWLINE);
+	}
+
 	return CMD_SUCCESS;
 }
 
@@ -157,8 +164,10 @@ DEFUN(cfg_ggsn_remote_ip, cfg_ggsn_remote_ip_cmd,
 {
 	uint32_t id = atoi(argv[0]);
 	struct sgsn_ggsn_ctx *ggc = sgsn_ggsn_ctx_find_alloc(id);
+	struct in_addr addr;
 
-	inet_aton(argv[1], &ggc->remote_addr);
+	inet_aton(argv[1], &addr);
+	sgsn_ggsn_ctx_set_addr(ggc, &addr);
 
 	return CMD_SUCCESS;
 }
@@ -191,14 +200,17 @@ DEFUN(cfg_ggsn_gtp_version, cfg_ggsn_gtp_version_cmd,
 	return CMD_SUCCESS;
 }
 
-#if 0
 DEFUN(cfg_apn_ggsn, cfg_apn_ggsn_cmd,
 	"apn APNAME ggsn <0-255>",
-	"")
+	"Configure an Access Point Name\n" "Access Point Name\n"
+	"Select the GGSN for this APN\n" "GGSN Number\n")
 {
-	struct apn_ctx **
+	struct apn_ctx *actx = apn_ctx_find_alloc(argv[0]);
+
+	actx->ggsn = sgsn_ggsn_ctx_find_alloc(atoi(argv[1]));
+
+	return CMD_SUCCESS;
 }
-#endif
 
 const struct value_string gprs_mm_st_strs[] = {
 	{ GMM_DEREGISTERED, "DEREGISTERED" },
@@ -220,6 +232,8 @@ static void vty_dump_pdp(struct vty *vty, const char *pfx,
 	vty_out(vty, "%s  PDP Address: %s%s", pfx,
 		gprs_pdpaddr2str(pdp->lib->eua.v, pdp->lib->eua.l),
 		VTY_NEWLINE);
+	vty_out(vty, "%s  Downlink queue: %u N-PDUs, %u bytes%s", pfx,
+		pdp->dl_queue_len, pdp->dl_queue_bytes, VTY_NEWLINE);
 	vty_out_rate_ctr_group(vty, " ", pdp->ctrg);
 }
 
@@ -249,7 +263,10 @@ static void vty_dump_mmctx(struct vty *vty, const char *pfx,
 DEFUN(show_sgsn, show_sgsn_cmd, "show sgsn",
       SHOW_STR "Display information about the SGSN")
 {
-	/* FIXME: statistics */
+	/* FIXME: more statistics */
+	vty_out(vty, "Downlink N-PDUs queued for paging: %lu%s",
+		sgsn_dl_queue_depth ? osmo_counter_get(sgsn_dl_queue_depth) : 0,
+		VTY_NEWLINE);
 	return CMD_SUCCESS;
 }
 
@@ -341,6 +358,7 @@ int sgsn_vty_init(void)
 	install_element(SGSN_NODE, &cfg_ggsn_remote_ip_cmd);
 	//install_element(SGSN_NODE, &cfg_ggsn_remote_port_cmd);
 	install_element(SGSN_NODE, &cfg_ggsn_gtp_version_cmd);
+	install_element(SGSN_NODE, &cfg_apn_ggsn_cmd);
 
 	return 0;
 }
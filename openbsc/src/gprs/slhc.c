@@ -0,0 +1,430 @@
+/* RFC 1144 TCP/IP header compression, as used by SNDCP (3GPP TS 44.065) */
+
+/* The algorithm, the wire format and the slhc_* naming are those of the
+ * reference implementation by Van Jacobson in RFC 1144, "Compressing
+ * TCP/IP Headers for Low-Speed Serial Links", February 1990, which is
+ * (C) 1989 by the Regents of the University of California.  This file
+ * is a new implementation of that algorithm and contains none of its
+ * code. */
+
+/*
+ * (C) 2026 by the OpenBSC contributors
+ * All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include <openbsc/slhc.h>
+
+/* TCP flags */
+#define TH_FIN		0x01
+#define TH_SYN		0x02
+#define TH_RST		0x04
+#define TH_PUSH		0x08
+#define TH_ACK		0x10
+#define TH_URG		0x20
+
+/* bits of the change mask, RFC 1144 Chapter 3.2.2 */
+#define NEW_C		0x40
+#define NEW_I		0x20
+#define TCP_PUSH_BIT	0x10
+#define NEW_S		0x08
+#define NEW_A		0x04
+#define NEW_W		0x02
+#define NEW_U		0x01
+
+#define SPECIAL_I	(NEW_S | NEW_W | NEW_U)
+#define SPECIAL_D	(NEW_S | NEW_A | NEW_W | NEW_U)
+#define SPECIALS_MASK	(NEW_S | NEW_A | NEW_W | NEW_U)
+
+static inline uint16_t get16(const uint8_t *p)
+{
+	return (p[0] << 8) | p[1];
+}
+
+static inline uint32_t get32(const uint8_t *p)
+{
+	return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static inline void put16(uint8_t *p, uint16_t val)
+{
+	p[0] = val >> 8;
+	p[1] = val;
+}
+
+static inline void put32(uint8_t *p, uint32_t val)
+{
+	p[0] = val >> 24;
+	p[1] = val >> 16;
+	p[2] = val >> 8;
+	p[3] = val;
+}
+
+static uint16_t ip_csum(const uint8_t *hdr, unsigned int len)
+{
+	uint32_t sum = 0;
+	unsigned int i;
+
+	for (i = 0; i < len; i += 2)
+		sum += get16(hdr + i);
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+
+	return ~sum;
+}
+
+/* return the IP + TCP header length of a compressible packet, or 0 */
+static unsigned int tcp_hdr_len(const uint8_t *pkt, unsigned int len)
+{
+	unsigned int ihl, hlen;
+
+	if (len < 40 || (pkt[0] >> 4) != 4 || pkt[9] != IPPROTO_TCP)
+		return 0;
+	/* don't bother with fragments */
+	if (get16(pkt + 6) & 0x3fff)
+		return 0;
+
+	ihl = (pkt[0] & 0xf) * 4;
+	if (ihl < 20 || ihl + 20 > len)
+		return 0;
+	hlen = ihl + (pkt[ihl + 12] >> 4) * 4;
+	if (hlen < ihl + 20 || hlen > len || hlen > SLHC_MAX_HDR)
+		return 0;
+
+	return hlen;
+}
+
+static uint8_t *encode(uint8_t *cp, uint16_t n)
+{
+	if (n == 0 || n >= 256) {
+		*cp++ = 0;
+		*cp++ = n >> 8;
+	}
+	*cp++ = n;
+	return cp;
+}
+
+static int decode(const uint8_t **cp, const uint8_t *end, uint32_t *val)
+{
+	const uint8_t *p = *cp;
+
+	if (p >= end)
+		return -EINVAL;
+	if (*p == 0) {
+		if (p + 3 > end)
+			return -EINVAL;
+		*val = get16(p + 1);
+		*cp = p + 3;
+	} else {
+		*val = *p;
+		*cp = p + 1;
+	}
+	return 0;
+}
+
+void slhc_init(struct slhc *comp, unsigned int num_slots)
+{
+	memset(comp, 0, sizeof(*comp));
+
+	if (num_slots < 1)
+		num_slots = 1;
+	if (num_slots > SLHC_MAX_SLOTS)
+		num_slots = SLHC_MAX_SLOTS;
+	comp->num_slots = num_slots;
+	comp->tx_last = 0xff;
+	comp->rx_toss = 1;
+}
+
+enum slhc_type slhc_compress(struct slhc *comp, uint8_t *pkt,
+			     unsigned int len, uint8_t **hdr)
+{
+	struct slhc_cstate *cs, *lru = NULL;
+	uint8_t new_seq[16], *cp = new_seq, *th, *oip, *oth, *out;
+	uint8_t tcp_csum[2];
+	unsigned int hlen, ihl, changes = 0, i;
+	uint32_t delta_s, delta_a;
+	uint16_t delta;
+
+	*hdr = pkt;
+
+	hlen = tcp_hdr_len(pkt, len);
+	if (!hlen || get16(pkt + 2) != len)
+		return SLHC_TYPE_IP;
+	ihl = (pkt[0] & 0xf) * 4;
+	th = pkt + ihl;
+
+	/* connection setup and teardown are sent as they are */
+	if ((th[13] & (TH_SYN | TH_FIN | TH_RST | TH_ACK)) != TH_ACK)
+		return SLHC_TYPE_IP;
+
+	/* find the connection state, or the least recently used one */
+	for (i = 0; i < comp->num_slots; i++) {
+		cs = &comp->tx[i];
+		if (!cs->hlen) {
+			if (!lru || lru->hlen)
+				lru = cs;
+			continue;
+		}
+		oth = cs->hdr + (cs->hdr[0] & 0xf) * 4;
+		if (!memcmp(pkt + 12, cs->hdr + 12, 8) && !memcmp(th, oth, 4))
+			goto found;
+		if (!lru || (lru->hlen && cs->lru < lru->lru))
+			lru = cs;
+	}
+	cs = lru;
+	if (!cs)
+		return SLHC_TYPE_IP;
+	goto uncompressed;
+
+found:
+	oip = cs->hdr;
+	oth = oip + ihl;
+
+	/* everything that is not delta coded must be unchanged */
+	if (oip[0] != pkt[0] || oip[1] != pkt[1] ||
+	    get16(oip + 6) != get16(pkt + 6) || oip[8] != pkt[8] ||
+	    oth[12] != th[12] || cs->hlen != hlen ||
+	    ((oth[13] ^ th[13]) & ~(TH_PUSH | TH_URG)) ||
+	    memcmp(oip + 20, pkt + 20, ihl - 20) ||
+	    memcmp(oth + 20, th + 20, hlen - ihl - 20))
+		goto uncompressed;
+
+	if (th[13] & TH_URG) {
+		cp = encode(cp, get16(th + 18));
+		changes |= NEW_U;
+	} else if ((oth[13] & TH_URG) || get16(th + 18) != get16(oth + 18))
+		goto uncompressed;
+
+	delta = get16(th + 14) - get16(oth + 14);
+	if (delta) {
+		cp = encode(cp, delta);
+		changes |= NEW_W;
+	}
+
+	delta_a = get32(th + 8) - get32(oth + 8);
+	if (delta_a) {
+		if (delta_a > 0xffff)
+			goto uncompressed;
+		cp = encode(cp, delta_a);
+		changes |= NEW_A;
+	}
+
+	delta_s = get32(th + 4) - get32(oth + 4);
+	if (delta_s) {
+		if (delta_s > 0xffff)
+			goto uncompressed;
+		cp = encode(cp, delta_s);
+		changes |= NEW_S;
+	}
+
+	switch (changes) {
+	case 0:
+		/* data following a pure ACK is fine, anything else is
+		 * most likely a retransmission */
+		if (get16(pkt + 2) != get16(oip + 2) && get16(oip + 2) == hlen)
+			break;
+		goto uncompressed;
+	case SPECIAL_I:
+	case SPECIAL_D:
+		/* would be mistaken for the special cases below */
+		goto uncompressed;
+	case NEW_S | NEW_A:
+		if (delta_s == delta_a && delta_s == get16(oip + 2) - hlen) {
+			/* echoed interactive traffic */
+			changes = SPECIAL_I;
+			cp = new_seq;
+		}
+		break;
+	case NEW_S:
+		if (delta_s == get16(oip + 2) - hlen) {
+			/* unidirectional data transfer */
+			changes = SPECIAL_D;
+			cp = new_seq;
+		}
+		break;
+	}
+
+	delta = get16(pkt + 4) - get16(oip + 4);
+	if (delta != 1) {
+		cp = encode(cp, delta);
+		changes |= NEW_I;
+	}
+	if (th[13] & TH_PUSH)
+		changes |= TCP_PUSH_BIT;
+
+	memcpy(cs->hdr, pkt, hlen);
+	cs->lru = ++comp->tx_clock;
+
+	/* build the compressed header right in front of the payload,
+	 * where it may overlap the TCP checksum */
+	tcp_csum[0] = th[16];
+	tcp_csum[1] = th[17];
+	i = cp - new_seq;
+	if (comp->tx_last != cs - comp->tx) {
+		comp->tx_last = cs - comp->tx;
+		changes |= NEW_C;
+	}
+	out = pkt + hlen - i - 3 - ((changes & NEW_C) ? 1 : 0);
+	*hdr = out;
+	*out++ = changes;
+	if (changes & NEW_C)
+		*out++ = comp->tx_last;
+	*out++ = tcp_csum[0];
+	*out++ = tcp_csum[1];
+	memcpy(out, new_seq, i);
+
+	return SLHC_TYPE_COMPRESSED_TCP;
+
+uncompressed:
+	memcpy(cs->hdr, pkt, hlen);
+	cs->hlen = hlen;
+	cs->lru = ++comp->tx_clock;
+	comp->tx_last = cs - comp->tx;
+	/* the connection number replaces the protocol */
+	pkt[9] = comp->tx_last;
+
+	return SLHC_TYPE_UNCOMPRESSED_TCP;
+}
+
+int slhc_uncompress(struct slhc *comp, enum slhc_type type,
+		    const uint8_t *in, unsigned int in_len, uint8_t *out)
+{
+	const uint8_t *cp = in, *end = in + in_len;
+	struct slhc_cstate *cs;
+	unsigned int changes, hlen, ihl, id;
+	uint8_t *ip, *th;
+	uint32_t val;
+
+	switch (type) {
+	case SLHC_TYPE_IP:
+		memcpy(out, in, in_len);
+		return in_len;
+	case SLHC_TYPE_UNCOMPRESSED_TCP:
+		if (in_len < 40)
+			goto bad;
+		id = in[9];
+		if (id >= comp->num_slots)
+			goto bad;
+		memcpy(out, in, in_len);
+		out[9] = IPPROTO_TCP;
+		hlen = tcp_hdr_len(out, in_len);
+		if (!hlen)
+			goto bad;
+
+		cs = &comp->rx[id];
+		memcpy(cs->hdr, out, hlen);
+		cs->hlen = hlen;
+		comp->rx_last = id;
+		comp->rx_toss = 0;
+		return in_len;
+	case SLHC_TYPE_COMPRESSED_TCP:
+		break;
+	default:
+		goto bad;
+	}
+
+	if (in_len < 3)
+		goto bad;
+	changes = *cp++;
+	if (changes & NEW_C) {
+		id = *cp++;
+		if (id >= comp->num_slots)
+			goto bad;
+		comp->rx_last = id;
+		comp->rx_toss = 0;
+	} else if (comp->rx_toss)
+		return -EIO;
+
+	cs = &comp->rx[comp->rx_last];
+	if (!cs->hlen || cp + 2 > end)
+		goto bad;
+	hlen = cs->hlen;
+	ip = cs->hdr;
+	ihl = (ip[0] & 0xf) * 4;
+	th = ip + ihl;
+
+	th[16] = *cp++;
+	th[17] = *cp++;
+	if (changes & TCP_PUSH_BIT)
+		th[13] |= TH_PUSH;
+	else
+		th[13] &= ~TH_PUSH;
+
+	switch (changes & SPECIALS_MASK) {
+	case SPECIAL_I:
+		val = get16(ip + 2) - hlen;
+		put32(th + 8, get32(th + 8) + val);
+		put32(th + 4, get32(th + 4) + val);
+		break;
+	case SPECIAL_D:
+		put32(th + 4, get32(th + 4) + get16(ip + 2) - hlen);
+		break;
+	default:
+		if (changes & NEW_U) {
+			th[13] |= TH_URG;
+			if (decode(&cp, end, &val) < 0)
+				goto bad;
+			put16(th + 18, val);
+		} else
+			th[13] &= ~TH_URG;
+		if (changes & NEW_W) {
+			if (decode(&cp, end, &val) < 0)
+				goto bad;
+			put16(th + 14, get16(th + 14) + val);
+		}
+		if (changes & NEW_A) {
+			if (decode(&cp, end, &val) < 0)
+				goto bad;
+			put32(th + 8, get32(th + 8) + val);
+		}
+		if (changes & NEW_S) {
+			if (decode(&cp, end, &val) < 0)
+				goto bad;
+			put32(th + 4, get32(th + 4) + val);
+		}
+		break;
+	}
+
+	if (changes & NEW_I) {
+		if (decode(&cp, end, &val) < 0)
+			goto bad;
+		put16(ip + 4, get16(ip + 4) + val);
+	} else
+		put16(ip + 4, get16(ip + 4) + 1);
+
+	/* rebuild total length and header checksum */
+	put16(ip + 2, hlen + (end - cp));
+	put16(ip + 10, 0);
+	put16(ip + 10, ip_csum(ip, ihl));
+
+	memcpy(out, ip, hlen);
+	memcpy(out + hlen, cp, end - cp);
+	return hlen + (end - cp);
+
+bad:
+	comp->rx_toss = 1;
+	return -EINVAL;
+}
+
+void slhc_toss(struct slhc *comp)
+{
+	comp->rx_toss = 1;
+}
@@ -0,0 +1,326 @@
+/* ITU-T V.42bis data compression, as used by SNDCP (3GPP TS 44.065) */
+
+/*
+ * (C) 2026 by the OpenBSC contributors
+ * All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* SNDCP always operates V.42bis in compressed mode and flushes at the
+ * end of each N-PDU, so the transparent mode is not implemented. */
+
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <osmocom/core/talloc.h>
+
+#include <openbsc/v42bis.h>
+
+/* control codewords */
+#define V42BIS_ETM	0
+#define V42BIS_FLUSH	1
+#define V42BIS_STEPUP	2
+
+/* number of control codewords and first dictionary entry */
+#define V42BIS_N6	3
+#define V42BIS_N5	(256 + V42BIS_N6)
+
+static int dict_init(void *ctx, struct v42bis_dict *d,
+		     unsigned int p1, unsigned int p2)
+{
+	unsigned int i;
+
+	d->n2 = p1;
+	d->n7 = p2;
+	for (d->n1 = 9; (1U << d->n1) < d->n2; d->n1++)
+		;
+	d->c1 = V42BIS_N5;
+	d->c2 = 9;
+	d->c3 = 512;
+
+	d->nodes = talloc_zero_array(ctx, struct v42bis_node, d->n2);
+	if (!d->nodes)
+		return -ENOMEM;
+	for (i = 0; i < 256; i++) {
+		d->nodes[i + V42BIS_N6].byte = i;
+		d->nodes[i + V42BIS_N6].depth = 1;
+	}
+
+	return 0;
+}
+
+static uint16_t dict_find(struct v42bis_dict *d, uint16_t string, uint8_t byte)
+{
+	uint16_t n;
+
+	for (n = d->nodes[string].child; n; n = d->nodes[n].sibling) {
+		if (d->nodes[n].byte == byte)
+			return n;
+	}
+	return 0;
+}
+
+static void dict_unlink(struct v42bis_dict *d, uint16_t n)
+{
+	struct v42bis_node *parent = &d->nodes[d->nodes[n].parent];
+	uint16_t *link = &parent->child;
+
+	while (*link != n)
+		link = &d->nodes[*link].sibling;
+	*link = d->nodes[n].sibling;
+
+	memset(&d->nodes[n], 0, sizeof(d->nodes[n]));
+}
+
+/* Get the next free entry, recycling leaf nodes once the dictionary is
+ * full.  The string to be extended must not be recycled. */
+static uint16_t dict_alloc(struct v42bis_dict *d, uint16_t exclude)
+{
+	unsigned int i;
+
+	for (i = V42BIS_N5; i < d->n2; i++) {
+		uint16_t n = d->c1;
+
+		if (++d->c1 >= d->n2)
+			d->c1 = V42BIS_N5;
+
+		if (!d->nodes[n].depth)
+			return n;
+		if (d->nodes[n].child || n == exclude)
+			continue;
+		dict_unlink(d, n);
+		return n;
+	}
+	return 0;
+}
+
+static void dict_add(struct v42bis_dict *d, uint16_t string, uint8_t byte,
+		     uint16_t n)
+{
+	struct v42bis_node *node = &d->nodes[n];
+
+	node->parent = string;
+	node->byte = byte;
+	node->depth = d->nodes[string].depth + 1;
+	node->child = 0;
+	node->sibling = d->nodes[string].child;
+	d->nodes[string].child = n;
+}
+
+struct v42bis *v42bis_alloc(void *ctx, unsigned int p1, unsigned int p2)
+{
+	struct v42bis *v;
+
+	if (p1 < V42BIS_MIN_CODEWORDS)
+		p1 = V42BIS_MIN_CODEWORDS;
+	if (p1 > V42BIS_MAX_CODEWORDS)
+		p1 = V42BIS_MAX_CODEWORDS;
+	if (p2 < V42BIS_MIN_STRING)
+		p2 = V42BIS_MIN_STRING;
+	if (p2 > V42BIS_MAX_STRING)
+		p2 = V42BIS_MAX_STRING;
+
+	v = talloc_zero(ctx, struct v42bis);
+	if (!v)
+		return NULL;
+
+	if (dict_init(v, &v->tx.dict, p1, p2) < 0 ||
+	    dict_init(v, &v->rx.dict, p1, p2) < 0) {
+		talloc_free(v);
+		return NULL;
+	}
+
+	return v;
+}
+
+struct bit_writer {
+	uint8_t *out;
+	unsigned int len;
+	unsigned int max;
+};
+
+static int put_bits(struct v42bis_comp *c, struct bit_writer *bw,
+		    uint16_t val, unsigned int num_bits)
+{
+	c->bits |= (uint32_t) val << c->num_bits;
+	c->num_bits += num_bits;
+
+	while (c->num_bits >= 8) {
+		if (bw->len >= bw->max)
+			return -ENOSPC;
+		bw->out[bw->len++] = c->bits;
+		c->bits >>= 8;
+		c->num_bits -= 8;
+	}
+	return 0;
+}
+
+static int put_codeword(struct v42bis_comp *c, struct bit_writer *bw,
+			uint16_t code)
+{
+	struct v42bis_dict *d = &c->dict;
+
+	while (code >= d->c3) {
+		if (put_bits(c, bw, V42BIS_STEPUP, d->c2) < 0)
+			return -ENOSPC;
+		d->c2++;
+		d->c3 <<= 1;
+	}
+	return put_bits(c, bw, code, d->c2);
+}
+
+int v42bis_compress(struct v42bis *v, const uint8_t *in, unsigned int len,
+		    uint8_t *out, unsigned int out_max)
+{
+	struct v42bis_comp *c = &v->tx;
+	struct v42bis_dict *d = &c->dict;
+	struct bit_writer bw = { out, 0, out_max };
+	unsigned int i;
+	uint16_t n;
+
+	for (i = 0; i < len; i++) {
+		uint8_t byte = in[i];
+
+		if (!c->string) {
+			c->string = byte + V42BIS_N6;
+			continue;
+		}
+		if (d->nodes[c->string].depth < d->n7) {
+			n = dict_find(d, c->string, byte);
+			if (n) {
+				c->string = n;
+				continue;
+			}
+		}
+
+		if (put_codeword(c, &bw, c->string) < 0)
+			return -ENOSPC;
+		if (d->nodes[c->string].depth < d->n7) {
+			n = dict_alloc(d, c->string);
+			if (n)
+				dict_add(d, c->string, byte, n);
+		}
+		c->string = byte + V42BIS_N6;
+	}
+
+	/* flush: terminate the string and pad to an octet boundary */
+	if (c->string && put_codeword(c, &bw, c->string) < 0)
+		return -ENOSPC;
+	c->string = 0;
+	if (put_bits(c, &bw, V42BIS_FLUSH, d->c2) < 0)
+		return -ENOSPC;
+	if (c->num_bits && put_bits(c, &bw, 0, 8 - c->num_bits) < 0)
+		return -ENOSPC;
+
+	return bw.len;
+}
+
+/* write the string of node n to out, returns its length */
+static int get_string(struct v42bis_dict *d, uint16_t n, uint8_t *out,
+		      unsigned int out_max)
+{
+	unsigned int len = d->nodes[n].depth, i;
+
+	if (len > out_max)
+		return -ENOSPC;
+	for (i = len; i > 0; i--) {
+		out[i - 1] = d->nodes[n].byte;
+		n = d->nodes[n].parent;
+	}
+	return len;
+}
+
+int v42bis_decompress(struct v42bis *v, const uint8_t *in, unsigned int len,
+		      uint8_t *out, unsigned int out_max)
+{
+	struct v42bis_comp *c = &v->rx;
+	struct v42bis_dict *d = &c->dict;
+	const uint8_t *end = in + len;
+	unsigned int out_len = 0;
+	int rc;
+
+	while (1) {
+		uint16_t code, n = 0;
+
+		while (c->num_bits < d->c2) {
+			if (in >= end)
+				goto out;
+			c->bits |= (uint32_t) *in++ << c->num_bits;
+			c->num_bits += 8;
+		}
+		code = c->bits & ((1 << d->c2) - 1);
+		c->bits >>= d->c2;
+		c->num_bits -= d->c2;
+
+		switch (code) {
+		case V42BIS_ETM:
+			return -EINVAL;
+		case V42BIS_FLUSH:
+			/* the rest of the octet is padding */
+			c->bits = 0;
+			c->num_bits = 0;
+			c->string = 0;
+			continue;
+		case V42BIS_STEPUP:
+			if (d->c2 >= d->n1)
+				return -EINVAL;
+			d->c2++;
+			d->c3 <<= 1;
+			continue;
+		}
+
+		if (code >= d->n2)
+			return -EINVAL;
+
+		/* create the entry the compressor added after sending the
+		 * previous string, its last byte is known below */
+		if (c->string && d->nodes[c->string].depth < d->n7)
+			n = dict_alloc(d, c->string);
+
+		if (n && code == n) {
+			/* the string just added: previous string plus its
+			 * own first byte */
+			rc = get_string(d, c->string, out + out_len,
+					out_max - out_len);
+			if (rc < 0 || out_len + rc >= out_max)
+				return -ENOSPC;
+			out[out_len + rc] = out[out_len];
+			rc++;
+		} else {
+			if (!d->nodes[code].depth)
+				return -EINVAL;
+			rc = get_string(d, code, out + out_len,
+					out_max - out_len);
+			if (rc < 0)
+				return rc;
+		}
+
+		if (n)
+			dict_add(d, c->string, out[out_len], n);
+		c->string = code;
+		out_len += rc;
+	}
+
+out:
+	/* a flushed N-PDU ends on an octet boundary */
+	if (c->num_bits) {
+		c->bits = 0;
+		c->num_bits = 0;
+		return -EINVAL;
+	}
+	return out_len;
+}
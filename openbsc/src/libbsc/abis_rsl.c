@@ -226,7 +226,9 @@ int rsl_bcch_info(struct gsm_bts_trx *trx, uint8_t type,
 	dh->chan_nr = RSL_CHAN_BCCH;
 
 	msgb_tv_put(msg, RSL_IE_SYSINFO_TYPE, type);
-	msgb_tlv_put(msg, RSL_IE_FULL_BCCH_INFO, len, data);
+	/* without the info the BTS stops sending this SI type */
+	if (data)
+		msgb_tlv_put(msg, RSL_IE_FULL_BCCH_INFO, len, data);
 
 	msg->dst = trx->rsl_link;
 
@@ -244,7 +246,8 @@ int rsl_sacch_filling(struct gsm_bts_trx *trx, uint8_t type,
 	ch->msg_type = RSL_MT_SACCH_FILL;
 
 	msgb_tv_put(msg, RSL_IE_SYSINFO_TYPE, type);
-	msgb_tl16v_put(msg, RSL_IE_L3_INFO, len, data);
+	if (data)
+		msgb_tl16v_put(msg, RSL_IE_L3_INFO, len, data);
 
 	msg->dst = trx->rsl_link;
 
@@ -263,7 +266,8 @@ int rsl_sacch_info_modify(struct gsm_lchan *lchan, uint8_t type,
 	dh->chan_nr = chan_nr;
 
 	msgb_tv_put(msg, RSL_IE_SYSINFO_TYPE, type);
-	msgb_tl16v_put(msg, RSL_IE_L3_INFO, len, data);
+	if (data)
+		msgb_tl16v_put(msg, RSL_IE_L3_INFO, len, data);
 
 	msg->dst = lchan->ts->trx->rsl_link;
 
@@ -1107,6 +1111,7 @@ static int rsl_rx_meas_res(struct msgb *msg)
 
 	print_meas_rep(msg->lchan, mr);
 
+	meas_rep_sums_add(&msg->lchan->meas_sums, mr);
 	send_lchan_signal(S_LCHAN_MEAS_REP, msg->lchan, mr);
 
 	return 0;
@@ -1137,15 +1142,14 @@ static int abis_rsl_rx_dchan(struct msgb *msg)
 {
 	struct abis_rsl_dchan_hdr *rslh = msgb_l2(msg);
 	int rc = 0;
-	char *ts_name;
 	struct e1inp_sign_link *sign_link = msg->dst;
 
 	msg->lchan = lchan_lookup(sign_link->trx, rslh->chan_nr);
-	ts_name = gsm_lchan_name(msg->lchan);
 
 	switch (rslh->c.msg_type) {
 	case RSL_MT_CHAN_ACTIV_ACK:
-		DEBUGP(DRSL, "%s CHANNEL ACTIVATE ACK\n", ts_name);
+		DEBUGP(DRSL, "%s CHANNEL ACTIVATE ACK\n",
+			gsm_lchan_name(msg->lchan));
 		rc = rsl_rx_chan_act_ack(msg);
 		break;
 	case RSL_MT_CHAN_ACTIV_NACK:
@@ -1164,24 +1168,30 @@ static int abis_rsl_rx_dchan(struct msgb *msg)
 		rc = rsl_rx_rf_chan_rel_ack(msg->lchan);
 		break;
 	case RSL_MT_MODE_MODIFY_ACK:
-		DEBUGP(DRSL, "%s CHANNEL MODE MODIFY ACK\n", ts_name);
+		DEBUGP(DRSL, "%s CHANNEL MODE MODIFY ACK\n",
+			gsm_lchan_name(msg->lchan));
 		break;
 	case RSL_MT_MODE_MODIFY_NACK:
-		LOGP(DRSL, LOGL_ERROR, "%s CHANNEL MODE MODIFY NACK\n", ts_name);
+		LOGP(DRSL, LOGL_ERROR, "%s CHANNEL MODE MODIFY NACK\n",
+			gsm_lchan_name(msg->lchan));
 		break;
 	case RSL_MT_IPAC_PDCH_ACT_ACK:
-		DEBUGPC(DRSL, "%s IPAC PDCH ACT ACK\n", ts_name);
+		DEBUGPC(DRSL, "%s IPAC PDCH ACT ACK\n",
+			gsm_lchan_name(msg->lchan));
 		msg->lchan->ts->flags |= TS_F_PDCH_MODE;
 		break;
 	case RSL_MT_IPAC_PDCH_ACT_NACK:
-		LOGP(DRSL, LOGL_ERROR, "%s IPAC PDCH ACT NACK\n", ts_name);
+		LOGP(DRSL, LOGL_ERROR, "%s IPAC PDCH ACT NACK\n",
+			gsm_lchan_name(msg->lchan));
 		break;
 	case RSL_MT_IPAC_PDCH_DEACT_ACK:
-		DEBUGP(DRSL, "%s IPAC PDCH DEACT ACK\n", ts_name);
+		DEBUGP(DRSL, "%s IPAC PDCH DEACT ACK\n",
+			gsm_lchan_name(msg->lchan));
 		msg->lchan->ts->flags &= ~TS_F_PDCH_MODE;
 		break;
 	case RSL_MT_IPAC_PDCH_DEACT_NACK:
-		LOGP(DRSL, LOGL_ERROR, "%s IPAC PDCH DEACT NACK\n", ts_name);
+		LOGP(DRSL, LOGL_ERROR, "%s IPAC PDCH DEACT NACK\n",
+			gsm_lchan_name(msg->lchan));
 		break;
 	case RSL_MT_PHY_CONTEXT_CONF:
 	case RSL_MT_PREPROC_MEAS_RES:
@@ -1192,11 +1202,12 @@ static int abis_rsl_rx_dchan(struct msgb *msg)
 	case RSL_MT_MR_CODEC_MOD_NACK:
 	case RSL_MT_MR_CODEC_MOD_PER:
 		LOGP(DRSL, LOGL_NOTICE, "%s Unimplemented Abis RSL DChan "
-			"msg 0x%02x\n", ts_name, rslh->c.msg_type);
+			"msg 0x%02x\n", gsm_lchan_name(msg->lchan),
+			rslh->c.msg_type);
 		break;
 	default:
 		LOGP(DRSL, LOGL_NOTICE, "%s unknown Abis RSL DChan msg 0x%02x\n",
-			ts_name, rslh->c.msg_type);
+			gsm_lchan_name(msg->lchan), rslh->c.msg_type);
 		return -EINVAL;
 	}
 
@@ -20,6 +20,9 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdlib.h>
+#include <string.h>
+
 #include <openbsc/arfcn_range_encode.h>
 #include <openbsc/debug.h>
 
@@ -134,6 +137,195 @@ int range_enc_arfcns(const int range,
 	return 0;
 }
 
+/*
+ * A subtree still to be encoded by range_enc_arfcns_iter: its range, the
+ * index of its W(i) and the ARFCNs relative to its origin.
+ */
+struct range_enc_node {
+	int range;
+	int index;
+	int *arfcns;
+	int size;
+};
+
+/*
+ * Every level halves the range, so starting with 1023 the leaves are
+ * reached after ten levels. Each level holds at most all of the ARFCNs.
+ */
+#define RANGE_ENC_MAX_LEVELS	10
+
+/**
+ * Range encode the ARFCN list like range_enc_arfcns but without recursion
+ * and variable length arrays. The subtrees are processed from a queue and
+ * their ARFCNs are placed in one scratch buffer.
+ * \param range The range to use.
+ * \param arfcns The list of ARFCNs
+ * \param size The size of the list of ARFCNs
+ * \param out Place to store the W(i) output.
+ * \returns 0 on success, -1 if the list can not be encoded
+ */
+int range_enc_arfcns_iter(const int range, const int *arfcns, int size,
+			  int *out)
+{
+	struct range_enc_node queue[RANGE_ENC_MAX_ARFCNS];
+	int scratch[RANGE_ENC_MAX_ARFCNS * (RANGE_ENC_MAX_LEVELS + 1)];
+	int head = 0, tail = 0, used = 0;
+
+	if (size > RANGE_ENC_MAX_ARFCNS)
+		return -1;
+	if (size == 0)
+		return 0;
+
+	memcpy(scratch, arfcns, size * sizeof(*arfcns));
+	used = size;
+	queue[tail++] = (struct range_enc_node) {
+		.range = range, .index = 0, .arfcns = scratch, .size = size,
+	};
+
+	while (head < tail) {
+		struct range_enc_node *node = &queue[head++];
+		struct range_enc_node left, right;
+		int split_at, l_origin, r_origin, pow2, i, d;
+
+		if (node->index >= RANGE_ENC_MAX_ARFCNS)
+			return -1;
+
+		if (node->size == 1) {
+			out[node->index] = 1 + node->arfcns[0];
+			continue;
+		}
+
+		split_at = range_enc_find_index(node->range, node->arfcns,
+						node->size);
+		if (split_at < 0)
+			return -1;
+		out[node->index] = 1 + node->arfcns[split_at];
+
+		/* the children split the other ARFCNs between them */
+		if (used + node->size - 1 > ARRAY_SIZE(scratch))
+			return -1;
+
+		pow2 = greatest_power_of_2_lesser_or_equal_to(node->index + 1);
+		left.range = node->range / 2;
+		left.index = node->index + pow2;
+		left.arfcns = &scratch[used];
+		left.size = 0;
+		l_origin = mod(node->arfcns[split_at] + ((node->range - 1) / 2) + 1,
+			       node->range);
+		for (i = 0; i < node->size; ++i) {
+			d = mod(node->arfcns[i] - l_origin, node->range);
+			if (d < node->range / 2)
+				left.arfcns[left.size++] = d;
+		}
+		used += left.size;
+
+		right.range = (node->range - 1) / 2;
+		right.index = node->index + 2 * pow2;
+		right.arfcns = &scratch[used];
+		right.size = 0;
+		r_origin = mod(node->arfcns[split_at] + 1, node->range);
+		for (i = 0; i < node->size; ++i) {
+			d = mod(node->arfcns[i] - r_origin, node->range);
+			if (d < node->range / 2)
+				right.arfcns[right.size++] = d;
+		}
+		used += right.size;
+
+		/* every ARFCN is the split point of exactly one subtree */
+		if (left.size)
+			queue[tail++] = left;
+		if (right.size)
+			queue[tail++] = right;
+	}
+
+	return 0;
+}
+
+/*
+ * Many BTS of a network carry the same neighbor sets, so remember the
+ * W(i) of the last encodings keyed by the range and the sorted ARFCNs.
+ */
+#define RANGE_ENC_MEMO_SIZE	16
+
+struct range_enc_memo {
+	int valid;
+	int range;
+	int size;
+	int arfcns[RANGE_ENC_MAX_ARFCNS];
+	int w[RANGE_ENC_MAX_ARFCNS];
+};
+
+static struct range_enc_memo range_enc_memo[RANGE_ENC_MEMO_SIZE];
+
+static unsigned int range_enc_memo_hash(const int range, const int *arfcns,
+					const int size)
+{
+	unsigned int hash = range;
+	int i;
+
+	for (i = 0; i < size; ++i)
+		hash = hash * 31 + arfcns[i];
+
+	return hash % RANGE_ENC_MEMO_SIZE;
+}
+
+static int range_enc_memo_cmp(const void *a, const void *b)
+{
+	return *(const int *) a - *(const int *) b;
+}
+
+/**
+ * Range encode the ARFCN list, re-using the result of an earlier encoding
+ * of the same set of ARFCNs in any order if it is still known.
+ * \param range The range to use.
+ * \param arfcns The list of ARFCNs
+ * \param size The size of the list of ARFCNs
+ * \param out Place to store the W(i) output, RANGE_ENC_MAX_ARFCNS entries
+ * \returns 0 on success, -1 if the list can not be encoded
+ */
+int range_enc_arfcns_cached(const int range, const int *arfcns, int size,
+			    int *out)
+{
+	struct range_enc_memo *memo;
+	int sorted[RANGE_ENC_MAX_ARFCNS];
+	int rc;
+
+	if (size > RANGE_ENC_MAX_ARFCNS)
+		return -1;
+
+	/* every order of a set gives valid W(i), encode the sorted one */
+	memcpy(sorted, arfcns, size * sizeof(*arfcns));
+	qsort(sorted, size, sizeof(*sorted), range_enc_memo_cmp);
+
+	memo = &range_enc_memo[range_enc_memo_hash(range, sorted, size)];
+	if (memo->valid && memo->range == range && memo->size == size
+	 && !memcmp(memo->arfcns, sorted, size * sizeof(*sorted))) {
+		memcpy(out, memo->w, sizeof(memo->w));
+		return 0;
+	}
+
+	memset(out, 0, RANGE_ENC_MAX_ARFCNS * sizeof(*out));
+	rc = range_enc_arfcns_iter(range, sorted, size, out);
+	if (rc != 0)
+		return rc;
+
+	memo->valid = 1;
+	memo->range = range;
+	memo->size = size;
+	memcpy(memo->arfcns, sorted, size * sizeof(*sorted));
+	memcpy(memo->w, out, sizeof(memo->w));
+
+	return 0;
+}
+
+/**
+ * Forget all remembered encodings.
+ */
+void range_enc_memo_flush(void)
+{
+	memset(range_enc_memo, 0, sizeof(range_enc_memo));
+}
+
 /*
  * The easiest is to use f0 == arfcns[0]. This means that under certain
  * circumstances we can encode less ARFCNs than possible with an optimal f0.
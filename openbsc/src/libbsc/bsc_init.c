@@ -95,126 +95,6 @@ int bsc_shutdown_net(struct gsm_network *net)
 	return 0;
 }
 
-static int rsl_si(struct gsm_bts_trx *trx, enum osmo_sysinfo_type i, int si_len)
-{
-	struct gsm_bts *bts = trx->bts;
-	int rc, j;
-
-	DEBUGP(DRR, "SI%s: %s\n", get_value_string(osmo_sitype_strs, i),
-		osmo_hexdump(GSM_BTS_SI(bts, i), GSM_MACBLOCK_LEN));
-
-	switch (i) {
-	case SYSINFO_TYPE_5:
-	case SYSINFO_TYPE_5bis:
-	case SYSINFO_TYPE_5ter:
-	case SYSINFO_TYPE_6:
-		if (trx->bts->type == GSM_BTS_TYPE_HSL_FEMTO) {
-			/* HSL has mistaken SACCH INFO MODIFY for SACCH FILLING,
-			 * so we need a special workaround here */
-			/* This assumes a combined BCCH and TCH on TS1...7 */
-			for (j = 0; j < 4; j++)
-				rsl_sacch_info_modify(&trx->ts[0].lchan[j],
-						      osmo_sitype2rsl(i),
-						      GSM_BTS_SI(bts, i), si_len);
-			for (j = 1; j < 8; j++) {
-				rsl_sacch_info_modify(&trx->ts[j].lchan[0],
-						      osmo_sitype2rsl(i),
-						      GSM_BTS_SI(bts, i), si_len);
-				rsl_sacch_info_modify(&trx->ts[j].lchan[1],
-						      osmo_sitype2rsl(i),
-						      GSM_BTS_SI(bts, i), si_len);
-			}
-			rc = 0;
-		} else
-			rc = rsl_sacch_filling(trx, osmo_sitype2rsl(i),
-					       GSM_BTS_SI(bts, i), si_len);
-		break;
-	default:
-		rc = rsl_bcch_info(trx, osmo_sitype2rsl(i),
-				   GSM_BTS_SI(bts, i), si_len);
-		break;
-	}
-
-	return rc;
-}
-
-/* set all system information types */
-static int set_system_infos(struct gsm_bts_trx *trx)
-{
-	int i, rc;
-	struct gsm_bts *bts = trx->bts;
-	uint8_t gen_si[_MAX_SYSINFO_TYPE], n_si = 0, n;
-	int si_len[_MAX_SYSINFO_TYPE];
-
-	bts->si_common.cell_sel_par.ms_txpwr_max_ccch =
-			ms_pwr_ctl_lvl(bts->band, bts->ms_max_power);
-	bts->si_common.cell_sel_par.neci = bts->network->neci;
-
-	/* First, we determine which of the SI messages we actually need */
-
-	if (trx == bts->c0) {
-		/* 1...4 are always present on a C0 TRX */
-		gen_si[n_si++] = SYSINFO_TYPE_1;
-		gen_si[n_si++] = SYSINFO_TYPE_2;
-		gen_si[n_si++] = SYSINFO_TYPE_2bis;
-		gen_si[n_si++] = SYSINFO_TYPE_2ter;
-		gen_si[n_si++] = SYSINFO_TYPE_3;
-		gen_si[n_si++] = SYSINFO_TYPE_4;
-
-		/* 13 is always present on a C0 TRX of a GPRS BTS */
-		if (bts->gprs.mode != BTS_GPRS_NONE)
-			gen_si[n_si++] = SYSINFO_TYPE_13;
-	}
-
-	/* 5 and 6 are always present on every TRX */
-	gen_si[n_si++] = SYSINFO_TYPE_5;
-	gen_si[n_si++] = SYSINFO_TYPE_5bis;
-	gen_si[n_si++] = SYSINFO_TYPE_5ter;
-	gen_si[n_si++] = SYSINFO_TYPE_6;
-
-	/* Second, we generate the selected SI via RSL */
-
-	for (n = 0; n < n_si; n++) {
-		i = gen_si[n];
-		/* Only generate SI if this SI is not in "static" (user-defined) mode */
-		if (!(bts->si_mode_static & (1 << i))) {
-			/* Set SI as being valid. gsm_generate_si() might unset
-			 * it, if SI is not required. */
-			bts->si_valid |= (1 << i);
-			rc = gsm_generate_si(bts, i);
-			if (rc < 0)
-				goto err_out;
-			si_len[i] = rc;
-		} else {
-			if (i == SYSINFO_TYPE_5 || i == SYSINFO_TYPE_5bis
-			 || i == SYSINFO_TYPE_5ter)
-				si_len[i] = 18;
-			else if (i == SYSINFO_TYPE_6)
-				si_len[i] = 11;
-			else
-				si_len[i] = 23;
-		}
-	}
-
-	/* Third, we send the selected SI via RSL */
-
-	for (n = 0; n < n_si; n++) {
-		i = gen_si[n];
-		if (!(bts->si_valid & (1 << i)))
-			continue;
-		rc = rsl_si(trx, i, si_len[i]);
-		if (rc < 0)
-			return rc;
-	}
-
-	return 0;
-err_out:
-	LOGP(DRR, LOGL_ERROR, "Cannot generate SI%s for BTS %u, most likely "
-		"a problem with neighbor cell list generation\n",
-		get_value_string(osmo_sitype_strs, i), bts->nr);
-	return rc;
-}
-
 /* Produce a MA as specified in 10.5.2.21 */
 static int generate_ma_for_ts(struct gsm_bts_trx_ts *ts)
 {
@@ -287,7 +167,7 @@ static void bootstrap_rsl(struct gsm_bts_trx *trx)
 		rsl_nokia_si_begin(trx);
 	}
 
-	set_system_infos(trx);
+	gsm_bts_trx_set_system_infos(trx);
 
 	if (trx->bts->type == GSM_BTS_TYPE_NOKIA_SITE) {
 		/* channel unspecific, power reduction in 2 dB steps */
@@ -198,7 +198,8 @@ static void net_dump_vty(struct vty *vty, struct gsm_network *net)
 		VTY_NEWLINE);
 	vty_out(vty, "  MM Info: %s%s", net->send_mm_info ? "On" : "Off",
 		VTY_NEWLINE);
-	vty_out(vty, "  Handover: %s%s", net->handover.active ? "On" : "Off",
+	vty_out(vty, "  Handover: %s, Algorithm %d%s",
+		net->handover.active ? "On" : "Off", net->handover.algorithm,
 		VTY_NEWLINE);
 	network_chan_load(&pl, net);
 	vty_out(vty, "  Current Channel Load:%s", VTY_NEWLINE);
@@ -640,6 +641,12 @@ static int config_write_net(struct vty *vty)
 		gsmnet->handover.pwr_hysteresis, VTY_NEWLINE);
 	vty_out(vty, " handover maximum distance %u%s",
 		gsmnet->handover.max_distance, VTY_NEWLINE);
+	vty_out(vty, " handover algorithm %d%s",
+		gsmnet->handover.algorithm, VTY_NEWLINE);
+	vty_out(vty, " handover batch interval %u%s",
+		gsmnet->handover.batch_interval, VTY_NEWLINE);
+	vty_out(vty, " handover congestion minimum free %u%s",
+		gsmnet->handover.congestion_min_free, VTY_NEWLINE);
 	vty_out(vty, " timer t3101 %u%s", gsmnet->T3101, VTY_NEWLINE);
 	vty_out(vty, " timer t3103 %u%s", gsmnet->T3103, VTY_NEWLINE);
 	vty_out(vty, " timer t3105 %u%s", gsmnet->T3105, VTY_NEWLINE);
@@ -655,6 +662,11 @@ static int config_write_net(struct vty *vty)
 	vty_out(vty, " dtx-used %u%s", gsmnet->dtx_enabled, VTY_NEWLINE);
 	vty_out(vty, " subscriber-keep-in-ram %d%s",
 		gsmnet->keep_subscr, VTY_NEWLINE);
+	vty_out(vty, " mncc-socket queue-limit %u%s",
+		gsmnet->mncc_sock.queue_limit, VTY_NEWLINE);
+	vty_out(vty, " mncc-socket voice-drop %s%s",
+		gsmnet->mncc_sock.voice_drop == MNCC_SOCK_DROP_OLDEST ?
+		"oldest" : "newest", VTY_NEWLINE);
 
 	return CMD_SUCCESS;
 }
@@ -1362,6 +1374,43 @@ DEFUN(cfg_net_ho_max_distance, cfg_net_ho_max_distance_cmd,
 	return CMD_SUCCESS;
 }
 
+DEFUN(cfg_net_ho_algorithm, cfg_net_ho_algorithm_cmd,
+      "handover algorithm (1|2)",
+	HANDOVER_STR
+	"Which algorithm is used to decide about handover\n"
+	"Decide on every single measurement report\n"
+	"Decide for all calls of a BTS at once, balancing congested cells\n")
+{
+	struct gsm_network *gsmnet = gsmnet_from_vty(vty);
+	gsmnet->handover.algorithm = atoi(argv[0]);
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_net_ho_batch_interval, cfg_net_ho_batch_interval_cmd,
+      "handover batch interval <1-60>",
+	HANDOVER_STR
+	"Batched decision of algorithm 2\n"
+	"How often all calls of a BTS are checked\n"
+	"Seconds\n")
+{
+	struct gsm_network *gsmnet = gsmnet_from_vty(vty);
+	gsmnet->handover.batch_interval = atoi(argv[0]);
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_net_ho_congestion_min_free, cfg_net_ho_congestion_min_free_cmd,
+      "handover congestion minimum free <0-100>",
+	HANDOVER_STR
+	"Congestion based load balancing of algorithm 2\n"
+	"Minimum\n"
+	"Percentage of TCH a cell keeps free before calls are moved away\n"
+	"Percent, 0 to disable\n")
+{
+	struct gsm_network *gsmnet = gsmnet_from_vty(vty);
+	gsmnet->handover.congestion_min_free = atoi(argv[0]);
+	return CMD_SUCCESS;
+}
+
 DEFUN(cfg_net_pag_any_tch,
       cfg_net_pag_any_tch_cmd,
       "paging any use tch (0|1)",
@@ -1431,6 +1480,37 @@ DEFUN(cfg_net_subscr_keep,
 	return CMD_SUCCESS;
 }
 
+#define MNCC_SOCK_STR "Queue towards the external MNCC application\n"
+
+DEFUN(cfg_net_mncc_sock_limit,
+      cfg_net_mncc_sock_limit_cmd,
+      "mncc-socket queue-limit <1-65535>",
+      MNCC_SOCK_STR
+      "Queued primitives above which voice frames are dropped\n"
+      "Primitives\n")
+{
+	struct gsm_network *gsmnet = gsmnet_from_vty(vty);
+	gsmnet->mncc_sock.queue_limit = atoi(argv[0]);
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_net_mncc_sock_drop,
+      cfg_net_mncc_sock_drop_cmd,
+      "mncc-socket voice-drop (newest|oldest)",
+      MNCC_SOCK_STR
+      "Voice frame to drop when the queue is full\n"
+      "Drop the new voice frame\n"
+      "Drop the oldest queued voice frame\n")
+{
+	struct gsm_network *gsmnet = gsmnet_from_vty(vty);
+
+	if (!strcmp(argv[0], "oldest"))
+		gsmnet->mncc_sock.voice_drop = MNCC_SOCK_DROP_OLDEST;
+	else
+		gsmnet->mncc_sock.voice_drop = MNCC_SOCK_DROP_NEWEST;
+	return CMD_SUCCESS;
+}
+
 /* per-BTS configuration */
 DEFUN(cfg_bts,
       cfg_bts_cmd,
@@ -1807,6 +1887,7 @@ DEFUN(cfg_bts_rach_tx_integer,
 {
 	struct gsm_bts *bts = vty->index;
 	bts->si_common.rach_control.tx_integer = atoi(argv[0]) & 0xf;
+	gsm_bts_set_system_infos(bts);
 	return CMD_SUCCESS;
 }
 
@@ -1823,6 +1904,7 @@ DEFUN(cfg_bts_rach_max_trans,
 {
 	struct gsm_bts *bts = vty->index;
 	bts->si_common.rach_control.max_trans = rach_max_trans_val2raw(atoi(argv[0]));
+	gsm_bts_set_system_infos(bts);
 	return CMD_SUCCESS;
 }
 
@@ -1909,6 +1991,8 @@ DEFUN(cfg_bts_cell_barred, cfg_bts_cell_barred_cmd,
 
 	bts->si_common.rach_control.cell_bar = atoi(argv[0]);
 
+	gsm_bts_set_system_infos(bts);
+
 	return CMD_SUCCESS;
 }
 
@@ -1928,6 +2012,8 @@ DEFUN(cfg_bts_rach_ec_allowed, cfg_bts_rach_ec_allowed_cmd,
 	else
 		bts->si_common.rach_control.t2 &= ~0x4;
 
+	gsm_bts_set_system_infos(bts);
+
 	return CMD_SUCCESS;
 }
 
@@ -1942,6 +2028,8 @@ DEFUN(cfg_bts_ms_max_power, cfg_bts_ms_max_power_cmd,
 
 	bts->ms_max_power = atoi(argv[0]);
 
+	gsm_bts_set_system_infos(bts);
+
 	return CMD_SUCCESS;
 }
 
@@ -1957,6 +2045,8 @@ DEFUN(cfg_bts_cell_resel_hyst, cfg_bts_cell_resel_hyst_cmd,
 
 	bts->si_common.cell_sel_par.cell_resel_hyst = atoi(argv[0])/2;
 
+	gsm_bts_set_system_infos(bts);
+
 	return CMD_SUCCESS;
 }
 
@@ -1971,6 +2061,8 @@ DEFUN(cfg_bts_rxlev_acc_min, cfg_bts_rxlev_acc_min_cmd,
 
 	bts->si_common.cell_sel_par.rxlev_acc_min = atoi(argv[0]);
 
+	gsm_bts_set_system_infos(bts);
+
 	return CMD_SUCCESS;
 }
 
@@ -1984,6 +2076,8 @@ DEFUN(cfg_bts_cell_bar_qualify, cfg_bts_cell_bar_qualify_cmd,
 	bts->si_common.cell_ro_sel_par.present = 1;
 	bts->si_common.cell_ro_sel_par.cbq = atoi(argv[0]);
 
+	gsm_bts_set_system_infos(bts);
+
 	return CMD_SUCCESS;
 }
 
@@ -1999,6 +2093,8 @@ DEFUN(cfg_bts_cell_resel_ofs, cfg_bts_cell_resel_ofs_cmd,
 	bts->si_common.cell_ro_sel_par.present = 1;
 	bts->si_common.cell_ro_sel_par.cell_resel_off = atoi(argv[0])/2;
 
+	gsm_bts_set_system_infos(bts);
+
 	return CMD_SUCCESS;
 }
 
@@ -2013,6 +2109,8 @@ DEFUN(cfg_bts_temp_ofs, cfg_bts_temp_ofs_cmd,
 	bts->si_common.cell_ro_sel_par.present = 1;
 	bts->si_common.cell_ro_sel_par.temp_offs = atoi(argv[0])/10;
 
+	gsm_bts_set_system_infos(bts);
+
 	return CMD_SUCCESS;
 }
 
@@ -2027,6 +2125,8 @@ DEFUN(cfg_bts_temp_ofs_inf, cfg_bts_temp_ofs_inf_cmd,
 	bts->si_common.cell_ro_sel_par.present = 1;
 	bts->si_common.cell_ro_sel_par.temp_offs = 7;
 
+	gsm_bts_set_system_infos(bts);
+
 	return CMD_SUCCESS;
 }
 
@@ -2041,6 +2141,8 @@ DEFUN(cfg_bts_penalty_time, cfg_bts_penalty_time_cmd,
 	bts->si_common.cell_ro_sel_par.present = 1;
 	bts->si_common.cell_ro_sel_par.penalty_time = (atoi(argv[0])-20)/20;
 
+	gsm_bts_set_system_infos(bts);
+
 	return CMD_SUCCESS;
 }
 
@@ -2057,6 +2159,8 @@ DEFUN(cfg_bts_penalty_time_rsvd, cfg_bts_penalty_time_rsvd_cmd,
 	bts->si_common.cell_ro_sel_par.present = 1;
 	bts->si_common.cell_ro_sel_par.penalty_time = 31;
 
+	gsm_bts_set_system_infos(bts);
+
 	return CMD_SUCCESS;
 }
 
@@ -2336,6 +2440,8 @@ DEFUN(cfg_bts_gprs_mode, cfg_bts_gprs_mode_cmd,
 
 	bts->gprs.mode = mode;
 
+	gsm_bts_set_system_infos(bts);
+
 	return CMD_SUCCESS;
 }
 
@@ -2448,6 +2554,8 @@ DEFUN(cfg_bts_neigh_mode, cfg_bts_neigh_mode_cmd,
 
 	bts->neigh_list_manual_mode = mode;
 
+	gsm_bts_set_system_infos(bts);
+
 	return CMD_SUCCESS;
 }
 
@@ -2472,6 +2580,8 @@ DEFUN(cfg_bts_neigh, cfg_bts_neigh_cmd,
 	else
 		bitvec_set_bit_pos(bv, arfcn, 0);
 
+	gsm_bts_set_system_infos(bts);
+
 	return CMD_SUCCESS;
 }
 
@@ -2497,6 +2607,8 @@ DEFUN(cfg_bts_si5_neigh, cfg_bts_si5_neigh_cmd,
 	else
 		bitvec_set_bit_pos(bv, arfcn, 0);
 
+	gsm_bts_set_system_infos(bts);
+
 	return CMD_SUCCESS;
 }
 
@@ -2568,9 +2680,8 @@ DEFUN(cfg_trx_arfcn,
 
 	trx->arfcn = arfcn;
 
-	/* FIXME: patch ARFCN into SYSTEM INFORMATION */
 	/* FIXME: use OML layer to update the ARFCN */
-	/* FIXME: use RSL layer to update SYSTEM INFORMATION */
+	gsm_bts_set_system_infos(trx->bts);
 
 	return CMD_SUCCESS;
 }
@@ -2806,6 +2917,8 @@ DEFUN(cfg_ts_arfcn_add,
 
 	bitvec_set_bit_pos(&ts->hopping.arfcns, arfcn, 1);
 
+	gsm_bts_set_system_infos(ts->trx->bts);
+
 	return CMD_SUCCESS;
 }
 
@@ -2820,6 +2933,8 @@ DEFUN(cfg_ts_arfcn_del,
 
 	bitvec_set_bit_pos(&ts->hopping.arfcns, arfcn, 0);
 
+	gsm_bts_set_system_infos(ts->trx->bts);
+
 	return CMD_SUCCESS;
 }
 
@@ -3042,6 +3157,9 @@ int bsc_vty_init(const struct log_info *cat)
 	install_element(GSMNET_NODE, &cfg_net_ho_pwr_interval_cmd);
 	install_element(GSMNET_NODE, &cfg_net_ho_pwr_hysteresis_cmd);
 	install_element(GSMNET_NODE, &cfg_net_ho_max_distance_cmd);
+	install_element(GSMNET_NODE, &cfg_net_ho_algorithm_cmd);
+	install_element(GSMNET_NODE, &cfg_net_ho_batch_interval_cmd);
+	install_element(GSMNET_NODE, &cfg_net_ho_congestion_min_free_cmd);
 	install_element(GSMNET_NODE, &cfg_net_T3101_cmd);
 	install_element(GSMNET_NODE, &cfg_net_T3103_cmd);
 	install_element(GSMNET_NODE, &cfg_net_T3105_cmd);
@@ -3056,6 +3174,8 @@ int bsc_vty_init(const struct log_info *cat)
 	install_element(GSMNET_NODE, &cfg_net_T3141_cmd);
 	install_element(GSMNET_NODE, &cfg_net_dtx_cmd);
 	install_element(GSMNET_NODE, &cfg_net_subscr_keep_cmd);
+	install_element(GSMNET_NODE, &cfg_net_mncc_sock_limit_cmd);
+	install_element(GSMNET_NODE, &cfg_net_mncc_sock_drop_cmd);
 	install_element(GSMNET_NODE, &cfg_net_pag_any_tch_cmd);
 
 	install_element(GSMNET_NODE, &cfg_bts_cmd);
@@ -224,6 +224,20 @@ _lc_find_bts(struct gsm_bts *bts, enum gsm_phys_chan_config pchan)
 	return &ts->lchan[0];
 }
 
+/* keep the number of allocated TCH of the BTS up to date */
+static void bts_tch_used_update(struct gsm_bts *bts, enum gsm_chan_t type,
+				int delta)
+{
+	switch (type) {
+	case GSM_LCHAN_TCH_F:
+	case GSM_LCHAN_TCH_H:
+		bts->tch_used += delta;
+		break;
+	default:
+		break;
+	}
+}
+
 /* Allocate a logical channel */
 struct gsm_lchan *lchan_alloc(struct gsm_bts *bts, enum gsm_chan_t type,
 			      int allow_bigger)
@@ -275,6 +289,7 @@ struct gsm_lchan *lchan_alloc(struct gsm_bts *bts, enum gsm_chan_t type,
 
 	if (lchan) {
 		lchan->type = type;
+		bts_tch_used_update(bts, type, 1);
 
 		/* clear sapis */
 		memset(lchan->sapis, 0, ARRAY_SIZE(lchan->sapis));
@@ -298,6 +313,7 @@ void lchan_free(struct gsm_lchan *lchan)
 	int i;
 
 	sig.type = lchan->type;
+	bts_tch_used_update(lchan->ts->trx->bts, lchan->type, -1);
 	lchan->type = GSM_LCHAN_NONE;
 
 
@@ -326,8 +342,8 @@ void lchan_free(struct gsm_lchan *lchan)
 		lchan->meas_rep[i].flags = 0;
 		lchan->meas_rep[i].nr = 0;
 	}
-	for (i = 0; i < ARRAY_SIZE(lchan->neigh_meas); i++)
-		lchan->neigh_meas[i].arfcn = 0;
+	memset(&lchan->meas_sums, 0, sizeof(lchan->meas_sums));
+	memset(&lchan->neigh_meas, 0, sizeof(lchan->neigh_meas));
 
 	if (lchan->rqd_ref) {
 		talloc_free(lchan->rqd_ref);
@@ -365,6 +381,7 @@ void lchan_reset(struct gsm_lchan *lchan)
 	osmo_timer_del(&lchan->T3111);
 	osmo_timer_del(&lchan->error_timer);
 
+	bts_tch_used_update(lchan->ts->trx->bts, lchan->type, -1);
 	lchan->type = GSM_LCHAN_NONE;
 	lchan->state = LCHAN_S_NONE;
 
@@ -481,6 +498,39 @@ void bts_chan_load(struct pchan_load *cl, const struct gsm_bts *bts)
 	}
 }
 
+/* number of TCH/F and TCH/H lchans the BTS can currently allocate */
+unsigned int bts_tch_total(struct gsm_bts *bts)
+{
+	struct gsm_bts_trx *trx;
+	unsigned int total = 0;
+
+	llist_for_each_entry(trx, &bts->trx_list, list) {
+		int i;
+
+		if (!trx_is_usable(trx))
+			continue;
+
+		for (i = 0; i < ARRAY_SIZE(trx->ts); i++) {
+			struct gsm_bts_trx_ts *ts = &trx->ts[i];
+
+			if (!ts_is_usable(ts))
+				continue;
+
+			switch (ts->pchan) {
+			case GSM_PCHAN_TCH_F:
+			case GSM_PCHAN_TCH_H:
+			case GSM_PCHAN_TCH_F_PDCH:
+				total += subslots_per_pchan[ts->pchan];
+				break;
+			default:
+				break;
+			}
+		}
+	}
+
+	return total;
+}
+
 void network_chan_load(struct pchan_load *pl, struct gsm_network *net)
 {
 	struct gsm_bts *bts;
@@ -22,6 +22,7 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 
 #include <osmocom/core/msgb.h>
@@ -31,11 +32,13 @@
 #include <openbsc/signal.h>
 #include <osmocom/core/talloc.h>
 #include <openbsc/handover.h>
+#include <openbsc/chan_alloc.h>
 #include <osmocom/gsm/gsm_utils.h>
 
 /* issue handover to a cell identified by ARFCN and BSIC */
 static int handover_to_arfcn_bsic(struct gsm_lchan *lchan,
-				  uint16_t arfcn, uint8_t bsic)
+				  uint16_t arfcn, uint8_t bsic,
+				  enum handover_reason reason)
 {
 	struct gsm_bts *new_bts;
 
@@ -48,165 +51,180 @@ static int handover_to_arfcn_bsic(struct gsm_lchan *lchan,
 	}
 
 	/* and actually try to handover to that cell */
-	return bsc_handover_start(lchan, new_bts);
+	return bsc_handover_start(lchan, new_bts, reason);
 }
 
-/* did we get a RXLEV for a given cell in the given report? */
-static int rxlev_for_cell_in_rep(struct gsm_meas_rep *mr,
-				 uint16_t arfcn, uint8_t bsic)
+/* find the slot tracking a given neighbor key, -1 if not tracked */
+static int neigh_meas_find(const struct neigh_meas_tbl *nmt, uint32_t key)
 {
 	int i;
 
-	for (i = 0; i < mr->num_cell; i++) {
-		struct gsm_meas_rep_cell *mrc = &mr->cell[i];
-
-		/* search for matching report */
-		if (!(mrc->arfcn == arfcn && mrc->bsic == bsic))
-			continue;
-
-		mrc->flags |= MRC_F_PROCESSED;
-		return mrc->rxlev;
+	for (i = 0; i < MAX_NEIGH_MEAS; i++) {
+		if (nmt->key[i] == key)
+			return i;
 	}
-	return -ENODEV;
+
+	return -1;
 }
 
-/* obtain averaged rxlev for given neighbor */
-static int neigh_meas_avg(struct neigh_meas_proc *nmp, int window)
+/* obtain averaged rxlev for all neighbor slots */
+static void neigh_meas_avg(const struct neigh_meas_tbl *nmt,
+			   unsigned int window, int *avg)
 {
-	unsigned int i, idx;
-	int avg = 0;
-
-	idx = calc_initial_idx(ARRAY_SIZE(nmp->rxlev),
-				nmp->rxlev_cnt % ARRAY_SIZE(nmp->rxlev),
-				window);
+	static const uint16_t zero[MAX_NEIGH_MEAS];
+	const uint16_t *sum, *old = zero;
+	int i;
 
-	for (i = 0; i < window; i++) {
-		int j = (idx+i) % ARRAY_SIZE(nmp->rxlev);
+	if (window < 1)
+		window = 1;
+	if (window > MAX_WIN_NEIGH_AVG)
+		window = MAX_WIN_NEIGH_AVG;
 
-		avg += nmp->rxlev[j];
-	}
+	/* reports before the first one count as zero */
+	sum = nmt->rxlev_sum[nmt->rxlev_cnt % ARRAY_SIZE(nmt->rxlev_sum)];
+	if (nmt->rxlev_cnt >= window)
+		old = nmt->rxlev_sum[(nmt->rxlev_cnt - window)
+					% ARRAY_SIZE(nmt->rxlev_sum)];
 
-	return avg / window;
+	for (i = 0; i < MAX_NEIGH_MEAS; i++)
+		avg[i] = (uint16_t)(sum[i] - old[i]) / window;
 }
 
 /* find empty or evict bad neighbor */
-static struct neigh_meas_proc *find_evict_neigh(struct gsm_lchan *lchan)
+static int find_evict_neigh(const struct neigh_meas_tbl *nmt)
 {
-	int j, worst = 999999;
-	struct neigh_meas_proc *nmp_worst = NULL;
+	int avg[MAX_NEIGH_MEAS];
+	int j, worst = 0;
 
 	/* first try to find an empty/unused slot */
-	for (j = 0; j < ARRAY_SIZE(lchan->neigh_meas); j++) {
-		struct neigh_meas_proc *nmp = &lchan->neigh_meas[j];
-		if (!nmp->arfcn)
-			return nmp;
-	}
+	j = neigh_meas_find(nmt, 0);
+	if (j >= 0)
+		return j;
 
 	/* no empty slot found. evict worst neighbor from list */
-	for (j = 0; j < ARRAY_SIZE(lchan->neigh_meas); j++) {
-		struct neigh_meas_proc *nmp = &lchan->neigh_meas[j];
-		int avg = neigh_meas_avg(nmp, MAX_WIN_NEIGH_AVG);
-		if (!nmp_worst || avg < worst) {
-			worst = avg;
-			nmp_worst = nmp;
-		}
+	neigh_meas_avg(nmt, MAX_WIN_NEIGH_AVG, avg);
+	for (j = 1; j < MAX_NEIGH_MEAS; j++) {
+		if (avg[j] < avg[worst])
+			worst = j;
 	}
 
-	return nmp_worst;
+	return worst;
 }
 
 /* process neighbor cell measurement reports */
 static void process_meas_neigh(struct gsm_meas_rep *mr)
 {
-	int i, j, idx;
-
-	/* for each reported cell, try to update global state */
-	for (j = 0; j < ARRAY_SIZE(mr->lchan->neigh_meas); j++) {
-		struct neigh_meas_proc *nmp = &mr->lchan->neigh_meas[j];
-		unsigned int idx;
-		int rxlev;
+	struct neigh_meas_tbl *nmt = &mr->lchan->neigh_meas;
+	uint16_t rxlev[MAX_NEIGH_MEAS];
+	const uint16_t *prev;
+	uint16_t *next;
+	int i, j;
+
+	/* tracked cells that were not reported count as zero */
+	memset(rxlev, 0, sizeof(rxlev));
+	for (i = 0; i < mr->num_cell; i++) {
+		struct gsm_meas_rep_cell *mrc = &mr->cell[i];
 
-		/* skip unused entries */
-		if (!nmp->arfcn)
+		j = neigh_meas_find(nmt, NEIGH_MEAS_KEY(mrc->arfcn, mrc->bsic));
+		if (j < 0)
 			continue;
 
-		rxlev = rxlev_for_cell_in_rep(mr, nmp->arfcn, nmp->bsic);
-		idx = nmp->rxlev_cnt % ARRAY_SIZE(nmp->rxlev);
-		if (rxlev >= 0) {
-			nmp->rxlev[idx] = rxlev;
-			nmp->last_seen_nr = mr->nr;
-		} else
-			nmp->rxlev[idx] = 0;
-		nmp->rxlev_cnt++;
+		rxlev[j] = mrc->rxlev;
+		nmt->last_seen_nr[j] = mr->nr;
+		mrc->flags |= MRC_F_PROCESSED;
 	}
 
+	/* advance the running sums of all slots by one report */
+	prev = nmt->rxlev_sum[nmt->rxlev_cnt % ARRAY_SIZE(nmt->rxlev_sum)];
+	nmt->rxlev_cnt++;
+	next = nmt->rxlev_sum[nmt->rxlev_cnt % ARRAY_SIZE(nmt->rxlev_sum)];
+	for (j = 0; j < MAX_NEIGH_MEAS; j++)
+		next[j] = prev[j] + rxlev[j];
+
 	/* iterate over list of reported cells, check if we did not
 	 * process all of them */
 	for (i = 0; i < mr->num_cell; i++) {
 		struct gsm_meas_rep_cell *mrc = &mr->cell[i];
-		struct neigh_meas_proc *nmp;
+		uint32_t key = NEIGH_MEAS_KEY(mrc->arfcn, mrc->bsic);
+		int k;
 
 		if (mrc->flags & MRC_F_PROCESSED)
 			continue;
+		mrc->flags |= MRC_F_PROCESSED;
 
-		nmp = find_evict_neigh(mr->lchan);
-
-		nmp->arfcn = mrc->arfcn;
-		nmp->bsic = mrc->bsic;
+		/* reported twice within the same report */
+		if (neigh_meas_find(nmt, key) >= 0)
+			continue;
 
-		idx = nmp->rxlev_cnt % ARRAY_SIZE(nmp->rxlev);
-		nmp->rxlev[idx] = mrc->rxlev;
-		nmp->rxlev_cnt++;
-		nmp->last_seen_nr = mr->nr;
+		j = find_evict_neigh(nmt);
 
-		mrc->flags |= MRC_F_PROCESSED;
+		/* the new cell has no history: all earlier sums are zero
+		 * and this report is its first sample */
+		nmt->key[j] = key;
+		nmt->last_seen_nr[j] = mr->nr;
+		for (k = 0; k < ARRAY_SIZE(nmt->rxlev_sum); k++)
+			nmt->rxlev_sum[k][j] = 0;
+		next[j] = mrc->rxlev;
 	}
 }
 
-/* attempt to do a handover */
-static int attempt_handover(struct gsm_meas_rep *mr)
+static const struct value_string ho_reason_names[] = {
+	{ HO_REASON_INTERFERENCE,	"Interference" },
+	{ HO_REASON_BAD_QUALITY,	"Bad Quality" },
+	{ HO_REASON_LOW_LEVEL,		"Low Level" },
+	{ HO_REASON_MAX_DISTANCE,	"Distance" },
+	{ HO_REASON_POWER_BUDGET,	"Power Budget" },
+	{ HO_REASON_CONGESTION,		"Congestion" },
+	{ 0,				NULL }
+};
+
+/* find the neighbor whose average is at least 'hyst' better than 'rxlev' */
+static int best_neigh(const struct neigh_meas_tbl *nmt, const int *avg,
+		      int rxlev, int hyst)
 {
-	struct gsm_network *net = mr->lchan->ts->trx->bts->network;
-	struct neigh_meas_proc *best_cell = NULL;
-	unsigned int best_better_db = 0;
-	int i, rc;
-
-	/* find the best cell in this report that is at least RXLEV_HYST
-	 * better than the current serving cell */
+	int best_cell = -1;
+	int best_better_db = 0;
+	int i;
 
-	for (i = 0; i < ARRAY_SIZE(mr->lchan->neigh_meas); i++) {
-		struct neigh_meas_proc *nmp = &mr->lchan->neigh_meas[i];
-		int avg, better;
+	for (i = 0; i < MAX_NEIGH_MEAS; i++) {
+		int better;
 
 		/* skip empty slots */
-		if (nmp->arfcn == 0)
+		if (nmt->key[i] == 0)
 			continue;
 
-		/* caculate average rxlev for this cell over the window */
-		avg = neigh_meas_avg(nmp, net->handover.win_rxlev_avg_neigh);
-
 		/* check if hysteresis is fulfilled */
-		if (avg < mr->dl.full.rx_lev + net->handover.pwr_hysteresis)
+		if (avg[i] < rxlev + hyst)
 			continue;
 
-		better = avg - mr->dl.full.rx_lev;
+		better = avg[i] - rxlev;
 		if (better > best_better_db) {
-			best_cell = nmp;
+			best_cell = i;
 			best_better_db = better;
 		}
 	}
 
-	if (!best_cell)
-		return 0;
+	return best_cell;
+}
+
+/* hand the lchan over to the given neighbor slot and log the outcome */
+static int start_handover(struct gsm_lchan *lchan, int slot,
+			  enum handover_reason reason)
+{
+	struct gsm_network *net = lchan->ts->trx->bts->network;
+	uint32_t key = lchan->neigh_meas.key[slot];
+	int rc;
 
-	LOGP(DHO, LOGL_INFO, "%s: Cell on ARFCN %u is better: ",
-		gsm_ts_name(mr->lchan->ts), best_cell->arfcn);
+	LOGP(DHO, LOGL_INFO, "%s: %s: Cell on ARFCN %u: ",
+		gsm_ts_name(lchan->ts), get_value_string(ho_reason_names, reason),
+		NEIGH_MEAS_KEY_ARFCN(key));
 	if (!net->handover.active) {
 		LOGPC(DHO, LOGL_INFO, "Skipping, Handover disabled\n");
 		return 0;
 	}
 
-	rc = handover_to_arfcn_bsic(mr->lchan, best_cell->arfcn, best_cell->bsic);
+	rc = handover_to_arfcn_bsic(lchan, NEIGH_MEAS_KEY_ARFCN(key),
+				    NEIGH_MEAS_KEY_BSIC(key), reason);
 	switch (rc) {
 	case 0:
 		LOGPC(DHO, LOGL_INFO, "Starting handover\n");
@@ -223,54 +241,300 @@ static int attempt_handover(struct gsm_meas_rep *mr)
 	return rc;
 }
 
-/* process an already parsed measurement report and decide if we want to
- * attempt a handover */
-static int process_meas_rep(struct gsm_meas_rep *mr)
+/* attempt to do a handover */
+static int attempt_handover(struct gsm_meas_rep *mr,
+			    enum handover_reason reason)
 {
 	struct gsm_network *net = mr->lchan->ts->trx->bts->network;
-	int av_rxlev;
+	int avg[MAX_NEIGH_MEAS];
+	int best_cell;
 
-	/* we currently only do handover for TCH channels */
-	switch (mr->lchan->type) {
-	case GSM_LCHAN_TCH_F:
-	case GSM_LCHAN_TCH_H:
-		break;
-	default:
+	/* caculate average rxlev for all cells over the window */
+	neigh_meas_avg(&mr->lchan->neigh_meas,
+		       net->handover.win_rxlev_avg_neigh, avg);
+
+	/* find the best cell in this report that is at least RXLEV_HYST
+	 * better than the current serving cell */
+	best_cell = best_neigh(&mr->lchan->neigh_meas, avg, mr->dl.full.rx_lev,
+			       net->handover.pwr_hysteresis);
+	if (best_cell < 0)
 		return 0;
-	}
 
-	/* parse actual neighbor cell info */
-	if (mr->num_cell > 0 && mr->num_cell < 7)
-		process_meas_neigh(mr);
+	return start_handover(mr->lchan, best_cell, reason);
+}
+
+/* check if the serving cell conditions require a handover, returns the
+ * reason or -1 */
+static int serving_cell_reason(struct gsm_lchan *lchan,
+			       const struct gsm_meas_rep *mr)
+{
+	struct gsm_network *net = lchan->ts->trx->bts->network;
+	int av_rxlev, bad_qual;
 
-	av_rxlev = get_meas_rep_avg(mr->lchan, MEAS_REP_DL_RXLEV_FULL,
+	av_rxlev = get_meas_rep_avg(lchan, MEAS_REP_DL_RXLEV_FULL,
 				    net->handover.win_rxlev_avg);
+	bad_qual = meas_rep_n_out_of_m_be(lchan, MEAS_REP_DL_RXQUAL_FULL,
+					  3, 4, 5);
 
 	/* Interference HO */
-	if (rxlev2dbm(av_rxlev) > -85 &&
-	    meas_rep_n_out_of_m_be(mr->lchan, MEAS_REP_DL_RXQUAL_FULL,
-				   3, 4, 5))
-		return attempt_handover(mr);
+	if (rxlev2dbm(av_rxlev) > -85 && bad_qual)
+		return HO_REASON_INTERFERENCE;
 
 	/* Bad Quality */
-	if (meas_rep_n_out_of_m_be(mr->lchan, MEAS_REP_DL_RXQUAL_FULL,
-				   3, 4, 5))
-		return attempt_handover(mr);
+	if (bad_qual)
+		return HO_REASON_BAD_QUALITY;
 
 	/* Low Level */
 	if (rxlev2dbm(av_rxlev) <= -110)
-		return attempt_handover(mr);
+		return HO_REASON_LOW_LEVEL;
 
 	/* Distance */
 	if (mr->ms_l1.ta > net->handover.max_distance)
-		return attempt_handover(mr);
+		return HO_REASON_MAX_DISTANCE;
+
+	return -1;
+}
+
+/* algorithm 1: decide on every single measurement report */
+static int ho_1_meas_rep(struct gsm_meas_rep *mr)
+{
+	struct gsm_network *net = mr->lchan->ts->trx->bts->network;
+	int reason;
+
+	reason = serving_cell_reason(mr->lchan, mr);
+	if (reason >= 0)
+		return attempt_handover(mr, reason);
 
 	/* Power Budget AKA Better Cell */
 	if ((mr->nr % net->handover.pwr_interval) == 0)
-		return attempt_handover(mr);
+		return attempt_handover(mr, HO_REASON_POWER_BUDGET);
 
 	return 0;
+}
+
+/* an lchan that could be moved to a neighbor to relieve congestion */
+struct ho_candidate {
+	struct gsm_lchan *lchan;
+	struct gsm_bts *bts;
+	int slot;
+	/* how much better the neighbor is than the serving cell */
+	int margin;
+};
+
+static int ho_candidate_cmp(const void *_a, const void *_b)
+{
+	const struct ho_candidate *a = _a, *b = _b;
+
+	return b->margin - a->margin;
+}
+
+/* free TCH above the congestion threshold, negative if congested */
+static int bts_tch_headroom(struct gsm_bts *bts)
+{
+	unsigned int total = bts_tch_total(bts);
+	int min_free, free_tch;
+
+	min_free = total * bts->network->handover.congestion_min_free / 100;
+	free_tch = (int) total - (int) bts->tch_used;
+
+	return free_tch - min_free;
+}
+
+/* check one lchan, return 1 if it should be considered for load balancing */
+static int ho_2_check_lchan(struct gsm_lchan *lchan,
+			    struct ho_candidate *cand)
+{
+	struct gsm_network *net = lchan->ts->trx->bts->network;
+	struct neigh_meas_tbl *nmt = &lchan->neigh_meas;
+	struct gsm_meas_rep *mr;
+	int avg[MAX_NEIGH_MEAS];
+	int av_rxlev, reason, best_cell, i;
+
+	/* wait for the first measurement report */
+	if (!lchan->meas_sums.num)
+		return 0;
+
+	mr = &lchan->meas_rep[calc_initial_idx(ARRAY_SIZE(lchan->meas_rep),
+					       lchan->meas_rep_idx, 1)];
+	av_rxlev = get_meas_rep_avg(lchan, MEAS_REP_DL_RXLEV_FULL,
+				    net->handover.win_rxlev_avg);
+	neigh_meas_avg(nmt, net->handover.win_rxlev_avg_neigh, avg);
+
+	/* every check is a Power Budget check unless the serving cell
+	 * itself requires us to leave */
+	reason = serving_cell_reason(lchan, mr);
+	if (reason < 0)
+		reason = HO_REASON_POWER_BUDGET;
+
+	best_cell = best_neigh(nmt, avg, av_rxlev,
+			       net->handover.pwr_hysteresis);
+	if (best_cell >= 0) {
+		start_handover(lchan, best_cell, reason);
+		return 0;
+	}
+
+	/* only look for load balancing candidates when congested */
+	if (!cand)
+		return 0;
+
+	/* pick the strongest neighbor the MS could camp on */
+	cand->slot = -1;
+	for (i = 0; i < MAX_NEIGH_MEAS; i++) {
+		struct gsm_bts *bts;
+
+		if (nmt->key[i] == 0)
+			continue;
+		if (cand->slot >= 0 && avg[i] <= avg[cand->slot])
+			continue;
+
+		bts = gsm_bts_neighbor(lchan->ts->trx->bts,
+				       NEIGH_MEAS_KEY_ARFCN(nmt->key[i]),
+				       NEIGH_MEAS_KEY_BSIC(nmt->key[i]));
+		if (!bts || avg[i] < bts->si_common.cell_sel_par.rxlev_acc_min)
+			continue;
+
+		cand->slot = i;
+		cand->bts = bts;
+	}
+	if (cand->slot < 0)
+		return 0;
+
+	cand->lchan = lchan;
+	cand->margin = avg[cand->slot] - av_rxlev;
+	return 1;
+}
+
+/* algorithm 2: decide for all lchans of the BTS at once */
+static void ho_2_check_bts(struct gsm_bts *bts)
+{
+	struct ho_candidate *cand = NULL;
+	struct gsm_bts_trx *trx;
+	int need, num_cand = 0;
+	int i;
+
+	need = -bts_tch_headroom(bts);
+	if (need > 0) {
+		cand = talloc_array(tall_bsc_ctx, struct ho_candidate,
+				    bts->num_trx * TRX_NR_TS * 2);
+		if (!cand)
+			need = 0;
+	}
+
+	llist_for_each_entry(trx, &bts->trx_list, list) {
+		if (!trx_is_usable(trx))
+			continue;
+
+		for (i = 0; i < ARRAY_SIZE(trx->ts); i++) {
+			struct gsm_bts_trx_ts *ts = &trx->ts[i];
+			int j;
+
+			for (j = 0; j < ARRAY_SIZE(ts->lchan); j++) {
+				struct gsm_lchan *lchan = &ts->lchan[j];
+
+				/* we currently only do handover for TCH */
+				if (lchan->type != GSM_LCHAN_TCH_F &&
+				    lchan->type != GSM_LCHAN_TCH_H)
+					continue;
+				if (lchan->state != LCHAN_S_ACTIVE ||
+				    !lchan->conn || lchan->conn->ho_lchan)
+					continue;
+
+				num_cand += ho_2_check_lchan(lchan,
+						need > 0 ? &cand[num_cand] : NULL);
+			}
+		}
+	}
+
+	if (need <= 0)
+		return;
+
+	/* move the calls with the best alternative first, as long as
+	 * the target cell is not congested itself */
+	qsort(cand, num_cand, sizeof(*cand), ho_candidate_cmp);
+	for (i = 0; i < num_cand && need > 0; i++) {
+		if (bts_tch_headroom(cand[i].bts) <= 0)
+			continue;
+		if (start_handover(cand[i].lchan, cand[i].slot,
+				   HO_REASON_CONGESTION) == 0)
+			need--;
+	}
+
+	talloc_free(cand);
+}
+
+struct ho_algorithm {
+	/* decide on a single measurement report */
+	int (*meas_rep)(struct gsm_meas_rep *mr);
+	/* decide on all lchans of a BTS, called every batch_interval */
+	void (*check_bts)(struct gsm_bts *bts);
+};
+
+static const struct ho_algorithm ho_algorithms[] = {
+	[1] = {
+		.meas_rep = ho_1_meas_rep,
+	},
+	[2] = {
+		.check_bts = ho_2_check_bts,
+	},
+};
+
+static const struct ho_algorithm *ho_algorithm(struct gsm_network *net)
+{
+	if (net->handover.algorithm < 1 ||
+	    net->handover.algorithm >= ARRAY_SIZE(ho_algorithms))
+		return &ho_algorithms[1];
+	return &ho_algorithms[net->handover.algorithm];
+}
+
+static void ho_batch_cb(void *data)
+{
+	struct gsm_network *net = data;
+	const struct ho_algorithm *algo = ho_algorithm(net);
+	struct gsm_bts *bts;
+
+	/* the algorithm has been changed in the meantime */
+	if (!algo->check_bts)
+		return;
+
+	llist_for_each_entry(bts, &net->bts_list, list)
+		algo->check_bts(bts);
+
+	osmo_timer_schedule(&net->handover.batch_timer,
+			    net->handover.batch_interval, 0);
+}
+
+/* process an already parsed measurement report and decide if we want to
+ * attempt a handover */
+static int process_meas_rep(struct gsm_meas_rep *mr)
+{
+	struct gsm_network *net = mr->lchan->ts->trx->bts->network;
+	const struct ho_algorithm *algo = ho_algorithm(net);
+
+	/* we currently only do handover for TCH channels */
+	switch (mr->lchan->type) {
+	case GSM_LCHAN_TCH_F:
+	case GSM_LCHAN_TCH_H:
+		break;
+	default:
+		return 0;
+	}
+
+	/* parse actual neighbor cell info */
+	if (mr->num_cell > 0 && mr->num_cell < 7)
+		process_meas_neigh(mr);
+
+	/* batched algorithms decide from the timer, make sure it runs */
+	if (algo->check_bts) {
+		if (!osmo_timer_pending(&net->handover.batch_timer)) {
+			net->handover.batch_timer.cb = ho_batch_cb;
+			net->handover.batch_timer.data = net;
+			osmo_timer_schedule(&net->handover.batch_timer,
+					    net->handover.batch_interval, 0);
+		}
+		return 0;
+	}
 
+	return algo->meas_rep(mr);
 }
 
 static int ho_dec_sig_cb(unsigned int subsys, unsigned int signal,
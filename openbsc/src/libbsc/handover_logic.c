@@ -49,6 +49,8 @@ struct bsc_handover {
 	struct osmo_timer_list T3103;
 
 	uint8_t ho_ref;
+	/* enum handover_reason of the decision, -1 if not decided */
+	int reason;
 };
 
 static LLIST_HEAD(bsc_handovers);
@@ -77,10 +79,24 @@ static struct bsc_handover *bsc_ho_by_old_lchan(struct gsm_lchan *old_lchan)
 	return NULL;
 }
 
+/* account the outcome of a handover for the reason it was decided on */
+static void ho_count_reason(struct gsm_network *net, int reason,
+			    int completed)
+{
+	if (reason < 0 || reason >= _NUM_HO_REASON)
+		return;
+
+	if (completed)
+		osmo_counter_inc(net->stats.handover.reason_completed[reason]);
+	else
+		osmo_counter_inc(net->stats.handover.reason_failed[reason]);
+}
+
 /* Hand over the specified logical channel to the specified new BTS.
  * This is the main entry point for the actual handover algorithm,
  * after it has decided it wants to initiate HO to a specific BTS */
-int bsc_handover_start(struct gsm_lchan *old_lchan, struct gsm_bts *bts)
+int bsc_handover_start(struct gsm_lchan *old_lchan, struct gsm_bts *bts,
+		       int reason)
 {
 	struct gsm_lchan *new_lchan;
 	struct bsc_handover *ho;
@@ -106,6 +122,7 @@ int bsc_handover_start(struct gsm_lchan *old_lchan, struct gsm_bts *bts)
 	if (!new_lchan) {
 		LOGP(DHO, LOGL_NOTICE, "No free channel\n");
 		osmo_counter_inc(bts->network->stats.handover.no_channel);
+		ho_count_reason(bts->network, reason, 0);
 		return -ENOSPC;
 	}
 
@@ -118,6 +135,7 @@ int bsc_handover_start(struct gsm_lchan *old_lchan, struct gsm_bts *bts)
 	ho->old_lchan = old_lchan;
 	ho->new_lchan = new_lchan;
 	ho->ho_ref = ho_ref++;
+	ho->reason = reason;
 
 	/* copy some parameters from old lchan */
 	memcpy(&new_lchan->encr, &old_lchan->encr, sizeof(new_lchan->encr));
@@ -182,6 +200,7 @@ static void ho_T3103_cb(void *_ho)
 
 	DEBUGP(DHO, "HO T3103 expired\n");
 	osmo_counter_inc(net->stats.handover.timeout);
+	ho_count_reason(net, ho->reason, 0);
 
 	ho->new_lchan->conn->ho_lchan = NULL;
 	ho->new_lchan->conn = NULL;
@@ -232,6 +251,8 @@ static int ho_chan_activ_nack(struct gsm_lchan *new_lchan)
 		return -ENODEV;
 	}
 
+	ho_count_reason(new_lchan->ts->trx->bts->network, ho->reason, 0);
+
 	new_lchan->conn->ho_lchan = NULL;
 	new_lchan->conn = NULL;
 	llist_del(&ho->list);
@@ -261,6 +282,7 @@ static int ho_gsm48_ho_compl(struct gsm_lchan *new_lchan)
 	     ho->old_lchan->ts->trx->arfcn, new_lchan->ts->trx->arfcn);
 
 	osmo_counter_inc(net->stats.handover.completed);
+	ho_count_reason(net, ho->reason, 1);
 
 	osmo_timer_del(&ho->T3103);
 
@@ -299,6 +321,7 @@ static int ho_gsm48_ho_fail(struct gsm_lchan *old_lchan)
 	}
 
 	osmo_counter_inc(net->stats.handover.failed);
+	ho_count_reason(net, ho->reason, 0);
 
 	osmo_timer_del(&ho->T3103);
 	llist_del(&ho->list);
@@ -67,26 +67,40 @@ unsigned int calc_initial_idx(unsigned int array_size,
 	return idx;
 }
 
+/* account a freshly parsed report in the running sums */
+void meas_rep_sums_add(struct meas_rep_sums *sums,
+		       const struct gsm_meas_rep *rep)
+{
+	const uint16_t *prev;
+	uint16_t *next;
+	int i;
+
+	prev = sums->sum[sums->num % ARRAY_SIZE(sums->sum)];
+	sums->num++;
+	next = sums->sum[sums->num % ARRAY_SIZE(sums->sum)];
+
+	for (i = 0; i < _NUM_MEAS_REP_FIELD; i++)
+		next[i] = prev[i] + get_field(rep, i);
+}
+
 /* obtain an average over the last 'num' fields in the meas reps */
 int get_meas_rep_avg(const struct gsm_lchan *lchan,
 		     enum meas_rep_field field, unsigned int num)
 {
-	unsigned int i, idx;
-	int avg = 0;
+	const struct meas_rep_sums *sums = &lchan->meas_sums;
+	uint16_t sum, old = 0;
 
 	if (num < 1)
 		return 0;
+	if (num > MAX_WIN_MEAS_REP_AVG)
+		num = MAX_WIN_MEAS_REP_AVG;
 
-	idx = calc_initial_idx(ARRAY_SIZE(lchan->meas_rep),
-				lchan->meas_rep_idx, num);
-
-	for (i = 0; i < num; i++) {
-		int j = (idx+i) % ARRAY_SIZE(lchan->meas_rep);
-
-		avg += get_field(&lchan->meas_rep[j], field);
-	}
+	/* reports before the first one count as zero */
+	sum = sums->sum[sums->num % ARRAY_SIZE(sums->sum)][field];
+	if (sums->num >= num)
+		old = sums->sum[(sums->num - num) % ARRAY_SIZE(sums->sum)][field];
 
-	return avg / num;
+	return (uint16_t)(sum - old) / num;
 }
 
 /* Check if N out of M last values for FIELD are >= bd */
@@ -28,6 +28,7 @@
 
 #include <osmocom/core/bitvec.h>
 #include <osmocom/core/utils.h>
+#include <osmocom/gsm/gsm_utils.h>
 #include <osmocom/gsm/sysinfo.h>
 
 #include <openbsc/debug.h>
@@ -197,8 +198,7 @@ static int enc_freq_lst_range(uint8_t *chan_list,
 	arfcns_used = range_enc_filter_arfcns(range, arfcns, arfcns_used,
 				f0, &f0_included);
 
-	memset(w, 0, sizeof(w));
-	rc = range_enc_arfcns(range, arfcns, arfcns_used, w, 0);
+	rc = range_enc_arfcns_cached(range, arfcns, arfcns_used, w);
 	if (rc != 0)
 		return -3;
 
@@ -221,17 +221,21 @@ static int enc_freq_lst_range(uint8_t *chan_list,
 	};
 }
 
+static int is_pgsm_net(const struct gsm_bts *bts)
+{
+	return bts->band == GSM_BAND_900
+		&& bts->c0->arfcn >= 1 && bts->c0->arfcn <= 124;
+}
+
 /* generate a cell channel list as per Section 10.5.2.1b of 04.08 */
 static int bitvec2freq_list(uint8_t *chan_list, struct bitvec *bv,
 			    const struct gsm_bts *bts, int bis, int ter)
 {
-	int i, rc, min = -1, max = -1, pgsm = 0, arfcns = 0;
+	int i, rc, min = -1, max = -1, pgsm, arfcns = 0;
 
 	memset(chan_list, 0, 16);
 
-	if (bts->band == GSM_BAND_900
-	 && bts->c0->arfcn >= 1 && bts->c0->arfcn <= 124)
-		pgsm = 1;
+	pgsm = is_pgsm_net(bts);
 	/* P-GSM-only handsets only support 'bit map 0 format' */
 	if (!bis && !ter && pgsm) {
 		chan_list[0] = 0;
@@ -299,6 +303,34 @@ static int bitvec2freq_list(uint8_t *chan_list, struct bitvec *bv,
 	return -EINVAL;
 }
 
+/* The (range) encoding is the expensive part of the SI generation and its
+ * inputs rarely change, so only re-encode a list if its bitvec, the band or
+ * the P-GSM property of the BTS differ from the last time. */
+static int cached_freq_list(uint8_t *chan_list, struct bitvec *bv,
+			    struct gsm_bts *bts, int bis, int ter,
+			    enum si_freq_list list)
+{
+	struct si_freq_list_cache *cache = &bts->si_freq_cache[list];
+	unsigned int len = OSMO_MIN(bv->data_len, sizeof(cache->arfcns));
+	int pgsm = is_pgsm_net(bts);
+
+	if (cache->valid && cache->band == bts->band && cache->pgsm == pgsm
+	 && !memcmp(cache->arfcns, bv->data, len)) {
+		memcpy(chan_list, cache->chan_list, sizeof(cache->chan_list));
+		return cache->rc;
+	}
+
+	cache->rc = bitvec2freq_list(chan_list, bv, bts, bis, ter);
+	memcpy(cache->chan_list, chan_list, sizeof(cache->chan_list));
+	memset(cache->arfcns, 0, sizeof(cache->arfcns));
+	memcpy(cache->arfcns, bv->data, len);
+	cache->band = bts->band;
+	cache->pgsm = pgsm;
+	cache->valid = 1;
+
+	return cache->rc;
+}
+
 /* generate a cell channel list as per Section 10.5.2.1b of 04.08 */
 /* static*/ int generate_cell_chan_list(uint8_t *chan_list, struct gsm_bts *bts)
 {
@@ -310,21 +342,22 @@ static int bitvec2freq_list(uint8_t *chan_list, struct bitvec *bv,
 
 	/* first we generate a bitvec of all TRX ARFCN's in our BTS */
 	llist_for_each_entry(trx, &bts->trx_list, list) {
-		unsigned int i, j;
+		unsigned int i, j, len;
 		/* Always add the TRX's ARFCN */
 		bitvec_set_bit_pos(bv, trx->arfcn, 1);
 		for (i = 0; i < ARRAY_SIZE(trx->ts); i++) {
 			struct gsm_bts_trx_ts *ts = &trx->ts[i];
-			/* Add any ARFCNs present in hopping channels */
-			for (j = 0; j < 1024; j++) {
-				if (bitvec_get_bit_pos(&ts->hopping.arfcns, j))
-					bitvec_set_bit_pos(bv, j, 1);
-			}
+			/* Add any ARFCNs present in hopping channels, both
+			 * bitvecs share the same layout */
+			len = OSMO_MIN(bv->data_len, ts->hopping.arfcns.data_len);
+			for (j = 0; j < len; j++)
+				bv->data[j] |= ts->hopping.arfcns.data[j];
 		}
 	}
 
 	/* then we generate a GSM 04.08 frequency list from the bitvec */
-	return bitvec2freq_list(chan_list, bv, bts, 0, 0);
+	return cached_freq_list(chan_list, bv, bts, 0, 0,
+				SI_FREQ_LIST_CELL_ALLOC);
 }
 
 /* generate a cell channel list as per Section 10.5.2.1b of 04.08 */
@@ -333,6 +366,14 @@ static int generate_bcch_chan_list(uint8_t *chan_list, struct gsm_bts *bts,
 {
 	struct gsm_bts *cur_bts;
 	struct bitvec *bv;
+	enum si_freq_list list;
+
+	if (si5)
+		list = bis ? SI_FREQ_LIST_SI5bis :
+			ter ? SI_FREQ_LIST_SI5ter : SI_FREQ_LIST_SI5;
+	else
+		list = bis ? SI_FREQ_LIST_SI2bis :
+			ter ? SI_FREQ_LIST_SI2ter : SI_FREQ_LIST_SI2;
 
 	if (si5 && bts->neigh_list_manual_mode == NL_MODE_MANUAL_SI5SEP)
 		bv = &bts->si_common.si5_neigh_list;
@@ -353,7 +394,7 @@ static int generate_bcch_chan_list(uint8_t *chan_list, struct gsm_bts *bts,
 	}
 
 	/* then we generate a GSM 04.08 frequency list from the bitvec */
-	return bitvec2freq_list(chan_list, bv, bts, bis, ter);
+	return cached_freq_list(chan_list, bv, bts, bis, ter, list);
 }
 
 static int list_arfcn(uint8_t *chan_list, uint8_t mask, char *text)
@@ -490,7 +531,7 @@ static int generate_si2ter(uint8_t *output, struct gsm_bts *bts)
 	return sizeof(*si2t);
 }
 
-static struct gsm48_si_ro_info si_info = {
+static const struct gsm48_si_ro_info si_info_default = {
 	.selection_params = {
 		.present = 0,
 	},
@@ -514,8 +555,21 @@ static struct gsm48_si_ro_info si_info = {
 	.break_ind = 0,
 };
 
+/* fill the rest octet info of SI3/SI4 from the BTS configuration */
+static void gen_si_ro_info(struct gsm48_si_ro_info *si_info,
+			   const struct gsm_bts *bts)
+{
+	*si_info = si_info_default;
+
+	si_info->gprs_ind.present = bts->gprs.mode != BTS_GPRS_NONE;
+	memcpy(&si_info->selection_params,
+	       &bts->si_common.cell_ro_sel_par,
+	       sizeof(struct gsm48_si_selection_params));
+}
+
 static int generate_si3(uint8_t *output, struct gsm_bts *bts)
 {
+	struct gsm48_si_ro_info si_info;
 	int rc;
 	struct gsm48_system_information_type_3 *si3 =
 		(struct gsm48_system_information_type_3 *) output;
@@ -536,11 +590,10 @@ static int generate_si3(uint8_t *output, struct gsm_bts *bts)
 	si3->cell_sel_par = bts->si_common.cell_sel_par;
 	si3->rach_control = bts->si_common.rach_control;
 
+	gen_si_ro_info(&si_info, bts);
 	if ((bts->si_valid & (1 << SYSINFO_TYPE_2ter))) {
 		LOGP(DRR, LOGL_INFO, "SI 2ter is included.\n");
 		si_info.si2ter_indicator = 1;
-	} else {
-		si_info.si2ter_indicator = 0;
 	}
 
 	/* SI3 Rest Octets (10.5.2.34), containing
@@ -554,6 +607,7 @@ static int generate_si3(uint8_t *output, struct gsm_bts *bts)
 
 static int generate_si4(uint8_t *output, struct gsm_bts *bts)
 {
+	struct gsm48_si_ro_info si_info;
 	int rc;
 	struct gsm48_system_information_type_4 *si4 =
 		(struct gsm48_system_information_type_4 *) output;
@@ -580,6 +634,7 @@ static int generate_si4(uint8_t *output, struct gsm_bts *bts)
 	/* SI4 Rest Octets (10.5.2.35), containing
 		Optional Power offset, GPRS Indicator,
 		Cell Identity, LSA ID, Selection Parameter */
+	gen_si_ro_info(&si_info, bts);
 	rc = rest_octets_si4(si4->data, &si_info);
 
 	return sizeof(*si4) + rc;
@@ -740,7 +795,7 @@ static int generate_si6(uint8_t *output, struct gsm_bts *bts)
 	return l2_plen;
 }
 
-static struct gsm48_si13_info si13_default = {
+static const struct gsm48_si13_info si13_default = {
 	.cell_opts = {
 		.nmo 		= GPRS_NMO_II,
 		.t3168		= 2000,
@@ -782,6 +837,7 @@ static int generate_si13(uint8_t *output, struct gsm_bts *bts)
 {
 	struct gsm48_system_information_type_13 *si13 =
 		(struct gsm48_system_information_type_13 *) output;
+	struct gsm48_si13_info si13_info = si13_default;
 	int ret;
 
 	memset(si13, GSM_MACBLOCK_PADDING, GSM_MACBLOCK_LEN);
@@ -790,10 +846,14 @@ static int generate_si13(uint8_t *output, struct gsm_bts *bts)
 	si13->header.skip_indicator = 0;
 	si13->header.system_information = GSM48_MT_RR_SYSINFO_13;
 
-	si13_default.no_pbcch.rac = bts->gprs.rac;
-	si13_default.no_pbcch.net_ctrl_ord = bts->gprs.net_ctrl_ord;
+	si13_info.no_pbcch.rac = bts->gprs.rac;
+	si13_info.no_pbcch.net_ctrl_ord = bts->gprs.net_ctrl_ord;
+	if (bts->gprs.mode == BTS_GPRS_EGPRS) {
+		si13_info.cell_opts.ext_info_present = 1;
+		si13_info.cell_opts.ext_info.egprs_supported = 1;
+	}
 
-	ret = rest_octets_si13(si13->rest_octets, &si13_default);
+	ret = rest_octets_si13(si13->rest_octets, &si13_info);
 	if (ret < 0)
 		return ret;
 
@@ -823,26 +883,231 @@ int gsm_generate_si(struct gsm_bts *bts, enum osmo_sysinfo_type si_type)
 {
 	gen_si_fn_t gen_si;
 
-	switch (bts->gprs.mode) {
-	case BTS_GPRS_EGPRS:
-		si13_default.cell_opts.ext_info_present = 1;
-		si13_default.cell_opts.ext_info.egprs_supported = 1;
-		/* fallthrough */
-	case BTS_GPRS_GPRS:
-		si_info.gprs_ind.present = 1;
+	gen_si = gen_si_fn[si_type];
+	if (!gen_si)
+		return -EINVAL;
+
+	return gen_si(bts->si_buf[si_type], bts);
+}
+
+/* send one SI type to a TRX via RSL.  An SI that is not valid is sent
+ * without content, which stops the BTS from broadcasting it. */
+static int rsl_si(struct gsm_bts_trx *trx, enum osmo_sysinfo_type i)
+{
+	struct gsm_bts *bts = trx->bts;
+	const uint8_t *data = NULL;
+	int si_len = 0;
+	int rc, j;
+
+	if (bts->si_valid & (1 << i)) {
+		data = GSM_BTS_SI(bts, i);
+		si_len = bts->si_len[i];
+		DEBUGP(DRR, "SI%s: %s\n", get_value_string(osmo_sitype_strs, i),
+			osmo_hexdump(data, GSM_MACBLOCK_LEN));
+	} else
+		DEBUGP(DRR, "SI%s: stopped\n",
+			get_value_string(osmo_sitype_strs, i));
+
+	switch (i) {
+	case SYSINFO_TYPE_5:
+	case SYSINFO_TYPE_5bis:
+	case SYSINFO_TYPE_5ter:
+	case SYSINFO_TYPE_6:
+		if (trx->bts->type == GSM_BTS_TYPE_HSL_FEMTO) {
+			/* HSL has mistaken SACCH INFO MODIFY for SACCH FILLING,
+			 * so we need a special workaround here */
+			/* This assumes a combined BCCH and TCH on TS1...7 */
+			for (j = 0; j < 4; j++)
+				rsl_sacch_info_modify(&trx->ts[0].lchan[j],
+						      osmo_sitype2rsl(i),
+						      data, si_len);
+			for (j = 1; j < 8; j++) {
+				rsl_sacch_info_modify(&trx->ts[j].lchan[0],
+						      osmo_sitype2rsl(i),
+						      data, si_len);
+				rsl_sacch_info_modify(&trx->ts[j].lchan[1],
+						      osmo_sitype2rsl(i),
+						      data, si_len);
+			}
+			rc = 0;
+		} else
+			rc = rsl_sacch_filling(trx, osmo_sitype2rsl(i),
+					       data, si_len);
 		break;
-	case BTS_GPRS_NONE:
-		si_info.gprs_ind.present = 0;
+	default:
+		rc = rsl_bcch_info(trx, osmo_sitype2rsl(i), data, si_len);
 		break;
 	}
 
-	memcpy(&si_info.selection_params,
-	       &bts->si_common.cell_ro_sel_par,
-	       sizeof(struct gsm48_si_selection_params));
+	return rc;
+}
 
-	gen_si = gen_si_fn[si_type];
-	if (!gen_si)
-		return -EINVAL;
+/* SI types a TRX broadcasts, in the order they are generated: SI2bis and
+ * SI5bis patch SI2 and SI5, SI3 refers to SI2ter */
+static const uint8_t trx_si_order[] = {
+	SYSINFO_TYPE_1, SYSINFO_TYPE_2, SYSINFO_TYPE_2bis, SYSINFO_TYPE_2ter,
+	SYSINFO_TYPE_3, SYSINFO_TYPE_4, SYSINFO_TYPE_13, SYSINFO_TYPE_5,
+	SYSINFO_TYPE_5bis, SYSINFO_TYPE_5ter, SYSINFO_TYPE_6,
+};
 
-	return gen_si(bts->si_buf[si_type], bts);
+/* determine which of the SI messages a TRX actually needs */
+static uint32_t trx_si_types(struct gsm_bts_trx *trx)
+{
+	struct gsm_bts *bts = trx->bts;
+	uint32_t types = 0;
+
+	if (trx == bts->c0) {
+		/* 1...4 are always present on a C0 TRX */
+		types |= (1 << SYSINFO_TYPE_1) | (1 << SYSINFO_TYPE_2) |
+			 (1 << SYSINFO_TYPE_2bis) | (1 << SYSINFO_TYPE_2ter) |
+			 (1 << SYSINFO_TYPE_3) | (1 << SYSINFO_TYPE_4);
+
+		/* 13 is always present on a C0 TRX of a GPRS BTS */
+		if (bts->gprs.mode != BTS_GPRS_NONE)
+			types |= (1 << SYSINFO_TYPE_13);
+	}
+
+	/* 5 and 6 are always present on every TRX */
+	types |= (1 << SYSINFO_TYPE_5) | (1 << SYSINFO_TYPE_5bis) |
+		 (1 << SYSINFO_TYPE_5ter) | (1 << SYSINFO_TYPE_6);
+
+	return types;
+}
+
+/* (re)generate the given SI types of a BTS, the types whose content or
+ * validity differs from before are returned in *changed. A type the BTS
+ * no longer broadcasts at all (SI13 after GPRS was turned off) turns
+ * invalid and is returned as changed as well. */
+static int generate_system_infos(struct gsm_bts *bts, uint32_t types,
+				 uint32_t *changed)
+{
+	sysinfo_buf_t old_buf[ARRAY_SIZE(trx_si_order)];
+	uint32_t old_valid = bts->si_valid;
+	uint32_t bts_types = trx_si_types(bts->c0);
+	uint32_t gone = 0;
+	int n, i, rc;
+
+	bts->si_common.cell_sel_par.ms_txpwr_max_ccch =
+			ms_pwr_ctl_lvl(bts->band, bts->ms_max_power);
+	bts->si_common.cell_sel_par.neci = bts->network->neci;
+
+	for (n = 0; n < ARRAY_SIZE(trx_si_order); n++)
+		memcpy(old_buf[n], bts->si_buf[trx_si_order[n]],
+		       sizeof(old_buf[n]));
+
+	for (n = 0; n < ARRAY_SIZE(trx_si_order); n++) {
+		i = trx_si_order[n];
+		if (!(types & (1 << i)))
+			continue;
+		/* Only generate SI if this SI is not in "static" (user-defined) mode */
+		if (!(bts->si_mode_static & (1 << i))) {
+			/* Set SI as being valid. gsm_generate_si() might unset
+			 * it, if SI is not required. */
+			bts->si_valid |= (1 << i);
+			rc = gsm_generate_si(bts, i);
+			if (rc < 0)
+				goto err_out;
+			bts->si_len[i] = rc;
+		} else {
+			if (i == SYSINFO_TYPE_5 || i == SYSINFO_TYPE_5bis
+			 || i == SYSINFO_TYPE_5ter)
+				bts->si_len[i] = 18;
+			else if (i == SYSINFO_TYPE_6)
+				bts->si_len[i] = 11;
+			else
+				bts->si_len[i] = 23;
+		}
+	}
+
+	for (n = 0; n < ARRAY_SIZE(trx_si_order); n++) {
+		i = trx_si_order[n];
+		if (!(bts_types & (1 << i)))
+			gone |= (1 << i);
+	}
+	bts->si_valid &= ~gone;
+
+	*changed = (bts->si_valid ^ old_valid) & (types | gone);
+	for (n = 0; n < ARRAY_SIZE(trx_si_order); n++) {
+		i = trx_si_order[n];
+		if ((types & (1 << i))
+		 && memcmp(old_buf[n], bts->si_buf[i], sizeof(old_buf[n])))
+			*changed |= (1 << i);
+	}
+	/* the content of an SI that was and is not broadcast is irrelevant */
+	*changed &= bts->si_valid | old_valid;
+
+	return 0;
+err_out:
+	LOGP(DRR, LOGL_ERROR, "Cannot generate SI%s for BTS %u, most likely "
+		"a problem with neighbor cell list generation\n",
+		get_value_string(osmo_sitype_strs, i), bts->nr);
+	return rc;
+}
+
+/* send the given SI types of the BTS on a TRX via RSL, those that are
+ * not valid are stopped */
+static int send_system_infos(struct gsm_bts_trx *trx, uint32_t types)
+{
+	int n, i, rc;
+
+	for (n = 0; n < ARRAY_SIZE(trx_si_order); n++) {
+		i = trx_si_order[n];
+		if (!(types & (1 << i)))
+			continue;
+		rc = rsl_si(trx, i);
+		if (rc < 0)
+			return rc;
+	}
+
+	return 0;
+}
+
+/* set all system information types of a TRX being bootstrapped */
+int gsm_bts_trx_set_system_infos(struct gsm_bts_trx *trx)
+{
+	uint32_t types = trx_si_types(trx);
+	uint32_t changed;
+	int rc;
+
+	rc = generate_system_infos(trx->bts, types, &changed);
+	if (rc < 0)
+		return rc;
+
+	/* nothing has been broadcast yet, so there is nothing to stop */
+	return send_system_infos(trx, types & trx->bts->si_valid);
+}
+
+/* regenerate the SI of a running BTS after a configuration change and only
+ * send those whose content or validity changed to its TRXs, the C0 TRX
+ * also stops the types the BTS no longer broadcasts */
+int gsm_bts_set_system_infos(struct gsm_bts *bts)
+{
+	struct gsm_bts_trx *trx;
+	uint32_t changed;
+	int rc;
+
+	if (!bts->c0->rsl_link)
+		return 0;
+
+	rc = generate_system_infos(bts, trx_si_types(bts->c0), &changed);
+	if (rc < 0)
+		return rc;
+	if (!changed)
+		return 0;
+
+	LOGP(DRR, LOGL_INFO, "BTS %u: SI changed (0x%08x), resending\n",
+		bts->nr, changed);
+
+	llist_for_each_entry(trx, &bts->trx_list, list) {
+		if (!trx->rsl_link)
+			continue;
+		if (trx == bts->c0)
+			rc = send_system_infos(trx, changed);
+		else
+			rc = send_system_infos(trx, trx_si_types(trx) & changed);
+		if (rc < 0)
+			return rc;
+	}
+
+	return 0;
 }
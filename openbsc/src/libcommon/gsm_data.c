@@ -70,10 +70,29 @@ int gsm_bts_model_register(struct gsm_bts_model *model)
 	return 0;
 }
 
+static const char *ho_reason_completed_names[_NUM_HO_REASON] = {
+	[HO_REASON_INTERFERENCE]	= "net.handover.completed.interference",
+	[HO_REASON_BAD_QUALITY]		= "net.handover.completed.bad_quality",
+	[HO_REASON_LOW_LEVEL]		= "net.handover.completed.low_level",
+	[HO_REASON_MAX_DISTANCE]	= "net.handover.completed.max_distance",
+	[HO_REASON_POWER_BUDGET]	= "net.handover.completed.power_budget",
+	[HO_REASON_CONGESTION]		= "net.handover.completed.congestion",
+};
+
+static const char *ho_reason_failed_names[_NUM_HO_REASON] = {
+	[HO_REASON_INTERFERENCE]	= "net.handover.failed.interference",
+	[HO_REASON_BAD_QUALITY]		= "net.handover.failed.bad_quality",
+	[HO_REASON_LOW_LEVEL]		= "net.handover.failed.low_level",
+	[HO_REASON_MAX_DISTANCE]	= "net.handover.failed.max_distance",
+	[HO_REASON_POWER_BUDGET]	= "net.handover.failed.power_budget",
+	[HO_REASON_CONGESTION]		= "net.handover.failed.congestion",
+};
+
 struct gsm_network *gsm_network_init(uint16_t country_code, uint16_t network_code,
 				     int (*mncc_recv)(struct gsm_network *, struct msgb *))
 {
 	struct gsm_network *net;
+	int i;
 
 	net = talloc_zero(tall_bsc_ctx, struct gsm_network);
 	if (!net)
@@ -107,6 +126,12 @@ struct gsm_network *gsm_network_init(uint16_t country_code, uint16_t network_cod
 	net->handover.pwr_interval = 6;
 	net->handover.pwr_hysteresis = 3;
 	net->handover.max_distance = 9999;
+	net->handover.algorithm = 1;
+	net->handover.batch_interval = 1;
+	net->handover.congestion_min_free = 0;
+
+	net->mncc_sock.queue_limit = MNCC_SOCK_QUEUE_DEFAULT;
+	net->mncc_sock.voice_drop = MNCC_SOCK_DROP_NEWEST;
 
 	INIT_LLIST_HEAD(&net->trans_list);
 	INIT_LLIST_HEAD(&net->upqueue);
@@ -119,6 +144,12 @@ struct gsm_network *gsm_network_init(uint16_t country_code, uint16_t network_cod
 	net->stats.handover.timeout = osmo_counter_alloc("net.handover.timeout");
 	net->stats.handover.completed = osmo_counter_alloc("net.handover.completed");
 	net->stats.handover.failed = osmo_counter_alloc("net.handover.failed");
+	for (i = 0; i < _NUM_HO_REASON; i++) {
+		net->stats.handover.reason_completed[i] =
+			osmo_counter_alloc(ho_reason_completed_names[i]);
+		net->stats.handover.reason_failed[i] =
+			osmo_counter_alloc(ho_reason_failed_names[i]);
+	}
 	net->stats.loc_upd_type.attach = osmo_counter_alloc("net.loc_upd_type.attach");
 	net->stats.loc_upd_type.normal = osmo_counter_alloc("net.loc_upd_type.normal");
 	net->stats.loc_upd_type.periodic = osmo_counter_alloc("net.loc_upd_type.periodic");
@@ -142,6 +173,11 @@ struct gsm_network *gsm_network_init(uint16_t country_code, uint16_t network_cod
 	net->stats.chan.rll_err = osmo_counter_alloc("net.chan.rll_err");
 	net->stats.bts.oml_fail = osmo_counter_alloc("net.bts.oml_fail");
 	net->stats.bts.rsl_fail = osmo_counter_alloc("net.bts.rsl_fail");
+	net->stats.mncc.rx = osmo_counter_alloc("net.mncc.rx");
+	net->stats.mncc.tx = osmo_counter_alloc("net.mncc.tx");
+	net->stats.mncc.rx_calls = osmo_counter_alloc("net.mncc.rx_calls");
+	net->stats.mncc.tx_calls = osmo_counter_alloc("net.mncc.tx_calls");
+	net->stats.mncc.voice_dropped = osmo_counter_alloc("net.mncc.voice_dropped");
 
 	net->mncc_recv = mncc_recv;
 
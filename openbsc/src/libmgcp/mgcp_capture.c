@@ -0,0 +1,680 @@
+/* Capture of the MGCP taps to pcap and rtpdump files */
+
+/*
+ * (C) 2026 by the OpenBSC contributors
+ * All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * The data plane copies a tapped packet into a bounded queue and goes
+ * on, a packet that does not fit is dropped.  A writer thread takes the
+ * queued packets in batches, every CAPTURE_BATCH_MS or when the queue is
+ * half full, and writes them through the buffers of the files.
+ *
+ * The writer must not use talloc or the logging of libosmocore, the
+ * files are allocated with malloc as the writer frees them.  It counts
+ * a batch on its own and adds it to the statistics under the lock.
+ *
+ * The same queue carries lines to append to a text file, like the call
+ * quality records, so the main loop never waits for the disk.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <arpa/inet.h>
+
+#include <osmocom/core/talloc.h>
+
+#include <openbsc/debug.h>
+#include <openbsc/mgcp.h>
+#include <openbsc/mgcp_internal.h>
+#include <openbsc/mgcp_capture.h>
+
+#define CAPTURE_BATCH_MS	50
+#define CAPTURE_FILE_BUFFER	(64 * 1024)
+
+#define PCAP_MAGIC		0xa1b2c3d4
+#define PCAP_LINKTYPE_RAW	101
+#define PCAP_SNAPLEN		65535
+
+struct mgcp_capture_writer {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	/* signals the writer, and the writer signals it is idle */
+	pthread_cond_t wakeup;
+	pthread_cond_t idle;
+
+	uint8_t *queue;
+	size_t size;
+	/* the octets ever queued and written, the queue holds the rest */
+	uint64_t in;
+	uint64_t out;
+
+	/* files to close after the queued packets */
+	struct llist_head closing;
+
+	/* the appended lines, see mgcp_capture_put_line() */
+	struct mgcp_capture_stats lines;
+
+	int busy;
+	int flush;
+	int stop;
+};
+
+enum capture_rec_type {
+	/* the rest of the queue is skipped */
+	REC_WRAP,
+	REC_PACKET,
+	/* the file name, the header and the line, each with a NUL */
+	REC_LINE,
+};
+
+/* a packet or a line in the queue */
+struct capture_rec {
+	enum capture_rec_type type;
+	struct mgcp_capture *cap;
+	struct timeval tv;
+	struct in_addr src;
+	struct in_addr dst;
+	uint16_t src_port;
+	uint16_t dst_port;
+	uint16_t len;
+};
+
+#define REC_SIZE(len) \
+	((sizeof(struct capture_rec) + (len) + 7) & ~(size_t) 7)
+
+struct pcap_file_hdr {
+	uint32_t magic;
+	uint16_t version_major;
+	uint16_t version_minor;
+	int32_t thiszone;
+	uint32_t sigfigs;
+	uint32_t snaplen;
+	uint32_t network;
+};
+
+static void put_u16(uint8_t *p, uint16_t val)
+{
+	p[0] = val >> 8;
+	p[1] = val;
+}
+
+static void put_u32(uint8_t *p, uint32_t val)
+{
+	p[0] = val >> 24;
+	p[1] = val >> 16;
+	p[2] = val >> 8;
+	p[3] = val;
+}
+
+static uint16_t ip_checksum(const uint8_t *hdr, int len)
+{
+	uint32_t sum = 0;
+	int i;
+
+	for (i = 0; i < len; i += 2)
+		sum += (hdr[i] << 8) | hdr[i + 1];
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return ~sum;
+}
+
+static int write_pcap(struct mgcp_capture *cap, struct capture_rec *rec,
+		      const uint8_t *data)
+{
+	uint32_t pkt[4];
+	uint8_t hdr[28];
+	int len = sizeof(hdr) + rec->len;
+
+	pkt[0] = rec->tv.tv_sec;
+	pkt[1] = rec->tv.tv_usec;
+	pkt[2] = len;
+	pkt[3] = len;
+
+	/* IPv4 and UDP, the UDP checksum is optional */
+	memset(hdr, 0, sizeof(hdr));
+	hdr[0] = 0x45;
+	put_u16(&hdr[2], len);
+	hdr[6] = 0x40;
+	hdr[8] = 64;
+	hdr[9] = IPPROTO_UDP;
+	memcpy(&hdr[12], &rec->src, 4);
+	memcpy(&hdr[16], &rec->dst, 4);
+	put_u16(&hdr[10], ip_checksum(hdr, 20));
+	memcpy(&hdr[20], &rec->src_port, 2);
+	memcpy(&hdr[22], &rec->dst_port, 2);
+	put_u16(&hdr[24], 8 + rec->len);
+
+	if (fwrite(pkt, sizeof(pkt), 1, cap->file) != 1 ||
+	    fwrite(hdr, sizeof(hdr), 1, cap->file) != 1 ||
+	    fwrite(data, rec->len, 1, cap->file) != 1)
+		return -1;
+	return 0;
+}
+
+/* the format of the rtptools, RTCP has no packet length */
+static int write_rtpdump(struct mgcp_capture *cap, struct capture_rec *rec,
+			 const uint8_t *data)
+{
+	struct timeval offset;
+	uint8_t hdr[8];
+	int is_rtcp = rec->len >= 2 && data[1] >= 200 && data[1] <= 204;
+
+	timersub(&rec->tv, &cap->start, &offset);
+	put_u16(&hdr[0], sizeof(hdr) + rec->len);
+	put_u16(&hdr[2], is_rtcp ? 0 : rec->len);
+	put_u32(&hdr[4], offset.tv_sec * 1000 + offset.tv_usec / 1000);
+
+	if (fwrite(hdr, sizeof(hdr), 1, cap->file) != 1 ||
+	    fwrite(data, rec->len, 1, cap->file) != 1)
+		return -1;
+	return 0;
+}
+
+/* the header goes first if the file is new or empty */
+static int write_line(struct capture_rec *rec)
+{
+	const char *filename = (const char *) &rec[1];
+	const char *header = filename + strlen(filename) + 1;
+	const char *line = header + strlen(header) + 1;
+	FILE *file;
+	int rc = 0;
+
+	file = fopen(filename, "a");
+	if (!file)
+		return -1;
+
+	fseek(file, 0, SEEK_END);
+	if (ftell(file) == 0 && fputs(header, file) < 0)
+		rc = -1;
+	if (fputs(line, file) < 0)
+		rc = -1;
+	if (fclose(file) != 0)
+		rc = -1;
+	return rc;
+}
+
+static void write_batch(struct mgcp_capture_writer *w, uint64_t end,
+			struct llist_head *dirty,
+			struct mgcp_capture_stats *lines)
+{
+	struct capture_rec *rec;
+	struct mgcp_capture *cap;
+	uint64_t pos = w->out;
+	size_t off;
+	int rc;
+
+	while (pos < end) {
+		off = pos % w->size;
+		rec = (struct capture_rec *) &w->queue[off];
+		if (w->size - off < sizeof(*rec) || rec->type == REC_WRAP) {
+			pos += w->size - off;
+			continue;
+		}
+
+		if (rec->type == REC_LINE) {
+			if (write_line(rec) == 0)
+				lines->packets += 1;
+			else
+				lines->errors += 1;
+			pos += REC_SIZE(rec->len);
+			continue;
+		}
+
+		cap = rec->cap;
+		if (cap->format == MGCP_CAPTURE_PCAP)
+			rc = write_pcap(cap, rec, (uint8_t *) &rec[1]);
+		else
+			rc = write_rtpdump(cap, rec, (uint8_t *) &rec[1]);
+		if (rc == 0)
+			cap->batch_packets += 1;
+		else
+			cap->batch_errors += 1;
+
+		if (!cap->dirty) {
+			cap->dirty = 1;
+			llist_add_tail(&cap->dirty_entry, dirty);
+		}
+		pos += REC_SIZE(rec->len);
+	}
+}
+
+static void capture_free(struct mgcp_capture *cap)
+{
+	if (cap->dirty)
+		llist_del(&cap->dirty_entry);
+	fclose(cap->file);
+	free(cap->filename);
+	free(cap);
+}
+
+static void *writer_thread(void *data)
+{
+	struct mgcp_capture_writer *w = data;
+	struct mgcp_capture *cap, *tmp;
+	struct mgcp_capture_stats lines;
+	struct timespec wait;
+	uint64_t end;
+	LLIST_HEAD(closing);
+	LLIST_HEAD(dirty);
+
+	pthread_mutex_lock(&w->lock);
+	for (;;) {
+		if (w->in == w->out && llist_empty(&w->closing)) {
+			pthread_cond_broadcast(&w->idle);
+			if (w->stop)
+				break;
+			pthread_cond_wait(&w->wakeup, &w->lock);
+			continue;
+		}
+
+		/* give the batch some time unless we are in a hurry */
+		if (!w->flush && !w->stop && w->in - w->out < w->size / 2) {
+			clock_gettime(CLOCK_REALTIME, &wait);
+			wait.tv_nsec += CAPTURE_BATCH_MS * 1000000;
+			if (wait.tv_nsec >= 1000000000) {
+				wait.tv_sec += 1;
+				wait.tv_nsec -= 1000000000;
+			}
+			pthread_cond_timedwait(&w->wakeup, &w->lock, &wait);
+		}
+
+		w->flush = 0;
+		w->busy = 1;
+		end = w->in;
+		llist_splice_init(&w->closing, &closing);
+		pthread_mutex_unlock(&w->lock);
+
+		memset(&lines, 0, sizeof(lines));
+		write_batch(w, end, &dirty, &lines);
+		llist_for_each_entry(cap, &dirty, dirty_entry) {
+			if (fflush(cap->file) != 0)
+				cap->batch_errors += 1;
+		}
+		/* nobody looks at the files that are closed any more */
+		llist_for_each_entry_safe(cap, tmp, &closing, entry) {
+			llist_del(&cap->entry);
+			capture_free(cap);
+		}
+
+		pthread_mutex_lock(&w->lock);
+		llist_for_each_entry_safe(cap, tmp, &dirty, dirty_entry) {
+			cap->stats.packets += cap->batch_packets;
+			cap->stats.errors += cap->batch_errors;
+			cap->batch_packets = cap->batch_errors = 0;
+			cap->dirty = 0;
+			llist_del(&cap->dirty_entry);
+		}
+		w->lines.packets += lines.packets;
+		w->lines.errors += lines.errors;
+		w->out = end;
+		w->busy = 0;
+	}
+	pthread_mutex_unlock(&w->lock);
+
+	return NULL;
+}
+
+static struct mgcp_capture_writer *writer_get(struct mgcp_config *cfg)
+{
+	struct mgcp_capture_writer *w;
+
+	if (cfg->capture_writer)
+		return cfg->capture_writer;
+
+	w = talloc_zero(cfg, struct mgcp_capture_writer);
+	if (!w)
+		return NULL;
+
+	w->size = (size_t) cfg->capture_queue_kb * 1024;
+	w->queue = malloc(w->size);
+	if (!w->queue) {
+		LOGP(DMGCP, LOGL_ERROR, "Failed to allocate the capture queue.\n");
+		talloc_free(w);
+		return NULL;
+	}
+
+	INIT_LLIST_HEAD(&w->closing);
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_cond_init(&w->wakeup, NULL);
+	pthread_cond_init(&w->idle, NULL);
+
+	if (pthread_create(&w->thread, NULL, writer_thread, w) != 0) {
+		LOGP(DMGCP, LOGL_ERROR, "Failed to start the capture writer.\n");
+		pthread_cond_destroy(&w->idle);
+		pthread_cond_destroy(&w->wakeup);
+		pthread_mutex_destroy(&w->lock);
+		free(w->queue);
+		talloc_free(w);
+		return NULL;
+	}
+
+	cfg->capture_writer = w;
+	return w;
+}
+
+static int write_file_hdr(struct mgcp_capture *cap)
+{
+	struct pcap_file_hdr pcap;
+	uint8_t rd[16];
+
+	if (cap->format == MGCP_CAPTURE_PCAP) {
+		memset(&pcap, 0, sizeof(pcap));
+		pcap.magic = PCAP_MAGIC;
+		pcap.version_major = 2;
+		pcap.version_minor = 4;
+		pcap.snaplen = PCAP_SNAPLEN;
+		pcap.network = PCAP_LINKTYPE_RAW;
+		return fwrite(&pcap, sizeof(pcap), 1, cap->file) == 1 ? 0 : -1;
+	}
+
+	if (fprintf(cap->file, "#!rtpplay1.0 %s/%u\n",
+		    inet_ntoa(cap->peer->addr), ntohs(cap->peer->rtp_port)) < 0)
+		return -1;
+
+	memset(rd, 0, sizeof(rd));
+	put_u32(&rd[0], cap->start.tv_sec);
+	put_u32(&rd[4], cap->start.tv_usec);
+	memcpy(&rd[8], &cap->peer->addr, 4);
+	memcpy(&rd[12], &cap->peer->rtp_port, 2);
+	return fwrite(rd, sizeof(rd), 1, cap->file) == 1 ? 0 : -1;
+}
+
+struct mgcp_capture *mgcp_capture_open(struct mgcp_endpoint *endp, int tap,
+				       enum mgcp_capture_format format,
+				       const char *filename)
+{
+	struct mgcp_capture_writer *w;
+	struct mgcp_capture *cap;
+
+	w = writer_get(endp->cfg);
+	if (!w)
+		return NULL;
+
+	cap = calloc(1, sizeof(*cap));
+	if (!cap)
+		return NULL;
+
+	cap->writer = w;
+	cap->format = format;
+	cap->incoming = tap == MGCP_TAP_BTS_IN || tap == MGCP_TAP_NET_IN;
+	if (tap == MGCP_TAP_BTS_IN || tap == MGCP_TAP_BTS_OUT)
+		cap->peer = &endp->bts_end;
+	else
+		cap->peer = &endp->net_end;
+	if (!endp->cfg->source_addr ||
+	    inet_aton(endp->cfg->source_addr, &cap->local_addr) == 0)
+		cap->local_addr.s_addr = INADDR_ANY;
+	gettimeofday(&cap->start, NULL);
+
+	cap->filename = strdup(filename);
+	cap->file = fopen(filename, "wb");
+	if (!cap->filename || !cap->file) {
+		LOGP(DMGCP, LOGL_ERROR, "Failed to open the capture %s: %s\n",
+			filename, strerror(errno));
+		goto error;
+	}
+	setvbuf(cap->file, NULL, _IOFBF, CAPTURE_FILE_BUFFER);
+
+	if (write_file_hdr(cap) != 0) {
+		LOGP(DMGCP, LOGL_ERROR, "Failed to write the capture %s.\n",
+			filename);
+		goto error;
+	}
+
+	return cap;
+
+error:
+	if (cap->file)
+		fclose(cap->file);
+	free(cap->filename);
+	free(cap);
+	return NULL;
+}
+
+void mgcp_capture_close(struct mgcp_capture *cap)
+{
+	struct mgcp_capture_writer *w;
+
+	if (!cap)
+		return;
+
+	w = cap->writer;
+	pthread_mutex_lock(&w->lock);
+	llist_add_tail(&cap->entry, &w->closing);
+	pthread_cond_signal(&w->wakeup);
+	pthread_mutex_unlock(&w->lock);
+}
+
+/* called with the lock held, the record is queued by queue_commit() */
+static struct capture_rec *queue_reserve(struct mgcp_capture_writer *w,
+					 size_t need)
+{
+	struct capture_rec *rec;
+	size_t off, contig;
+
+	/* a record is never split, skip the end of the queue */
+	off = w->in % w->size;
+	contig = w->size - off;
+	if (contig < need) {
+		if (w->size - (w->in - w->out) < contig + need)
+			return NULL;
+		if (contig >= sizeof(*rec)) {
+			rec = (struct capture_rec *) &w->queue[off];
+			rec->type = REC_WRAP;
+		}
+		w->in += contig;
+		off = 0;
+	} else if (w->size - (w->in - w->out) < need) {
+		return NULL;
+	}
+
+	return (struct capture_rec *) &w->queue[off];
+}
+
+static void queue_commit(struct mgcp_capture_writer *w, size_t need)
+{
+	int was_empty = w->in == w->out;
+
+	/* an idle writer starts the batch timer, a full one is hurried */
+	w->in += need;
+	if (was_empty || w->in - w->out >= w->size / 2)
+		pthread_cond_signal(&w->wakeup);
+}
+
+int mgcp_capture_put(struct mgcp_capture *cap, const char *data, int len)
+{
+	struct mgcp_capture_writer *w = cap->writer;
+	struct capture_rec *rec;
+	size_t need;
+
+	if (len <= 0 || len > PCAP_SNAPLEN - 28)
+		return -1;
+
+	need = REC_SIZE(len);
+	pthread_mutex_lock(&w->lock);
+
+	rec = queue_reserve(w, need);
+	if (!rec)
+		goto drop;
+
+	rec->type = REC_PACKET;
+	rec->cap = cap;
+	gettimeofday(&rec->tv, NULL);
+	if (cap->incoming) {
+		rec->src = cap->peer->addr;
+		rec->src_port = cap->peer->rtp_port;
+		rec->dst = cap->local_addr;
+		rec->dst_port = htons(cap->peer->local_port);
+	} else {
+		rec->src = cap->local_addr;
+		rec->src_port = htons(cap->peer->local_port);
+		rec->dst = cap->peer->addr;
+		rec->dst_port = cap->peer->rtp_port;
+	}
+	rec->len = len;
+	memcpy(&rec[1], data, len);
+	queue_commit(w, need);
+	pthread_mutex_unlock(&w->lock);
+	return 0;
+
+drop:
+	cap->stats.dropped += 1;
+	pthread_mutex_unlock(&w->lock);
+	return -1;
+}
+
+int mgcp_capture_put_line(struct mgcp_config *cfg, const char *filename,
+			  const char *header, const char *line)
+{
+	struct mgcp_capture_writer *w;
+	struct capture_rec *rec;
+	size_t name_len, header_len, line_len, len, need;
+	char *data;
+
+	w = writer_get(cfg);
+	if (!w)
+		return -1;
+
+	name_len = strlen(filename) + 1;
+	header_len = strlen(header) + 1;
+	line_len = strlen(line) + 1;
+	len = name_len + header_len + line_len;
+	if (len > UINT16_MAX)
+		return -1;
+
+	need = REC_SIZE(len);
+	pthread_mutex_lock(&w->lock);
+
+	rec = queue_reserve(w, need);
+	if (!rec) {
+		w->lines.dropped += 1;
+		pthread_mutex_unlock(&w->lock);
+		return -1;
+	}
+
+	rec->type = REC_LINE;
+	rec->cap = NULL;
+	rec->len = len;
+	data = (char *) &rec[1];
+	memcpy(data, filename, name_len);
+	memcpy(data + name_len, header, header_len);
+	memcpy(data + name_len + header_len, line, line_len);
+	queue_commit(w, need);
+	pthread_mutex_unlock(&w->lock);
+	return 0;
+}
+
+void mgcp_capture_get_stats(struct mgcp_capture *cap,
+			    struct mgcp_capture_stats *stats)
+{
+	pthread_mutex_lock(&cap->writer->lock);
+	*stats = cap->stats;
+	pthread_mutex_unlock(&cap->writer->lock);
+}
+
+void mgcp_capture_get_line_stats(struct mgcp_config *cfg,
+				 struct mgcp_capture_stats *stats)
+{
+	struct mgcp_capture_writer *w = cfg->capture_writer;
+
+	if (!w) {
+		memset(stats, 0, sizeof(*stats));
+		return;
+	}
+
+	pthread_mutex_lock(&w->lock);
+	*stats = w->lines;
+	pthread_mutex_unlock(&w->lock);
+}
+
+void mgcp_capture_sync(struct mgcp_config *cfg)
+{
+	struct mgcp_capture_writer *w = cfg->capture_writer;
+
+	if (!w)
+		return;
+
+	pthread_mutex_lock(&w->lock);
+	w->flush = 1;
+	pthread_cond_signal(&w->wakeup);
+	while (w->in != w->out || !llist_empty(&w->closing) || w->busy)
+		pthread_cond_wait(&w->idle, &w->lock);
+	pthread_mutex_unlock(&w->lock);
+}
+
+void mgcp_capture_stop(struct mgcp_config *cfg)
+{
+	struct mgcp_capture_writer *w = cfg->capture_writer;
+
+	if (!w)
+		return;
+
+	pthread_mutex_lock(&w->lock);
+	w->stop = 1;
+	pthread_cond_signal(&w->wakeup);
+	pthread_mutex_unlock(&w->lock);
+	pthread_join(w->thread, NULL);
+
+	pthread_cond_destroy(&w->idle);
+	pthread_cond_destroy(&w->wakeup);
+	pthread_mutex_destroy(&w->lock);
+	free(w->queue);
+	talloc_free(w);
+	cfg->capture_writer = NULL;
+}
+
+static void close_trunk(struct mgcp_trunk_config *tcfg)
+{
+	struct mgcp_endpoint *endp;
+	int i, j;
+
+	if (!tcfg->endpoints)
+		return;
+
+	for (i = 0; i < tcfg->number_endpoints; ++i) {
+		endp = &tcfg->endpoints[i];
+		for (j = 0; j < MGCP_TAP_COUNT; ++j) {
+			if (!endp->taps[j].capture)
+				continue;
+			mgcp_capture_close(endp->taps[j].capture);
+			endp->taps[j].capture = NULL;
+			endp->taps[j].enabled = 0;
+		}
+	}
+}
+
+void mgcp_capture_shutdown(struct mgcp_config *cfg)
+{
+	struct mgcp_trunk_config *trunk;
+
+	if (!cfg->capture_writer)
+		return;
+
+	close_trunk(&cfg->trunk);
+	llist_for_each_entry(trunk, &cfg->trunks, entry)
+		close_trunk(trunk);
+
+	mgcp_capture_sync(cfg);
+	mgcp_capture_stop(cfg);
+}
@@ -0,0 +1,411 @@
+/* Adaptive jitter buffer of the MGCP Media Gateway */
+
+/*
+ * (C) 2026 by the OpenBSC contributors
+ * All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * The packets of an endpoint are kept in a ring indexed by their
+ * sequence number and are played out one per ptime.  A packet that
+ * arrives after its playout time is dropped, a missing one is replaced
+ * by the previous packet.  The depth follows the interarrival jitter of
+ * RFC 3550 between the configured minimum and maximum.  The RTP time
+ * of the output runs with the playout clock, so a pause in the output
+ * shows up as a gap in the timestamps, and the frame after it carries
+ * the marker bit.
+ *
+ * Instead of a timer per endpoint all buffers hang in the slots of one
+ * wheel.  The wheel turns every 5ms and serves one slot, so each buffer
+ * is served every 20ms and the work is spread over the period.
+ */
+
+#include <string.h>
+
+#include <osmocom/core/msgb.h>
+#include <osmocom/core/talloc.h>
+
+#include <openbsc/debug.h>
+#include <openbsc/mgcp.h>
+#include <openbsc/mgcp_internal.h>
+#include <openbsc/mgcp_jitter.h>
+
+#define RTP_HDR_LEN		12
+#define WHEEL_TICK_MS		(MGCP_JB_FRAME_MS / MGCP_JB_WHEEL_SLOTS)
+/* give up catching up on the missed slots after a stall */
+#define WHEEL_MAX_BEHIND_MS	(10 * MGCP_JB_FRAME_MS)
+
+static uint16_t rtp_seq(const uint8_t *rtp)
+{
+	return (rtp[2] << 8) | rtp[3];
+}
+
+static uint32_t rtp_u32(const uint8_t *p)
+{
+	return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static void rtp_set_seq_ts(uint8_t *rtp, uint16_t seq, uint32_t ts)
+{
+	rtp[2] = seq >> 8;
+	rtp[3] = seq;
+	rtp[4] = ts >> 24;
+	rtp[5] = ts >> 16;
+	rtp[6] = ts >> 8;
+	rtp[7] = ts;
+}
+
+static void wheel_schedule(struct mgcp_jitter_wheel *wheel)
+{
+	int32_t delay = wheel->next - get_current_ts();
+
+	if (delay < 0)
+		delay = 0;
+	osmo_timer_schedule(&wheel->timer, 0, delay * 1000);
+}
+
+static void wheel_timer_cb(void *data)
+{
+	struct mgcp_jitter_wheel *wheel = data;
+	uint32_t now = get_current_ts();
+
+	if ((int32_t) (now - wheel->next) > WHEEL_MAX_BEHIND_MS) {
+		LOGP(DMGCP, LOGL_NOTICE,
+			"Jitter buffers were not served for %d ms.\n",
+			(int32_t) (now - wheel->next));
+		wheel->clock_ms += now - wheel->next;
+		wheel->next = now;
+	}
+
+	while (wheel->count > 0 && (int32_t) (now - wheel->next) >= 0) {
+		mgcp_jitter_wheel_advance(wheel);
+		wheel->next += WHEEL_TICK_MS;
+	}
+
+	if (wheel->count > 0)
+		wheel_schedule(wheel);
+}
+
+static struct mgcp_jitter_wheel *wheel_get(struct mgcp_config *cfg)
+{
+	struct mgcp_jitter_wheel *wheel;
+	int i;
+
+	if (cfg->jitter_wheel)
+		return cfg->jitter_wheel;
+
+	wheel = talloc_zero(cfg, struct mgcp_jitter_wheel);
+	if (!wheel)
+		return NULL;
+
+	for (i = 0; i < MGCP_JB_WHEEL_SLOTS; ++i)
+		INIT_LLIST_HEAD(&wheel->slots[i]);
+	wheel->timer.cb = wheel_timer_cb;
+	wheel->timer.data = wheel;
+
+	cfg->jitter_wheel = wheel;
+	return wheel;
+}
+
+struct mgcp_jitter_buffer *mgcp_jitter_alloc(struct mgcp_endpoint *endp,
+					     mgcp_jitter_output output)
+{
+	struct mgcp_trunk_config *tcfg = endp->tcfg;
+	struct mgcp_jitter_wheel *wheel;
+	struct mgcp_jitter_buffer *jb;
+
+	wheel = wheel_get(endp->cfg);
+	if (!wheel)
+		return NULL;
+
+	jb = talloc_zero(wheel, struct mgcp_jitter_buffer);
+	if (!jb)
+		return NULL;
+
+	jb->endp = endp;
+	jb->output = output;
+	jb->frame_ms = endp->net_end.packet_duration_ms;
+	if (jb->frame_ms < MGCP_JB_MIN_FRAME_MS ||
+	    jb->frame_ms > MGCP_JB_MAX_FRAME_MS)
+		jb->frame_ms = MGCP_JB_FRAME_MS;
+	jb->frame_ts = jb->frame_ms * 8;
+	/* the first service plays out a frame */
+	jb->served_ms = wheel->clock_ms - MGCP_JB_FRAME_MS;
+	jb->min_depth = tcfg->jitter_min_frames;
+	jb->max_depth = tcfg->jitter_max_frames;
+	if (jb->min_depth < 1)
+		jb->min_depth = 1;
+	if (jb->max_depth >= MGCP_JB_SIZE)
+		jb->max_depth = MGCP_JB_SIZE - 1;
+	if (jb->max_depth < jb->min_depth)
+		jb->max_depth = jb->min_depth;
+	jb->target = jb->min_depth;
+	jb->buffering = 1;
+
+	/* start with the slot that is served next */
+	llist_add_tail(&jb->entry, &wheel->slots[wheel->current]);
+	if (wheel->count++ == 0) {
+		wheel->next = get_current_ts() + WHEEL_TICK_MS;
+		wheel_schedule(wheel);
+	}
+
+	return jb;
+}
+
+static void flush(struct mgcp_jitter_buffer *jb)
+{
+	int i;
+
+	for (i = 0; i < MGCP_JB_SIZE; ++i) {
+		msgb_free(jb->packets[i]);
+		jb->packets[i] = NULL;
+	}
+	jb->count = 0;
+}
+
+void mgcp_jitter_free(struct mgcp_jitter_buffer *jb)
+{
+	struct mgcp_jitter_wheel *wheel;
+
+	if (!jb)
+		return;
+
+	wheel = jb->endp->cfg->jitter_wheel;
+	llist_del(&jb->entry);
+	if (--wheel->count == 0)
+		osmo_timer_del(&wheel->timer);
+
+	flush(jb);
+	msgb_free(jb->last);
+	talloc_free(jb);
+}
+
+unsigned int mgcp_jitter_depth(struct mgcp_jitter_buffer *jb)
+{
+	if (jb->count == 0)
+		return 0;
+	return (uint16_t) (jb->max_seq - jb->play_seq) + 1;
+}
+
+static void restart(struct mgcp_jitter_buffer *jb, uint16_t seq)
+{
+	flush(jb);
+	msgb_free(jb->last);
+	jb->last = NULL;
+	jb->play_seq = seq;
+	jb->max_seq = seq;
+	jb->buffering = 1;
+	jb->marker = 1;
+}
+
+/* the target depth covers three times the jitter */
+static void update_target(struct mgcp_jitter_buffer *jb, uint32_t arrival_ms,
+			  uint32_t ts)
+{
+	int32_t transit, d;
+	int target;
+
+	transit = arrival_ms - ts / 8;
+	d = transit - jb->transit;
+	jb->transit = transit;
+	if (d < 0)
+		d = -d;
+	jb->jitter += d - ((jb->jitter + 8) >> 4);
+
+	target = 1 + (3 * (jb->jitter >> 4) + jb->frame_ms - 1) / jb->frame_ms;
+	if (target < jb->min_depth)
+		target = jb->min_depth;
+	if (target > jb->max_depth)
+		target = jb->max_depth;
+	jb->target = target;
+}
+
+int mgcp_jitter_put(struct mgcp_jitter_buffer *jb, const char *data, int len,
+		    uint32_t arrival_ms)
+{
+	const uint8_t *rtp = (const uint8_t *) data;
+	struct msgb *msg;
+	uint32_t ts, ssrc;
+	uint16_t seq;
+	int16_t delta;
+	int slot;
+
+	if (len < RTP_HDR_LEN)
+		return -1;
+
+	seq = rtp_seq(rtp);
+	ts = rtp_u32(&rtp[4]);
+	ssrc = rtp_u32(&rtp[8]);
+	jb->stats.received += 1;
+
+	if (!jb->started || ssrc != jb->ssrc) {
+		if (jb->started)
+			jb->stats.resyncs += 1;
+		else {
+			jb->out_seq = seq;
+			jb->out_ts = ts;
+		}
+		jb->started = 1;
+		jb->ssrc = ssrc;
+		jb->transit = arrival_ms - ts / 8;
+		restart(jb, seq);
+	}
+
+	update_target(jb, arrival_ms, ts);
+
+	delta = seq - jb->play_seq;
+	if (delta < 0) {
+		jb->stats.late += 1;
+		return -1;
+	}
+
+	/* a jump the ring can not hold, play out from here */
+	if (delta >= MGCP_JB_SIZE) {
+		LOGP(DMGCP, LOGL_NOTICE,
+			"Jitter buffer resync on 0x%x from seq %u to %u\n",
+			ENDPOINT_NUMBER(jb->endp), jb->play_seq, seq);
+		jb->stats.resyncs += 1;
+		restart(jb, seq);
+	}
+
+	slot = seq & (MGCP_JB_SIZE - 1);
+	if (jb->packets[slot]) {
+		jb->stats.duplicates += 1;
+		return -1;
+	}
+
+	msg = msgb_alloc(len, "RTP jitter");
+	if (!msg)
+		return -1;
+	memcpy(msgb_put(msg, len), data, len);
+	jb->packets[slot] = msg;
+
+	if (jb->count++ == 0 || (int16_t) (seq - jb->max_seq) > 0)
+		jb->max_seq = seq;
+	return 0;
+}
+
+static void emit(struct mgcp_jitter_buffer *jb, struct msgb *msg)
+{
+	char buf[4096];
+	int len = msgb_length(msg);
+
+	/* the output may patch the header, keep the original */
+	if (len > sizeof(buf))
+		return;
+	memcpy(buf, msg->data, len);
+	rtp_set_seq_ts((uint8_t *) buf, jb->out_seq, jb->out_ts);
+	if (jb->marker)
+		buf[1] |= 0x80;
+	else
+		buf[1] &= ~0x80;
+	jb->marker = 0;
+	jb->output(jb->endp, buf, len);
+
+	jb->out_seq += 1;
+	jb->stats.emitted += 1;
+}
+
+static struct msgb *take(struct mgcp_jitter_buffer *jb)
+{
+	int slot = jb->play_seq & (MGCP_JB_SIZE - 1);
+	struct msgb *msg = jb->packets[slot];
+
+	if (msg) {
+		jb->packets[slot] = NULL;
+		jb->count -= 1;
+	}
+	return msg;
+}
+
+/* play out one frame */
+static void play_frame(struct mgcp_jitter_buffer *jb)
+{
+	struct msgb *msg;
+
+	if (jb->buffering) {
+		if (mgcp_jitter_depth(jb) < jb->target)
+			return;
+		jb->buffering = 0;
+	}
+
+	if (jb->count == 0) {
+		jb->stats.underruns += 1;
+		jb->buffering = 1;
+		jb->marker = 1;
+		return;
+	}
+
+	/* the delay grew beyond the target, skip a frame */
+	if (mgcp_jitter_depth(jb) > jb->target + 1) {
+		msg = take(jb);
+		if (msg) {
+			jb->stats.discarded += 1;
+			msgb_free(msg);
+		}
+		jb->play_seq += 1;
+	}
+
+	msg = take(jb);
+	if (msg) {
+		emit(jb, msg);
+		msgb_free(jb->last);
+		jb->last = msg;
+	} else if (jb->last) {
+		jb->stats.concealed += 1;
+		emit(jb, jb->last);
+	}
+
+	jb->play_seq += 1;
+}
+
+/* play out the frames due since the last service */
+static void jitter_tick(struct mgcp_jitter_buffer *jb, uint32_t now_ms)
+{
+	int32_t elapsed = now_ms - jb->served_ms;
+
+	jb->served_ms = now_ms;
+	if (!jb->started)
+		return;
+
+	/* after a stall the missed frames are not sent in a burst, the
+	 * RTP time jumps instead */
+	if (elapsed > 2 * MGCP_JB_FRAME_MS) {
+		jb->out_ts += (elapsed - MGCP_JB_FRAME_MS) * 8;
+		jb->marker = 1;
+		elapsed = MGCP_JB_FRAME_MS;
+	}
+
+	/* the RTP time advances whether a frame is sent or not */
+	jb->due_ms += elapsed;
+	while (jb->due_ms >= jb->frame_ms) {
+		play_frame(jb);
+		jb->out_ts += jb->frame_ts;
+		jb->due_ms -= jb->frame_ms;
+	}
+}
+
+void mgcp_jitter_wheel_advance(struct mgcp_jitter_wheel *wheel)
+{
+	struct mgcp_jitter_buffer *jb, *tmp;
+
+	llist_for_each_entry_safe(jb, tmp, &wheel->slots[wheel->current], entry)
+		jitter_tick(jb, wheel->clock_ms);
+
+	wheel->current = (wheel->current + 1) % MGCP_JB_WHEEL_SLOTS;
+	wheel->clock_ms += WHEEL_TICK_MS;
+}
@@ -34,6 +34,9 @@
 
 #include <openbsc/mgcp.h>
 #include <openbsc/mgcp_internal.h>
+#include <openbsc/mgcp_transcode.h>
+#include <openbsc/mgcp_jitter.h>
+#include <openbsc/mgcp_capture.h>
 
 #warning "Make use of the rtp proxy code"
 
@@ -133,6 +136,52 @@ int mgcp_send_dummy(struct mgcp_endpoint *endp)
 			endp->net_end.rtp_port, buf, 1);
 }
 
+const uint16_t mgcp_quality_iat_edges[MGCP_QUALITY_BUCKETS - 1] = {
+	5, 15, 25, 40, 60, 100, 200,
+};
+const uint16_t mgcp_quality_jitter_edges[MGCP_QUALITY_BUCKETS - 1] = {
+	2, 5, 10, 20, 40, 80, 160,
+};
+const uint16_t mgcp_quality_gap_edges[MGCP_QUALITY_BUCKETS - 1] = {
+	1, 2, 3, 5, 9, 17, 65,
+};
+
+static void quality_add(uint32_t *hist, const uint16_t *edges, uint32_t val)
+{
+	int i;
+
+	for (i = 0; i < MGCP_QUALITY_BUCKETS - 1; ++i)
+		if (val < edges[i])
+			break;
+	hist[i] += 1;
+}
+
+/* the RTP clock of our codecs is 8kHz, a new source restarts the transit */
+void mgcp_quality_count(struct mgcp_rtp_quality *q, int first, int new_ssrc,
+			uint16_t udelta, uint32_t arrival_time, uint32_t timestamp)
+{
+	int32_t transit = arrival_time - timestamp / 8;
+	int32_t d = new_ssrc ? 0 : transit - q->transit;
+
+	q->transit = transit;
+	if (new_ssrc)
+		q->ssrc_changes += 1;
+	if (first) {
+		q->last_arrival = arrival_time;
+		return;
+	}
+
+	if (d < 0)
+		d = -d;
+	q->jitter += d - ((q->jitter + 8) >> 4);
+
+	quality_add(q->iat, mgcp_quality_iat_edges, arrival_time - q->last_arrival);
+	quality_add(q->jitter_hist, mgcp_quality_jitter_edges, q->jitter >> 4);
+	quality_add(q->seq_gap, mgcp_quality_gap_edges,
+		    udelta < RTP_MAX_DROPOUT ? udelta : 0);
+	q->last_arrival = arrival_time;
+}
+
 /**
  * The RFC 3550 Appendix A assumes there are multiple sources but
  * some of the supported endpoints (e.g. the nanoBTS) can only handle
@@ -149,6 +198,7 @@ static void patch_and_count(struct mgcp_endpoint *endp, struct mgcp_rtp_state *s
 	uint16_t seq, udelta;
 	uint32_t timestamp;
 	struct rtp_hdr *rtp_hdr;
+	int first = 0, new_ssrc = 0;
 
 	if (len < sizeof(*rtp_hdr))
 		return;
@@ -166,8 +216,10 @@ static void patch_and_count(struct mgcp_endpoint *endp, struct mgcp_rtp_state *s
 		state->last_timestamp = timestamp;
 		state->jitter = 0;
 		state->transit = arrival_time - timestamp;
+		first = 1;
 	} else if (state->ssrc != rtp_hdr->ssrc) {
 		state->ssrc = rtp_hdr->ssrc;
+		new_ssrc = 1;
 		state->seq_offset = (state->max_seq + 1) - seq;
 		state->timestamp_offset = state->last_timestamp - timestamp;
 		state->patch = endp->allow_patch;
@@ -214,6 +266,8 @@ static void patch_and_count(struct mgcp_endpoint *endp, struct mgcp_rtp_state *s
 		d = -d;
 	state->jitter += d - ((state->jitter + 8) >> 4);
 
+	mgcp_quality_count(&state->quality, first, new_ssrc, udelta,
+			   arrival_time, timestamp);
 
 	state->max_seq = seq;
 	state->last_timestamp = timestamp;
@@ -233,6 +287,9 @@ static int forward_data(int fd, struct mgcp_rtp_tap *tap, const char *buf, int l
 	if (!tap->enabled)
 		return 0;
 
+	if (tap->capture)
+		return mgcp_capture_put(tap->capture, buf, len);
+
 	return sendto(fd, buf, len, 0,
 		      (struct sockaddr *)&tap->forward, sizeof(tap->forward));
 }
@@ -263,10 +320,14 @@ static int send_transcoder(struct mgcp_rtp_end *end, struct mgcp_config *cfg,
 	return rc;
 }
 
-static int send_to(struct mgcp_endpoint *endp, int dest, int is_rtp,
-		   struct sockaddr_in *addr, char *buf, int rc)
+/* counted: patch_and_count() was done when the packet arrived */
+static int do_send_to(struct mgcp_endpoint *endp, int dest, int is_rtp,
+		      struct sockaddr_in *addr, char *buf, int rc, int counted)
 {
 	struct mgcp_trunk_config *tcfg = endp->tcfg;
+	char trans_buf[4096];
+	int orig_dest = dest;
+
 	/* For loop toggle the destination and then dispatch. */
 	if (tcfg->audio_loop)
 		dest = !dest;
@@ -275,11 +336,21 @@ static int send_to(struct mgcp_endpoint *endp, int dest, int is_rtp,
 	if (endp->conn_mode == MGCP_CONN_LOOPBACK)
 		dest = !dest;
 
+	/* Looped audio goes back in the codec it arrived in */
+	if (is_rtp && endp->transcoding && dest == orig_dest) {
+		rc = mgcp_transcoding_process_rtp(endp, dest == DEST_BTS, buf, rc,
+						  trans_buf, sizeof(trans_buf));
+		if (rc < 0)
+			return 0;
+		buf = trans_buf;
+	}
+
 	if (dest == DEST_NETWORK) {
 		if (is_rtp) {
-			patch_and_count(endp, &endp->bts_state,
-					endp->net_end.payload_type,
-					addr, buf, rc);
+			if (!counted)
+				patch_and_count(endp, &endp->bts_state,
+						endp->net_end.payload_type,
+						addr, buf, rc);
 			forward_data(endp->net_end.rtp.fd,
 				     &endp->taps[MGCP_TAP_NET_OUT], buf, rc);
 			return udp_send(endp->net_end.rtp.fd, &endp->net_end.addr,
@@ -290,9 +361,10 @@ static int send_to(struct mgcp_endpoint *endp, int dest, int is_rtp,
 		}
 	} else {
 		if (is_rtp) {
-			patch_and_count(endp, &endp->net_state,
-					endp->bts_end.payload_type,
-					addr, buf, rc);
+			if (!counted)
+				patch_and_count(endp, &endp->net_state,
+						endp->bts_end.payload_type,
+						addr, buf, rc);
 			forward_data(endp->bts_end.rtp.fd,
 				     &endp->taps[MGCP_TAP_BTS_OUT], buf, rc);
 			return udp_send(endp->bts_end.rtp.fd, &endp->bts_end.addr,
@@ -306,6 +378,22 @@ static int send_to(struct mgcp_endpoint *endp, int dest, int is_rtp,
 	return 0;
 }
 
+static int send_to(struct mgcp_endpoint *endp, int dest, int is_rtp,
+		   struct sockaddr_in *addr, char *buf, int rc)
+{
+	return do_send_to(endp, dest, is_rtp, addr, buf, rc, 0);
+}
+
+static int send_jitter_buffered(struct mgcp_endpoint *endp, char *buf, int len)
+{
+	struct sockaddr_in addr;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_addr = endp->bts_end.addr;
+	addr.sin_port = endp->bts_end.rtp_port;
+	return do_send_to(endp, DEST_NETWORK, 1, &addr, buf, len, 1);
+}
+
 static int receive_from(struct mgcp_endpoint *endp, int fd, struct sockaddr_in *addr,
 			char *buf, int bufsize)
 {
@@ -452,8 +540,24 @@ static int rtp_data_bts(struct osmo_fd *fd, unsigned int what)
 	forward_data(fd->fd, &endp->taps[MGCP_TAP_BTS_IN], buf, rc);
 	if (endp->is_transcoded)
 		return send_transcoder(&endp->trans_bts, endp->cfg, proto == PROTO_RTP, &buf[0], rc);
-	else
-		return send_to(endp, DEST_NETWORK, proto == PROTO_RTP, &addr, &buf[0], rc);
+
+	/*
+	 * the jitter buffer sends it on its own clock, the loss and the
+	 * jitter of the BTS stream are counted on arrival
+	 */
+	if (proto == PROTO_RTP && endp->tcfg->jitter_buffer) {
+		if (!endp->jitter_buffer)
+			endp->jitter_buffer = mgcp_jitter_alloc(endp, send_jitter_buffered);
+		if (endp->jitter_buffer) {
+			patch_and_count(endp, &endp->bts_state,
+					endp->net_end.payload_type,
+					&addr, buf, rc);
+			mgcp_jitter_put(endp->jitter_buffer, buf, rc, get_current_ts());
+			return 0;
+		}
+	}
+
+	return send_to(endp, DEST_NETWORK, proto == PROTO_RTP, &addr, &buf[0], rc);
 }
 
 static int rtp_data_transcoder(struct mgcp_rtp_end *end, struct mgcp_endpoint *_endp,
@@ -35,18 +35,23 @@
 
 #include <openbsc/mgcp.h>
 #include <openbsc/mgcp_internal.h>
+#include <openbsc/mgcp_transcode.h>
+#include <openbsc/mgcp_jitter.h>
+#include <openbsc/mgcp_capture.h>
 
-#define for_each_line(line, save)			\
-	for (line = strtok_r(NULL, "\r\n", &save); line;\
-	     line = strtok_r(NULL, "\r\n", &save))
+#define for_each_param(param, p)					\
+	for (param = (p)->msg->params;					\
+	     param < (p)->msg->params + (p)->msg->num_params; param++)
 
 static void mgcp_rtp_end_reset(struct mgcp_rtp_end *end);
+static struct mgcp_endpoint *find_endpoint(struct mgcp_config *cfg,
+					   const char *mgcp, unsigned int len);
 
 struct mgcp_parse_data {
 	struct mgcp_config *cfg;
 	struct mgcp_endpoint *endp;
+	struct mgcp_parsed *msg;
 	char *trans;
-	char *save;
 	int found;
 };
 
@@ -68,8 +73,7 @@ static struct msgb *handle_noti_req(struct mgcp_parse_data *data);
 
 static void create_transcoder(struct mgcp_endpoint *endp);
 static void delete_transcoder(struct mgcp_endpoint *endp);
-
-static int mgcp_analyze_header(struct mgcp_parse_data *parse, char *data);
+static void write_quality_record(struct mgcp_endpoint *endp);
 
 static uint32_t generate_call_id(struct mgcp_config *cfg)
 {
@@ -117,17 +121,71 @@ static struct msgb *mgcp_msgb_alloc(void)
 	return msg;
 }
 
-static struct msgb *do_retransmission(const struct mgcp_endpoint *endp)
+static struct msgb *do_retransmission(const struct mgcp_trans_cache_entry *entry)
 {
 	struct msgb *msg = mgcp_msgb_alloc();
 	if (!msg)
 		return NULL;
 
-	msg->l2h = msgb_put(msg, strlen(endp->last_response));
-	memcpy(msg->l2h, endp->last_response, msgb_l2len(msg));
+	msg->l2h = msgb_put(msg, entry->response_len);
+	memcpy(msg->l2h, entry->response, msgb_l2len(msg));
 	return msg;
 }
 
+/* FNV-1a of the command */
+static uint32_t cmd_hash(const char *data, unsigned int len)
+{
+	uint32_t hash = 2166136261u;
+	unsigned int i;
+
+	for (i = 0; i < len; ++i) {
+		hash ^= (uint8_t) data[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+static struct mgcp_trans_cache_entry *trans_cache_find(struct mgcp_endpoint *endp,
+						       const char *trans)
+{
+	int i;
+
+	for (i = 0; i < MGCP_TRANS_CACHE_SIZE; ++i) {
+		struct mgcp_trans_cache_entry *entry = &endp->trans_cache[i];
+
+		if (entry->response && strcmp(entry->trans, trans) == 0)
+			return entry;
+	}
+
+	return NULL;
+}
+
+/*
+ * Remember the response of a transaction, replacing the oldest one of
+ * the endpoint.
+ */
+static void trans_cache_add(struct mgcp_endpoint *endp, const char *trans,
+			    uint32_t hash, const struct msgb *resp)
+{
+	struct mgcp_trans_cache_entry *entry;
+	unsigned int len = msgb_l2len(resp);
+
+	entry = trans_cache_find(endp, trans);
+	if (!entry) {
+		entry = &endp->trans_cache[endp->trans_cache_next];
+		endp->trans_cache_next = (endp->trans_cache_next + 1)
+						% MGCP_TRANS_CACHE_SIZE;
+	}
+
+	talloc_free(entry->response);
+	snprintf(entry->trans, sizeof(entry->trans), "%s", trans);
+	entry->cmd_hash = hash;
+	entry->response = talloc_strndup(endp->tcfg->endpoints,
+					 (const char *) resp->l2h, len);
+	entry->response_len = entry->response ? len : 0;
+}
+
 static struct msgb *create_resp(struct mgcp_endpoint *endp, int code,
 				const char *txt, const char *msg,
 				const char *trans, const char *param,
@@ -150,20 +208,6 @@ static struct msgb *create_resp(struct mgcp_endpoint *endp, int code,
 
 	res->l2h = msgb_put(res, len);
 	LOGP(DMGCP, LOGL_DEBUG, "Generated response: code: %d for '%s'\n", code, res->l2h);
-
-	/*
-	 * Remember the last transmission per endpoint.
-	 */
-	if (endp) {
-		struct mgcp_trunk_config *tcfg = endp->tcfg;
-		talloc_free(endp->last_response);
-		talloc_free(endp->last_trans);
-		endp->last_trans = talloc_strdup(tcfg->endpoints, trans);
-		endp->last_response = talloc_strndup(tcfg->endpoints,
-						(const char *) res->l2h,
-						msgb_l2len(res));
-	}
-
 	return res;
 }
 
@@ -212,6 +256,247 @@ static struct msgb *create_response_with_sdp(struct mgcp_endpoint *endp,
 	return create_resp(endp, 200, " OK", msg, trans_id, NULL, sdp_record);
 }
 
+static int is_space(char c)
+{
+	return c == ' ' || c == '\t';
+}
+
+static int is_eol(char c)
+{
+	return c == '\r' || c == '\n';
+}
+
+/* parse the number at *cur, returns -1 if there are no digits */
+static int parse_uint(const char **cur, const char *end, int base,
+		      unsigned int *val)
+{
+	const char *start = *cur;
+	unsigned int v = 0;
+
+	for (; *cur < end; ++*cur) {
+		char c = **cur;
+		int digit;
+
+		if (c >= '0' && c <= '9')
+			digit = c - '0';
+		else if (base == 16 && c >= 'a' && c <= 'f')
+			digit = c - 'a' + 10;
+		else if (base == 16 && c >= 'A' && c <= 'F')
+			digit = c - 'A' + 10;
+		else
+			break;
+
+		/* nothing we parse is this large */
+		if (v > 0xffffff)
+			return -1;
+		v = v * base + digit;
+	}
+
+	if (*cur == start)
+		return -1;
+	*val = v;
+	return 0;
+}
+
+static int skip_str(const char **cur, const char *end, const char *str)
+{
+	size_t len = strlen(str);
+
+	if (end - *cur < len || memcmp(*cur, str, len) != 0)
+		return -1;
+	*cur += len;
+	return 0;
+}
+
+static void skip_space(const char **cur, const char *end)
+{
+	while (*cur < end && is_space(**cur))
+		++*cur;
+}
+
+static void set_ptr(struct mgcp_parsed *msg, struct mgcp_msg_ptr *ptr,
+		    const char *start, const char *end)
+{
+	ptr->start = start - msg->data;
+	ptr->length = end - start;
+}
+
+static int ptr_equals(const struct mgcp_parsed *msg,
+		      const struct mgcp_msg_ptr *ptr, const char *str)
+{
+	return ptr->length == strlen(str) &&
+		memcmp(MGCP_PTR(msg, *ptr), str, ptr->length) == 0;
+}
+
+/*
+ * m=audio <port> RTP/AVP <payload type>, a=rtpmap:<payload type> <name>,
+ * a=ptime:<ms> and c=IN IP4 <address>
+ */
+static void parse_sdp_line(struct mgcp_parsed *msg, const char *line,
+			   const char *end)
+{
+	const char *cur = line;
+	unsigned int port, payload;
+
+	if (skip_str(&cur, end, "m=audio") == 0) {
+		skip_space(&cur, end);
+		if (parse_uint(&cur, end, 10, &port) != 0)
+			return;
+		skip_space(&cur, end);
+		if (skip_str(&cur, end, "RTP/AVP") != 0)
+			return;
+		skip_space(&cur, end);
+		if (parse_uint(&cur, end, 10, &payload) != 0)
+			return;
+		msg->audio_port = port;
+		msg->audio_payload = payload;
+	} else if (skip_str(&cur, end, "a=rtpmap:") == 0) {
+		const char *name;
+
+		if (parse_uint(&cur, end, 10, &payload) != 0 ||
+		    msg->audio_port < 0 || payload != msg->audio_payload)
+			return;
+		skip_space(&cur, end);
+		for (name = cur; cur < end && !is_space(*cur); ++cur)
+			;
+		set_ptr(msg, &msg->audio_name, name, cur);
+	} else if (skip_str(&cur, end, "a=ptime:") == 0) {
+		unsigned int ptime;
+
+		if (parse_uint(&cur, end, 10, &ptime) == 0)
+			msg->audio_ptime = ptime;
+	} else if (skip_str(&cur, end, "c=IN IP4") == 0) {
+		const char *addr;
+
+		skip_space(&cur, end);
+		for (addr = cur; cur < end && !is_space(*cur); ++cur)
+			;
+		set_ptr(msg, &msg->conn_addr, addr, cur);
+	}
+}
+
+/* "Name: value" */
+static void parse_param_line(struct mgcp_parsed *msg, const char *line,
+			     const char *end)
+{
+	struct mgcp_param *param;
+	const char *cur, *value;
+
+	if (msg->num_params >= MGCP_MAX_PARAMS) {
+		LOGP(DMGCP, LOGL_NOTICE, "Ignoring parameter '%.*s'\n",
+		     (int) (end - line), line);
+		return;
+	}
+	param = &msg->params[msg->num_params++];
+
+	for (cur = line; cur < end && *cur != ':'; ++cur)
+		;
+	set_ptr(msg, &param->name, line, cur);
+	if (cur == end) {
+		set_ptr(msg, &param->value, end, end);
+		return;
+	}
+
+	++cur;
+	skip_space(&cur, end);
+	value = cur;
+	while (end > value && is_space(end[-1]))
+		--end;
+	set_ptr(msg, &param->value, value, end);
+}
+
+int mgcp_parse(struct mgcp_parsed *msg, const char *data, unsigned int len)
+{
+	struct mgcp_msg_ptr tok[5];
+	const char *cur, *end, *line;
+	unsigned int ntok = 0;
+	int in_sdp = 0;
+
+	memset(msg, 0, sizeof(*msg));
+	msg->data = data;
+	msg->audio_port = -1;
+
+	/* a NUL ends the message */
+	end = memchr(data, '\0', len);
+	if (!end)
+		end = data + len;
+	msg->len = end - data;
+
+	/* the status line */
+	for (cur = data; cur < end && !is_eol(*cur); ) {
+		const char *start;
+
+		skip_space(&cur, end);
+		for (start = cur; cur < end && !is_space(*cur) && !is_eol(*cur); ++cur)
+			;
+		if (cur == start)
+			continue;
+		if (ntok < ARRAY_SIZE(tok))
+			set_ptr(msg, &tok[ntok], start, cur);
+		ntok++;
+	}
+
+	if (ntok == 0)
+		return -1;
+
+	/* a response: three digits, space, transaction id */
+	if (data[0] >= '0' && data[0] <= '9') {
+		const char *code = data;
+		unsigned int val;
+
+		if (parse_uint(&code, data + tok[0].length, 10, &val) == 0)
+			msg->code = val;
+		if (ntok > 1)
+			msg->trans = tok[1];
+		return 1;
+	}
+
+	msg->verb = tok[0];
+	if (ntok != 5 || tok[1].length > MGCP_TRANS_MAX) {
+		LOGP(DMGCP, LOGL_ERROR, "MGCP status line too short.\n");
+		return -1;
+	}
+	msg->trans = tok[1];
+	msg->endp = tok[2];
+
+	if (!ptr_equals(msg, &tok[3], "MGCP")) {
+		LOGP(DMGCP, LOGL_ERROR, "MGCP header parsing error\n");
+		return -1;
+	}
+	if (!ptr_equals(msg, &tok[4], "1.0")) {
+		LOGP(DMGCP, LOGL_ERROR, "MGCP version `%.*s' not supported\n",
+		     tok[4].length, MGCP_PTR(msg, tok[4]));
+		return -1;
+	}
+
+	/* parameter lines, an empty line starts the session description */
+	while (cur < end) {
+		/* the line ends with \r\n, \n or \r */
+		if (*cur == '\r' && cur + 1 < end && cur[1] == '\n')
+			cur += 2;
+		else
+			cur += 1;
+
+		for (line = cur; cur < end && !is_eol(*cur); ++cur)
+			;
+		if (cur == line) {
+			in_sdp = 1;
+			continue;
+		}
+
+		/* be tolerant about a missing empty line before the SDP */
+		if (in_sdp || (cur - line >= 2 && line[1] == '=' &&
+			       line[0] >= 'a' && line[0] <= 'z')) {
+			if (!msg->sdp.length)
+				set_ptr(msg, &msg->sdp, line, end);
+			parse_sdp_line(msg, line, cur);
+		} else
+			parse_param_line(msg, line, cur);
+	}
+
+	return 0;
+}
+
 /*
  * handle incoming messages:
  *   - this can be a command (four letters, space, transaction id)
@@ -220,40 +505,53 @@ static struct msgb *create_response_with_sdp(struct mgcp_endpoint *endp,
 struct msgb *mgcp_handle_message(struct mgcp_config *cfg, struct msgb *msg)
 {
 	struct mgcp_parse_data pdata;
-	int i, code, handled = 0;
+	struct mgcp_parsed parsed;
+	struct mgcp_trans_cache_entry *cached;
+	char trans[MGCP_TRANS_MAX + 1];
+	uint32_t hash;
+	int i, rc, handled = 0;
 	struct msgb *resp = NULL;
-	char *data;
 
 	if (msgb_l2len(msg) < 4) {
 		LOGP(DMGCP, LOGL_ERROR, "msg too short: %d\n", msg->len);
 		return NULL;
 	}
 
-        /* attempt to treat it as a response */
-        if (sscanf((const char *)&msg->l2h[0], "%3d %*s", &code) == 1) {
-		LOGP(DMGCP, LOGL_DEBUG, "Response: Code: %d\n", code);
+	rc = mgcp_parse(&parsed, (const char *) msg->l2h, msgb_l2len(msg));
+	if (rc == 1) {
+		LOGP(DMGCP, LOGL_DEBUG, "Response: Code: %d\n", parsed.code);
 		return NULL;
 	}
 
-	msg->l3h = &msg->l2h[4];
-
-
-	/*
-	 * Check for a duplicate message and respond.
-	 * FIXME: Verify that the msg->l3h is NULL terminated.
-	 */
 	memset(&pdata, 0, sizeof(pdata));
 	pdata.cfg = cfg;
-	data = strtok_r((char *) msg->l3h, "\r\n", &pdata.save);
-	pdata.found = mgcp_analyze_header(&pdata, data);
-	if (pdata.endp && pdata.trans
-			&& pdata.endp->last_trans
-			&& strcmp(pdata.endp->last_trans, pdata.trans) == 0) {
-		return do_retransmission(pdata.endp);
+	pdata.msg = &parsed;
+	pdata.trans = trans;
+	if (parsed.trans.length)
+		snprintf(trans, sizeof(trans), "%.*s", parsed.trans.length,
+			 MGCP_PTR(&parsed, parsed.trans));
+	else
+		strcpy(trans, "000000");
+
+	if (rc == 0) {
+		pdata.endp = find_endpoint(cfg, MGCP_PTR(&parsed, parsed.endp),
+					   parsed.endp.length);
+		if (!pdata.endp)
+			LOGP(DMGCP, LOGL_ERROR, "Unable to find Endpoint `%.*s'\n",
+			     parsed.endp.length, MGCP_PTR(&parsed, parsed.endp));
+	}
+	pdata.found = pdata.endp ? 0 : -1;
+
+	/* Check for a duplicate message and respond. */
+	hash = cmd_hash(parsed.data, parsed.len);
+	if (pdata.endp) {
+		cached = trans_cache_find(pdata.endp, trans);
+		if (cached && cached->cmd_hash == hash)
+			return do_retransmission(cached);
 	}
 
 	for (i = 0; i < ARRAY_SIZE(mgcp_requests); ++i) {
-		if (strncmp(mgcp_requests[i].name, (const char *) &msg->l2h[0], 4) == 0) {
+		if (ptr_equals(&parsed, &parsed.verb, mgcp_requests[i].name)) {
 			handled = 1;
 			resp = mgcp_requests[i].handle_request(&pdata);
 			break;
@@ -263,30 +561,33 @@ struct msgb *mgcp_handle_message(struct mgcp_config *cfg, struct msgb *msg)
 	if (!handled)
 		LOGP(DMGCP, LOGL_NOTICE, "MSG with type: '%.4s' not handled\n", &msg->l2h[0]);
 
+	/* Remember the recent transmissions per endpoint. */
+	if (resp && pdata.endp)
+		trans_cache_add(pdata.endp, trans, hash, resp);
+
 	return resp;
 }
 
 /**
- * We have a null terminated string with the endpoint name here. We only
- * support two kinds. Simple ones as seen on the BSC level and the ones
- * seen on the trunk side.
+ * We have the endpoint name of len octets here. We only support two
+ * kinds. Simple ones as seen on the BSC level and the ones seen on the
+ * trunk side.
  */
 static struct mgcp_endpoint *find_e1_endpoint(struct mgcp_config *cfg,
-					     const char *mgcp)
+					     const char *mgcp, unsigned int len)
 {
-	char *rest = NULL;
+	const char *cur = mgcp + 6, *end = mgcp + len;
 	struct mgcp_trunk_config *tcfg;
-	int trunk, endp;
+	unsigned int trunk, endp;
 
-	trunk = strtoul(mgcp + 6, &rest, 10);
-	if (rest == NULL || rest[0] != '/' || trunk < 1) {
-		LOGP(DMGCP, LOGL_ERROR, "Wrong trunk name '%s'\n", mgcp);
+	if (len < 6 || parse_uint(&cur, end, 10, &trunk) != 0 ||
+	    skip_str(&cur, end, "/") != 0 || trunk < 1) {
+		LOGP(DMGCP, LOGL_ERROR, "Wrong trunk name '%.*s'\n", len, mgcp);
 		return NULL;
 	}
 
-	endp = strtoul(rest + 1, &rest, 10);
-	if (rest == NULL || rest[0] != '@') {
-		LOGP(DMGCP, LOGL_ERROR, "Wrong endpoint name '%s'\n", mgcp);
+	if (parse_uint(&cur, end, 10, &endp) != 0 || cur == end || *cur != '@') {
+		LOGP(DMGCP, LOGL_ERROR, "Wrong endpoint name '%.*s'\n", len, mgcp);
 		return NULL;
 	}
 
@@ -306,89 +607,55 @@ static struct mgcp_endpoint *find_e1_endpoint(struct mgcp_config *cfg,
 	}
 
 	if (endp < 1 || endp >= tcfg->number_endpoints) {
-		LOGP(DMGCP, LOGL_ERROR, "Failed to find endpoint '%s'\n", mgcp);
+		LOGP(DMGCP, LOGL_ERROR, "Failed to find endpoint '%.*s'\n", len, mgcp);
 		return NULL;
 	}
 
 	return &tcfg->endpoints[endp];
 }
 
-static struct mgcp_endpoint *find_endpoint(struct mgcp_config *cfg, const char *mgcp)
+static struct mgcp_endpoint *find_endpoint(struct mgcp_config *cfg,
+					   const char *mgcp, unsigned int len)
 {
-	char *endptr = NULL;
-	unsigned int gw = INT_MAX;
-
-	if (strncmp(mgcp, "ds/e1", 5) == 0) {
-		return find_e1_endpoint(cfg, mgcp);
-	} else {
-		gw = strtoul(mgcp, &endptr, 16);
-		if (gw > 0 && gw < cfg->trunk.number_endpoints && strcmp(endptr, "@mgw") == 0)
+	const char *cur = mgcp, *end = mgcp + len;
+	unsigned int gw;
+
+	if (len >= 5 && strncmp(mgcp, "ds/e1", 5) == 0) {
+		return find_e1_endpoint(cfg, mgcp, len);
+	} else if (parse_uint(&cur, end, 16, &gw) == 0) {
+		if (gw > 0 && gw < cfg->trunk.number_endpoints &&
+		    end - cur == 4 && memcmp(cur, "@mgw", 4) == 0)
 			return &cfg->trunk.endpoints[gw];
 	}
 
-	LOGP(DMGCP, LOGL_ERROR, "Not able to find endpoint: '%s'\n", mgcp);
+	LOGP(DMGCP, LOGL_ERROR, "Not able to find endpoint: '%.*s'\n", len, mgcp);
 	return NULL;
 }
 
-/**
- * @returns 0 when the status line was complete and transaction_id and
- * endp out parameters are set.
- */
-static int mgcp_analyze_header(struct mgcp_parse_data *pdata, char *data)
+/* the single letter name of a parameter or 0 */
+static char param_name(const struct mgcp_parsed *msg,
+		       const struct mgcp_param *param)
 {
-	int i = 0;
-	char *elem, *save;
-
-	pdata->trans = "000000";
-
-	for (elem = strtok_r(data, " ", &save); elem;
-	     elem = strtok_r(NULL, " ", &save)) {
-		switch (i) {
-		case 0:
-			pdata->trans = elem;
-			break;
-		case 1:
-			pdata->endp = find_endpoint(pdata->cfg, elem);
-			if (!pdata->endp) {
-				LOGP(DMGCP, LOGL_ERROR,
-				     "Unable to find Endpoint `%s'\n", elem);
-				return -1;
-			}
-			break;
-		case 2:
-			if (strcmp("MGCP", elem)) {
-				LOGP(DMGCP, LOGL_ERROR,
-				     "MGCP header parsing error\n");
-				return -1;
-			}
-			break;
-		case 3:
-			if (strcmp("1.0", elem)) {
-				LOGP(DMGCP, LOGL_ERROR, "MGCP version `%s' "
-					"not supported\n", elem);
-				return -1;
-			}
-			break;
-		}
-		i++;
-	}
-
-	if (i != 4) {
-		LOGP(DMGCP, LOGL_ERROR, "MGCP status line too short.\n");
-		pdata->trans = "000000";
-		pdata->endp = NULL;
-		return -1;
-	}
+	return param->name.length == 1 ? *MGCP_PTR(msg, param->name) : 0;
+}
 
-	return 0;
+static void log_unhandled_param(const struct mgcp_parsed *msg,
+				const struct mgcp_param *param,
+				const struct mgcp_endpoint *endp)
+{
+	LOGP(DMGCP, LOGL_NOTICE, "Unhandled option: '%.*s' on 0x%x\n",
+	     param->name.length, MGCP_PTR(msg, param->name),
+	     ENDPOINT_NUMBER(endp));
 }
 
 static int verify_call_id(const struct mgcp_endpoint *endp,
-			  const char *callid)
+			  const struct mgcp_parsed *msg,
+			  const struct mgcp_msg_ptr *callid)
 {
-	if (strcmp(endp->callid, callid) != 0) {
-		LOGP(DMGCP, LOGL_ERROR, "CallIDs does not match on 0x%x. '%s' != '%s'\n",
-			ENDPOINT_NUMBER(endp), endp->callid, callid);
+	if (!endp->callid || !ptr_equals(msg, callid, endp->callid)) {
+		LOGP(DMGCP, LOGL_ERROR, "CallIDs does not match on 0x%x. '%s' != '%.*s'\n",
+			ENDPOINT_NUMBER(endp), endp->callid,
+			callid->length, MGCP_PTR(msg, *callid));
 		return -1;
 	}
 
@@ -396,13 +663,17 @@ static int verify_call_id(const struct mgcp_endpoint *endp,
 }
 
 static int verify_ci(const struct mgcp_endpoint *endp,
-		     const char *_ci)
+		     const struct mgcp_parsed *msg,
+		     const struct mgcp_msg_ptr *_ci)
 {
-	uint32_t ci = strtoul(_ci, NULL, 10);
+	const char *cur = MGCP_PTR(msg, *_ci);
+	unsigned int ci = 0;
 
+	parse_uint(&cur, cur + _ci->length, 10, &ci);
 	if (ci != endp->ci) {
-		LOGP(DMGCP, LOGL_ERROR, "ConnectionIdentifiers do not match on 0x%x. %u != %s\n",
-			ENDPOINT_NUMBER(endp), endp->ci, _ci);
+		LOGP(DMGCP, LOGL_ERROR, "ConnectionIdentifiers do not match on 0x%x. %u != %.*s\n",
+			ENDPOINT_NUMBER(endp), endp->ci,
+			_ci->length, MGCP_PTR(msg, *_ci));
 		return -1;
 	}
 
@@ -417,19 +688,21 @@ static struct msgb *handle_audit_endpoint(struct mgcp_parse_data *p)
 		return create_ok_response(p->endp, 200, "AUEP", p->trans);
 }
 
-static int parse_conn_mode(const char *msg, int *conn_mode)
+static int parse_conn_mode(const struct mgcp_parsed *msg,
+			   const struct mgcp_msg_ptr *mode, int *conn_mode)
 {
 	int ret = 0;
-	if (strcmp(msg, "recvonly") == 0)
+	if (ptr_equals(msg, mode, "recvonly"))
 		*conn_mode = MGCP_CONN_RECV_ONLY;
-	else if (strcmp(msg, "sendrecv") == 0)
+	else if (ptr_equals(msg, mode, "sendrecv"))
 		*conn_mode = MGCP_CONN_RECV_SEND;
-	else if (strcmp(msg, "sendonly") == 0)
+	else if (ptr_equals(msg, mode, "sendonly"))
 		*conn_mode = MGCP_CONN_SEND_ONLY;
-	else if (strcmp(msg, "loopback") == 0)
+	else if (ptr_equals(msg, mode, "loopback"))
 		*conn_mode = MGCP_CONN_LOOPBACK;
 	else {
-		LOGP(DMGCP, LOGL_ERROR, "Unknown connection mode: '%s'\n", msg);
+		LOGP(DMGCP, LOGL_ERROR, "Unknown connection mode: '%.*s'\n",
+		     mode->length, MGCP_PTR(msg, *mode));
 		ret = -1;
 	}
 
@@ -512,29 +785,28 @@ static struct msgb *handle_create_con(struct mgcp_parse_data *p)
 	struct mgcp_endpoint *endp = p->endp;
 	int error_code = 400;
 
-	const char *local_options = NULL;
-	const char *callid = NULL;
-	const char *mode = NULL;
-	char *line;
+	const struct mgcp_msg_ptr *local_options = NULL;
+	const struct mgcp_msg_ptr *callid = NULL;
+	const struct mgcp_msg_ptr *mode = NULL;
+	struct mgcp_param *param;
 
 	if (p->found != 0)
 		return create_err_response(NULL, 510, "CRCX", p->trans);
 
 	/* parse CallID C: and LocalParameters L: */
-	for_each_line(line, p->save) {
-		switch (line[0]) {
+	for_each_param(param, p) {
+		switch (param_name(p->msg, param)) {
 		case 'L':
-			local_options = (const char *) line + 3;
+			local_options = &param->value;
 			break;
 		case 'C':
-			callid = (const char *) line + 3;
+			callid = &param->value;
 			break;
 		case 'M':
-			mode = (const char *) line + 3;
+			mode = &param->value;
 			break;
 		default:
-			LOGP(DMGCP, LOGL_NOTICE, "Unhandled option: '%c'/%d on 0x%x\n",
-				*line, *line, ENDPOINT_NUMBER(endp));
+			log_unhandled_param(p->msg, param, endp);
 			break;
 		}
 	}
@@ -563,12 +835,15 @@ static struct msgb *handle_create_con(struct mgcp_parse_data *p)
 	}
 
 	/* copy some parameters */
-	endp->callid = talloc_strdup(tcfg->endpoints, callid);
+	endp->callid = talloc_strndup(tcfg->endpoints,
+				      MGCP_PTR(p->msg, *callid), callid->length);
 
 	if (local_options)
-		endp->local_options = talloc_strdup(tcfg->endpoints, local_options);
+		endp->local_options = talloc_strndup(tcfg->endpoints,
+					MGCP_PTR(p->msg, *local_options),
+					local_options->length);
 
-	if (parse_conn_mode(mode, &endp->conn_mode) != 0) {
+	if (parse_conn_mode(p->msg, mode, &endp->conn_mode) != 0) {
 		    error_code = 517;
 		    goto error2;
 	}
@@ -635,7 +910,7 @@ static struct msgb *handle_modify_con(struct mgcp_parse_data *p)
 	struct mgcp_endpoint *endp = p->endp;
 	int error_code = 500;
 	int silent = 0;
-	char *line;
+	struct mgcp_param *param;
 
 	if (p->found != 0)
 		return create_err_response(NULL, 510, "MDCX", p->trans);
@@ -646,64 +921,68 @@ static struct msgb *handle_modify_con(struct mgcp_parse_data *p)
 		return create_err_response(endp, 400, "MDCX", p->trans);
 	}
 
-	for_each_line(line, p->save) {
-		switch (line[0]) {
-		case 'C': {
-			if (verify_call_id(endp, line + 3) != 0)
+	for_each_param(param, p) {
+		switch (param_name(p->msg, param)) {
+		case 'C':
+			if (verify_call_id(endp, p->msg, &param->value) != 0)
 				goto error3;
 			break;
-		}
-		case 'I': {
-			if (verify_ci(endp, line + 3) != 0)
+		case 'I':
+			if (verify_ci(endp, p->msg, &param->value) != 0)
 				goto error3;
 			break;
-		}
 		case 'L':
 			/* skip */
 			break;
 		case 'M':
-			if (parse_conn_mode(line + 3, &endp->conn_mode) != 0) {
+			if (parse_conn_mode(p->msg, &param->value,
+					    &endp->conn_mode) != 0) {
 			    error_code = 517;
 			    goto error3;
 			}
 			endp->orig_mode = endp->conn_mode;
 			break;
 		case 'Z':
-			silent = strcmp("noanswer", line + 3) == 0;
-			break;
-		case '\0':
-			/* SDP file begins */
-			break;
-		case 'a':
-		case 'o':
-		case 's':
-		case 't':
-		case 'v':
-			/* skip these SDP attributes */
+			silent = ptr_equals(p->msg, &param->value, "noanswer");
 			break;
-		case 'm': {
-			int port;
-			int payload;
-
-			if (sscanf(line, "m=audio %d RTP/AVP %d", &port, &payload) == 2) {
-				endp->net_end.rtp_port = htons(port);
-				endp->net_end.rtcp_port = htons(port + 1);
-				endp->net_end.payload_type = payload;
-			}
+		default:
+			log_unhandled_param(p->msg, param, endp);
 			break;
 		}
-		case 'c': {
-			char ipv4[16];
+	}
 
-			if (sscanf(line, "c=IN IP4 %15s", ipv4) == 1) {
-				inet_aton(ipv4, &endp->net_end.addr);
-			}
-			break;
-		}
-		default:
-			LOGP(DMGCP, LOGL_NOTICE, "Unhandled option: '%c'/%d on 0x%x\n",
-				line[0], line[0], ENDPOINT_NUMBER(endp));
-			break;
+	/* the session description was parsed with the header */
+	if (p->msg->audio_port >= 0) {
+		endp->net_end.rtp_port = htons(p->msg->audio_port);
+		endp->net_end.rtcp_port = htons(p->msg->audio_port + 1);
+		endp->net_end.payload_type = p->msg->audio_payload;
+		endp->net_end.packet_duration_ms = p->msg->audio_ptime;
+	}
+
+	if (p->msg->conn_addr.length) {
+		char ipv4[16];
+
+		snprintf(ipv4, sizeof(ipv4), "%.*s", p->msg->conn_addr.length,
+			 MGCP_PTR(p->msg, p->msg->conn_addr));
+		inet_aton(ipv4, &endp->net_end.addr);
+	}
+
+	if (endp->tcfg->internal_transcoding && p->msg->audio_port >= 0 &&
+	    !endp->is_transcoded) {
+		struct mgcp_trunk_config *tcfg = endp->tcfg;
+		enum mgcp_codec bts, net;
+
+		bts = mgcp_codec_from_payload(tcfg->audio_payload,
+					tcfg->audio_name,
+					tcfg->audio_name ? strlen(tcfg->audio_name) : 0);
+		net = mgcp_codec_from_payload(p->msg->audio_payload,
+					MGCP_PTR(p->msg, p->msg->audio_name),
+					p->msg->audio_name.length);
+		/* 20ms is the default of the GSM codecs */
+		if (mgcp_transcoding_setup(endp, bts, net,
+				p->msg->audio_ptime ? p->msg->audio_ptime : 20) < 0) {
+			error_code = 534;
+			goto error3;
 		}
 	}
 
@@ -753,7 +1032,7 @@ static struct msgb *handle_delete_con(struct mgcp_parse_data *p)
 	struct mgcp_endpoint *endp = p->endp;
 	int error_code = 400;
 	int silent = 0;
-	char *line;
+	struct mgcp_param *param;
 	char stats[1048];
 
 	if (p->found != 0)
@@ -765,22 +1044,21 @@ static struct msgb *handle_delete_con(struct mgcp_parse_data *p)
 		return create_err_response(endp, 400, "DLCX", p->trans);
 	}
 
-	for_each_line(line, p->save) {
-		switch (line[0]) {
+	for_each_param(param, p) {
+		switch (param_name(p->msg, param)) {
 		case 'C':
-			if (verify_call_id(endp, line + 3) != 0)
+			if (verify_call_id(endp, p->msg, &param->value) != 0)
 				goto error3;
 			break;
 		case 'I':
-			if (verify_ci(endp, line + 3) != 0)
+			if (verify_ci(endp, p->msg, &param->value) != 0)
 				goto error3;
 			break;
 		case 'Z':
-			silent = strcmp("noanswer", line + 3) == 0;
+			silent = ptr_equals(p->msg, &param->value, "noanswer");
 			break;
 		default:
-			LOGP(DMGCP, LOGL_NOTICE, "Unhandled option: '%c'/%d on 0x%x\n",
-				line[0], line[0], ENDPOINT_NUMBER(endp));
+			log_unhandled_param(p->msg, param, endp);
 			break;
 		}
 	}
@@ -844,13 +1122,17 @@ static struct msgb *handle_rsip(struct mgcp_parse_data *p)
 	return NULL;
 }
 
-static char extract_tone(const char *line)
+static char extract_tone(const struct mgcp_parsed *msg,
+			 const struct mgcp_msg_ptr *value)
 {
-	const char *str = strstr(line, "D/");
-	if (!str)
-		return CHAR_MAX;
+	const char *str = MGCP_PTR(msg, *value);
+	unsigned int i;
 
-	return str[2];
+	for (i = 0; i + 2 < value->length; ++i)
+		if (str[i] == 'D' && str[i + 1] == '/')
+			return str[i + 2];
+
+	return CHAR_MAX;
 }
 
 /*
@@ -861,16 +1143,16 @@ static char extract_tone(const char *line)
 static struct msgb *handle_noti_req(struct mgcp_parse_data *p)
 {
 	int res = 0;
-	char *line;
+	struct mgcp_param *param;
 	char tone = 0;
 
 	if (p->found != 0)
 		return create_err_response(NULL, 400, "RQNT", p->trans);
 
-	for_each_line(line, p->save) {
-		switch (line[0]) {
+	for_each_param(param, p) {
+		switch (param_name(p->msg, param)) {
 		case 'S':
-			tone = extract_tone(line);
+			tone = extract_tone(p->msg, &param->value);
 			break;
 		}
 	}
@@ -912,6 +1194,9 @@ struct mgcp_config *mgcp_config_alloc(void)
 	cfg->trunk.audio_name = talloc_strdup(cfg, "AMR/8000");
 	cfg->trunk.audio_payload = 126;
 	cfg->trunk.omit_rtcp = 0;
+	cfg->trunk.jitter_min_frames = 2;
+	cfg->trunk.jitter_max_frames = 10;
+	cfg->capture_queue_kb = MGCP_CAPTURE_QUEUE_KB;
 
 	INIT_LLIST_HEAD(&cfg->trunks);
 
@@ -935,6 +1220,8 @@ struct mgcp_trunk_config *mgcp_trunk_alloc(struct mgcp_config *cfg, int nr)
 	trunk->audio_payload = 126;
 	trunk->number_endpoints = 33;
 	trunk->omit_rtcp = 0;
+	trunk->jitter_min_frames = 2;
+	trunk->jitter_max_frames = 10;
 	llist_add_tail(&trunk->entry, &cfg->trunks);
 	return trunk;
 }
@@ -962,6 +1249,7 @@ static void mgcp_rtp_end_reset(struct mgcp_rtp_end *end)
 	memset(&end->addr, 0, sizeof(end->addr));
 	end->rtp_port = end->rtcp_port = 0;
 	end->payload_type = -1;
+	end->packet_duration_ms = 0;
 	end->local_alloc = -1;
 	talloc_free(end->fmtp_extra);
 	end->fmtp_extra = NULL;
@@ -1000,7 +1288,12 @@ int mgcp_endpoints_allocate(struct mgcp_trunk_config *tcfg)
 
 void mgcp_free_endp(struct mgcp_endpoint *endp)
 {
+	int i;
+
 	LOGP(DMGCP, LOGL_DEBUG, "Deleting endpoint on: 0x%x\n", ENDPOINT_NUMBER(endp));
+	if (endp->allocated && endp->cfg->quality_file)
+		write_quality_record(endp);
+
 	endp->ci = CI_UNUSED;
 	endp->allocated = 0;
 
@@ -1015,6 +1308,9 @@ void mgcp_free_endp(struct mgcp_endpoint *endp)
 	mgcp_rtp_end_reset(&endp->trans_net);
 	mgcp_rtp_end_reset(&endp->trans_bts);
 	endp->is_transcoded = 0;
+	mgcp_transcoding_free(endp);
+	mgcp_jitter_free(endp->jitter_buffer);
+	endp->jitter_buffer = NULL;
 
 	memset(&endp->net_state, 0, sizeof(endp->net_state));
 	memset(&endp->bts_state, 0, sizeof(endp->bts_state));
@@ -1022,6 +1318,9 @@ void mgcp_free_endp(struct mgcp_endpoint *endp)
 	endp->conn_mode = endp->orig_mode = MGCP_CONN_NONE;
 	endp->allow_patch = 0;
 
+	/* the capture files of a call end with it */
+	for (i = 0; i < MGCP_TAP_COUNT; ++i)
+		mgcp_capture_close(endp->taps[i].capture);
 	memset(&endp->taps, 0, sizeof(endp->taps));
 }
 
@@ -1172,4 +1471,141 @@ void mgcp_format_stats(struct mgcp_endpoint *endp, char *msg, size_t size)
 			endp->net_end.packets, endp->net_end.octets,
 			ploss, jitter);
 	msg[size - 1] = '\0';
+
+	/* the depth and what the jitter buffer had to drop or make up */
+	if (endp->jitter_buffer) {
+		struct mgcp_jitter_buffer *jb = endp->jitter_buffer;
+		int len = strlen(msg);
+
+		snprintf(msg + len, size - len, ", JB=%u, JL=%lu, JC=%lu",
+			 mgcp_jitter_depth(jb), jb->stats.late,
+			 jb->stats.concealed);
+		msg[size - 1] = '\0';
+	}
+}
+
+/*
+ * The call quality record has the packets, octets, loss, jitter and
+ * the histograms of what we received from the BTS and from the network.
+ */
+static const char *quality_dirs[] = { "bts", "net" };
+
+static int format_hist_names(char *msg, size_t size, const char *dir,
+			     const char *name, const uint16_t *edges)
+{
+	int i, len = 0;
+
+	for (i = 0; i < MGCP_QUALITY_BUCKETS - 1 && len < size; ++i)
+		len += snprintf(msg + len, size - len, ",%s_%s_lt%u",
+				dir, name, edges[i]);
+	if (len < size)
+		len += snprintf(msg + len, size - len, ",%s_%s_ge%u",
+				dir, name, edges[i - 1]);
+	return len;
+}
+
+int mgcp_format_quality_header(char *msg, size_t size)
+{
+	int i, len;
+
+	len = snprintf(msg, size, "time,trunk,endpoint,callid");
+	for (i = 0; i < ARRAY_SIZE(quality_dirs) && len < size; ++i) {
+		const char *dir = quality_dirs[i];
+
+		len += snprintf(msg + len, size - len,
+				",%s_packets,%s_octets,%s_loss,%s_jitter,"
+				"%s_ssrc_changes", dir, dir, dir, dir, dir);
+		if (len < size)
+			len += format_hist_names(msg + len, size - len, dir,
+						 "iat", mgcp_quality_iat_edges);
+		if (len < size)
+			len += format_hist_names(msg + len, size - len, dir,
+						 "jitter", mgcp_quality_jitter_edges);
+		if (len < size)
+			len += format_hist_names(msg + len, size - len, dir,
+						 "gap", mgcp_quality_gap_edges);
+	}
+	if (len < size)
+		len += snprintf(msg + len, size - len, "\n");
+
+	return len < size ? len : -1;
+}
+
+static int format_hist(char *msg, size_t size, const uint32_t *hist)
+{
+	int i, len = 0;
+
+	for (i = 0; i < MGCP_QUALITY_BUCKETS && len < size; ++i)
+		len += snprintf(msg + len, size - len, ",%u", hist[i]);
+	return len;
+}
+
+/* the call agent picks the callid, quote it and double the quotes */
+static int format_csv_string(char *msg, size_t size, const char *str)
+{
+	size_t len = 0;
+
+	if (len < size)
+		msg[len++] = '"';
+	for (; *str && len < size; ++str) {
+		if (*str == '"' && len < size)
+			msg[len++] = '"';
+		if (len < size)
+			msg[len++] = *str;
+	}
+	if (len < size)
+		msg[len++] = '"';
+	if (len < size)
+		msg[len] = '\0';
+	return len;
+}
+
+int mgcp_format_quality(struct mgcp_endpoint *endp, char *msg, size_t size)
+{
+	struct mgcp_rtp_state *states[] = { &endp->bts_state, &endp->net_state };
+	struct mgcp_rtp_end *ends[] = { &endp->bts_end, &endp->net_end };
+	uint32_t expected;
+	int i, len, loss;
+
+	len = snprintf(msg, size, "%lu,%d,0x%x,", (unsigned long) time(NULL),
+		       endp->tcfg->trunk_nr, ENDPOINT_NUMBER(endp));
+	if (len < size)
+		len += format_csv_string(msg + len, size - len,
+					 endp->callid ? endp->callid : "");
+	for (i = 0; i < ARRAY_SIZE(states) && len < size; ++i) {
+		struct mgcp_rtp_quality *q = &states[i]->quality;
+
+		mgcp_state_calc_loss(states[i], ends[i], &expected, &loss);
+		len += snprintf(msg + len, size - len, ",%u,%u,%d,%u,%u",
+				ends[i]->packets, ends[i]->octets, loss,
+				q->jitter >> 4, q->ssrc_changes);
+		if (len < size)
+			len += format_hist(msg + len, size - len, q->iat);
+		if (len < size)
+			len += format_hist(msg + len, size - len, q->jitter_hist);
+		if (len < size)
+			len += format_hist(msg + len, size - len, q->seq_gap);
+	}
+	if (len < size)
+		len += snprintf(msg + len, size - len, "\n");
+
+	return len < size ? len : -1;
+}
+
+/* the capture writer appends it, the main loop must not wait for the disk */
+static void write_quality_record(struct mgcp_endpoint *endp)
+{
+	char header[2048], line[2048];
+
+	if (mgcp_format_quality_header(header, sizeof(header)) < 0 ||
+	    mgcp_format_quality(endp, line, sizeof(line)) < 0) {
+		LOGP(DMGCP, LOGL_ERROR, "The call quality of 0x%x is too long.\n",
+			ENDPOINT_NUMBER(endp));
+		return;
+	}
+
+	if (mgcp_capture_put_line(endp->cfg, endp->cfg->quality_file,
+				  header, line) != 0)
+		LOGP(DMGCP, LOGL_ERROR, "Dropped the call quality of 0x%x.\n",
+			ENDPOINT_NUMBER(endp));
 }
@@ -0,0 +1,437 @@
+/* In-process transcoding of the MGCP Media Gateway */
+
+/*
+ * (C) 2026 by the OpenBSC contributors
+ * All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include <arpa/inet.h>
+
+#include <osmocom/core/talloc.h>
+
+#include <openbsc/mgcp.h>
+#include <openbsc/mgcp_internal.h>
+#include <openbsc/mgcp_transcode.h>
+
+#include "../../bscconfig.h"
+
+#ifdef BUILD_MGCP_TRANSCODING
+#ifdef HAVE_GSM_GSM_H
+#include <gsm/gsm.h>
+#else
+#include <gsm.h>
+#endif
+#endif
+
+/* RFC 3551, GSM 06.10 frames with the 0xD signature */
+#define GSM_FR_FRAME_LEN	33
+#define RTP_HDR_LEN		12
+
+static const struct {
+	enum mgcp_codec codec;
+	int payload_type;
+	const char *name;
+} codecs[] = {
+	{ MGCP_CODEC_PCMU,	0,	"PCMU" },
+	{ MGCP_CODEC_GSM_FR,	3,	"GSM" },
+	{ MGCP_CODEC_PCMA,	8,	"PCMA" },
+	{ MGCP_CODEC_GSM_EFR,	-1,	"GSM-EFR" },
+};
+
+/* the rtpmap encoding name, e.g. GSM-EFR/8000 */
+enum mgcp_codec mgcp_codec_from_name(const char *name, unsigned int len)
+{
+	const char *slash;
+	int i;
+
+	if (!name)
+		return MGCP_CODEC_UNKNOWN;
+
+	slash = memchr(name, '/', len);
+	if (slash)
+		len = slash - name;
+
+	for (i = 0; i < ARRAY_SIZE(codecs); ++i)
+		if (strlen(codecs[i].name) == len &&
+		    strncasecmp(codecs[i].name, name, len) == 0)
+			return codecs[i].codec;
+
+	return MGCP_CODEC_UNKNOWN;
+}
+
+enum mgcp_codec mgcp_codec_from_payload(int payload_type, const char *name,
+					unsigned int len)
+{
+	int i;
+
+	/* the static payload types of RFC 3551 */
+	for (i = 0; i < ARRAY_SIZE(codecs); ++i)
+		if (payload_type >= 0 && codecs[i].payload_type == payload_type)
+			return codecs[i].codec;
+
+	return mgcp_codec_from_name(name, len);
+}
+
+const char *mgcp_codec_name(enum mgcp_codec codec)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(codecs); ++i)
+		if (codecs[i].codec == codec)
+			return codecs[i].name;
+
+	return "unknown";
+}
+
+int mgcp_codec_is_supported(enum mgcp_codec codec)
+{
+	switch (codec) {
+	case MGCP_CODEC_PCMU:
+	case MGCP_CODEC_PCMA:
+		return 1;
+#ifdef BUILD_MGCP_TRANSCODING
+	case MGCP_CODEC_GSM_FR:
+		return 1;
+#endif
+	default:
+		return 0;
+	}
+}
+
+/*
+ * G.711 as in the ITU-T reference code, the linear samples are 16 bit.
+ */
+static int16_t alaw_to_linear(uint8_t a)
+{
+	int16_t t;
+	int seg;
+
+	a ^= 0x55;
+	t = (a & 0x0f) << 4;
+	seg = (a & 0x70) >> 4;
+	if (seg == 0)
+		t += 8;
+	else
+		t = (t + 0x108) << (seg - 1);
+
+	return (a & 0x80) ? t : -t;
+}
+
+static uint8_t linear_to_alaw(int16_t sample)
+{
+	int val = sample >> 3;
+	uint8_t mask;
+	int seg;
+
+	if (val >= 0) {
+		mask = 0xd5;
+	} else {
+		mask = 0x55;
+		val = -val - 1;
+	}
+
+	for (seg = 0; seg < 8; ++seg)
+		if (val <= (0x20 << seg) - 1)
+			break;
+	if (seg >= 8)
+		return 0x7f ^ mask;
+
+	if (seg < 2)
+		return (((seg << 4) | ((val >> 1) & 0x0f)) ^ mask);
+	return (((seg << 4) | ((val >> seg) & 0x0f)) ^ mask);
+}
+
+static int16_t ulaw_to_linear(uint8_t u)
+{
+	int t;
+
+	u = ~u;
+	t = ((u & 0x0f) << 3) + 0x84;
+	t <<= (u & 0x70) >> 4;
+
+	return (u & 0x80) ? (0x84 - t) : (t - 0x84);
+}
+
+static uint8_t linear_to_ulaw(int16_t sample)
+{
+	int val = sample >> 2;
+	uint8_t mask;
+	int seg;
+
+	if (val < 0) {
+		val = -val;
+		mask = 0x7f;
+	} else {
+		mask = 0xff;
+	}
+
+	if (val > 8159)
+		val = 8159;
+	val += 0x21;
+
+	for (seg = 0; seg < 8; ++seg)
+		if (val <= (0x40 << seg) - 1)
+			break;
+	if (seg >= 8)
+		return 0x7f ^ mask;
+
+	return ((seg << 4) | ((val >> (seg + 1)) & 0x0f)) ^ mask;
+}
+
+static void path_free(struct mgcp_transcode_path *path)
+{
+#ifdef BUILD_MGCP_TRANSCODING
+	if (path->src == MGCP_CODEC_GSM_FR && path->decoder)
+		gsm_destroy(path->decoder);
+	if (path->dst == MGCP_CODEC_GSM_FR && path->encoder)
+		gsm_destroy(path->encoder);
+#endif
+	path->decoder = path->encoder = NULL;
+}
+
+static int path_init(struct mgcp_transcode_path *path,
+		     enum mgcp_codec src, enum mgcp_codec dst)
+{
+	memset(path, 0, sizeof(*path));
+	path->src = src;
+	path->dst = dst;
+
+#ifdef BUILD_MGCP_TRANSCODING
+	if (src == MGCP_CODEC_GSM_FR) {
+		path->decoder = gsm_create();
+		if (!path->decoder)
+			return -1;
+	}
+	if (dst == MGCP_CODEC_GSM_FR) {
+		path->encoder = gsm_create();
+		if (!path->encoder) {
+			path_free(path);
+			return -1;
+		}
+	}
+#endif
+
+	return 0;
+}
+
+int mgcp_transcoding_setup(struct mgcp_endpoint *endp,
+			   enum mgcp_codec bts, enum mgcp_codec net,
+			   unsigned int ptime)
+{
+	struct mgcp_transcoding *state;
+
+	mgcp_transcoding_free(endp);
+
+	if (bts == net || bts == MGCP_CODEC_UNKNOWN || net == MGCP_CODEC_UNKNOWN)
+		return 0;
+
+	if (!mgcp_codec_is_supported(bts) || !mgcp_codec_is_supported(net)) {
+		LOGP(DMGCP, LOGL_ERROR,
+		     "No transcoding from %s to %s on 0x%x.\n",
+		     mgcp_codec_name(bts), mgcp_codec_name(net),
+		     ENDPOINT_NUMBER(endp));
+		return -1;
+	}
+
+	/* GSM FR frames are 20ms and nothing is buffered */
+	if ((bts == MGCP_CODEC_GSM_FR || net == MGCP_CODEC_GSM_FR) &&
+	    (ptime % 20 != 0 ||
+	     ptime * 8 > MGCP_TRANSCODE_MAX_SAMPLES)) {
+		LOGP(DMGCP, LOGL_ERROR,
+		     "No transcoding from %s to %s with a ptime of %u ms "
+		     "on 0x%x.\n", mgcp_codec_name(bts), mgcp_codec_name(net),
+		     ptime, ENDPOINT_NUMBER(endp));
+		return -1;
+	}
+
+	state = talloc_zero(endp->tcfg->endpoints, struct mgcp_transcoding);
+	if (!state)
+		return -1;
+
+	if (path_init(&state->to_bts, net, bts) != 0 ||
+	    path_init(&state->to_net, bts, net) != 0) {
+		path_free(&state->to_bts);
+		talloc_free(state);
+		return -1;
+	}
+
+	LOGP(DMGCP, LOGL_NOTICE, "Transcoding %s to %s on 0x%x.\n",
+	     mgcp_codec_name(bts), mgcp_codec_name(net), ENDPOINT_NUMBER(endp));
+	endp->transcoding = state;
+	return 1;
+}
+
+void mgcp_transcoding_free(struct mgcp_endpoint *endp)
+{
+	if (!endp->transcoding)
+		return;
+
+	path_free(&endp->transcoding->to_bts);
+	path_free(&endp->transcoding->to_net);
+	talloc_free(endp->transcoding);
+	endp->transcoding = NULL;
+}
+
+/* returns the number of samples or -1 */
+static int decode(struct mgcp_transcode_path *path, const uint8_t *data,
+		  int len, int16_t *samples)
+{
+	int i;
+
+	switch (path->src) {
+	case MGCP_CODEC_PCMA:
+		if (len > MGCP_TRANSCODE_MAX_SAMPLES)
+			return -1;
+		for (i = 0; i < len; ++i)
+			samples[i] = alaw_to_linear(data[i]);
+		path->stats.frames_in += 1;
+		return len;
+	case MGCP_CODEC_PCMU:
+		if (len > MGCP_TRANSCODE_MAX_SAMPLES)
+			return -1;
+		for (i = 0; i < len; ++i)
+			samples[i] = ulaw_to_linear(data[i]);
+		path->stats.frames_in += 1;
+		return len;
+#ifdef BUILD_MGCP_TRANSCODING
+	case MGCP_CODEC_GSM_FR: {
+		int frames = len / GSM_FR_FRAME_LEN;
+
+		if (len % GSM_FR_FRAME_LEN != 0 ||
+		    frames * MGCP_TRANSCODE_FRAME_SAMPLES > MGCP_TRANSCODE_MAX_SAMPLES)
+			return -1;
+		for (i = 0; i < frames; ++i) {
+			if (gsm_decode(path->decoder,
+				       (gsm_byte *) &data[i * GSM_FR_FRAME_LEN],
+				       &samples[i * MGCP_TRANSCODE_FRAME_SAMPLES]) != 0)
+				return -1;
+		}
+		path->stats.frames_in += frames;
+		return frames * MGCP_TRANSCODE_FRAME_SAMPLES;
+	}
+#endif
+	default:
+		return -1;
+	}
+}
+
+/* returns the length of the payload or -1 */
+static int encode(struct mgcp_transcode_path *path, int16_t *samples,
+		  int num, uint8_t *data, int size)
+{
+	int i;
+
+	switch (path->dst) {
+	case MGCP_CODEC_PCMA:
+		if (num > size)
+			return -1;
+		for (i = 0; i < num; ++i)
+			data[i] = linear_to_alaw(samples[i]);
+		path->stats.frames_out += 1;
+		return num;
+	case MGCP_CODEC_PCMU:
+		if (num > size)
+			return -1;
+		for (i = 0; i < num; ++i)
+			data[i] = linear_to_ulaw(samples[i]);
+		path->stats.frames_out += 1;
+		return num;
+#ifdef BUILD_MGCP_TRANSCODING
+	case MGCP_CODEC_GSM_FR: {
+		int frames = num / MGCP_TRANSCODE_FRAME_SAMPLES;
+
+		/* we do not buffer, the ptime needs to be a multiple of 20ms */
+		if (num % MGCP_TRANSCODE_FRAME_SAMPLES != 0 ||
+		    frames * GSM_FR_FRAME_LEN > size)
+			return -1;
+		for (i = 0; i < frames; ++i)
+			gsm_encode(path->encoder,
+				   &samples[i * MGCP_TRANSCODE_FRAME_SAMPLES],
+				   &data[i * GSM_FR_FRAME_LEN]);
+		path->stats.frames_out += frames;
+		return frames * GSM_FR_FRAME_LEN;
+	}
+#endif
+	default:
+		return -1;
+	}
+}
+
+static uint64_t cpu_time_ns(void)
+{
+	struct timespec tp;
+
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &tp) != 0)
+		return 0;
+	return (uint64_t) tp.tv_sec * 1000000000 + tp.tv_nsec;
+}
+
+int mgcp_transcoding_process_rtp(struct mgcp_endpoint *endp, int to_bts,
+				 const char *data, int len,
+				 char *out, int out_size)
+{
+	struct mgcp_transcode_path *path;
+	const uint8_t *rtp = (const uint8_t *) data;
+	int16_t samples[MGCP_TRANSCODE_MAX_SAMPLES];
+	int hdr_len, payload_len, num, rc, sample;
+	uint64_t start = 0;
+
+	if (!endp->transcoding)
+		return -1;
+	path = to_bts ? &endp->transcoding->to_bts : &endp->transcoding->to_net;
+
+	/* the fixed header, CSRCs and the extension */
+	if (len < RTP_HDR_LEN)
+		goto drop;
+	hdr_len = RTP_HDR_LEN + (rtp[0] & 0x0f) * 4;
+	if (rtp[0] & 0x10) {
+		if (len < hdr_len + 4)
+			goto drop;
+		hdr_len += 4 + ((rtp[hdr_len + 2] << 8) | rtp[hdr_len + 3]) * 4;
+	}
+	payload_len = len - hdr_len;
+	if (rtp[0] & 0x20)
+		payload_len -= rtp[len - 1];
+	if (payload_len < 0 || hdr_len > out_size)
+		goto drop;
+
+	/* reading the thread CPU clock is a system call */
+	sample = path->cpu_sample++ % MGCP_TRANSCODE_CPU_SAMPLE == 0;
+	if (sample)
+		start = cpu_time_ns();
+	num = decode(path, &rtp[hdr_len], payload_len, samples);
+	rc = num < 0 ? -1 : encode(path, samples, num,
+				   (uint8_t *) &out[hdr_len], out_size - hdr_len);
+	if (sample)
+		path->stats.cpu_ns += (cpu_time_ns() - start) *
+					MGCP_TRANSCODE_CPU_SAMPLE;
+	if (rc < 0)
+		goto drop;
+
+	/* the header stays, the padding is gone */
+	memcpy(out, data, hdr_len);
+	out[0] &= ~0x20;
+	return hdr_len + rc;
+
+drop:
+	path->stats.dropped += 1;
+	return -1;
+}
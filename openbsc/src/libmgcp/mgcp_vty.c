@@ -26,11 +26,20 @@
 
 #include <openbsc/mgcp.h>
 #include <openbsc/mgcp_internal.h>
+#include <openbsc/mgcp_transcode.h>
+#include <openbsc/mgcp_jitter.h>
+#include <openbsc/mgcp_capture.h>
 #include <openbsc/vty.h>
 
 #include <string.h>
 
 #define RTCP_OMIT_STR "Drop RTCP packets in both directions\n"
+#define TRANSCODING_STR "Transcode between the BTS and network codecs\n" \
+			"Transcode in the MGW instead of a transcoder-mgw\n"
+#define JITTER_STR "Re-time the audio of the BTS with a jitter buffer\n"
+#define JITTER_ARGS_STR JITTER_STR \
+			"Minimum depth in 20ms frames\n" \
+			"Maximum depth in 20ms frames\n"
 
 static struct mgcp_config *g_cfg = NULL;
 
@@ -84,10 +93,17 @@ static int config_write_mgcp(struct vty *vty)
 			g_cfg->net_ports.range_start, g_cfg->net_ports.range_end, VTY_NEWLINE);
 
 	vty_out(vty, "  rtp ip-dscp %d%s", g_cfg->endp_dscp, VTY_NEWLINE);
+	vty_out(vty, "  rtp capture-queue %d%s", g_cfg->capture_queue_kb, VTY_NEWLINE);
 	if (g_cfg->trunk.omit_rtcp)
 		vty_out(vty, "  rtcp-omit%s", VTY_NEWLINE);
 	else
 		vty_out(vty, "  no rtcp-omit%s", VTY_NEWLINE);
+	if (g_cfg->trunk.internal_transcoding)
+		vty_out(vty, "  transcoding internal%s", VTY_NEWLINE);
+	if (g_cfg->trunk.jitter_buffer)
+		vty_out(vty, "  jitter-buffer %d %d%s",
+			g_cfg->trunk.jitter_min_frames,
+			g_cfg->trunk.jitter_max_frames, VTY_NEWLINE);
 	if (g_cfg->trunk.audio_payload != -1)
 		vty_out(vty, "  sdp audio-payload number %d%s",
 			g_cfg->trunk.audio_payload, VTY_NEWLINE);
@@ -101,6 +117,8 @@ static int config_write_mgcp(struct vty *vty)
 	vty_out(vty, "  number endpoints %u%s", g_cfg->trunk.number_endpoints - 1, VTY_NEWLINE);
 	if (g_cfg->call_agent_addr)
 		vty_out(vty, "  call-agent ip %s%s", g_cfg->call_agent_addr, VTY_NEWLINE);
+	if (g_cfg->quality_file)
+		vty_out(vty, "  quality-records %s%s", g_cfg->quality_file, VTY_NEWLINE);
 	if (g_cfg->transcoder_ip)
 		vty_out(vty, "  transcoder-mgw %s%s", g_cfg->transcoder_ip, VTY_NEWLINE);
 
@@ -114,9 +132,45 @@ static int config_write_mgcp(struct vty *vty)
 	return CMD_SUCCESS;
 }
 
+static void dump_transcode_path(struct vty *vty, const char *dir,
+				struct mgcp_transcode_path *path)
+{
+	vty_out(vty, "  %s %s to %s: frames in: %lu out: %lu dropped: %lu "
+		"CPU: %llu us%s", dir, mgcp_codec_name(path->src),
+		mgcp_codec_name(path->dst), path->stats.frames_in,
+		path->stats.frames_out, path->stats.dropped,
+		(unsigned long long) path->stats.cpu_ns / 1000, VTY_NEWLINE);
+}
+
+static void dump_transcoding(struct vty *vty, struct mgcp_transcoding *state)
+{
+	dump_transcode_path(vty, "Transcoding to BTS", &state->to_bts);
+	dump_transcode_path(vty, "Transcoding to net", &state->to_net);
+}
+
+static void dump_jitter_buffer(struct vty *vty, struct mgcp_jitter_buffer *jb)
+{
+	vty_out(vty, "  Jitter buffer depth: %u target: %d jitter: %u ms "
+		"late: %lu duplicates: %lu concealed: %lu discarded: %lu "
+		"underruns: %lu resyncs: %lu%s", mgcp_jitter_depth(jb),
+		jb->target, jb->jitter >> 4, jb->stats.late,
+		jb->stats.duplicates, jb->stats.concealed, jb->stats.discarded,
+		jb->stats.underruns, jb->stats.resyncs, VTY_NEWLINE);
+}
+
+static void dump_capture(struct vty *vty, struct mgcp_capture *cap)
+{
+	struct mgcp_capture_stats stats;
+
+	mgcp_capture_get_stats(cap, &stats);
+	vty_out(vty, "  Capture %s: packets: %lu dropped: %lu errors: %lu%s",
+		cap->filename, stats.packets, stats.dropped, stats.errors,
+		VTY_NEWLINE);
+}
+
 static void dump_trunk(struct vty *vty, struct mgcp_trunk_config *cfg)
 {
-	int i;
+	int i, j;
 
 	vty_out(vty, "%s trunk nr %d with %d endpoints:%s",
 		cfg->trunk_type == MGCP_TRUNK_VIRTUAL ? "Virtual" : "E1",
@@ -139,6 +193,13 @@ static void dump_trunk(struct vty *vty, struct mgcp_trunk_config *cfg)
 			endp->bts_end.packets, endp->net_end.packets,
 			endp->trans_net.packets, endp->trans_bts.packets,
 			VTY_NEWLINE);
+		if (endp->transcoding)
+			dump_transcoding(vty, endp->transcoding);
+		if (endp->jitter_buffer)
+			dump_jitter_buffer(vty, endp->jitter_buffer);
+		for (j = 0; j < MGCP_TAP_COUNT; ++j)
+			if (endp->taps[j].capture)
+				dump_capture(vty, endp->taps[j].capture);
 	}
 }
 
@@ -152,6 +213,15 @@ DEFUN(show_mcgp, show_mgcp_cmd, "show mgcp",
 	llist_for_each_entry(trunk, &g_cfg->trunks, entry)
 		dump_trunk(vty, trunk);
 
+	if (g_cfg->quality_file) {
+		struct mgcp_capture_stats stats;
+
+		mgcp_capture_get_line_stats(g_cfg, &stats);
+		vty_out(vty, "Quality records %s: written: %lu dropped: %lu "
+			"errors: %lu%s", g_cfg->quality_file, stats.packets,
+			stats.dropped, stats.errors, VTY_NEWLINE);
+	}
+
 	return CMD_SUCCESS;
 }
 
@@ -324,6 +394,17 @@ ALIAS_DEPRECATED(cfg_mgcp_rtp_ip_dscp, cfg_mgcp_rtp_ip_tos_cmd,
       RTP_STR
       "Apply IP_TOS to the audio stream\n" "The DSCP value\n")
 
+DEFUN(cfg_mgcp_rtp_capture_queue,
+      cfg_mgcp_rtp_capture_queue_cmd,
+      "rtp capture-queue <16-65536>",
+      RTP_STR
+      "Bound the packets waiting to be written by tap-call to a file\n"
+      "The size in KiB, used when the first capture is opened\n")
+{
+	g_cfg->capture_queue_kb = atoi(argv[0]);
+	return CMD_SUCCESS;
+}
+
 DEFUN(cfg_mgcp_sdp_fmtp_extra,
       cfg_mgcp_sdp_fmtp_extra_cmd,
       "sdp audio fmtp-extra .NAME",
@@ -408,6 +489,79 @@ DEFUN(cfg_mgcp_no_omit_rtcp,
 	return CMD_SUCCESS;
 }
 
+DEFUN(cfg_mgcp_transcoding,
+      cfg_mgcp_transcoding_cmd,
+      "transcoding internal",
+      TRANSCODING_STR)
+{
+	g_cfg->trunk.internal_transcoding = 1;
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_mgcp_no_transcoding,
+      cfg_mgcp_no_transcoding_cmd,
+      "no transcoding internal",
+      NO_STR TRANSCODING_STR)
+{
+	g_cfg->trunk.internal_transcoding = 0;
+	return CMD_SUCCESS;
+}
+
+static int set_jitter_buffer(struct vty *vty, struct mgcp_trunk_config *trunk,
+			     const char *min, const char *max)
+{
+	int min_frames = atoi(min);
+	int max_frames = atoi(max);
+
+	if (min_frames > max_frames) {
+		vty_out(vty, "%% The minimum depth %d is above the maximum %d%s",
+			min_frames, max_frames, VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+
+	trunk->jitter_buffer = 1;
+	trunk->jitter_min_frames = min_frames;
+	trunk->jitter_max_frames = max_frames;
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_mgcp_jitter_buffer,
+      cfg_mgcp_jitter_buffer_cmd,
+      "jitter-buffer <1-50> <1-50>",
+      JITTER_ARGS_STR)
+{
+	return set_jitter_buffer(vty, &g_cfg->trunk, argv[0], argv[1]);
+}
+
+DEFUN(cfg_mgcp_no_jitter_buffer,
+      cfg_mgcp_no_jitter_buffer_cmd,
+      "no jitter-buffer",
+      NO_STR JITTER_STR)
+{
+	g_cfg->trunk.jitter_buffer = 0;
+	return CMD_SUCCESS;
+}
+
+#define QUALITY_STR "Append a CSV record with the RTP quality of each call\n"
+DEFUN(cfg_mgcp_quality_records,
+      cfg_mgcp_quality_records_cmd,
+      "quality-records FILENAME",
+      QUALITY_STR "The file to append to\n")
+{
+	bsc_replace_string(g_cfg, &g_cfg->quality_file, argv[0]);
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_mgcp_no_quality_records,
+      cfg_mgcp_no_quality_records_cmd,
+      "no quality-records",
+      NO_STR QUALITY_STR)
+{
+	talloc_free(g_cfg->quality_file);
+	g_cfg->quality_file = NULL;
+	return CMD_SUCCESS;
+}
+
 #define CALL_AGENT_STR "Callagent information\n"
 DEFUN(cfg_mgcp_agent_addr,
       cfg_mgcp_agent_addr_cmd,
@@ -498,6 +652,12 @@ static int config_write_trunk(struct vty *vty)
 			vty_out(vty, "  rtcp-omit%s", VTY_NEWLINE);
 		else
 			vty_out(vty, "  no rtcp-omit%s", VTY_NEWLINE);
+		if (trunk->internal_transcoding)
+			vty_out(vty, "  transcoding internal%s", VTY_NEWLINE);
+		if (trunk->jitter_buffer)
+			vty_out(vty, "  jitter-buffer %d %d%s",
+				trunk->jitter_min_frames,
+				trunk->jitter_max_frames, VTY_NEWLINE);
 		if (trunk->audio_fmtp_extra)
 			vty_out(vty, "   sdp audio fmtp-extra %s%s",
 				trunk->audio_fmtp_extra, VTY_NEWLINE);
@@ -586,6 +746,45 @@ DEFUN(cfg_trunk_no_omit_rtcp,
 	return CMD_SUCCESS;
 }
 
+DEFUN(cfg_trunk_transcoding,
+      cfg_trunk_transcoding_cmd,
+      "transcoding internal",
+      TRANSCODING_STR)
+{
+	struct mgcp_trunk_config *trunk = vty->index;
+	trunk->internal_transcoding = 1;
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_trunk_no_transcoding,
+      cfg_trunk_no_transcoding_cmd,
+      "no transcoding internal",
+      NO_STR TRANSCODING_STR)
+{
+	struct mgcp_trunk_config *trunk = vty->index;
+	trunk->internal_transcoding = 0;
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_trunk_jitter_buffer,
+      cfg_trunk_jitter_buffer_cmd,
+      "jitter-buffer <1-50> <1-50>",
+      JITTER_ARGS_STR)
+{
+	struct mgcp_trunk_config *trunk = vty->index;
+	return set_jitter_buffer(vty, trunk, argv[0], argv[1]);
+}
+
+DEFUN(cfg_trunk_no_jitter_buffer,
+      cfg_trunk_no_jitter_buffer_cmd,
+      "no jitter-buffer",
+      NO_STR JITTER_STR)
+{
+	struct mgcp_trunk_config *trunk = vty->index;
+	trunk->jitter_buffer = 0;
+	return CMD_SUCCESS;
+}
+
 DEFUN(loop_endp,
       loop_endp_cmd,
       "loop-endpoint <0-64> NAME (0|1)",
@@ -628,18 +827,9 @@ DEFUN(loop_endp,
 	return CMD_SUCCESS;
 }
 
-DEFUN(tap_call,
-      tap_call_cmd,
-      "tap-call <0-64> ENDPOINT (bts-in|bts-out|net-in|net-out) A.B.C.D <0-65534>",
-      "Forward data on endpoint to a different system\n" "Trunk number\n"
-      "The endpoint in hex\n"
-      "Forward the data coming from the bts\n"
-      "Forward the data coming from the bts leaving to the network\n"
-      "Forward the data coming from the net\n"
-      "Forward the data coming from the net leaving to the bts\n"
-      "destination IP of the data\n" "destination port\n")
+static struct mgcp_rtp_tap *find_tap(struct vty *vty, const char **argv,
+				      struct mgcp_endpoint **_endp, int *_port)
 {
-	struct mgcp_rtp_tap *tap;
 	struct mgcp_trunk_config *trunk;
 	struct mgcp_endpoint *endp;
 	int port = 0;
@@ -648,20 +838,20 @@ DEFUN(tap_call,
 	if (!trunk) {
 		vty_out(vty, "%%Trunk %d not found in the config.%s",
 			atoi(argv[0]), VTY_NEWLINE);
-		return CMD_WARNING;
+		return NULL;
 	}
 
 	if (!trunk->endpoints) {
 		vty_out(vty, "%%Trunk %d has no endpoints allocated.%s",
 			trunk->trunk_nr, VTY_NEWLINE);
-		return CMD_WARNING;
+		return NULL;
 	}
 
 	int endp_no = strtoul(argv[1], NULL, 16);
 	if (endp_no < 1 || endp_no >= trunk->number_endpoints) {
 		vty_out(vty, "Endpoint number %s/%d is invalid.%s",
 		argv[1], endp_no, VTY_NEWLINE);
-		return CMD_WARNING;
+		return NULL;
 	}
 
 	endp = &trunk->endpoints[endp_no];
@@ -676,10 +866,39 @@ DEFUN(tap_call,
 		port = MGCP_TAP_NET_OUT;
 	} else {
 		vty_out(vty, "Unknown mode... tricked vty?%s", VTY_NEWLINE);
-		return CMD_WARNING;
+		return NULL;
 	}
 
-	tap = &endp->taps[port];
+	*_endp = endp;
+	*_port = port;
+	return &endp->taps[port];
+}
+
+#define TAP_CALL_STR \
+      "Forward data on endpoint to a different system\n" "Trunk number\n" \
+      "The endpoint in hex\n" \
+      "Forward the data coming from the bts\n" \
+      "Forward the data coming from the bts leaving to the network\n" \
+      "Forward the data coming from the net\n" \
+      "Forward the data coming from the net leaving to the bts\n"
+
+DEFUN(tap_call,
+      tap_call_cmd,
+      "tap-call <0-64> ENDPOINT (bts-in|bts-out|net-in|net-out) A.B.C.D <0-65534>",
+      TAP_CALL_STR
+      "destination IP of the data\n" "destination port\n")
+{
+	struct mgcp_rtp_tap *tap;
+	struct mgcp_endpoint *endp;
+	int port;
+
+	tap = find_tap(vty, argv, &endp, &port);
+	if (!tap)
+		return CMD_WARNING;
+
+	mgcp_capture_close(tap->capture);
+	tap->capture = NULL;
+
 	memset(&tap->forward, 0, sizeof(tap->forward));
 	inet_aton(argv[3], &tap->forward.sin_addr);
 	tap->forward.sin_port = htons(atoi(argv[4]));
@@ -687,6 +906,38 @@ DEFUN(tap_call,
 	return CMD_SUCCESS;
 }
 
+DEFUN(tap_call_file,
+      tap_call_file_cmd,
+      "tap-call <0-64> ENDPOINT (bts-in|bts-out|net-in|net-out) (pcap|rtpdump) FILENAME",
+      TAP_CALL_STR
+      "Write the data to a pcap file\n"
+      "Write the data to a rtpdump file of the rtptools\n"
+      "The file, it is closed at the end of the call\n")
+{
+	struct mgcp_rtp_tap *tap;
+	struct mgcp_endpoint *endp;
+	struct mgcp_capture *cap;
+	int port;
+
+	tap = find_tap(vty, argv, &endp, &port);
+	if (!tap)
+		return CMD_WARNING;
+
+	cap = mgcp_capture_open(endp, port,
+				strcmp(argv[3], "pcap") == 0 ?
+					MGCP_CAPTURE_PCAP : MGCP_CAPTURE_RTPDUMP,
+				argv[4]);
+	if (!cap) {
+		vty_out(vty, "%%Failed to open %s.%s", argv[4], VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+
+	mgcp_capture_close(tap->capture);
+	tap->capture = cap;
+	tap->enabled = 1;
+	return CMD_SUCCESS;
+}
+
 DEFUN(free_endp, free_endp_cmd,
       "free-endpoint <0-64> NUMBER",
       "Free the given endpoint\n" "Trunk number\n"
@@ -779,6 +1030,7 @@ int mgcp_vty_init(void)
 	install_element_ve(&show_mgcp_cmd);
 	install_element(ENABLE_NODE, &loop_endp_cmd);
 	install_element(ENABLE_NODE, &tap_call_cmd);
+	install_element(ENABLE_NODE, &tap_call_file_cmd);
 	install_element(ENABLE_NODE, &free_endp_cmd);
 	install_element(ENABLE_NODE, &reset_endp_cmd);
 	install_element(ENABLE_NODE, &reset_all_endp_cmd);
@@ -803,6 +1055,7 @@ int mgcp_vty_init(void)
 	install_element(MGCP_NODE, &cfg_mgcp_rtp_transcoder_base_cmd);
 	install_element(MGCP_NODE, &cfg_mgcp_rtp_ip_dscp_cmd);
 	install_element(MGCP_NODE, &cfg_mgcp_rtp_ip_tos_cmd);
+	install_element(MGCP_NODE, &cfg_mgcp_rtp_capture_queue_cmd);
 	install_element(MGCP_NODE, &cfg_mgcp_agent_addr_cmd);
 	install_element(MGCP_NODE, &cfg_mgcp_agent_addr_cmd_old);
 	install_element(MGCP_NODE, &cfg_mgcp_transcoder_cmd);
@@ -816,6 +1069,12 @@ int mgcp_vty_init(void)
 	install_element(MGCP_NODE, &cfg_mgcp_number_endp_cmd);
 	install_element(MGCP_NODE, &cfg_mgcp_omit_rtcp_cmd);
 	install_element(MGCP_NODE, &cfg_mgcp_no_omit_rtcp_cmd);
+	install_element(MGCP_NODE, &cfg_mgcp_transcoding_cmd);
+	install_element(MGCP_NODE, &cfg_mgcp_no_transcoding_cmd);
+	install_element(MGCP_NODE, &cfg_mgcp_jitter_buffer_cmd);
+	install_element(MGCP_NODE, &cfg_mgcp_no_jitter_buffer_cmd);
+	install_element(MGCP_NODE, &cfg_mgcp_quality_records_cmd);
+	install_element(MGCP_NODE, &cfg_mgcp_no_quality_records_cmd);
 	install_element(MGCP_NODE, &cfg_mgcp_sdp_fmtp_extra_cmd);
 
 	install_element(MGCP_NODE, &cfg_mgcp_trunk_cmd);
@@ -830,6 +1089,10 @@ int mgcp_vty_init(void)
 	install_element(TRUNK_NODE, &cfg_trunk_loop_cmd);
 	install_element(TRUNK_NODE, &cfg_trunk_omit_rtcp_cmd);
 	install_element(TRUNK_NODE, &cfg_trunk_no_omit_rtcp_cmd);
+	install_element(TRUNK_NODE, &cfg_trunk_transcoding_cmd);
+	install_element(TRUNK_NODE, &cfg_trunk_no_transcoding_cmd);
+	install_element(TRUNK_NODE, &cfg_trunk_jitter_buffer_cmd);
+	install_element(TRUNK_NODE, &cfg_trunk_no_jitter_buffer_cmd);
 	install_element(TRUNK_NODE, &cfg_trunk_sdp_fmtp_extra_cmd);
 
 	return 0;
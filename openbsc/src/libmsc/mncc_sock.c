@@ -21,37 +21,137 @@
  *
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
-#include <assert.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <sys/un.h>
 
 #include <osmocom/core/talloc.h>
 #include <osmocom/core/select.h>
 #include <osmocom/gsm/protocol/gsm_04_08.h>
+#include <osmocom/vty/vty.h>
 
 #include <openbsc/debug.h>
 #include <openbsc/mncc.h>
 #include <openbsc/gsm_data.h>
 
+#include "../../bscconfig.h"
+
+/* primitives read or written per wakeup */
+#define MNCC_SOCK_BATCH		16
+#define MNCC_SOCK_RX_SIZE	(sizeof(struct gsm_mncc) + 256)
+
+/* when the msgb was queued and its place in the queue */
+#define MNCC_QUEUED_CB(__msgb)	(__msgb)->cb[0]
+#define MNCC_SEQ_CB(__msgb)	(__msgb)->cb[1]
+
+union mncc_sock_rx_buf {
+	struct gsm_mncc mncc;
+	uint8_t data[MNCC_SOCK_RX_SIZE];
+};
+
 struct mncc_sock_state {
 	struct gsm_network *net;
 	struct osmo_fd listen_bfd;	/* fd for listen socket */
 	struct osmo_fd conn_bfd;		/* fd for connection to lcr */
+
+	/* the primitives of one read, handled before the next read */
+	union mncc_sock_rx_buf rx_buf[MNCC_SOCK_BATCH];
+
+	/*
+	 * The voice frames are queued apart from the rest in net->upqueue,
+	 * the oldest one is dropped without a search. The sequence number
+	 * keeps the order across both when sending.
+	 */
+	struct llist_head voice_queue;
+	unsigned long queue_seq;
+
+	/* depth of both queues */
+	unsigned int queue_len;
+	unsigned int queue_max;
+
+	/* from the queueing to the send in us */
+	unsigned long long latency_sum;
+	unsigned long latency_num;
+	unsigned long latency_max;
 };
 
+static unsigned long now_us(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000000UL + tv.tv_usec;
+}
+
+static int is_voice_frame(struct msgb *msg)
+{
+	struct gsm_mncc *mncc = (struct gsm_mncc *) msgb_data(msg);
+
+	if (msgb_length(msg) < sizeof(mncc->msg_type))
+		return 0;
+	return mncc->msg_type == GSM_TCHF_FRAME ||
+		mncc->msg_type == GSM_TCHF_FRAME_EFR;
+}
+
+static void mncc_sock_queue(struct mncc_sock_state *state, struct msgb *msg)
+{
+	MNCC_QUEUED_CB(msg) = now_us();
+	MNCC_SEQ_CB(msg) = state->queue_seq++;
+	if (is_voice_frame(msg))
+		msgb_enqueue(&state->voice_queue, msg);
+	else
+		msgb_enqueue(&state->net->upqueue, msg);
+
+	state->queue_len += 1;
+	if (state->queue_len > state->queue_max)
+		state->queue_max = state->queue_len;
+	state->conn_bfd.when |= BSC_FD_WRITE;
+}
+
+static void mncc_sock_unqueue(struct mncc_sock_state *state, struct msgb *msg)
+{
+	llist_del(&msg->list);
+	state->queue_len -= 1;
+}
+
+/* the queue is full, make room by dropping the oldest voice frame
+ * or drop the new one */
+static int mncc_sock_drop_voice(struct mncc_sock_state *state,
+				struct msgb *msg)
+{
+	struct gsm_network *net = state->net;
+	struct msgb *old;
+
+	osmo_counter_inc(net->stats.mncc.voice_dropped);
+
+	if (net->mncc_sock.voice_drop == MNCC_SOCK_DROP_OLDEST
+	    && !llist_empty(&state->voice_queue)) {
+		old = llist_entry(state->voice_queue.next, struct msgb, list);
+		mncc_sock_unqueue(state, old);
+		msgb_free(old);
+		mncc_sock_queue(state, msg);
+		return 0;
+	}
+
+	msgb_free(msg);
+	return -1;
+}
+
 /* input from CC code into mncc_sock */
 int mncc_sock_from_cc(struct gsm_network *net, struct msgb *msg)
 {
+	struct mncc_sock_state *state = net->mncc_state;
 	struct gsm_mncc *mncc_in = (struct gsm_mncc *) msgb_data(msg);
 	int msg_type = mncc_in->msg_type;
 
 	/* Check if we currently have a MNCC handler connected */
-	if (net->mncc_state->conn_bfd.fd < 0) {
+	if (state->conn_bfd.fd < 0) {
 		LOGP(DMNCC, LOGL_ERROR, "mncc_sock receives %s for external CC app "
 			"but socket is gone\n", get_mncc_name(msg_type));
 		if (msg_type != GSM_TCHF_FRAME &&
@@ -69,11 +169,14 @@ int mncc_sock_from_cc(struct gsm_network *net, struct msgb *msg)
 		return -1;
 	}
 
-	/* FIXME: check for some maximum queue depth? */
+	/* a slow application only loses voice frames, the call control
+	 * is always queued */
+	if (state->queue_len >= net->mncc_sock.queue_limit
+	    && is_voice_frame(msg))
+		return mncc_sock_drop_voice(state, msg);
 
 	/* Actually enqueue the message and mark socket write need */
-	msgb_enqueue(&net->upqueue, msg);
-	net->mncc_state->conn_bfd.when |= BSC_FD_WRITE;
+	mncc_sock_queue(state, msg);
 	return 0;
 }
 
@@ -101,85 +204,232 @@ static void mncc_sock_close(struct mncc_sock_state *state)
 		struct msgb *msg = msgb_dequeue(&state->net->upqueue);
 		msgb_free(msg);
 	}
+	while (!llist_empty(&state->voice_queue)) {
+		struct msgb *msg = msgb_dequeue(&state->voice_queue);
+		msgb_free(msg);
+	}
+	state->queue_len = 0;
 }
 
-static int mncc_sock_read(struct osmo_fd *bfd)
+/* read up to MNCC_SOCK_BATCH primitives, a length of zero is the end
+ * of the connection */
+static int mncc_sock_recv_batch(struct mncc_sock_state *state, int *len)
 {
-	struct mncc_sock_state *state = (struct mncc_sock_state *)bfd->data;
-	struct gsm_mncc *mncc_prim;
-	struct msgb *msg;
+	int fd = state->conn_bfd.fd;
+	unsigned int i;
+#ifdef HAVE_RECVMMSG
+	struct mmsghdr mmsg[MNCC_SOCK_BATCH];
+	struct iovec iov[MNCC_SOCK_BATCH];
 	int rc;
 
-	msg = msgb_alloc(sizeof(*mncc_prim)+256, "mncc_sock_rx");
-	if (!msg)
-		return -ENOMEM;
+	memset(mmsg, 0, sizeof(mmsg));
+	for (i = 0; i < MNCC_SOCK_BATCH; i++) {
+		iov[i].iov_base = state->rx_buf[i].data;
+		iov[i].iov_len = sizeof(state->rx_buf[i].data);
+		mmsg[i].msg_hdr.msg_iov = &iov[i];
+		mmsg[i].msg_hdr.msg_iovlen = 1;
+	}
 
-	mncc_prim = (struct gsm_mncc *) msg->tail;
+	rc = recvmmsg(fd, mmsg, MNCC_SOCK_BATCH, MSG_DONTWAIT, NULL);
+	osmo_counter_inc(state->net->stats.mncc.rx_calls);
+	if (rc < 0)
+		return errno == EAGAIN ? 0 : -errno;
 
-	rc = recv(bfd->fd, msg->tail, msgb_tailroom(msg), 0);
-	if (rc == 0)
-		goto close;
+	for (i = 0; i < rc; i++)
+		len[i] = mmsg[i].msg_len;
+	return rc;
+#else
+	for (i = 0; i < MNCC_SOCK_BATCH; i++) {
+		int rc;
 
-	if (rc < 0) {
-		if (errno == EAGAIN)
-			return 0;
-		goto close;
+		rc = recv(fd, state->rx_buf[i].data,
+			  sizeof(state->rx_buf[i].data), MSG_DONTWAIT);
+		osmo_counter_inc(state->net->stats.mncc.rx_calls);
+		if (rc < 0) {
+			if (i > 0 || errno == EAGAIN)
+				break;
+			return -errno;
+		}
+
+		len[i] = rc;
+		if (rc == 0)
+			return i + 1;
 	}
+	return i;
+#endif
+}
 
-	rc = mncc_tx_to_cc(state->net, mncc_prim->msg_type, mncc_prim);
+static int mncc_sock_read(struct osmo_fd *bfd)
+{
+	struct mncc_sock_state *state = (struct mncc_sock_state *)bfd->data;
+	int len[MNCC_SOCK_BATCH];
+	int i, num;
 
-	/* as we always synchronously process the message in mncc_send() and
-	 * its callbacks, we can free the message here. */
-	msgb_free(msg);
+	num = mncc_sock_recv_batch(state, len);
+	if (num < 0)
+		goto close;
 
-	return rc;
+	for (i = 0; i < num; i++) {
+		struct gsm_mncc *mncc_prim = &state->rx_buf[i].mncc;
+
+		if (len[i] == 0)
+			goto close;
+
+		/* as we always synchronously process the message in
+		 * mncc_send() and its callbacks, the buffer is free again
+		 * after this. */
+		osmo_counter_inc(state->net->stats.mncc.rx);
+		mncc_tx_to_cc(state->net, mncc_prim->msg_type, mncc_prim);
+	}
+
+	return 0;
 
 close:
-	msgb_free(msg);
 	mncc_sock_close(state);
 	return -1;
 }
 
-static int mncc_sock_write(struct osmo_fd *bfd)
+/* returns the number of sent msgbs or -errno if none was sent */
+static int mncc_sock_send_batch(struct mncc_sock_state *state,
+				struct msgb **msgs, unsigned int num)
 {
-	struct mncc_sock_state *state = bfd->data;
-	struct gsm_network *net = state->net;
+	int fd = state->conn_bfd.fd;
+	unsigned int i;
 	int rc;
+#ifdef HAVE_SENDMMSG
+	struct mmsghdr mmsg[MNCC_SOCK_BATCH];
+	struct iovec iov[MNCC_SOCK_BATCH];
+
+	memset(mmsg, 0, sizeof(mmsg[0]) * num);
+	for (i = 0; i < num; i++) {
+		iov[i].iov_base = msgb_data(msgs[i]);
+		iov[i].iov_len = msgb_length(msgs[i]);
+		mmsg[i].msg_hdr.msg_iov = &iov[i];
+		mmsg[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	rc = sendmmsg(fd, mmsg, num, MSG_DONTWAIT);
+	osmo_counter_inc(state->net->stats.mncc.tx_calls);
+	if (rc < 0)
+		return -errno;
+	return rc;
+#else
+	for (i = 0; i < num; i++) {
+		rc = send(fd, msgb_data(msgs[i]), msgb_length(msgs[i]),
+			  MSG_DONTWAIT);
+		osmo_counter_inc(state->net->stats.mncc.tx_calls);
+		if (rc < 0) {
+			if (i > 0)
+				break;
+			return -errno;
+		}
+	}
+	return i;
+#endif
+}
 
-	while (!llist_empty(&net->upqueue)) {
-		struct msgb *msg, *msg2;
-		struct gsm_mncc *mncc_prim;
+static void mncc_sock_sent(struct mncc_sock_state *state, struct msgb *msg,
+			   unsigned long now)
+{
+	unsigned long latency = now - MNCC_QUEUED_CB(msg);
 
-		/* peek at the beginning of the queue */
-		msg = llist_entry(net->upqueue.next, struct msgb, list);
-		mncc_prim = (struct gsm_mncc *)msg->data;
+	state->latency_sum += latency;
+	state->latency_num += 1;
+	if (latency > state->latency_max)
+		state->latency_max = latency;
 
-		bfd->when &= ~BSC_FD_WRITE;
+	osmo_counter_inc(state->net->stats.mncc.tx);
+	mncc_sock_unqueue(state, msg);
+	msgb_free(msg);
+}
+
+/* the msgb after pos in the queue, NULL at its end */
+static struct msgb *mncc_sock_next(struct llist_head *queue,
+				   struct llist_head *pos)
+{
+	if (pos->next == queue)
+		return NULL;
+	return llist_entry(pos->next, struct msgb, list);
+}
+
+/* take a batch in queue order from the beginning of both queues */
+static unsigned int mncc_sock_take_batch(struct mncc_sock_state *state,
+					 struct msgb **msgs)
+{
+	struct llist_head *queue = &state->net->upqueue;
+	struct llist_head *ctrl_pos = queue, *voice_pos = &state->voice_queue;
+	struct msgb *ctrl, *voice, *msg;
+	unsigned int num = 0;
+
+	while (num < MNCC_SOCK_BATCH) {
+		ctrl = mncc_sock_next(queue, ctrl_pos);
+		voice = mncc_sock_next(&state->voice_queue, voice_pos);
+		if (!ctrl && !voice)
+			break;
+
+		if (ctrl && (!voice ||
+			     (long) (MNCC_SEQ_CB(ctrl) - MNCC_SEQ_CB(voice)) < 0)) {
+			msg = ctrl;
+			ctrl_pos = &ctrl->list;
+		} else {
+			msg = voice;
+			voice_pos = &voice->list;
+		}
 
 		/* bug hunter 8-): maybe someone forgot msgb_put(...) ? */
 		if (!msgb_length(msg)) {
-			LOGP(DMNCC, LOGL_ERROR, "message type (%d) with ZERO "
-				"bytes!\n", mncc_prim->msg_type);
-			goto dontsend;
+			LOGP(DMNCC, LOGL_ERROR, "message with ZERO "
+				"bytes!\n");
+			if (msg == ctrl)
+				ctrl_pos = msg->list.prev;
+			else
+				voice_pos = msg->list.prev;
+			mncc_sock_unqueue(state, msg);
+			msgb_free(msg);
+			continue;
 		}
 
+		msgs[num++] = msg;
+	}
+
+	return num;
+}
+
+static int mncc_sock_write(struct osmo_fd *bfd)
+{
+	struct mncc_sock_state *state = bfd->data;
+	struct msgb *msgs[MNCC_SOCK_BATCH];
+	unsigned long now;
+	unsigned int num;
+	int i, rc;
+
+	bfd->when &= ~BSC_FD_WRITE;
+
+	while (state->queue_len > 0) {
+		num = mncc_sock_take_batch(state, msgs);
+		if (num == 0)
+			break;
+
 		/* try to send it over the socket */
-		rc = write(bfd->fd, msgb_data(msg), msgb_length(msg));
-		if (rc == 0)
-			goto close;
+		rc = mncc_sock_send_batch(state, msgs, num);
 		if (rc < 0) {
-			if (errno == EAGAIN) {
+			if (rc == -EAGAIN) {
 				bfd->when |= BSC_FD_WRITE;
 				break;
 			}
 			goto close;
 		}
 
-dontsend:
 		/* _after_ we send it, we can deueue */
-		msg2 = msgb_dequeue(&net->upqueue);
-		assert(msg == msg2);
-		msgb_free(msg);
+		now = now_us();
+		for (i = 0; i < rc; i++)
+			mncc_sock_sent(state, msgs[i], now);
+
+		/* the application does not keep up, wait for it */
+		if (rc < num) {
+			bfd->when |= BSC_FD_WRITE;
+			break;
+		}
 	}
 	return 0;
 
@@ -229,8 +479,31 @@ static void queue_hello(struct mncc_sock_state *mncc)
 	hello->emergency_offset = offsetof(struct gsm_mncc, emergency);
 	hello->lchan_type_offset = offsetof(struct gsm_mncc, lchan_type);
 
-	msgb_enqueue(&mncc->net->upqueue, msg);
-	mncc->conn_bfd.when |= BSC_FD_WRITE;
+	mncc_sock_queue(mncc, msg);
+}
+
+/* take the connection to the call control application */
+static int mncc_sock_connected(struct mncc_sock_state *state, int fd)
+{
+	struct osmo_fd *conn_bfd = &state->conn_bfd;
+
+	conn_bfd->fd = fd;
+	conn_bfd->when = BSC_FD_READ;
+	conn_bfd->cb = mncc_sock_cb;
+	conn_bfd->data = state;
+
+	if (osmo_fd_register(conn_bfd) != 0) {
+		LOGP(DMNCC, LOGL_ERROR, "Failed to register new connection fd\n");
+		close(conn_bfd->fd);
+		conn_bfd->fd = -1;
+		return -1;
+	}
+
+	LOGP(DMNCC, LOGL_NOTICE, "MNCC Socket has connection with external "
+		"call control application\n");
+
+	queue_hello(state);
+	return 0;
 }
 
 /* accept a new connection */
@@ -258,25 +531,24 @@ static int mncc_sock_accept(struct osmo_fd *bfd, unsigned int flags)
 		return 0;
 	}
 
-	conn_bfd->fd = rc;
-	conn_bfd->when = BSC_FD_READ;
-	conn_bfd->cb = mncc_sock_cb;
-	conn_bfd->data = state;
+	return mncc_sock_connected(state, rc);
+}
 
-	if (osmo_fd_register(conn_bfd) != 0) {
-		LOGP(DMNCC, LOGL_ERROR, "Failed to register new connection fd\n");
-		close(conn_bfd->fd);
-		conn_bfd->fd = -1;
-		return -1;
-	}
+static struct mncc_sock_state *mncc_sock_state_alloc(struct gsm_network *net)
+{
+	struct mncc_sock_state *state;
 
-	LOGP(DMNCC, LOGL_NOTICE, "MNCC Socket has connection with external "
-		"call control application\n");
+	state = talloc_zero(tall_bsc_ctx, struct mncc_sock_state);
+	if (!state)
+		return NULL;
 
-	queue_hello(state);
-	return 0;
-}
+	state->net = net;
+	state->listen_bfd.fd = -1;
+	state->conn_bfd.fd = -1;
+	INIT_LLIST_HEAD(&state->voice_queue);
 
+	return state;
+}
 
 int mncc_sock_init(struct gsm_network *net)
 {
@@ -284,13 +556,10 @@ int mncc_sock_init(struct gsm_network *net)
 	struct osmo_fd *bfd;
 	int rc;
 
-	state = talloc_zero(tall_bsc_ctx, struct mncc_sock_state);
+	state = mncc_sock_state_alloc(net);
 	if (!state)
 		return -ENOMEM;
 
-	state->net = net;
-	state->conn_bfd.fd = -1;
-
 	bfd = &state->listen_bfd;
 
 	rc = osmo_unixsock_listen(bfd, SOCK_SEQPACKET, "/tmp/bsc_mncc");
@@ -318,6 +587,47 @@ int mncc_sock_init(struct gsm_network *net)
 	return 0;
 }
 
+/* use an already connected socket instead of listening for one */
+int mncc_sock_attach(struct gsm_network *net, int fd)
+{
+	struct mncc_sock_state *state = net->mncc_state;
+
+	if (!state) {
+		state = mncc_sock_state_alloc(net);
+		if (!state)
+			return -ENOMEM;
+		net->mncc_state = state;
+	}
+
+	if (state->conn_bfd.fd >= 0)
+		return -EBUSY;
+
+	return mncc_sock_connected(state, fd);
+}
+
+void mncc_sock_stats(struct gsm_network *net, struct vty *vty)
+{
+	struct mncc_sock_state *state = net->mncc_state;
+
+	if (!state)
+		return;
+
+	vty_out(vty, "MNCC Socket             : %lu received, %lu sent, "
+		"%lu voice frames dropped%s",
+		osmo_counter_get(net->stats.mncc.rx),
+		osmo_counter_get(net->stats.mncc.tx),
+		osmo_counter_get(net->stats.mncc.voice_dropped), VTY_NEWLINE);
+	vty_out(vty, "MNCC Socket Calls       : %lu recv, %lu send%s",
+		osmo_counter_get(net->stats.mncc.rx_calls),
+		osmo_counter_get(net->stats.mncc.tx_calls), VTY_NEWLINE);
+	vty_out(vty, "MNCC Socket Queue       : %u queued, %u max, limit %u%s",
+		state->queue_len, state->queue_max,
+		net->mncc_sock.queue_limit, VTY_NEWLINE);
+	vty_out(vty, "MNCC Socket Latency     : %llu us average, %lu us max%s",
+		state->latency_num ? state->latency_sum / state->latency_num : 0,
+		state->latency_max, VTY_NEWLINE);
+}
+
 /* FIXME: move this to libosmocore */
 int osmo_unixsock_listen(struct osmo_fd *bfd, int type, const char *path)
 {
@@ -45,6 +45,7 @@
 #include <openbsc/gsm_04_80.h>
 #include <openbsc/chan_alloc.h>
 #include <openbsc/sms_queue.h>
+#include <openbsc/mncc.h>
 #include <openbsc/mncc_int.h>
 #include <openbsc/handover.h>
 
@@ -607,7 +608,7 @@ DEFUN(ena_subscr_handover,
 	}
 
 	/* now start the handover */
-	ret = bsc_handover_start(conn->lchan, bts);
+	ret = bsc_handover_start(conn->lchan, bts, -1);
 	if (ret != 0) {
 		vty_out(vty, "%% Handover failed with errno %d.%s",
 			ret, VTY_NEWLINE);
@@ -777,6 +778,24 @@ DEFUN(show_stats,
 		osmo_counter_get(net->stats.handover.timeout),
 		osmo_counter_get(net->stats.handover.completed),
 		osmo_counter_get(net->stats.handover.failed), VTY_NEWLINE);
+	vty_out(vty, "Handover Completed For  : %lu interference, %lu bad quality, "
+		"%lu low level, %lu distance, %lu power budget, %lu congestion%s",
+		osmo_counter_get(net->stats.handover.reason_completed[HO_REASON_INTERFERENCE]),
+		osmo_counter_get(net->stats.handover.reason_completed[HO_REASON_BAD_QUALITY]),
+		osmo_counter_get(net->stats.handover.reason_completed[HO_REASON_LOW_LEVEL]),
+		osmo_counter_get(net->stats.handover.reason_completed[HO_REASON_MAX_DISTANCE]),
+		osmo_counter_get(net->stats.handover.reason_completed[HO_REASON_POWER_BUDGET]),
+		osmo_counter_get(net->stats.handover.reason_completed[HO_REASON_CONGESTION]),
+		VTY_NEWLINE);
+	vty_out(vty, "Handover Failed For     : %lu interference, %lu bad quality, "
+		"%lu low level, %lu distance, %lu power budget, %lu congestion%s",
+		osmo_counter_get(net->stats.handover.reason_failed[HO_REASON_INTERFERENCE]),
+		osmo_counter_get(net->stats.handover.reason_failed[HO_REASON_BAD_QUALITY]),
+		osmo_counter_get(net->stats.handover.reason_failed[HO_REASON_LOW_LEVEL]),
+		osmo_counter_get(net->stats.handover.reason_failed[HO_REASON_MAX_DISTANCE]),
+		osmo_counter_get(net->stats.handover.reason_failed[HO_REASON_POWER_BUDGET]),
+		osmo_counter_get(net->stats.handover.reason_failed[HO_REASON_CONGESTION]),
+		VTY_NEWLINE);
 	vty_out(vty, "SMS MO                  : %lu submitted, %lu no receiver%s",
 		osmo_counter_get(net->stats.sms.submitted),
 		osmo_counter_get(net->stats.sms.no_receiver), VTY_NEWLINE);
@@ -790,6 +809,7 @@ DEFUN(show_stats,
 	vty_out(vty, "MT Calls                : %lu setup, %lu connect%s",
 		osmo_counter_get(net->stats.call.mt_setup),
 		osmo_counter_get(net->stats.call.mt_connect), VTY_NEWLINE);
+	mncc_sock_stats(net, vty);
 	return CMD_SUCCESS;
 }
 
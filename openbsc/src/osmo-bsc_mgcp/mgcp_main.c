@@ -27,6 +27,7 @@
 #include <string.h>
 #include <time.h>
 #include <limits.h>
+#include <signal.h>
 #include <unistd.h>
 
 #include <sys/socket.h>
@@ -35,6 +36,7 @@
 #include <openbsc/gsm_data.h>
 #include <openbsc/mgcp.h>
 #include <openbsc/mgcp_internal.h>
+#include <openbsc/mgcp_capture.h>
 #include <openbsc/vty.h>
 
 #include <osmocom/core/application.h>
@@ -61,6 +63,7 @@ static struct mgcp_config *cfg;
 static struct mgcp_trunk_config *reset_trunk;
 static int reset_endpoints = 0;
 static int daemonize = 0;
+static volatile sig_atomic_t quit = 0;
 
 const char *openbsc_copyright =
 	"Copyright (C) 2009-2010 Holger Freyther and On-Waves\r\n"
@@ -201,6 +204,12 @@ static struct vty_app_info vty_info = {
 	.is_config_node	= bsc_vty_is_config_node,
 };
 
+static void signal_handler(int signal)
+{
+	/* leave the main loop, the capture files need to be written */
+	quit = 1;
+}
+
 int main(int argc, char **argv)
 {
 	struct gsm_network dummy_network;
@@ -294,11 +303,14 @@ int main(int argc, char **argv)
 		}
 	}
 
+	signal(SIGINT, &signal_handler);
+	signal(SIGTERM, &signal_handler);
+
 	/* main loop */
-	while (1) {
+	while (!quit) {
 		osmo_select_main(0);
 	}
 
-
+	mgcp_capture_shutdown(cfg);
 	return 0;
 }
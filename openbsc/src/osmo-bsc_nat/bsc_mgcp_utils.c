@@ -59,7 +59,10 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
+#include <ctype.h>
 #include <errno.h>
+#include <string.h>
+#include <strings.h>
 #include <unistd.h>
 
 int bsc_mgcp_nr_multiplexes(int max_endpoints)
@@ -72,6 +75,33 @@ int bsc_mgcp_nr_multiplexes(int max_endpoints)
 	return div;
 }
 
+/* the timeslots of a multiplex that may carry audio */
+static uint32_t bsc_usable_timeslots(struct bsc_connection *bsc, int multiplex)
+{
+	/* timeslot 0 and 0x1f are never assigned */
+	uint32_t mask = 0x7ffffffe;
+	int left = bsc->max_endpoints - 32 * multiplex;
+
+	if (left <= 0)
+		return 0;
+	if (left < 32)
+		mask &= (1u << left) - 1;
+	return mask;
+}
+
+int bsc_mgcp_endpoint_in_use(struct bsc_connection *bsc, int endpoint)
+{
+	int multiplex, timeslot;
+
+	if (!bsc->_endpoint_status)
+		return 0;
+
+	mgcp_endpoint_to_timeslot(endpoint, &multiplex, &timeslot);
+	if (multiplex >= bsc->number_multiplexes)
+		return 0;
+	return (bsc->_endpoint_status[multiplex] >> timeslot) & 1;
+}
+
 static int bsc_init_endps_if_needed(struct bsc_connection *con)
 {
 	int multiplexes;
@@ -87,59 +117,64 @@ static int bsc_init_endps_if_needed(struct bsc_connection *con)
 	multiplexes = bsc_mgcp_nr_multiplexes(con->cfg->max_endpoints);
 	con->number_multiplexes = multiplexes;
 	con->max_endpoints = con->cfg->max_endpoints;
-	con->_endpoint_status = talloc_zero_array(con, char, 32 * multiplexes + 1);
+	con->_endpoint_status = talloc_zero_array(con, uint32_t, multiplexes + 1);
 	return con->_endpoint_status == NULL;
 }
 
+/*
+ * Hand out the next free endpoint after the last one. The first free
+ * timeslot of a multiplex is found with ffs, so only the multiplexes
+ * need to be walked.
+ */
 static int bsc_assign_endpoint(struct bsc_connection *bsc, struct sccp_connections *con)
 {
 	int multiplex;
 	int timeslot;
-	const int number_endpoints = bsc->max_endpoints;
+	int endpoint;
+	uint32_t free_ts;
 	int i;
 
-	mgcp_endpoint_to_timeslot(bsc->last_endpoint, &multiplex, &timeslot);
-	timeslot += 1;
-
-	for (i = 0; i < number_endpoints; ++i) {
-		int endpoint;
-
-		/* Wrap around timeslots */
-		if (timeslot == 0)
-			timeslot = 1;
-
-		if (timeslot == 0x1f) {
-			timeslot = 1;
-			multiplex += 1;
-		}
+	if (bsc->number_multiplexes <= 0)
+		return -1;
 
-		/* Wrap around the multiplex */
-		if (multiplex >= bsc->number_multiplexes)
-			multiplex = 0;
+	mgcp_endpoint_to_timeslot(bsc->last_endpoint, &multiplex, &timeslot);
+	if (multiplex >= bsc->number_multiplexes) {
+		multiplex = 0;
+		timeslot = 0;
+	}
 
-		endpoint = mgcp_timeslot_to_endpoint(multiplex, timeslot);
+	/* the start multiplex is visited again for the timeslots before the last */
+	for (i = 0; i <= bsc->number_multiplexes; ++i) {
+		free_ts = bsc_usable_timeslots(bsc, multiplex)
+				& ~bsc->_endpoint_status[multiplex];
+		if (i == 0)
+			free_ts &= timeslot >= 31 ? 0 : ~0u << (timeslot + 1);
 
-		/* Now check if we are allowed to assign this one */
-		if (endpoint >= bsc->max_endpoints) {
-			multiplex = 0;
-			timeslot = 1;
+		if (free_ts) {
+			timeslot = ffs(free_ts) - 1;
 			endpoint = mgcp_timeslot_to_endpoint(multiplex, timeslot);
-		}
-
-
-		if (bsc->_endpoint_status[endpoint] == 0) {
-			bsc->_endpoint_status[endpoint] = 1;
+			bsc->_endpoint_status[multiplex] |= 1u << timeslot;
 			con->bsc_endp = endpoint;
 			bsc->last_endpoint = endpoint;
 			return 0;
 		}
 
-		timeslot += 1;
+		multiplex = (multiplex + 1) % bsc->number_multiplexes;
 	}
 
 	return -1;
 }
 
+static void bsc_release_endpoint(struct bsc_connection *bsc, int endpoint)
+{
+	int multiplex, timeslot;
+
+	mgcp_endpoint_to_timeslot(endpoint, &multiplex, &timeslot);
+	if (multiplex >= bsc->number_multiplexes)
+		return;
+	bsc->_endpoint_status[multiplex] &= ~(1u << timeslot);
+}
+
 static uint16_t create_cic(int endpoint)
 {
 	int timeslot, multiplex;
@@ -187,19 +222,18 @@ int bsc_mgcp_assign_patch(struct sccp_connections *con, struct msgb *msg)
 		return -1;
 	}
 
-	/* find stale connections using that endpoint */
-	llist_for_each_entry(mcon, &con->bsc->nat->sccp_connections, list_entry) {
-		if (mcon->msc_endp == endp) {
-			LOGP(DNAT, LOGL_ERROR,
-			     "Endpoint %d was assigned to 0x%x and now 0x%x\n",
-			     endp,
-			     sccp_src_ref_to_int(&mcon->patched_ref),
-			     sccp_src_ref_to_int(&con->patched_ref));
-			bsc_mgcp_dlcx(mcon);
-		}
+	/* find a stale connection using that endpoint */
+	mcon = con->bsc->nat->bsc_endpoints[endp].con;
+	if (mcon) {
+		LOGP(DNAT, LOGL_ERROR,
+		     "Endpoint %d was assigned to 0x%x and now 0x%x\n",
+		     endp,
+		     sccp_src_ref_to_int(&mcon->patched_ref),
+		     sccp_src_ref_to_int(&con->patched_ref));
+		bsc_mgcp_dlcx(mcon);
 	}
 
-	con->msc_endp = endp;
+	bsc_mgcp_set_msc_endp(con, endp);
 	if (bsc_init_endps_if_needed(con->bsc) != 0)
 		return -1;
 	if (bsc_assign_endpoint(con->bsc, con) != 0)
@@ -216,6 +250,15 @@ int bsc_mgcp_assign_patch(struct sccp_connections *con, struct msgb *msg)
 	return 0;
 }
 
+static void bsc_endp_set_bsc(struct bsc_endpoint *bsc_endp, struct bsc_connection *bsc)
+{
+	if (bsc_endp->bsc)
+		llist_del(&bsc_endp->bsc_entry);
+	bsc_endp->bsc = bsc;
+	if (bsc)
+		llist_add_tail(&bsc_endp->bsc_entry, &bsc->mgcp_endpoints);
+}
+
 static void bsc_mgcp_free_endpoint(struct bsc_nat *nat, int i)
 {
 	if (nat->bsc_endpoints[i].transaction_id) {
@@ -224,7 +267,7 @@ static void bsc_mgcp_free_endpoint(struct bsc_nat *nat, int i)
 	}
 
 	nat->bsc_endpoints[i].transaction_state = 0;
-	nat->bsc_endpoints[i].bsc = NULL;
+	bsc_endp_set_bsc(&nat->bsc_endpoints[i], NULL);
 }
 
 void bsc_mgcp_free_endpoints(struct bsc_nat *nat)
@@ -286,30 +329,39 @@ void bsc_mgcp_dlcx(struct sccp_connections *con)
 {
 	/* send a DLCX down the stream */
 	if (con->bsc_endp != -1 && con->bsc->_endpoint_status) {
-		if (con->bsc->_endpoint_status[con->bsc_endp] != 1)
+		if (!bsc_mgcp_endpoint_in_use(con->bsc, con->bsc_endp))
 			LOGP(DNAT, LOGL_ERROR, "Endpoint 0x%x was not in use\n", con->bsc_endp);
-		con->bsc->_endpoint_status[con->bsc_endp] = 0;
+		bsc_release_endpoint(con->bsc, con->bsc_endp);
 		bsc_mgcp_send_dlcx(con->bsc, con->bsc_endp);
 		bsc_mgcp_free_endpoint(con->bsc->nat, con->msc_endp);
 	}
 
+	bsc_mgcp_set_msc_endp(con, -1);
 	bsc_mgcp_init(con);
 }
 
+/* remember the MSC endpoint of the connection for bsc_mgcp_find_con */
+void bsc_mgcp_set_msc_endp(struct sccp_connections *con, int endpoint)
+{
+	struct bsc_endpoint *endps;
+
+	if (con->msc_endp > 0) {
+		endps = con->bsc->nat->bsc_endpoints;
+		if (endps[con->msc_endp].con == con)
+			endps[con->msc_endp].con = NULL;
+	}
+
+	con->msc_endp = endpoint;
+	if (endpoint > 0)
+		con->bsc->nat->bsc_endpoints[endpoint].con = con;
+}
 
 struct sccp_connections *bsc_mgcp_find_con(struct bsc_nat *nat, int endpoint)
 {
 	struct sccp_connections *con = NULL;
-	struct sccp_connections *sccp;
-
-	llist_for_each_entry(sccp, &nat->sccp_connections, list_entry) {
-		if (sccp->msc_endp == -1)
-			continue;
-		if (sccp->msc_endp != endpoint)
-			continue;
 
-		con = sccp;
-	}
+	if (endpoint > 0 && endpoint < nat->mgcp_cfg->trunk.number_endpoints)
+		con = nat->bsc_endpoints[endpoint].con;
 
 	if (con)
 		return con;
@@ -337,7 +389,7 @@ static int bsc_mgcp_policy_cb(struct mgcp_trunk_config *tcfg, int endpoint, int
 		bsc_endp->transaction_id = NULL;
 		bsc_endp->transaction_state = 0;
 	}
-	bsc_endp->bsc = NULL;
+	bsc_endp_set_bsc(bsc_endp, NULL);
 
 	sccp = bsc_mgcp_find_con(nat, endpoint);
 
@@ -372,7 +424,7 @@ static int bsc_mgcp_policy_cb(struct mgcp_trunk_config *tcfg, int endpoint, int
 
 	bsc_endp->transaction_id = talloc_strdup(nat, transaction_id);
 	bsc_endp->transaction_state = state;
-	bsc_endp->bsc = sccp->bsc;
+	bsc_endp_set_bsc(bsc_endp, sccp->bsc);
 
 	/* we need to update some bits */
 	if (state == MGCP_ENDP_CRCX) {
@@ -436,18 +488,21 @@ static void free_chan_downstream(struct mgcp_endpoint *endp, struct bsc_endpoint
  * this transaction and if it belongs to the BSC. Then we will
  * need to patch the content to point to the local network and we
  * need to update the I: that was assigned by the BSS.
+ *
+ * The msg is rewritten in place and queued, it is always consumed.
  */
 void bsc_mgcp_forward(struct bsc_connection *bsc, struct msgb *msg)
 {
-	struct msgb *output;
 	struct bsc_endpoint *bsc_endp = NULL;
+	struct bsc_endpoint *tmp;
 	struct mgcp_endpoint *endp = NULL;
-	int i, code;
+	int code, len;
 	char transaction_id[60];
 
 	/* Some assumption that our buffer is big enough.. and null terminate */
 	if (msgb_l2len(msg) > 2000) {
 		LOGP(DMGCP, LOGL_ERROR, "MGCP message too long.\n");
+		msgb_free(msg);
 		return;
 	}
 
@@ -455,32 +510,33 @@ void bsc_mgcp_forward(struct bsc_connection *bsc, struct msgb *msg)
 
 	if (bsc_mgcp_parse_response((const char *) msg->l2h, &code, transaction_id) != 0) {
 		LOGP(DMGCP, LOGL_ERROR, "Failed to parse response code.\n");
+		msgb_free(msg);
 		return;
 	}
 
-	for (i = 1; i < bsc->nat->mgcp_cfg->trunk.number_endpoints; ++i) {
-		if (bsc->nat->bsc_endpoints[i].bsc != bsc)
-			continue;
+	llist_for_each_entry(tmp, &bsc->mgcp_endpoints, bsc_entry) {
 		/* no one listening? a bug? */
-		if (!bsc->nat->bsc_endpoints[i].transaction_id)
+		if (!tmp->transaction_id)
 			continue;
-		if (strcmp(transaction_id, bsc->nat->bsc_endpoints[i].transaction_id) != 0)
+		if (strcmp(transaction_id, tmp->transaction_id) != 0)
 			continue;
 
-		endp = &bsc->nat->mgcp_cfg->trunk.endpoints[i];
-		bsc_endp = &bsc->nat->bsc_endpoints[i];
+		endp = &bsc->nat->mgcp_cfg->trunk.endpoints[tmp - bsc->nat->bsc_endpoints];
+		bsc_endp = tmp;
 		break;
 	}
 
 	if (!bsc_endp) {
 		LOGP(DMGCP, LOGL_ERROR, "Could not find active endpoint: %s for msg: '%s'\n",
 		     transaction_id, (const char *) msg->l2h);
+		msgb_free(msg);
 		return;
 	}
 
 	endp->ci = bsc_mgcp_extract_ci((const char *) msg->l2h);
 	if (endp->ci == CI_UNUSED) {
 		free_chan_downstream(endp, bsc_endp, bsc);
+		msgb_free(msg);
 		return;
 	}
 
@@ -493,18 +549,28 @@ void bsc_mgcp_forward(struct bsc_connection *bsc, struct msgb *msg)
 	 * rewrite the information. In case the endpoint was deleted
 	 * there should be nothing for us to rewrite so putting endp->rtp_port
 	 * with the value of 0 should be no problem.
+	 *
+	 * It is rewritten in the msgb and queued without a copy.
 	 */
-	output = bsc_mgcp_rewrite((char * ) msg->l2h, msgb_l2len(msg), -1,
-				  bsc->nat->mgcp_cfg->source_addr, endp->net_end.local_port);
-
-	if (!output) {
+	len = bsc_mgcp_rewrite_buf((const char *) msg->l2h, msgb_l2len(msg),
+				   (char *) msg->l2h,
+				   msgb_l2len(msg) + msgb_tailroom(msg), -1,
+				   bsc->nat->mgcp_cfg->source_addr,
+				   endp->net_end.local_port);
+	if (len < 0) {
 		LOGP(DMGCP, LOGL_ERROR, "Failed to rewrite MGCP msg.\n");
+		msgb_free(msg);
 		return;
 	}
 
-	if (osmo_wqueue_enqueue(&bsc->nat->mgcp_cfg->gw_fd, output) != 0) {
+	/* only the MGCP is sent to the call agent */
+	msgb_pull(msg, msg->l2h - msg->data);
+	msg->tail = msg->data + len;
+	msg->len = len;
+
+	if (osmo_wqueue_enqueue(&bsc->nat->mgcp_cfg->gw_fd, msg) != 0) {
 		LOGP(DMGCP, LOGL_ERROR, "Failed to queue MGCP msg.\n");
-		msgb_free(output);
+		msgb_free(msg);
 	}
 }
 
@@ -531,31 +597,124 @@ uint32_t bsc_mgcp_extract_ci(const char *str)
 	return ci;
 }
 
+/*
+ * The rewriting walks the lines of the input once and does not modify
+ * it. The output is bounded and may be the input buffer itself, then
+ * the input is moved to the end of the buffer first so a line can grow
+ * into the free room before the unread input.
+ */
+struct rewrite_out {
+	char *buf;
+	int len;
+	/* writing beyond this would overwrite unread input or the end */
+	int limit;
+};
+
+static int out_put(struct rewrite_out *out, const char *data, int len)
+{
+	if (out->len + len > out->limit)
+		return -1;
+	memmove(out->buf + out->len, data, len);
+	out->len += len;
+	return 0;
+}
+
+static int out_str(struct rewrite_out *out, const char *str)
+{
+	return out_put(out, str, strlen(str));
+}
+
+static int out_num(struct rewrite_out *out, unsigned int num, int neg, int base)
+{
+	static const char digits[] = "0123456789abcdef";
+	char buf[12];
+	int pos = sizeof(buf);
+
+	do {
+		buf[--pos] = digits[num % base];
+		num /= base;
+	} while (num != 0);
+
+	if (neg)
+		buf[--pos] = '-';
+
+	return out_put(out, &buf[pos], sizeof(buf) - pos);
+}
+
+static int out_int(struct rewrite_out *out, int value)
+{
+	if (value < 0)
+		return out_num(out, -(unsigned int) value, 1, 10);
+	return out_num(out, value, 0, 10);
+}
+
+static int out_eol(struct rewrite_out *out, int cr)
+{
+	return cr ? out_put(out, "\r\n", 2) : out_put(out, "\n", 1);
+}
+
+static const char *skip_space(const char *str, const char *end)
+{
+	while (str < end && isspace((unsigned char) *str))
+		++str;
+	return str;
+}
+
+/* a number like %d of scanf, NULL if there is none */
+static const char *parse_int(const char *str, const char *end, int *value)
+{
+	const char *digits;
+	int neg = 0;
+	int num = 0;
+
+	str = skip_space(str, end);
+	if (str < end && (*str == '-' || *str == '+'))
+		neg = *str++ == '-';
+
+	for (digits = str; str < end && isdigit((unsigned char) *str); ++str)
+		num = num * 10 + (*str - '0');
+
+	if (str == digits)
+		return NULL;
+
+	*value = neg ? -num : num;
+	return str;
+}
+
 /**
  * Create a new MGCPCommand based on the input and endpoint from a message
  */
-static void patch_mgcp(struct msgb *output, const char *op, const char *tok,
-		       int endp, int len, int cr)
+static int patch_mgcp(struct rewrite_out *out, const char *op,
+		      const char *line, const char *end, int endp, int cr)
 {
-	int slen;
-	int ret;
-	char buf[40];
-
-	buf[0] = buf[39] = '\0';
-	ret = sscanf(tok, "%*s %s", buf);
-	if (ret != 1) {
+	const char *tid, *tid_end;
+
+	/* the transaction id is the second word */
+	tid = line;
+	while (tid < end && !isspace((unsigned char) *tid))
+		++tid;
+	tid = skip_space(tid, end);
+	tid_end = tid;
+	while (tid_end < end && !isspace((unsigned char) *tid_end))
+		++tid_end;
+
+	if (tid == tid_end || tid_end - tid > 39) {
 		LOGP(DMGCP, LOGL_ERROR,
-			"Failed to find Endpoint in: %s\n", tok);
-		return;
+			"Failed to find Endpoint in: %.*s\n", (int) (end - line), line);
+		return 0;
 	}
 
-	slen = sprintf((char *) output->l3h, "%s %s %x@mgw MGCP 1.0%s",
-			op, buf, endp, cr ? "\r\n" : "\n");
-	output->l3h = msgb_put(output, slen);
+	/* the verb is as long as in the input, the id is not touched yet */
+	if (out_str(out, op) != 0 || out_put(out, " ", 1) != 0
+	    || out_put(out, tid, tid_end - tid) != 0 || out_put(out, " ", 1) != 0
+	    || out_num(out, endp, 0, 16) != 0 || out_str(out, "@mgw MGCP 1.0") != 0
+	    || out_eol(out, cr) != 0)
+		return -1;
+	return 0;
 }
 
-/* we need to replace some strings... */
-struct msgb *bsc_mgcp_rewrite(char *input, int length, int endpoint, const char *ip, int port)
+int bsc_mgcp_rewrite_buf(const char *input, int length, char *output, int size,
+			 int endpoint, const char *ip, int port)
 {
 	static const char crcx_str[] = "CRCX ";
 	static const char dlcx_str[] = "DLCX ";
@@ -565,89 +724,117 @@ struct msgb *bsc_mgcp_rewrite(char *input, int length, int endpoint, const char
 	static const char aud_str[] = "m=audio ";
 	static const char fmt_str[] = "a=fmtp:";
 
-	char buf[128];
-	char *running, *token;
-	struct msgb *output;
+	const char *line, *end, *nl, *input_end;
+	struct rewrite_out out = { .buf = output };
+	int in_place = output == input;
 
 	/* keep state to add the a=fmtp line */
 	int found_fmtp = 0;
 	int payload = -1;
 	int cr = 1;
 
-	if (length > 4096 - 256) {
-		LOGP(DMGCP, LOGL_ERROR, "Input is too long.\n");
-		return NULL;
-	}
-
-	output = msgb_alloc_headroom(4096, 128, "MGCP rewritten");
-	if (!output) {
-		LOGP(DMGCP, LOGL_ERROR, "Failed to allocate new MGCP msg.\n");
-		return NULL;
-	}
-
-	running = input;
-	output->l2h = output->data;
-	output->l3h = output->l2h;
-	for (token = strsep(&running, "\n"); running; token = strsep(&running, "\n")) {
-		int len = strlen(token);
-		cr = len > 0 && token[len - 1] == '\r';
-
-		if (strncmp(crcx_str, token, (sizeof crcx_str) - 1) == 0) {
-			patch_mgcp(output, "CRCX", token, endpoint, len, cr);
-		} else if (strncmp(dlcx_str, token, (sizeof dlcx_str) - 1) == 0) {
-			patch_mgcp(output, "DLCX", token, endpoint, len, cr);
-		} else if (strncmp(mdcx_str, token, (sizeof mdcx_str) - 1) == 0) {
-			patch_mgcp(output, "MDCX", token, endpoint, len, cr);
-		} else if (strncmp(ip_str, token, (sizeof ip_str) - 1) == 0) {
-			output->l3h = msgb_put(output, strlen(ip_str));
-			memcpy(output->l3h, ip_str, strlen(ip_str));
-			output->l3h = msgb_put(output, strlen(ip));
-			memcpy(output->l3h, ip, strlen(ip));
-
-			if (cr) {
-				output->l3h = msgb_put(output, 2);
-				output->l3h[0] = '\r';
-				output->l3h[1] = '\n';
-			} else {
-				output->l3h = msgb_put(output, 1);
-				output->l3h[0] = '\n';
-			}
-		} else if (strncmp(aud_str, token, (sizeof aud_str) - 1) == 0) {
-			if (sscanf(token, "m=audio %*d RTP/AVP %d", &payload) != 1) {
+	if (in_place && size > length) {
+		memmove(output + size - length, output, length);
+		input = output + size - length;
+	}
+	input_end = input + length;
+
+	/* a line without a newline at the end is not forwarded */
+	for (line = input; (nl = memchr(line, '\n', input_end - line)); line = nl + 1) {
+		int len = nl - line;
+
+		end = nl;
+		cr = len > 0 && end[-1] == '\r';
+		if (cr)
+			end -= 1;
+
+		out.limit = size;
+		if (in_place && nl + 1 - output < size)
+			out.limit = nl + 1 - output;
+
+#define LINE_IS(str) (len >= sizeof(str) - 1 && memcmp(line, str, sizeof(str) - 1) == 0)
+		if (LINE_IS(crcx_str)) {
+			if (patch_mgcp(&out, "CRCX", line, end, endpoint, cr) != 0)
+				goto too_long;
+		} else if (LINE_IS(dlcx_str)) {
+			if (patch_mgcp(&out, "DLCX", line, end, endpoint, cr) != 0)
+				goto too_long;
+		} else if (LINE_IS(mdcx_str)) {
+			if (patch_mgcp(&out, "MDCX", line, end, endpoint, cr) != 0)
+				goto too_long;
+		} else if (LINE_IS(ip_str)) {
+			if (out_str(&out, ip_str) != 0 || out_str(&out, ip) != 0
+			    || out_eol(&out, cr) != 0)
+				goto too_long;
+		} else if (LINE_IS(aud_str)) {
+			const char *pos;
+			int dummy;
+
+			pos = parse_int(line + sizeof(aud_str) - 1, end, &dummy);
+			if (pos)
+				pos = skip_space(pos, end);
+			if (!pos || end - pos < 7 || memcmp(pos, "RTP/AVP", 7) != 0
+			    || !parse_int(pos + 7, end, &payload)) {
 				LOGP(DMGCP, LOGL_ERROR, "Could not parsed audio line.\n");
-				msgb_free(output);
-				return NULL;
+				return -1;
 			}
 
-			snprintf(buf, sizeof(buf)-1, "m=audio %d RTP/AVP %d%s",
-				 port, payload, cr ? "\r\n" : "\n");
-			buf[sizeof(buf)-1] = '\0';
-
-			output->l3h = msgb_put(output, strlen(buf));
-			memcpy(output->l3h, buf, strlen(buf));
-		} else if (strncmp(fmt_str, token, (sizeof fmt_str) - 1) == 0) {
-			found_fmtp = 1;
-			goto copy;
+			if (out_str(&out, aud_str) != 0 || out_int(&out, port) != 0
+			    || out_str(&out, " RTP/AVP ") != 0
+			    || out_int(&out, payload) != 0 || out_eol(&out, cr) != 0)
+				goto too_long;
 		} else {
-copy:
-			output->l3h = msgb_put(output, len + 1);
-			memcpy(output->l3h, token, len);
-			output->l3h[len] = '\n';
+			if (LINE_IS(fmt_str))
+				found_fmtp = 1;
+			if (out_put(&out, line, len + 1) != 0)
+				goto too_long;
 		}
+#undef LINE_IS
 	}
 
-	/*
-	 * the above code made sure that we have 128 bytes lefts. So we can
-	 * safely append another line.
-	 */
+	/* everything was read, the rest of the buffer is free */
 	if (!found_fmtp && payload != -1) {
-		snprintf(buf, sizeof(buf) - 1, "a=fmtp:%d mode-set=2%s",
-			payload, cr ? "\r\n" : "\n");
-		buf[sizeof(buf) - 1] = '\0';
-		output->l3h = msgb_put(output, strlen(buf));
-		memcpy(output->l3h, buf, strlen(buf));
+		out.limit = size;
+		if (out_str(&out, fmt_str) != 0 || out_int(&out, payload) != 0
+		    || out_str(&out, " mode-set=2") != 0 || out_eol(&out, cr) != 0)
+			goto too_long;
 	}
 
+	return out.len;
+
+too_long:
+	LOGP(DMGCP, LOGL_ERROR, "Rewritten MGCP message does not fit.\n");
+	return -1;
+}
+
+/* we need to replace some strings... */
+struct msgb *bsc_mgcp_rewrite(const char *input, int length, int endpoint,
+			      const char *ip, int port)
+{
+	char buf[4096];
+	struct msgb *output;
+	int len;
+
+	if (length > sizeof(buf) - 256) {
+		LOGP(DMGCP, LOGL_ERROR, "Input is too long.\n");
+		return NULL;
+	}
+
+	len = bsc_mgcp_rewrite_buf(input, length, buf, sizeof(buf),
+				   endpoint, ip, port);
+	if (len < 0)
+		return NULL;
+
+	/* room for the IPA header in front and a NUL behind */
+	output = msgb_alloc_headroom(len + 129, 128, "MGCP rewritten");
+	if (!output) {
+		LOGP(DMGCP, LOGL_ERROR, "Failed to allocate new MGCP msg.\n");
+		return NULL;
+	}
+
+	output->l2h = msgb_put(output, len);
+	memcpy(output->l2h, buf, len);
+	output->l2h[len] = '\0';
 	return output;
 }
 
@@ -798,16 +985,14 @@ int bsc_mgcp_nat_init(struct bsc_nat *nat)
 void bsc_mgcp_clear_endpoints_for(struct bsc_connection *bsc)
 {
 	struct rate_ctr *ctr = NULL;
+	struct bsc_endpoint *bsc_endp, *tmp;
 	int i;
 
 	if (bsc->cfg)
 		ctr = &bsc->cfg->stats.ctrg->ctr[BCFG_CTR_DROPPED_CALLS];
 
-	for (i = 1; i < bsc->nat->mgcp_cfg->trunk.number_endpoints; ++i) {
-		struct bsc_endpoint *bsc_endp = &bsc->nat->bsc_endpoints[i];
-
-		if (bsc_endp->bsc != bsc)
-			continue;
+	llist_for_each_entry_safe(bsc_endp, tmp, &bsc->mgcp_endpoints, bsc_entry) {
+		i = bsc_endp - bsc->nat->bsc_endpoints;
 
 		if (ctr)
 			rate_ctr_inc(ctr);
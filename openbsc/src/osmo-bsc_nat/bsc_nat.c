@@ -41,6 +41,7 @@
 #include <openbsc/bsc_nat_sccp.h>
 #include <openbsc/ipaccess.h>
 #include <openbsc/abis_nm.h>
+#include <openbsc/mgcp_capture.h>
 #include <openbsc/socket.h>
 #include <openbsc/vty.h>
 
@@ -73,6 +74,7 @@ static struct osmo_fd bsc_listen;
 static const char *msc_ip = NULL;
 static struct osmo_timer_list sccp_close;
 static int daemonize = 0;
+static volatile sig_atomic_t quit = 0;
 
 const char *openbsc_copyright =
 	"Copyright (C) 2010 Holger Hans Peter Freyther and On-Waves\r\n"
@@ -619,17 +621,13 @@ static void update_con_authorize(struct sccp_connections *con,
 	    parsed->gsm_type == BSS_MAP_MSG_CIPHER_MODE_CMD) {
 		con->authorized = 1;
 	} else if (parsed->bssap == BSSAP_MSG_DTAP) {
-		uint8_t msg_type, proto;
 		uint32_t len;
-		struct gsm48_hdr *hdr48;
-		hdr48 = bsc_unpack_dtap(parsed, msg, &len);
-		if (!hdr48)
+
+		if (!bsc_unpack_dtap(parsed, msg, &len))
 			return;
 
-		proto = hdr48->proto_discr & 0x0f;
-		msg_type = hdr48->msg_type & 0xbf;
-		if (proto == GSM48_PDISC_MM &&
-		    msg_type == GSM48_MT_MM_CM_SERV_ACC)
+		if (parsed->dtap_proto == GSM48_PDISC_MM &&
+		    parsed->dtap_msg_type == GSM48_MT_MM_CM_SERV_ACC)
 			con->authorized = 1;
 	}
 }
@@ -638,12 +636,11 @@ static int forward_sccp_to_bts(struct bsc_msc_connection *msc_con, struct msgb *
 {
 	struct sccp_connections *con = NULL;
 	struct bsc_connection *bsc;
-	struct bsc_nat_parsed *parsed;
+	struct bsc_nat_parsed parsed_msg, *parsed = &parsed_msg;
 	int proto;
 
 	/* filter, drop, patch the message? */
-	parsed = bsc_nat_parse(msg);
-	if (!parsed) {
+	if (bsc_nat_parse_into(msg, parsed) != 0) {
 		LOGP(DNAT, LOGL_ERROR, "Can not parse msg from BSC.\n");
 		return -1;
 	}
@@ -710,7 +707,6 @@ static int forward_sccp_to_bts(struct bsc_msc_connection *msc_con, struct msgb *
 			LOGP(DNAT, LOGL_ERROR, "Unknown connection for msg type: 0x%x from the MSC.\n", parsed->sccp_type);
 	}
 
-	talloc_free(parsed);
 	if (!con)
 		return -1;
 	if (!con->bsc->authenticated) {
@@ -742,7 +738,6 @@ send_to_all:
 	}
 
 exit:
-	talloc_free(parsed);
 	return 0;
 }
 
@@ -866,7 +861,7 @@ void bsc_close_connection(struct bsc_connection *connection)
 		ctr = &connection->cfg->stats.ctrg->ctr[BCFG_CTR_DROPPED_SCCP];
 
 	/* remove all SCCP connections */
-	llist_for_each_entry_safe(sccp_patch, tmp, &nat->sccp_connections, list_entry) {
+	llist_for_each_entry_safe(sccp_patch, tmp, &connection->shard->sccp_connections, shard_entry) {
 		if (sccp_patch->bsc != connection)
 			continue;
 
@@ -893,6 +888,7 @@ void bsc_close_connection(struct bsc_connection *connection)
 	/* close endpoints allocated by this BSC */
 	bsc_mgcp_clear_endpoints_for(connection);
 
+	bsc_nat_worker_del(connection);
 	osmo_fd_unregister(&connection->write_queue.bfd);
 	close(connection->write_queue.bfd.fd);
 	osmo_wqueue_clear(&connection->write_queue);
@@ -908,7 +904,7 @@ static void bsc_maybe_close(struct bsc_connection *bsc)
 		return;
 
 	/* are there any connections left */
-	llist_for_each_entry(sccp, &bsc->nat->sccp_connections, list_entry)
+	llist_for_each_entry(sccp, &bsc->shard->sccp_connections, shard_entry)
 		if (sccp->bsc == bsc)
 			return;
 
@@ -982,12 +978,11 @@ static int forward_sccp_to_msc(struct bsc_connection *bsc, struct msgb *msg)
 	struct bsc_msc_connection *con_msc = NULL;
 	struct bsc_connection *con_bsc = NULL;
 	int con_type;
-	struct bsc_nat_parsed *parsed;
+	struct bsc_nat_parsed parsed_msg, *parsed = &parsed_msg;
 	struct bsc_nat_reject_cause cause;
 
 	/* Parse and filter messages */
-	parsed = bsc_nat_parse(msg);
-	if (!parsed) {
+	if (bsc_nat_parse_into(msg, parsed) != 0) {
 		LOGP(DNAT, LOGL_ERROR, "Can not parse msg from BSC.\n");
 		msgb_free(msg);
 		return -1;
@@ -1064,7 +1059,6 @@ static int forward_sccp_to_msc(struct bsc_connection *bsc, struct msgb *msg)
 					 * invalid.
 					 */
 					msg = bsc_nat_rewrite_msg(bsc->nat, msg, parsed, con->imsi);
-					talloc_free(parsed);
 					parsed = NULL;
 				} else if (con->con_local == NAT_CON_END_USSD) {
 					bsc_check_ussd(con, parsed, msg);
@@ -1097,8 +1091,9 @@ static int forward_sccp_to_msc(struct bsc_connection *bsc, struct msgb *msg)
 			break;
 		}
         } else if (parsed->ipa_proto == IPAC_PROTO_MGCP_OLD) {
+                /* the msg is rewritten in place and queued to the call agent */
                 bsc_mgcp_forward(bsc, msg);
-                goto exit2;
+                return -1;
 	} else {
 		LOGP(DNAT, LOGL_ERROR, "Not forwarding unknown stream id: 0x%x\n", parsed->ipa_proto);
 		goto exit2;
@@ -1124,8 +1119,6 @@ static int forward_sccp_to_msc(struct bsc_connection *bsc, struct msgb *msg)
 
 	/* send the non-filtered but maybe modified msg */
 	queue_for_msc(con_msc, msg);
-	if (parsed)
-		talloc_free(parsed);
 	return 0;
 
 exit:
@@ -1156,7 +1149,6 @@ exit:
 exit2:
 	if (imsi)
 		talloc_free(imsi);
-	talloc_free(parsed);
 	msgb_free(msg);
 	return -1;
 
@@ -1165,34 +1157,28 @@ exit3:
 	if (imsi)
 		talloc_free(imsi);
 	bsc_send_con_refuse(bsc, parsed, con_type, &cause);
-	talloc_free(parsed);
 	msgb_free(msg);
 	return -1;
 }
 
-static int ipaccess_bsc_read_cb(struct osmo_fd *bfd)
+static void bsc_recv_failed(struct bsc_connection *bsc, int ret)
 {
-	struct bsc_connection *bsc = bfd->data;
-	struct msgb *msg;
-	struct ipaccess_head *hh;
-	struct ipaccess_head_ext *hh_ext;
-	int ret;
-
-	ret = ipa_msg_recv(bfd->fd, &msg);
-	if (ret <= 0) {
-		if (ret == 0)
-			LOGP(DNAT, LOGL_ERROR,
-			     "The connection to the BSC Nr: %d was lost. Cleaning it\n",
-			     bsc->cfg ? bsc->cfg->nr : -1);
-		else
-			LOGP(DNAT, LOGL_ERROR,
-			     "Stream error on BSC Nr: %d. Failed to parse ip access message: %d\n",
-			     bsc->cfg ? bsc->cfg->nr : -1, ret);
+	if (ret == 0)
+		LOGP(DNAT, LOGL_ERROR,
+		     "The connection to the BSC Nr: %d was lost. Cleaning it\n",
+		     bsc->cfg ? bsc->cfg->nr : -1);
+	else
+		LOGP(DNAT, LOGL_ERROR,
+		     "Stream error on BSC Nr: %d. Failed to parse ip access message: %d\n",
+		     bsc->cfg ? bsc->cfg->nr : -1, ret);
 
-		bsc_close_connection(bsc);
-		return -1;
-	}
+	bsc_close_connection(bsc);
+}
 
+static void bsc_handle_msg(struct bsc_connection *bsc, struct msgb *msg)
+{
+	struct ipaccess_head *hh;
+	struct ipaccess_head_ext *hh_ext;
 
 	LOGP(DNAT, LOGL_DEBUG, "MSG from BSC: %s proto: %d\n", osmo_hexdump(msg->data, msg->len), msg->l2h[0]);
 
@@ -1204,11 +1190,11 @@ static int ipaccess_bsc_read_cb(struct osmo_fd *bfd)
 		if (msg->l2h[0] == IPAC_MSGT_PONG) {
 			osmo_timer_del(&bsc->pong_timeout);
 			msgb_free(msg);
-			return 0;
+			return;
 		} else if (msg->l2h[0] == IPAC_MSGT_PING) {
 			send_pong(bsc);
 			msgb_free(msg);
-			return 0;
+			return;
 		}
 	/* Message contains the ipaccess_head_ext header, investigate further */
 	} else if (hh->proto == IPAC_PROTO_OSMO &&
@@ -1218,14 +1204,30 @@ static int ipaccess_bsc_read_cb(struct osmo_fd *bfd)
 		/* l2h is where the actual command data is expected */
 		msg->l2h = hh_ext->data;
 
-		if (hh_ext->proto == IPAC_PROTO_EXT_CTRL)
-			return bsc_nat_handle_ctrlif_msg(bsc, msg);
+		if (hh_ext->proto == IPAC_PROTO_EXT_CTRL) {
+			bsc_nat_handle_ctrlif_msg(bsc, msg);
+			return;
+		}
 	}
 
 	/* FIXME: Currently no PONG is sent to the BSC */
 	/* FIXME: Currently no ID ACK is sent to the BSC */
 	forward_sccp_to_msc(bsc, msg);
+}
+
+static int ipaccess_bsc_read_cb(struct osmo_fd *bfd)
+{
+	struct bsc_connection *bsc = bfd->data;
+	struct msgb *msg;
+	int ret;
 
+	ret = ipa_msg_recv(bfd->fd, &msg);
+	if (ret <= 0) {
+		bsc_recv_failed(bsc, ret);
+		return -1;
+	}
+
+	bsc_handle_msg(bsc, msg);
 	return 0;
 }
 
@@ -1298,6 +1300,10 @@ static int ipaccess_listen_bsc_cb(struct osmo_fd *bfd, unsigned int what)
 		return -2;
 	}
 
+	/* a worker reads the BSC, the select loop only writes to it */
+	if (nat->workers && bsc_nat_worker_add(bsc) == 0)
+		bsc->write_queue.bfd.when &= ~BSC_FD_READ;
+
 	LOGP(DNAT, LOGL_NOTICE, "BSC connection on %d with IP: %s\n",
 		fd, inet_ntoa(sa.sin_addr));
 
@@ -1393,6 +1399,11 @@ static void signal_handler(int signal)
 	case SIGUSR1:
 		talloc_report_full(tall_bsc_ctx, stderr);
 		break;
+	case SIGINT:
+	case SIGTERM:
+		/* leave the main loop, the capture files need to be written */
+		quit = 1;
+		break;
 	default:
 		break;
 	}
@@ -1538,6 +1549,8 @@ int main(int argc, char **argv)
 
 	signal(SIGABRT, &signal_handler);
 	signal(SIGUSR1, &signal_handler);
+	signal(SIGINT, &signal_handler);
+	signal(SIGTERM, &signal_handler);
 	osmo_init_ignore_signals();
 
 	if (daemonize) {
@@ -1548,16 +1561,24 @@ int main(int argc, char **argv)
 		}
 	}
 
+	/* after the fork, the threads would not survive it */
+	if (bsc_nat_workers_start(nat, bsc_handle_msg, bsc_recv_failed) != 0) {
+		fprintf(stderr, "Failed to start the BSC workers.\n");
+		exit(1);
+	}
+
 	/* recycle timer */
 	sccp_set_log_area(DSCCP);
 	sccp_close.cb = sccp_close_unconfirmed;
 	sccp_close.data = NULL;
 	osmo_timer_schedule(&sccp_close, SCCP_CLOSE_TIME, 0);
 
-	while (1) {
+	while (!quit) {
 		osmo_select_main(0);
 	}
 
+	bsc_nat_workers_stop(nat);
+	mgcp_capture_shutdown(nat->mgcp_cfg);
 	return 0;
 }
 
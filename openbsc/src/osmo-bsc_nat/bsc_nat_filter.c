@@ -408,7 +408,6 @@ int bsc_nat_filter_dt(struct bsc_connection *bsc, struct msgb *msg,
 		struct bsc_nat_reject_cause *cause)
 {
 	uint32_t len;
-	uint8_t msg_type, proto;
 	struct gsm48_hdr *hdr48;
 
 	cause->cm_reject_cause = GSM48_REJECT_PLMN_NOT_ALLOWED;
@@ -425,9 +424,8 @@ int bsc_nat_filter_dt(struct bsc_connection *bsc, struct msgb *msg,
 	if (!hdr48)
 		return -1;
 
-	proto = hdr48->proto_discr & 0x0f;
-	msg_type = hdr48->msg_type & 0xbf;
-	if (proto != GSM48_PDISC_MM || msg_type != GSM48_MT_MM_ID_RESP)
+	if (parsed->dtap_proto != GSM48_PDISC_MM
+	    || parsed->dtap_msg_type != GSM48_MT_MM_ID_RESP)
 		return 0;
 
 	return _dt_check_id_resp(bsc, &hdr48->data[0],
@@ -494,7 +494,6 @@ struct msgb *bsc_nat_rewrite_msg(struct bsc_nat *nat, struct msgb *msg, struct b
 {
 	struct gsm48_hdr *hdr48;
 	uint32_t len;
-	uint8_t msg_type, proto;
 	struct msgb *new_msg = NULL, *sccp;
 	uint8_t link_id;
 
@@ -512,12 +511,12 @@ struct msgb *bsc_nat_rewrite_msg(struct bsc_nat *nat, struct msgb *msg, struct b
 		return msg;
 
 	link_id = msg->l3h[1];
-	proto = hdr48->proto_discr & 0x0f;
-	msg_type = hdr48->msg_type & 0xbf;
 
-	if (proto == GSM48_PDISC_CC && msg_type == GSM48_MT_CC_SETUP)
+	if (parsed->dtap_proto == GSM48_PDISC_CC
+	    && parsed->dtap_msg_type == GSM48_MT_CC_SETUP)
 		new_msg = rewrite_setup(nat, msg, parsed, imsi, hdr48, len);
-	else if (proto == GSM48_PDISC_SMS && msg_type == GSM411_MT_CP_DATA)
+	else if (parsed->dtap_proto == GSM48_PDISC_SMS
+		 && parsed->dtap_msg_type == GSM411_MT_CP_DATA)
 		new_msg = rewrite_sms(nat, msg, parsed, imsi, hdr48, len);
 
 	if (!new_msg)
@@ -535,8 +534,7 @@ struct msgb *bsc_nat_rewrite_msg(struct bsc_nat *nat, struct msgb *msg, struct b
 
 	ipaccess_prepend_header(sccp, IPAC_PROTO_SCCP);
 
-	/* the parsed hangs off from msg but it needs to survive */
-	talloc_steal(sccp, parsed);
+	/* the parsed points into msg and is invalid from now on */
 	msgb_free(msg);
 	return sccp;
 }
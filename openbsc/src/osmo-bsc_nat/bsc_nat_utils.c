@@ -101,6 +101,11 @@ struct bsc_nat *bsc_nat_alloc(void)
 	INIT_LLIST_HEAD(&nat->sms_clear_tp_srr);
 	INIT_LLIST_HEAD(&nat->sms_num_rewr);
 
+	if (bsc_nat_set_shards(nat, 1) != 0) {
+		talloc_free(nat);
+		return NULL;
+	}
+
 	nat->stats.sccp.conn = osmo_counter_alloc("nat.sccp.conn");
 	nat->stats.sccp.calls = osmo_counter_alloc("nat.sccp.calls");
 	nat->stats.bsc.reconn = osmo_counter_alloc("nat.bsc.conn");
@@ -130,11 +135,41 @@ struct bsc_connection *bsc_connection_alloc(struct bsc_nat *nat)
 		return NULL;
 
 	con->nat = nat;
+	con->shard = &nat->shards[nat->next_shard];
+	nat->next_shard = (nat->next_shard + 1) % nat->num_shards;
 	osmo_wqueue_init(&con->write_queue, 100);
 	INIT_LLIST_HEAD(&con->cmd_pending);
+	INIT_LLIST_HEAD(&con->mgcp_endpoints);
 	return con;
 }
 
+/* the shards can only change while no BSC is connected */
+int bsc_nat_set_shards(struct bsc_nat *nat, int num_shards)
+{
+	struct bsc_nat_shard *shards;
+	int i;
+
+	if (!llist_empty(&nat->bsc_connections))
+		return -1;
+
+	shards = talloc_zero_array(nat, struct bsc_nat_shard, num_shards);
+	if (!shards)
+		return -1;
+
+	for (i = 0; i < num_shards; ++i) {
+		shards[i].nr = i;
+		INIT_LLIST_HEAD(&shards[i].sccp_connections);
+		/* the first reference is the old fixed start of 0x50000 */
+		shards[i].last_ref = 0x50000 - 0x50000 % num_shards + i - num_shards;
+	}
+
+	talloc_free(nat->shards);
+	nat->shards = shards;
+	nat->num_shards = num_shards;
+	nat->next_shard = 0;
+	return 0;
+}
+
 struct bsc_config *bsc_config_alloc(struct bsc_nat *nat, const char *token)
 {
 	struct bsc_config *conf = talloc_zero(nat, struct bsc_config);
@@ -277,6 +312,7 @@ void sccp_connection_destroy(struct sccp_connections *conn)
 	     sccp_src_ref_to_int(&conn->patched_ref), conn->bsc);
 	bsc_mgcp_dlcx(conn);
 	llist_del(&conn->list_entry);
+	llist_del(&conn->shard_entry);
 	talloc_free(conn);
 }
 
@@ -374,25 +410,49 @@ int bsc_nat_lst_check_allow(struct bsc_nat_acc_lst *lst, const char *mi_string)
 	return 1;
 }
 
+/*
+ * The filters, the rewriting and the USSD check all look at the DTAP,
+ * it is only checked the first time and remembered in the parsed msg
+ * together with the protocol, transaction id and message type.
+ */
 struct gsm48_hdr *bsc_unpack_dtap(struct bsc_nat_parsed *parsed,
 				  struct msgb *msg, uint32_t *len)
 {
+	if (parsed->dtap_unpacked)
+		goto out;
+
+	parsed->dtap_unpacked = 1;
+	parsed->dtap_hdr = NULL;
+
 	/* gsm_type is actually the size of the dtap */
-	*len = parsed->gsm_type;
-	if (*len < msgb_l3len(msg) - 3) {
+	parsed->dtap_len = parsed->gsm_type;
+	if (parsed->dtap_len < msgb_l3len(msg) - 3) {
 		LOGP(DNAT, LOGL_ERROR, "Not enough space for DTAP.\n");
-		return NULL;
+		goto out;
 	}
 
 	if (msgb_l3len(msg) - 3 < msg->l3h[2]) {
 		LOGP(DNAT, LOGL_ERROR,
 		     "GSM48 payload does not fit: %d %d\n",
 		     msg->l3h[2], msgb_l3len(msg) - 3);
-		return NULL;
+		goto out;
 	}
 
-	msg->l4h = &msg->l3h[3];
-	return (struct gsm48_hdr *) msg->l4h;
+	if (parsed->dtap_len < sizeof(struct gsm48_hdr)) {
+		LOGP(DNAT, LOGL_ERROR, "DTAP without a GSM48 header.\n");
+		goto out;
+	}
+
+	parsed->dtap_hdr = (struct gsm48_hdr *) &msg->l3h[3];
+	parsed->dtap_proto = parsed->dtap_hdr->proto_discr & 0x0f;
+	parsed->dtap_ti = (parsed->dtap_hdr->proto_discr & 0x70) >> 4;
+	parsed->dtap_msg_type = parsed->dtap_hdr->msg_type & 0xbf;
+
+out:
+	*len = parsed->dtap_len;
+	if (parsed->dtap_hdr)
+		msg->l4h = (uint8_t *) parsed->dtap_hdr;
+	return parsed->dtap_hdr;
 }
 
 static const char *con_types [] = {
@@ -110,6 +110,10 @@ static int config_write_nat(struct vty *vty)
 	if (_nat->token)
 		vty_out(vty, " token %s%s", _nat->token, VTY_NEWLINE);
 	vty_out(vty, " ip-dscp %d%s", _nat->bsc_ip_dscp, VTY_NEWLINE);
+	if (_nat->num_shards != 1)
+		vty_out(vty, " shards %d%s", _nat->num_shards, VTY_NEWLINE);
+	if (_nat->num_workers != 0)
+		vty_out(vty, " workers %d%s", _nat->num_workers, VTY_NEWLINE);
 	if (_nat->acc_lst_name)
 		vty_out(vty, " access-list-name %s%s", _nat->acc_lst_name, VTY_NEWLINE);
 	if (_nat->imsi_black_list_fn)
@@ -237,7 +241,7 @@ DEFUN(show_bsc_mgcp, show_bsc_mgcp_cmd, "show bsc mgcp NR",
 			for (j = 0; j < 32; ++j) {
 				endp = mgcp_timeslot_to_endpoint(i, j);
 				vty_out(vty, " Endpoint 0x%x %s%s", endp,
-					con->_endpoint_status[endp] == 0 
+					!bsc_mgcp_endpoint_in_use(con, endp)
 						? "free" : "allocated",
 				VTY_NEWLINE);
 			}
@@ -465,6 +469,31 @@ ALIAS_DEPRECATED(cfg_nat_bsc_ip_dscp, cfg_nat_bsc_ip_tos_cmd,
       "ip-tos <0-255>",
       "Use ip-dscp in the future.\n" "Set the DSCP\n")
 
+DEFUN(cfg_nat_shards, cfg_nat_shards_cmd,
+      "shards <1-64>",
+      "Spread the BSC connections and SCCP references over shards\n"
+      "Number of shards\n")
+{
+	if (bsc_nat_set_shards(_nat, atoi(argv[0])) != 0) {
+		vty_out(vty, "The shards can only be changed without BSCs.%s",
+			VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_nat_workers, cfg_nat_workers_cmd,
+      "workers <0-64>",
+      "Receive from the BSCs in threads, a new BSC goes to the least busy\n"
+      "Number of threads, 0 reads them in the main loop. Used at start\n")
+{
+	_nat->num_workers = atoi(argv[0]);
+	if (_nat->workers)
+		vty_out(vty, "The workers are used after a restart.%s",
+			VTY_NEWLINE);
+	return CMD_SUCCESS;
+}
+
 
 DEFUN(cfg_nat_acc_lst_name,
       cfg_nat_acc_lst_name_cmd,
@@ -1078,6 +1107,8 @@ int bsc_nat_vty_init(struct bsc_nat *nat)
 	install_element(NAT_NODE, &cfg_nat_token_cmd);
 	install_element(NAT_NODE, &cfg_nat_bsc_ip_dscp_cmd);
 	install_element(NAT_NODE, &cfg_nat_bsc_ip_tos_cmd);
+	install_element(NAT_NODE, &cfg_nat_shards_cmd);
+	install_element(NAT_NODE, &cfg_nat_workers_cmd);
 	install_element(NAT_NODE, &cfg_nat_acc_lst_name_cmd);
 	install_element(NAT_NODE, &cfg_nat_no_acc_lst_name_cmd);
 	install_element(NAT_NODE, &cfg_nat_imsi_black_list_fn_cmd);
@@ -0,0 +1,607 @@
+/* Worker threads reading the BSC connections of the NAT */
+
+/*
+ * (C) 2026 by the OpenBSC contributors
+ * All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * A new BSC connection goes to the worker thread serving the fewest, the
+ * shards of the SCCP references do not matter for it. The worker
+ * receives what is there without blocking, cuts it into IPA frames and
+ * queues them to the owner of the MSC link, the thread of the select
+ * loop. Only the receiving and framing run in the workers: the parsing,
+ * filtering, patching and forwarding stay with the owner as they use the
+ * SCCP connections, timers, counters and the logging of libosmocore, and
+ * the parser and the IPA filter log as well.
+ *
+ * The workers must not use talloc or the logging, the frames are
+ * allocated with malloc and the owner copies them into a msgb. A lost
+ * connection is queued like a frame. When the owner closes a BSC it is
+ * taken from its worker and its queued frames are dropped, the worker
+ * holds its lock while it reads so the fd and the BSC are not touched
+ * after that.
+ *
+ * The workers block SIGINT, SIGTERM and SIGUSR1, their handlers only
+ * work in the thread of the select loop.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include <openbsc/debug.h>
+#include <openbsc/bsc_nat.h>
+
+#include <osmocom/core/talloc.h>
+#include <osmocom/gsm/protocol/ipaccess.h>
+
+/* ipa_msg_recv() allocates this much, a longer frame is an error */
+#define WORKER_MSG_SIZE		1200
+#define WORKER_RECV_SIZE	(16 * 1024)
+/* frames handled before the select loop gets to the other fds */
+#define WORKER_DISPATCH_MAX	256
+
+/* a frame from a BSC, a length of 0 or less is the error of recv */
+struct worker_frame {
+	struct llist_head entry;
+	struct bsc_connection *bsc;
+	int len;
+	uint8_t data[0];
+};
+
+/* a BSC connection read by the worker */
+struct worker_conn {
+	struct llist_head entry;
+	struct bsc_connection *bsc;
+	int fd;
+
+	/* the frame being received */
+	uint8_t hdr[sizeof(struct ipaccess_head)];
+	int hdr_len;
+	struct worker_frame *frame;
+	int frame_len;
+};
+
+struct bsc_nat_worker {
+	struct bsc_nat_workers *workers;
+	pthread_t thread;
+	int started;
+
+	/* guards the connections, held while reading them */
+	pthread_mutex_t lock;
+	struct llist_head conns;
+	int num_conns;
+	int stop;
+
+	/* wakes the worker when the connections change */
+	int wake[2];
+
+	/* only used by the thread of the worker */
+	struct pollfd *pfds;
+	int num_pfds;
+	uint8_t buf[WORKER_RECV_SIZE];
+};
+
+struct bsc_nat_workers {
+	struct bsc_nat_worker *workers;
+	int num_workers;
+
+	/* the frames for the owner of the MSC link */
+	pthread_mutex_t lock;
+	struct llist_head queue;
+	struct osmo_fd notify;
+	int notify_wr;
+	int registered;
+
+	bsc_nat_worker_msg_cb msg_cb;
+	bsc_nat_worker_error_cb error_cb;
+};
+
+static int make_pipe(int fds[2])
+{
+	if (pipe(fds) != 0)
+		return -1;
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+	return 0;
+}
+
+static void drain_pipe(int fd)
+{
+	char buf[64];
+
+	while (read(fd, buf, sizeof(buf)) > 0)
+		;
+}
+
+static void wake_up(int fd)
+{
+	char c = 0;
+
+	/* a full pipe wakes the reader just as well */
+	while (write(fd, &c, 1) < 0 && errno == EINTR)
+		;
+}
+
+/* called with the lock of the worker held */
+static void queue_frame(struct bsc_nat_workers *ws, struct worker_frame *frame)
+{
+	int was_empty;
+
+	pthread_mutex_lock(&ws->lock);
+	was_empty = llist_empty(&ws->queue);
+	llist_add_tail(&frame->entry, &ws->queue);
+	pthread_mutex_unlock(&ws->lock);
+
+	if (was_empty)
+		wake_up(ws->notify_wr);
+}
+
+/* the connection is done, the owner gets the error and closes it */
+static void queue_error(struct bsc_nat_worker *w, struct worker_conn *conn,
+			int error)
+{
+	struct worker_frame *frame = conn->frame;
+
+	if (!frame)
+		frame = malloc(sizeof(*frame));
+	conn->frame = NULL;
+	llist_del(&conn->entry);
+	w->num_conns -= 1;
+
+	/* without memory the owner notices with the ping timeout */
+	if (frame) {
+		frame->bsc = conn->bsc;
+		frame->len = error;
+		queue_frame(w->workers, frame);
+	}
+	free(conn);
+}
+
+/* cut the received data into frames, an error if the stream is broken */
+static int put_data(struct bsc_nat_worker *w, struct worker_conn *conn,
+		    const uint8_t *data, int len)
+{
+	struct ipaccess_head *hh;
+	int need;
+
+	while (len > 0) {
+		if (conn->hdr_len < sizeof(conn->hdr)) {
+			need = sizeof(conn->hdr) - conn->hdr_len;
+			if (need > len)
+				need = len;
+			memcpy(&conn->hdr[conn->hdr_len], data, need);
+			conn->hdr_len += need;
+			data += need;
+			len -= need;
+			if (conn->hdr_len < sizeof(conn->hdr))
+				break;
+
+			hh = (struct ipaccess_head *) conn->hdr;
+			need = sizeof(*hh) + ntohs(hh->len);
+			if (need > WORKER_MSG_SIZE)
+				return -EIO;
+			conn->frame = malloc(sizeof(*conn->frame) + need);
+			if (!conn->frame)
+				return -ENOMEM;
+			conn->frame->bsc = conn->bsc;
+			conn->frame->len = need;
+			memcpy(conn->frame->data, conn->hdr, sizeof(conn->hdr));
+			conn->frame_len = sizeof(conn->hdr);
+		}
+
+		need = conn->frame->len - conn->frame_len;
+		if (need > len)
+			need = len;
+		memcpy(&conn->frame->data[conn->frame_len], data, need);
+		conn->frame_len += need;
+		data += need;
+		len -= need;
+
+		if (conn->frame_len == conn->frame->len) {
+			queue_frame(w->workers, conn->frame);
+			conn->frame = NULL;
+			conn->hdr_len = 0;
+		}
+	}
+
+	return 0;
+}
+
+/* called with the lock held, one recv for every connection */
+static void read_conn(struct bsc_nat_worker *w, struct worker_conn *conn)
+{
+	int rc;
+
+	rc = recv(conn->fd, w->buf, sizeof(w->buf), MSG_DONTWAIT);
+	if (rc < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+	if (rc <= 0) {
+		queue_error(w, conn, rc < 0 ? -errno : 0);
+		return;
+	}
+
+	rc = put_data(w, conn, w->buf, rc);
+	if (rc != 0)
+		queue_error(w, conn, rc);
+}
+
+static struct worker_conn *find_conn(struct bsc_nat_worker *w, int fd)
+{
+	struct worker_conn *conn;
+
+	llist_for_each_entry(conn, &w->conns, entry)
+		if (conn->fd == fd)
+			return conn;
+	return NULL;
+}
+
+static void *worker_thread(void *data)
+{
+	struct bsc_nat_worker *w = data;
+	struct worker_conn *conn;
+	struct pollfd *pfds;
+	int i, n;
+
+	pthread_mutex_lock(&w->lock);
+	while (!w->stop) {
+		/* the wake pipe and the connections */
+		if (w->num_pfds < w->num_conns + 1) {
+			pfds = realloc(w->pfds, (w->num_conns + 1) * sizeof(*pfds));
+			if (pfds) {
+				w->pfds = pfds;
+				w->num_pfds = w->num_conns + 1;
+			}
+		}
+
+		n = 0;
+		w->pfds[n].fd = w->wake[0];
+		w->pfds[n++].events = POLLIN;
+		llist_for_each_entry(conn, &w->conns, entry) {
+			if (n == w->num_pfds)
+				break;
+			w->pfds[n].fd = conn->fd;
+			w->pfds[n++].events = POLLIN;
+		}
+		pthread_mutex_unlock(&w->lock);
+
+		if (poll(w->pfds, n, -1) < 0 && errno != EINTR) {
+			pthread_mutex_lock(&w->lock);
+			break;
+		}
+		if (w->pfds[0].revents)
+			drain_pipe(w->wake[0]);
+
+		/* a connection might be gone, it is looked up again */
+		pthread_mutex_lock(&w->lock);
+		for (i = 1; i < n; ++i) {
+			if (!w->pfds[i].revents)
+				continue;
+			conn = find_conn(w, w->pfds[i].fd);
+			if (conn)
+				read_conn(w, conn);
+		}
+	}
+	pthread_mutex_unlock(&w->lock);
+
+	return NULL;
+}
+
+/* the select loop takes the frames of the workers */
+static int notify_cb(struct osmo_fd *bfd, unsigned int what)
+{
+	struct bsc_nat *nat = bfd->data;
+
+	bsc_nat_workers_dispatch(nat);
+	return 0;
+}
+
+static void deliver(struct bsc_nat_workers *ws, struct worker_frame *frame)
+{
+	struct msgb *msg;
+
+	if (frame->len <= 0) {
+		ws->error_cb(frame->bsc, frame->len);
+		return;
+	}
+
+	msg = msgb_alloc(WORKER_MSG_SIZE, "IPA Multiplex");
+	if (!msg) {
+		LOGP(DNAT, LOGL_ERROR, "Failed to allocate the BSC msg.\n");
+		return;
+	}
+
+	memcpy(msgb_put(msg, frame->len), frame->data, frame->len);
+	msg->l2h = msg->data + sizeof(struct ipaccess_head);
+	ws->msg_cb(frame->bsc, msg);
+}
+
+int bsc_nat_workers_dispatch(struct bsc_nat *nat)
+{
+	struct bsc_nat_workers *ws = nat->workers;
+	struct worker_frame *frame;
+	int count = 0;
+
+	if (!ws)
+		return 0;
+
+	drain_pipe(ws->notify.fd);
+
+	/*
+	 * One frame at a time, the callback might close a BSC and that
+	 * drops its frames from the queue.
+	 */
+	while (count < WORKER_DISPATCH_MAX) {
+		pthread_mutex_lock(&ws->lock);
+		if (llist_empty(&ws->queue)) {
+			pthread_mutex_unlock(&ws->lock);
+			return count;
+		}
+		frame = llist_entry(ws->queue.next, struct worker_frame, entry);
+		llist_del(&frame->entry);
+		pthread_mutex_unlock(&ws->lock);
+
+		deliver(ws, frame);
+		free(frame);
+		count += 1;
+	}
+
+	/* come back after the other fds, the workers do not notify again */
+	wake_up(ws->notify_wr);
+	return count;
+}
+
+/* the worker serving the fewest connections */
+static struct bsc_nat_worker *least_loaded(struct bsc_nat_workers *ws)
+{
+	struct bsc_nat_worker *w, *best = NULL;
+	int i, num, best_num = 0;
+
+	for (i = 0; i < ws->num_workers; ++i) {
+		w = &ws->workers[i];
+		pthread_mutex_lock(&w->lock);
+		num = w->num_conns;
+		pthread_mutex_unlock(&w->lock);
+
+		if (!best || num < best_num) {
+			best = w;
+			best_num = num;
+		}
+	}
+
+	return best;
+}
+
+int bsc_nat_worker_add(struct bsc_connection *bsc)
+{
+	struct bsc_nat_workers *ws = bsc->nat->workers;
+	struct bsc_nat_worker *w;
+	struct worker_conn *conn;
+
+	if (!ws)
+		return -1;
+
+	conn = calloc(1, sizeof(*conn));
+	if (!conn)
+		return -1;
+
+	w = least_loaded(ws);
+	conn->bsc = bsc;
+	conn->fd = bsc->write_queue.bfd.fd;
+
+	pthread_mutex_lock(&w->lock);
+	llist_add_tail(&conn->entry, &w->conns);
+	w->num_conns += 1;
+	pthread_mutex_unlock(&w->lock);
+
+	bsc->worker = w;
+	wake_up(w->wake[1]);
+	return 0;
+}
+
+void bsc_nat_worker_del(struct bsc_connection *bsc)
+{
+	struct bsc_nat_worker *w = bsc->worker;
+	struct bsc_nat_workers *ws;
+	struct worker_frame *frame, *tmp;
+	struct worker_conn *conn;
+
+	if (!w)
+		return;
+
+	ws = w->workers;
+	pthread_mutex_lock(&w->lock);
+	llist_for_each_entry(conn, &w->conns, entry) {
+		if (conn->bsc != bsc)
+			continue;
+		llist_del(&conn->entry);
+		w->num_conns -= 1;
+		free(conn->frame);
+		free(conn);
+		break;
+	}
+
+	/* the worker can not queue any more frames of the BSC */
+	pthread_mutex_lock(&ws->lock);
+	llist_for_each_entry_safe(frame, tmp, &ws->queue, entry) {
+		if (frame->bsc != bsc)
+			continue;
+		llist_del(&frame->entry);
+		free(frame);
+	}
+	pthread_mutex_unlock(&ws->lock);
+	pthread_mutex_unlock(&w->lock);
+
+	bsc->worker = NULL;
+	wake_up(w->wake[1]);
+}
+
+static void worker_free(struct bsc_nat_worker *w)
+{
+	struct worker_conn *conn, *tmp;
+
+	llist_for_each_entry_safe(conn, tmp, &w->conns, entry) {
+		llist_del(&conn->entry);
+		free(conn->frame);
+		free(conn);
+	}
+	free(w->pfds);
+	if (w->wake[0] >= 0)
+		close(w->wake[0]);
+	if (w->wake[1] >= 0)
+		close(w->wake[1]);
+	pthread_mutex_destroy(&w->lock);
+}
+
+int bsc_nat_workers_start(struct bsc_nat *nat, bsc_nat_worker_msg_cb msg_cb,
+			  bsc_nat_worker_error_cb error_cb)
+{
+	struct bsc_nat_workers *ws;
+	struct bsc_nat_worker *w;
+	sigset_t block, old;
+	int i, notify[2];
+
+	if (nat->num_workers == 0 || nat->workers)
+		return 0;
+
+	ws = talloc_zero(nat, struct bsc_nat_workers);
+	if (!ws)
+		return -1;
+	ws->workers = talloc_zero_array(ws, struct bsc_nat_worker,
+					nat->num_workers);
+	if (!ws->workers || make_pipe(notify) != 0) {
+		talloc_free(ws);
+		return -1;
+	}
+
+	ws->msg_cb = msg_cb;
+	ws->error_cb = error_cb;
+	pthread_mutex_init(&ws->lock, NULL);
+	INIT_LLIST_HEAD(&ws->queue);
+	ws->notify.fd = notify[0];
+	ws->notify.when = BSC_FD_READ;
+	ws->notify.cb = notify_cb;
+	ws->notify.data = nat;
+	ws->notify_wr = notify[1];
+	nat->workers = ws;
+
+	for (i = 0; i < nat->num_workers; ++i) {
+		w = &ws->workers[i];
+		w->workers = ws;
+		INIT_LLIST_HEAD(&w->conns);
+		pthread_mutex_init(&w->lock, NULL);
+		w->wake[0] = w->wake[1] = -1;
+		ws->num_workers += 1;
+
+		w->pfds = calloc(1, sizeof(*w->pfds));
+		w->num_pfds = 1;
+		if (!w->pfds || make_pipe(w->wake) != 0) {
+			LOGP(DNAT, LOGL_ERROR, "Failed to set up BSC worker %d.\n", i);
+			goto error;
+		}
+	}
+
+	if (osmo_fd_register(&ws->notify) != 0) {
+		LOGP(DNAT, LOGL_ERROR, "Failed to register the worker fd.\n");
+		goto error;
+	}
+	ws->registered = 1;
+
+	/* the threads inherit the mask, the signals go to the select loop */
+	sigemptyset(&block);
+	sigaddset(&block, SIGINT);
+	sigaddset(&block, SIGTERM);
+	sigaddset(&block, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &block, &old);
+
+	for (i = 0; i < ws->num_workers; ++i) {
+		w = &ws->workers[i];
+		if (pthread_create(&w->thread, NULL, worker_thread, w) != 0)
+			break;
+		w->started = 1;
+	}
+
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (i < ws->num_workers) {
+		LOGP(DNAT, LOGL_ERROR, "Failed to start BSC worker %d.\n", i);
+		goto error;
+	}
+
+	LOGP(DNAT, LOGL_NOTICE, "Started %d BSC workers.\n", ws->num_workers);
+	return 0;
+
+error:
+	bsc_nat_workers_stop(nat);
+	return -1;
+}
+
+void bsc_nat_workers_stop(struct bsc_nat *nat)
+{
+	struct bsc_nat_workers *ws = nat->workers;
+	struct worker_frame *frame, *tmp;
+	struct bsc_connection *bsc;
+	struct bsc_nat_worker *w;
+	int i;
+
+	if (!ws)
+		return;
+
+	for (i = 0; i < ws->num_workers; ++i) {
+		w = &ws->workers[i];
+		if (!w->started)
+			continue;
+		pthread_mutex_lock(&w->lock);
+		w->stop = 1;
+		pthread_mutex_unlock(&w->lock);
+		wake_up(w->wake[1]);
+		pthread_join(w->thread, NULL);
+	}
+
+	for (i = 0; i < ws->num_workers; ++i)
+		worker_free(&ws->workers[i]);
+
+	/* the connections are read by the select loop again */
+	llist_for_each_entry(bsc, &nat->bsc_connections, list_entry) {
+		if (!bsc->worker)
+			continue;
+		bsc->worker = NULL;
+		bsc->write_queue.bfd.when |= BSC_FD_READ;
+	}
+
+	llist_for_each_entry_safe(frame, tmp, &ws->queue, entry) {
+		llist_del(&frame->entry);
+		free(frame);
+	}
+
+	if (ws->registered)
+		osmo_fd_unregister(&ws->notify);
+	close(ws->notify.fd);
+	close(ws->notify_wr);
+	pthread_mutex_destroy(&ws->lock);
+	talloc_free(ws);
+	nat->workers = NULL;
+}
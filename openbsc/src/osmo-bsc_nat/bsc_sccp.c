@@ -39,12 +39,24 @@ static int equal(struct sccp_source_reference *ref1, struct sccp_source_referenc
  * SCCP patching below
  */
 
+static uint32_t ref_to_int(struct sccp_source_reference *ref)
+{
+	return ref->octet1 | (ref->octet2 << 8) | (ref->octet3 << 16);
+}
+
+/* the shard that handed out the patched reference */
+static struct bsc_nat_shard *shard_for_ref(struct bsc_nat *nat,
+					   struct sccp_source_reference *ref)
+{
+	return &nat->shards[ref_to_int(ref) % nat->num_shards];
+}
+
 /* check if we are using this ref for patched already */
-static int sccp_ref_is_free(struct sccp_source_reference *ref, struct bsc_nat *nat)
+static int sccp_ref_is_free(struct sccp_source_reference *ref, struct bsc_nat_shard *shard)
 {
 	struct sccp_connections *conn;
 
-	llist_for_each_entry(conn, &nat->sccp_connections, list_entry) {
+	llist_for_each_entry(conn, &shard->sccp_connections, shard_entry) {
 		if (memcmp(ref, &conn->patched_ref, sizeof(*ref)) == 0)
 			return -1;
 	}
@@ -52,27 +64,31 @@ static int sccp_ref_is_free(struct sccp_source_reference *ref, struct bsc_nat *n
 	return 0;
 }
 
-/* copied from sccp.c */
-static int assign_src_local_reference(struct sccp_source_reference *ref, struct bsc_nat *nat)
+/*
+ * copied from sccp.c, the shard only searches its part of the
+ * references and only needs to compare with its own connections.
+ */
+static int assign_src_local_reference(struct sccp_source_reference *ref, struct bsc_nat *nat,
+				      struct bsc_nat_shard *shard)
 {
-	static uint32_t last_ref = 0x50000;
 	int wrapped = 0;
 
 	do {
 		struct sccp_source_reference reference;
-		reference.octet1 = (last_ref >>  0) & 0xff;
-		reference.octet2 = (last_ref >>  8) & 0xff;
-		reference.octet3 = (last_ref >> 16) & 0xff;
 
-		++last_ref;
+		shard->last_ref += nat->num_shards;
 		/* do not use the reversed word and wrap around */
-		if ((last_ref & 0x00FFFFFF) == 0x00FFFFFF) {
+		if (shard->last_ref >= 0x00FFFFFF) {
 			LOGP(DNAT, LOGL_NOTICE, "Wrapped searching for a free code\n");
-			last_ref = 0;
+			shard->last_ref = shard->nr;
 			++wrapped;
 		}
 
-		if (sccp_ref_is_free(&reference, nat) == 0) {
+		reference.octet1 = (shard->last_ref >>  0) & 0xff;
+		reference.octet2 = (shard->last_ref >>  8) & 0xff;
+		reference.octet3 = (shard->last_ref >> 16) & 0xff;
+
+		if (sccp_ref_is_free(&reference, shard) == 0) {
 			*ref = reference;
 			return 0;
 		}
@@ -88,7 +104,7 @@ struct sccp_connections *create_sccp_src_ref(struct bsc_connection *bsc,
 	struct sccp_connections *conn;
 
 	/* Some commercial BSCs like to reassign there SRC ref */
-	llist_for_each_entry(conn, &bsc->nat->sccp_connections, list_entry) {
+	llist_for_each_entry(conn, &bsc->shard->sccp_connections, shard_entry) {
 		if (conn->bsc != bsc)
 			continue;
 		if (memcmp(&conn->real_ref, parsed->src_local_ref, sizeof(conn->real_ref)) != 0)
@@ -96,11 +112,12 @@ struct sccp_connections *create_sccp_src_ref(struct bsc_connection *bsc,
 
 		/* the BSC has reassigned the SRC ref and we failed to keep track */
 		memset(&conn->remote_ref, 0, sizeof(conn->remote_ref));
-		if (assign_src_local_reference(&conn->patched_ref, bsc->nat) != 0) {
+		if (assign_src_local_reference(&conn->patched_ref, bsc->nat, bsc->shard) != 0) {
 			LOGP(DNAT, LOGL_ERROR, "BSC %d reused src ref: %d and we failed to generate a new id.\n",
 			     bsc->cfg->nr, sccp_src_ref_to_int(parsed->src_local_ref));
 			bsc_mgcp_dlcx(conn);
 			llist_del(&conn->list_entry);
+			llist_del(&conn->shard_entry);
 			talloc_free(conn);
 			return NULL;
 		} else {
@@ -120,7 +137,7 @@ struct sccp_connections *create_sccp_src_ref(struct bsc_connection *bsc,
 	conn->bsc = bsc;
 	clock_gettime(CLOCK_MONOTONIC, &conn->creation_time);
 	conn->real_ref = *parsed->src_local_ref;
-	if (assign_src_local_reference(&conn->patched_ref, bsc->nat) != 0) {
+	if (assign_src_local_reference(&conn->patched_ref, bsc->nat, bsc->shard) != 0) {
 		LOGP(DNAT, LOGL_ERROR, "Failed to assign a ref.\n");
 		talloc_free(conn);
 		return NULL;
@@ -128,6 +145,7 @@ struct sccp_connections *create_sccp_src_ref(struct bsc_connection *bsc,
 
 	bsc_mgcp_init(conn);
 	llist_add_tail(&conn->list_entry, &bsc->nat->sccp_connections);
+	llist_add_tail(&conn->shard_entry, &bsc->shard->sccp_connections);
 	rate_ctr_inc(&bsc->cfg->stats.ctrg->ctr[BCFG_CTR_SCCP_CONN]);
 	osmo_counter_inc(bsc->cfg->nat->stats.sccp.conn);
 
@@ -157,8 +175,9 @@ int update_sccp_src_ref(struct sccp_connections *sccp, struct bsc_nat_parsed *pa
 void remove_sccp_src_ref(struct bsc_connection *bsc, struct msgb *msg, struct bsc_nat_parsed *parsed)
 {
 	struct sccp_connections *conn;
+	struct bsc_nat_shard *shard = shard_for_ref(bsc->nat, parsed->src_local_ref);
 
-	llist_for_each_entry(conn, &bsc->nat->sccp_connections, list_entry) {
+	llist_for_each_entry(conn, &shard->sccp_connections, shard_entry) {
 		if (memcmp(parsed->src_local_ref,
 			   &conn->patched_ref, sizeof(conn->patched_ref)) == 0) {
 
@@ -181,6 +200,7 @@ struct sccp_connections *patch_sccp_src_ref_to_bsc(struct msgb *msg,
 						   struct bsc_nat *nat)
 {
 	struct sccp_connections *conn;
+	struct bsc_nat_shard *shard;
 
 	if (!parsed->dest_local_ref) {
 		LOGP(DNAT, LOGL_ERROR, "MSG should contain dest_local_ref.\n");
@@ -188,7 +208,8 @@ struct sccp_connections *patch_sccp_src_ref_to_bsc(struct msgb *msg,
 	}
 
 
-	llist_for_each_entry(conn, &nat->sccp_connections, list_entry) {
+	shard = shard_for_ref(nat, parsed->dest_local_ref);
+	llist_for_each_entry(conn, &shard->sccp_connections, shard_entry) {
 		if (!equal(parsed->dest_local_ref, &conn->patched_ref))
 			continue;
 
@@ -214,7 +235,7 @@ struct sccp_connections *patch_sccp_src_ref_to_msc(struct msgb *msg,
 {
 	struct sccp_connections *conn;
 
-	llist_for_each_entry(conn, &bsc->nat->sccp_connections, list_entry) {
+	llist_for_each_entry(conn, &bsc->shard->sccp_connections, shard_entry) {
 		if (conn->bsc != bsc)
 			continue;
 
@@ -69,30 +69,28 @@ static void bsc_nat_ussd_destroy(struct bsc_nat_ussd_con *con)
 static int forward_sccp(struct bsc_nat *nat, struct msgb *msg)
 {
 	struct sccp_connections *con;
-	struct bsc_nat_parsed *parsed;
+	struct bsc_nat_parsed parsed;
 
 
-	parsed = bsc_nat_parse(msg);
-	if (!parsed) {
+	if (bsc_nat_parse_into(msg, &parsed) != 0) {
 		LOGP(DNAT, LOGL_ERROR, "Can not parse msg from USSD.\n");
 		msgb_free(msg);
 		return -1;
 	}
 
-	if (!parsed->dest_local_ref) {
+	if (!parsed.dest_local_ref) {
 		LOGP(DNAT, LOGL_ERROR, "No destination local reference.\n");
 		msgb_free(msg);
 		return -1;
 	}
 
-	con = bsc_nat_find_con_by_bsc(nat, parsed->dest_local_ref);
+	con = bsc_nat_find_con_by_bsc(nat, parsed.dest_local_ref);
 	if (!con || !con->bsc) {
 		LOGP(DNAT, LOGL_ERROR, "No active connection found.\n");
 		msgb_free(msg);
 		return -1;
 	}
 
-	talloc_free(parsed);
 	bsc_write_msg(&con->bsc->write_queue, msg);
 	return 0;
 }
@@ -364,9 +362,9 @@ int bsc_check_ussd(struct sccp_connections *con, struct bsc_nat_parsed *parsed,
 	if (!hdr48)
 		return 0;
 
-	proto = hdr48->proto_discr & 0x0f;
-	msg_type = hdr48->msg_type & 0xbf;
-	ti = (hdr48->proto_discr & 0x70) >> 4;
+	proto = parsed->dtap_proto;
+	msg_type = parsed->dtap_msg_type;
+	ti = parsed->dtap_ti;
 	if (proto != GSM48_PDISC_NC_SS)
 		return 0;
 
@@ -19,14 +19,21 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
 
 #include <osmocom/core/application.h>
+#include <osmocom/core/msgb.h>
 #include <osmocom/core/utils.h>
+#include <osmocom/abis/e1_input.h>
 
 #include <openbsc/gsm_data.h>
 #include <openbsc/abis_nm.h>
+#include <openbsc/abis_rsl.h>
 #include <openbsc/debug.h>
 
+#define RSL_BENCH_ROUNDS	20000
+
 static const uint8_t simple_config[] = {
 	/*0, 13, */
 	66, 18, 0, 3, 1, 2, 3, 19, 0, 3, 3, 4, 5,
@@ -157,6 +164,102 @@ static void test_sw_selection(void)
 	printf("SELECTED: %d\n", pos);
 }
 
+/* RSL messages of an active TCH/F on TS2 as received from a BTS */
+static const uint8_t rsl_meas_res[] = {
+	0x08, 0x28, 0x01, 0x0a, 0x1b, 0x00, 0x19, 0x03,
+	0x26, 0x25, 0x00, 0x04, 0x00, 0x0a, 0x50, 0x01,
+	0x0b, 0x00, 0x12, 0x06, 0x15, 0x28, 0x27, 0x01,
+	0x0f, 0x10, 0xaf, 0x00, 0x16, 0x48, 0x49, 0x85,
+	0x28, 0x00, 0x00, 0x00, 0x00,
+};
+
+static const uint8_t rsl_hando_det[] = {
+	0x08, 0x27, 0x01, 0x0a, 0x11, 0x05,
+};
+
+static const uint8_t rsl_ccch_load_ind[] = {
+	0x0c, 0x12, 0x01, 0x90, 0x0f, 0x00, 0x20,
+};
+
+static const uint8_t rsl_error_report[] = {
+	0x10, 0x1c, 0x1a, 0x01, 0x00,
+};
+
+static const struct {
+	const char *name;
+	const uint8_t *data;
+	int len;
+} rsl_stream[] = {
+	{ "MEAS RES", rsl_meas_res, sizeof(rsl_meas_res) },
+	{ "HANDO DET", rsl_hando_det, sizeof(rsl_hando_det) },
+	{ "CCCH LOAD IND", rsl_ccch_load_ind, sizeof(rsl_ccch_load_ind) },
+	{ "ERROR REPORT", rsl_error_report, sizeof(rsl_error_report) },
+};
+
+static struct e1inp_sign_link rsl_link;
+
+static int rsl_rx(const uint8_t *data, int len)
+{
+	struct msgb *msg = msgb_alloc(128, "rsl rx");
+
+	msg->l2h = msgb_put(msg, len);
+	memcpy(msg->l2h, data, len);
+	msg->dst = &rsl_link;
+
+	return abis_rsl_rcvmsg(msg);
+}
+
+static void test_rsl_rx_stream(void)
+{
+	struct gsm_network *net;
+	struct gsm_bts *bts;
+	struct gsm_lchan *lchan;
+	int i, rc;
+
+	printf("Testing RSL receive path\n");
+
+	net = gsm_network_init(1, 1, NULL);
+	bts = gsm_bts_alloc_register(net, GSM_BTS_TYPE_UNKNOWN,
+				     HARDCODED_TSC, HARDCODED_BSIC);
+	bts->c0->ts[0].pchan = GSM_PCHAN_CCCH;
+	bts->c0->ts[2].pchan = GSM_PCHAN_TCH_F;
+	lchan = &bts->c0->ts[2].lchan[0];
+	lchan->type = GSM_LCHAN_TCH_F;
+	lchan->state = LCHAN_S_ACTIVE;
+	rsl_link.trx = bts->c0;
+
+	log_set_log_level(osmo_stderr_target, LOGL_FATAL);
+	for (i = 0; i < ARRAY_SIZE(rsl_stream); i++) {
+		rc = rsl_rx(rsl_stream[i].data, rsl_stream[i].len);
+		printf("%s: rc=%d\n", rsl_stream[i].name, rc);
+	}
+	printf("meas_rep_idx=%d paging slots=%u\n", lchan->meas_rep_idx,
+		bts->paging.available_slots);
+}
+
+#ifdef BENCHMARK
+/* replays the stream on the channel set up by test_rsl_rx_stream */
+static void bench_rsl_rx_stream(void)
+{
+	struct timeval start, end, diff;
+	unsigned int num;
+	double secs;
+	int i, j;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < RSL_BENCH_ROUNDS; i++)
+		for (j = 0; j < ARRAY_SIZE(rsl_stream); j++)
+			rsl_rx(rsl_stream[j].data, rsl_stream[j].len);
+	gettimeofday(&end, NULL);
+
+	timersub(&end, &start, &diff);
+	secs = diff.tv_sec + diff.tv_usec / 1000000.0;
+	num = RSL_BENCH_ROUNDS * ARRAY_SIZE(rsl_stream);
+	fprintf(stderr, "Received %u RSL messages in %.3f s: %.0f msgs/s\n",
+		num, secs, secs > 0 ? num / secs : 0);
+}
+#endif
+
 int main(int argc, char **argv)
 {
 	osmo_init_logging(&log_info);
@@ -164,6 +267,10 @@ int main(int argc, char **argv)
 	test_simple_sw_short();
 	test_dual_sw_config();
 	test_sw_selection();
+	test_rsl_rx_stream();
+#ifdef BENCHMARK
+	bench_rsl_rx_stream();
+#endif
 
 	return EXIT_SUCCESS;
 }
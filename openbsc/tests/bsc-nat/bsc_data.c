@@ -172,6 +172,13 @@ static const char mdcx_resp_patched[] = "200 23330829\r\n\r\nv=0\r\nc=IN IP4 10.
 static const char mdcx_resp2[] = "200 33330829\n\nv=0\nc=IN IP4 172.16.18.2\nm=audio 4002 RTP/AVP 98\na=rtpmap:98 AMR/8000\n";
 static const char mdcx_resp_patched2[] = "200 33330829\n\nv=0\nc=IN IP4 10.0.0.23\nm=audio 5555 RTP/AVP 98\na=rtpmap:98 AMR/8000\na=fmtp:98 mode-set=2\n";
 
+/* mixed line endings, the unterminated last line is dropped */
+static const char dlcx_mixed[] = "DLCX 23330830 8@mgw MGCP 1.0\nC: 394b0439fb\r\nI: 1\nZ: noanswer";
+static const char dlcx_mixed_patched[] = "DLCX 23330830 1e@mgw MGCP 1.0\nC: 394b0439fb\r\nI: 1\n";
+
+/* no payload type in the audio line */
+static const char mdcx_bad_audio[] = "200 23330829\r\n\r\nv=0\r\nm=audio 4002 RTP/AVP\r\n";
+
 struct mgcp_patch_test {
 	const char *orig;
 	const char *patch;
@@ -210,6 +217,12 @@ static const struct mgcp_patch_test mgcp_messages[] = {
 		.ip = "10.0.0.23",
 		.port = 5555,
 	},
+	{
+		.orig = dlcx_mixed,
+		.patch = dlcx_mixed_patched,
+		.ip = "10.0.0.23",
+		.port = 5555,
+	},
 };
 
 /* CC Setup messages */
@@ -33,7 +33,11 @@
 #include <osmocom/sccp/sccp.h>
 #include <osmocom/gsm/protocol/gsm_08_08.h>
 
+#include <errno.h>
 #include <stdio.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
 
 /* test messages for ipa */
 static uint8_t ipa_id[] = {
@@ -421,6 +425,169 @@ static void test_contrack()
 	msgb_free(msg);
 }
 
+/* the references of the shards are disjoint and found in their shard */
+static void test_shards(void)
+{
+	struct bsc_nat *nat;
+	struct bsc_connection *bsc[3];
+	struct sccp_connections *con[6];
+	struct sccp_source_reference real, patched;
+	struct bsc_nat_parsed parsed;
+	int i;
+
+	printf("Testing sharded SCCP references.\n");
+	nat = bsc_nat_alloc();
+	if (bsc_nat_set_shards(nat, 4) != 0) {
+		printf("Failed to create the shards.\n");
+		abort();
+	}
+
+	for (i = 0; i < ARRAY_SIZE(bsc); ++i) {
+		bsc[i] = bsc_connection_alloc(nat);
+		bsc[i]->cfg = bsc_config_alloc(nat, "foo");
+		llist_add(&bsc[i]->list_entry, &nat->bsc_connections);
+	}
+
+	if (bsc_nat_set_shards(nat, 2) == 0) {
+		printf("Changed the shards with connected BSCs.\n");
+		abort();
+	}
+
+	memset(&parsed, 0, sizeof(parsed));
+	for (i = 0; i < ARRAY_SIZE(con); ++i) {
+		/* every BSC uses the same real references */
+		memset(&real, 0, sizeof(real));
+		real.octet1 = i / ARRAY_SIZE(bsc);
+		parsed.src_local_ref = &real;
+		con[i] = create_sccp_src_ref(bsc[i % ARRAY_SIZE(bsc)], &parsed);
+		if (!con[i]) {
+			printf("Failed to create a ref %d\n", i);
+			abort();
+		}
+
+		if (sccp_src_ref_to_int(&con[i]->patched_ref) % 4 != i % ARRAY_SIZE(bsc)) {
+			printf("Ref 0x%x is not in shard %d\n",
+			       sccp_src_ref_to_int(&con[i]->patched_ref), i % 3);
+			abort();
+		}
+	}
+
+	parsed.src_local_ref = NULL;
+	for (i = 0; i < ARRAY_SIZE(con); ++i) {
+		patched = con[i]->patched_ref;
+		parsed.dest_local_ref = &patched;
+		if (patch_sccp_src_ref_to_bsc(NULL, &parsed, nat) != con[i]) {
+			printf("Did not find the connection %d\n", i);
+			abort();
+		}
+	}
+
+	/* the freed reference is not found anymore */
+	patched = con[4]->patched_ref;
+	parsed.dest_local_ref = &patched;
+	sccp_connection_destroy(con[4]);
+	if (patch_sccp_src_ref_to_bsc(NULL, &parsed, nat) != NULL) {
+		printf("Found the destroyed connection.\n");
+		abort();
+	}
+
+	talloc_free(nat);
+}
+
+static struct bsc_connection *worker_bsc[2];
+
+static void worker_msg(struct bsc_connection *bsc, struct msgb *msg)
+{
+	printf(" BSC %d: proto 0x%x, %d octets, 0x%x\n",
+	       bsc == worker_bsc[1], msg->data[2], msgb_l2len(msg),
+	       msgb_l2len(msg) ? msg->l2h[0] : 0);
+	msgb_free(msg);
+}
+
+static void worker_error(struct bsc_connection *bsc, int error)
+{
+	printf(" BSC %d: %s\n", bsc == worker_bsc[1],
+	       error == 0 ? "lost" : error == -EIO ? "broken" : "error");
+	bsc_nat_worker_del(bsc);
+}
+
+/* the frames come in from the threads and we wait for them */
+static int worker_wait(struct bsc_nat *nat, int count)
+{
+	int i, got = 0;
+
+	for (i = 0; i < 1000 && got < count; ++i) {
+		got += bsc_nat_workers_dispatch(nat);
+		if (got < count)
+			usleep(1000);
+	}
+	return got;
+}
+
+static void test_workers(void)
+{
+	static const uint8_t split[] = { 0x00, 0x02, 0xfd, 0x09, 0x01 };
+	static const uint8_t two[] = {
+		0x00, 0x01, 0xfe, 0x00,
+		0x00, 0x00, 0xfd,
+	};
+	static const uint8_t long_hdr[] = { 0x07, 0xd0, 0xfd };
+	struct bsc_nat *nat;
+	int fds[2][2];
+	int i;
+
+	printf("Testing the BSC workers.\n");
+	nat = bsc_nat_alloc();
+	nat->num_workers = 2;
+	if (bsc_nat_workers_start(nat, worker_msg, worker_error) != 0) {
+		printf("Failed to start the workers.\n");
+		abort();
+	}
+
+	for (i = 0; i < ARRAY_SIZE(worker_bsc); ++i) {
+		socketpair(AF_UNIX, SOCK_STREAM, 0, fds[i]);
+		worker_bsc[i] = bsc_connection_alloc(nat);
+		worker_bsc[i]->write_queue.bfd.fd = fds[i][0];
+		bsc_nat_worker_add(worker_bsc[i]);
+	}
+
+	/* both workers are used with a single shard */
+	printf("Workers used: %d\n",
+	       1 + (worker_bsc[0]->worker != worker_bsc[1]->worker));
+
+	/* a frame in pieces and two frames, one is empty, at once */
+	send(fds[0][1], split, 2, 0);
+	usleep(10000);
+	send(fds[0][1], &split[2], 3, 0);
+	send(fds[0][1], two, sizeof(two), 0);
+	printf("Frames: %d\n", worker_wait(nat, 3));
+
+	/* longer than ipa_msg_recv() takes */
+	send(fds[1][1], long_hdr, sizeof(long_hdr), 0);
+	printf("Long frame: %d\n", worker_wait(nat, 1));
+
+	/* the queued frames of a BSC are dropped with it */
+	send(fds[0][1], two, sizeof(two), 0);
+	usleep(10000);
+	bsc_nat_worker_del(worker_bsc[0]);
+	printf("Deleted BSC: %d\n", worker_wait(nat, 1));
+
+	/* the BSC goes away */
+	for (i = 0; i < 2; ++i)
+		close(fds[1][i]);
+	socketpair(AF_UNIX, SOCK_STREAM, 0, fds[1]);
+	worker_bsc[1]->write_queue.bfd.fd = fds[1][0];
+	bsc_nat_worker_add(worker_bsc[1]);
+	close(fds[1][1]);
+	printf("Closed BSC: %d\n", worker_wait(nat, 1));
+
+	bsc_nat_workers_stop(nat);
+	for (i = 0; i < 2; ++i)
+		close(fds[0][i]);
+	close(fds[1][0]);
+	talloc_free(nat);
+}
+
 static void test_paging(void)
 {
 	struct bsc_nat *nat;
@@ -491,7 +658,7 @@ static void test_mgcp_allocations(void)
 	multiplex = bsc_mgcp_nr_multiplexes(bsc->cfg->max_endpoints);
 	for (i = 0; i < multiplex; ++i) {
 		for (j = 0; j < 32; ++j)
-			printf("%d", bsc->_endpoint_status[i*32 + j]);
+			printf("%d", bsc_mgcp_endpoint_in_use(bsc, i*32 + j));
 		printf(": %d of %d\n", i*32 + 32, 32 * 8);
 	}
 #endif
@@ -547,7 +714,7 @@ static void test_mgcp_ass_tracking(void)
 		printf("Assigned timeslot should have been 1.\n");
 		abort();
 	}
-	if (con.bsc->_endpoint_status[0x1] != 1) {
+	if (!bsc_mgcp_endpoint_in_use(con.bsc, 0x1)) {
 		printf("The status on the BSC is wrong.\n");
 		abort();
 	}
@@ -566,7 +733,7 @@ static void test_mgcp_ass_tracking(void)
 
 	bsc_mgcp_dlcx(&con);
 	if (con.bsc_endp != -1 || con.msc_endp != -1 ||
-	    con.bsc->_endpoint_status[1] != 0 || con.bsc->last_endpoint != 0x1) {
+	    bsc_mgcp_endpoint_in_use(con.bsc, 1) || con.bsc->last_endpoint != 0x1) {
 		printf("Clearing should remove the mapping.\n");
 		abort();
 	}
@@ -585,13 +752,18 @@ static void test_mgcp_find(void)
 	printf("Testing finding of a BSC Connection\n");
 
 	nat = bsc_nat_alloc();
+	nat->bsc_endpoints = talloc_zero_array(nat,
+					       struct bsc_endpoint,
+					       33);
+	nat->mgcp_cfg = mgcp_config_alloc();
+	nat->mgcp_cfg->trunk.number_endpoints = 32;
 	con = bsc_connection_alloc(nat);
 	llist_add(&con->list_entry, &nat->bsc_connections);
 
 	sccp_con = talloc_zero(con, struct sccp_connections);
-	sccp_con->msc_endp = 12;
 	sccp_con->bsc_endp = 12;
 	sccp_con->bsc = con;
+	bsc_mgcp_set_msc_endp(sccp_con, 12);
 	llist_add(&sccp_con->list_entry, &nat->sccp_connections);
 
 	if (bsc_mgcp_find_con(nat, 11) != NULL) {
@@ -604,13 +776,21 @@ static void test_mgcp_find(void)
 		abort();
 	}
 
+	/* the endpoint is forgotten with the connection */
+	bsc_mgcp_set_msc_endp(sccp_con, -1);
+	if (bsc_mgcp_find_con(nat, 12) != NULL) {
+		printf("Found a released connection.\n");
+		abort();
+	}
+
 	/* free everything */
 	talloc_free(nat);
 }
 
 static void test_mgcp_rewrite(void)
 {
-	int i;
+	char buf[4096];
+	int i, len, size;
 	struct msgb *output;
 	printf("Testing rewriting MGCP messages.\n");
 
@@ -635,9 +815,56 @@ static void test_mgcp_rewrite(void)
 		}
 
 		msgb_free(output);
+
+		/*
+		 * in place a line may grow into the room behind the input,
+		 * a message that only grows needs no more than its output.
+		 */
+		strcpy(buf, orig);
+		size = strlen(patc) > strlen(orig) ? strlen(patc) : sizeof(buf);
+		len = bsc_mgcp_rewrite_buf(buf, strlen(orig), buf, size,
+					   0x1e, ip, port);
+		if (len != strlen(patc) || memcmp(buf, patc, len) != 0) {
+			printf("Broken in place on %d msg: %d\n", i, len);
+			abort();
+		}
+
 		free(input);
 	}
+
+	/* a broken audio line is refused */
+	if (bsc_mgcp_rewrite(mdcx_bad_audio, strlen(mdcx_bad_audio),
+			     0x1e, "10.0.0.23", 5555) != NULL) {
+		printf("Accepted a broken audio line.\n");
+		abort();
+	}
+}
+
+#ifdef BENCHMARK
+static void bench_mgcp_rewrite(void)
+{
+	const int num_msgs = 200000;
+	struct timeval start, end, diff;
+	struct msgb *output;
+	int i, bytes = 0;
+	double ms;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < num_msgs; ++i) {
+		output = bsc_mgcp_rewrite(mdcx, strlen(mdcx), 0x1e,
+					  "10.0.0.23", 6666);
+		bytes += msgb_l2len(output);
+		msgb_free(output);
+	}
+	gettimeofday(&end, NULL);
+
+	timersub(&end, &start, &diff);
+	ms = diff.tv_sec * 1000 + diff.tv_usec / 1000.0;
+	fprintf(stderr, "MGCP rewrite: %d MDCX in %.1f ms, %.0f msgs/s, "
+		"%.1f MB/s\n", num_msgs, ms, num_msgs / (ms / 1000),
+		bytes / 1048576.0 / (ms / 1000));
 }
+#endif
 
 static void test_mgcp_parse(void)
 {
@@ -878,6 +1105,82 @@ static void test_dt_filter()
 	}
 }
 
+static void test_parse_into(void)
+{
+	struct msgb *msg = msgb_alloc(4096, "test_parse_into");
+	struct bsc_nat_parsed parsed;
+	struct gsm48_hdr *hdr, *again;
+	uint32_t len, len_again;
+	size_t blocks;
+
+	copy_to_msg(msg, id_resp, ARRAY_SIZE(id_resp));
+	blocks = talloc_total_blocks(msg);
+
+	if (bsc_nat_parse_into(msg, &parsed) != 0) {
+		printf("FAIL: Could not parse ID resp\n");
+		abort();
+	}
+
+	hdr = bsc_unpack_dtap(&parsed, msg, &len);
+	again = bsc_unpack_dtap(&parsed, msg, &len_again);
+	if (!hdr || hdr != again || len != len_again
+	    || msg->l4h != (uint8_t *) hdr) {
+		printf("FAIL: The DTAP should be unpacked once\n");
+		abort();
+	}
+
+	if (parsed.dtap_proto != GSM48_PDISC_MM
+	    || parsed.dtap_msg_type != GSM48_MT_MM_ID_RESP
+	    || parsed.dtap_ti != 0) {
+		printf("FAIL: The DTAP header was not decoded\n");
+		abort();
+	}
+
+	if (talloc_total_blocks(msg) != blocks) {
+		printf("FAIL: Parsing should not allocate\n");
+		abort();
+	}
+
+	/* a truncated message is refused */
+	copy_to_msg(msg, id_resp, 2);
+	if (bsc_nat_parse_into(msg, &parsed) == 0) {
+		printf("FAIL: Parsed a truncated message\n");
+		abort();
+	}
+
+	msgb_free(msg);
+}
+
+#ifdef BENCHMARK
+static void bench_nat_parse(void)
+{
+	const int num_msgs = 500000;
+	struct msgb *msg = msgb_alloc(4096, "bench_nat_parse");
+	struct timeval start, end, diff;
+	struct bsc_nat_parsed parsed;
+	uint32_t len;
+	double ms;
+	int i;
+
+	copy_to_msg(msg, cc_setup_national, ARRAY_SIZE(cc_setup_national));
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < num_msgs; ++i) {
+		bsc_nat_parse_into(msg, &parsed);
+		bsc_unpack_dtap(&parsed, msg, &len);
+		bsc_unpack_dtap(&parsed, msg, &len);
+	}
+	gettimeofday(&end, NULL);
+
+	timersub(&end, &start, &diff);
+	ms = diff.tv_sec * 1000 + diff.tv_usec / 1000.0;
+	fprintf(stderr, "NAT parse: %d DT1 in %.1f ms, %.0f msgs/s\n",
+		num_msgs, ms, num_msgs / (ms / 1000));
+
+	msgb_free(msg);
+}
+#endif
+
 static void test_setup_rewrite()
 {
 	struct msgb *msg = msgb_alloc(4096, "test_dt_filter");
@@ -1226,6 +1529,8 @@ int main(int argc, char **argv)
 
 	test_filter();
 	test_contrack();
+	test_shards();
+	test_workers();
 	test_paging();
 	test_mgcp_ass_tracking();
 	test_mgcp_find();
@@ -1233,11 +1538,16 @@ int main(int argc, char **argv)
 	test_mgcp_parse();
 	test_cr_filter();
 	test_dt_filter();
+	test_parse_into();
 	test_setup_rewrite();
 	test_sms_smsc_rewrite();
 	test_sms_number_rewrite();
 	test_mgcp_allocations();
 	test_barr_list_parsing();
+#ifdef BENCHMARK
+	bench_mgcp_rewrite();
+	bench_nat_parse();
+#endif
 
 	printf("Testing execution completed.\n");
 	return 0;
@@ -0,0 +1,239 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <osmocom/core/application.h>
+#include <osmocom/core/msgb.h>
+#include <osmocom/core/talloc.h>
+#include <osmocom/gprs/gprs_ns.h>
+#include <osmocom/gprs/gprs_bssgp.h>
+
+#include <openbsc/debug.h>
+#include <openbsc/gb_proxy.h>
+
+#define SGSN_NSEI	0x0100
+
+void *tall_bsc_ctx;
+struct gbproxy_config gbcfg;
+
+static int bench_mode;
+static unsigned long sent_pdus, sent_bytes;
+
+/* Replaces the NS layer: print what would be sent */
+int gprs_ns_sendmsg(struct gprs_ns_inst *nsi, struct msgb *msg)
+{
+	int i;
+
+	sent_pdus++;
+	sent_bytes += msg->len;
+
+	if (!bench_mode) {
+		printf("  -> NSEI=%u BVCI=%u:", msgb_nsei(msg), msgb_bvci(msg));
+		for (i = 0; i < msg->len; i++)
+			printf(" %02x", msg->data[i]);
+		printf("\n");
+	}
+
+	msgb_free(msg);
+	return 0;
+}
+
+/* Pass a BSSGP PDU to the proxy as the NS layer would */
+static void rx_bssgp(struct gprs_nsvc *nsvc, uint16_t ns_bvci,
+		     const uint8_t *data, unsigned int len)
+{
+	struct msgb *msg = msgb_alloc_headroom(2048, 128, "gbproxy test");
+	uint8_t *ns_hdr;
+
+	/* NS UNITDATA header */
+	ns_hdr = msgb_put(msg, 4);
+	ns_hdr[0] = 0x00;
+	ns_hdr[1] = 0x00;
+	ns_hdr[2] = ns_bvci >> 8;
+	ns_hdr[3] = ns_bvci & 0xff;
+
+	msgb_bssgph(msg) = msgb_put(msg, len);
+	memcpy(msgb_bssgph(msg), data, len);
+	msgb_nsei(msg) = nsvc->nsei;
+	msgb_bvci(msg) = ns_bvci;
+
+	gbprox_rcvmsg(msg, nsvc, ns_bvci);
+	msgb_free(msg);
+}
+
+static void send_bvc_reset(struct gprs_nsvc *nsvc, uint16_t bvci,
+			   const uint8_t *ra)
+{
+	uint8_t pdu[] = {
+		0x22,				/* BVC-RESET */
+		0x04, 0x82, bvci >> 8, bvci & 0xff,
+		0x07, 0x81, 0x08,		/* O&M intervention */
+		0x08, 0x88, ra[0], ra[1], ra[2], ra[3], ra[4], ra[5],
+		0x00, 0x01,
+	};
+
+	rx_bssgp(nsvc, 0, pdu, sizeof(pdu));
+}
+
+static const uint8_t ra1[] = { 0x62, 0xf2, 0x24, 0x00, 0x01, 0x0a };
+static const uint8_t ra2[] = { 0x62, 0xf2, 0x24, 0x00, 0x02, 0x0b };
+static const uint8_t ra3[] = { 0x62, 0xf2, 0x24, 0x00, 0x02, 0x0c };
+
+static void test_gbproxy_relay()
+{
+	/* the proxy keeps pointers to them */
+	static struct gprs_nsvc sgsn_nsvc = {
+		.nsei = SGSN_NSEI, .nsvci = 0x0100, .remote_end_is_sgsn = 1,
+	};
+	static struct gprs_nsvc bss_nsvc[2] = {
+		{ .nsei = 0x1000, .nsvci = 0x1000 },
+		{ .nsei = 0x2000, .nsvci = 0x2000 },
+	};
+	const uint8_t ul_unitdata[] = {
+		0x01, 0xc0, 0x00, 0x00, 0x01, 0x00, 0x00, 0x04,
+		0x0e, 0x84, 0x01, 0x02, 0x03, 0x04,
+	};
+	const uint8_t dl_unitdata[] = {
+		0x00, 0xc0, 0x00, 0x00, 0x02, 0x00, 0x00, 0x04,
+		0x16, 0x82, 0x02, 0x58, 0x0e, 0x83, 0x05, 0x06, 0x07,
+	};
+	const uint8_t flush_ll[] = {
+		0x2a, 0x1f, 0x84, 0xc0, 0x00, 0x00, 0x01,
+		0x04, 0x82, 0x10, 0x01,
+	};
+	uint8_t paging_ra[] = {
+		0x06, 0x0d, 0x88, 0x09, 0x10, 0x32, 0x54, 0x76,
+		0x98, 0x10, 0xf0, 0x1b, 0x86,
+		0, 0, 0, 0, 0, 0,
+	};
+	uint8_t paging_la[] = {
+		0x06, 0x0d, 0x88, 0x09, 0x10, 0x32, 0x54, 0x76,
+		0x98, 0x10, 0xf0, 0x10, 0x85,
+		0, 0, 0, 0, 0,
+	};
+	uint8_t suspend[] = {
+		0x0b, 0x1f, 0x84, 0xc0, 0x00, 0x00, 0x02, 0x1b, 0x86,
+		0, 0, 0, 0, 0, 0,
+	};
+	uint8_t suspend_ack[] = {
+		0x0c, 0x1f, 0x84, 0xc0, 0x00, 0x00, 0x02, 0x1b, 0x86,
+		0, 0, 0, 0, 0, 0, 0x1d, 0x81, 0x01,
+	};
+
+	printf("Testing Gb proxy relay\n");
+
+	gbcfg.nsip_sgsn_nsei = SGSN_NSEI;
+
+	printf("BVC-RESET BVCI=0x1001 from BSS 1\n");
+	send_bvc_reset(&bss_nsvc[0], 0x1001, ra1);
+	printf("BVC-RESET BVCI=0x2001 from BSS 2\n");
+	send_bvc_reset(&bss_nsvc[1], 0x2001, ra2);
+
+	printf("UL-UNITDATA from BSS 1\n");
+	rx_bssgp(&bss_nsvc[0], 0x1001, ul_unitdata, sizeof(ul_unitdata));
+	printf("DL-UNITDATA to BVCI=0x2001\n");
+	rx_bssgp(&sgsn_nsvc, 0x2001, dl_unitdata, sizeof(dl_unitdata));
+	printf("DL-UNITDATA to BVCI=0x1001\n");
+	rx_bssgp(&sgsn_nsvc, 0x1001, dl_unitdata, sizeof(dl_unitdata));
+	printf("FLUSH-LL for BVCI=0x1001\n");
+	rx_bssgp(&sgsn_nsvc, 0, flush_ll, sizeof(flush_ll));
+
+	printf("PAGING-PS by RA of BSS 2\n");
+	memcpy(paging_ra + 13, ra2, 6);
+	rx_bssgp(&sgsn_nsvc, 0, paging_ra, sizeof(paging_ra));
+	printf("PAGING-PS by LA of BSS 1\n");
+	memcpy(paging_la + 13, ra1, 5);
+	rx_bssgp(&sgsn_nsvc, 0, paging_la, sizeof(paging_la));
+
+	/* BSS 2 moves to another RA in the same LA */
+	printf("SUSPEND from BSS 2 in a new RA\n");
+	memcpy(suspend + 9, ra3, 6);
+	rx_bssgp(&bss_nsvc[1], 0, suspend, sizeof(suspend));
+	printf("SUSPEND-ACK for the new RA\n");
+	memcpy(suspend_ack + 9, ra3, 6);
+	rx_bssgp(&sgsn_nsvc, 0, suspend_ack, sizeof(suspend_ack));
+	printf("PAGING-PS by the old RA\n");
+	rx_bssgp(&sgsn_nsvc, 0, paging_ra, sizeof(paging_ra));
+	printf("PAGING-PS by LA of BSS 2\n");
+	memcpy(paging_la + 13, ra3, 5);
+	rx_bssgp(&sgsn_nsvc, 0, paging_la, sizeof(paging_la));
+
+	/* libgb changes the NSEI of a known NS-VC on NS-RESET */
+	printf("NS-RESET moves BSS 1 to NSEI 0x3000\n");
+	bss_nsvc[0].nsei = 0x3000;
+	printf("SUSPEND from BSS 1\n");
+	memcpy(suspend + 9, ra1, 6);
+	rx_bssgp(&bss_nsvc[0], 0, suspend, sizeof(suspend));
+	printf("SUSPEND-ACK for the RA of BSS 1\n");
+	memcpy(suspend_ack + 9, ra1, 6);
+	rx_bssgp(&sgsn_nsvc, 0, suspend_ack, sizeof(suspend_ack));
+}
+
+#ifdef BENCHMARK
+/* relay UNITDATA PDUs in both directions between many BSS and the SGSN */
+static void bench_gbproxy()
+{
+	const unsigned int num_peers = 1024, num_pdus = 500000;
+	const unsigned int pdu_len = 500;
+	struct gprs_nsvc sgsn_nsvc = {
+		.nsei = SGSN_NSEI, .nsvci = 0x0100, .remote_end_is_sgsn = 1,
+	};
+	struct gprs_nsvc *bss_nsvc;
+	struct timeval start, end, diff;
+	uint8_t pdu[500];
+	unsigned int i;
+	double ms;
+
+	bss_nsvc = talloc_zero_array(tall_bsc_ctx, struct gprs_nsvc, num_peers);
+
+	bench_mode = 1;
+	for (i = 0; i < num_peers; i++) {
+		uint8_t ra[6] = { 0x62, 0xf2, 0x24, 0x10, i >> 8, i & 0xff };
+
+		bss_nsvc[i].nsei = 0x4000 + i;
+		bss_nsvc[i].nsvci = 0x4000 + i;
+		send_bvc_reset(&bss_nsvc[i], 0x4000 + i, ra);
+	}
+
+	memset(pdu, 0x2b, sizeof(pdu));
+	sent_pdus = sent_bytes = 0;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < num_pdus; i++) {
+		unsigned int peer = (i * 7) % num_peers;
+
+		if (i & 1) {
+			pdu[0] = 0x01;
+			rx_bssgp(&bss_nsvc[peer], 0x4000 + peer, pdu, pdu_len);
+		} else {
+			pdu[0] = 0x00;
+			rx_bssgp(&sgsn_nsvc, 0x4000 + peer, pdu, pdu_len);
+		}
+	}
+	gettimeofday(&end, NULL);
+	bench_mode = 0;
+
+	timersub(&end, &start, &diff);
+	ms = diff.tv_sec * 1000 + diff.tv_usec / 1000.0;
+	fprintf(stderr, "Gb proxy: relayed %lu of %u PDUs (%u peers) in "
+		"%.1f ms, %.0f PDUs/s, %.1f MB/s\n", sent_pdus, num_pdus,
+		num_peers, ms, sent_pdus / (ms / 1000),
+		sent_bytes / 1048576.0 / (ms / 1000));
+
+	talloc_free(bss_nsvc);
+}
+#endif
+
+int main(int argc, char **argv)
+{
+	osmo_init_logging(&log_info);
+
+	test_gbproxy_relay();
+#ifdef BENCHMARK
+	bench_gbproxy();
+#endif
+
+	printf("Done.\n");
+	return EXIT_SUCCESS;
+}
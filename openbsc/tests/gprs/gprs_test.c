@@ -1,8 +1,30 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <inttypes.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 
+#include <osmocom/core/application.h>
+#include <osmocom/core/talloc.h>
+#include <osmocom/core/utils.h>
+#include <osmocom/core/msgb.h>
+#include <osmocom/gprs/gprs_bssgp.h>
+
+#include <openbsc/debug.h>
 #include <openbsc/gprs_llc.h>
+#include <openbsc/crc24.h>
+#include <openbsc/slhc.h>
+#include <openbsc/v42bis.h>
+#include <openbsc/gprs_gmm.h>
+#include <openbsc/sgsn.h>
+#include <openbsc/sgsn_gtpu.h>
+
+#include "gprs_sndcp.h"
 
 #define ASSERT_FALSE(x) if (x)  { printf("Should have returned false.\n"); abort(); }
 #define ASSERT_TRUE(x)  if (!x) { printf("Should have returned true.\n"); abort(); }
@@ -42,9 +64,1277 @@ static void test_8_4_2()
 	ASSERT_FALSE(nu_is_retransmission(479, 511)); // wrapped
 }
 
+static int count_llmes(void)
+{
+	struct gprs_llc_llme *llme;
+	int count = 0;
+
+	llist_for_each_entry(llme, &gprs_llc_llmes, list)
+		count++;
+	return count;
+}
+
+static void print_lookup(const char *name, uint32_t tlli,
+			 struct gprs_llc_llme *llme)
+{
+	struct gprs_llc_lle *lle = gprs_lle_get_or_create(tlli, GPRS_SAPI_GMM);
+
+	printf("%s TLLI 0x%08x: %s\n", name, tlli,
+	       lle->llme == llme ? "same LLME" : "new LLME");
+}
+
+static void test_llme_tlli_hash()
+{
+	struct gprs_llc_llme *llme, *llme2;
+	int i, mismatches = 0;
+
+	printf("Testing LLME TLLI reassignment.\n");
+
+	/* first frame of an attaching MS with a random TLLI */
+	llme = gprs_lle_get_or_create(0x78000001, GPRS_SAPI_GMM)->llme;
+	OSMO_ASSERT(gprs_lle_get_or_create(0x78000001, 3) == &llme->lle[3]);
+	printf("LLMEs: %d\n", count_llmes());
+
+	/* TLLI change to the local TLLI, both are accepted */
+	gprs_llgmm_assign(llme, 0x78000001, 0xc0000123, GPRS_ALGO_GEA0, NULL);
+	print_lookup("Old", 0x78000001, llme);
+	print_lookup("New", 0xc0000123, llme);
+	print_lookup("Foreign", 0x80000123, llme);
+	printf("LLMEs: %d\n", count_llmes());
+
+	/* TLLI assignment, only the new TLLI is accepted */
+	gprs_llgmm_assign(llme, 0xffffffff, 0xc0000123, GPRS_ALGO_GEA0, NULL);
+	print_lookup("New", 0xc0000123, llme);
+	print_lookup("Old", 0x78000001, llme);
+	llme2 = gprs_lle_get_or_create(0x78000001, GPRS_SAPI_GMM)->llme;
+	printf("LLMEs: %d\n", count_llmes());
+
+	/* P-TMSI reallocation */
+	gprs_llgmm_assign(llme, 0xc0000123, 0xc0000456, GPRS_ALGO_GEA0, NULL);
+	print_lookup("Old", 0xc0000123, llme);
+	print_lookup("New", 0xc0000456, llme);
+	printf("LLMEs: %d\n", count_llmes());
+
+	/* TLLI unassignment frees the LLMEs */
+	gprs_llgmm_assign(llme, 0xc0000456, 0xffffffff, GPRS_ALGO_GEA0, NULL);
+	gprs_llgmm_assign(llme2, 0x78000001, 0xffffffff, GPRS_ALGO_GEA0, NULL);
+	printf("LLMEs: %d\n", count_llmes());
+
+	/* many MS changing their TLLI */
+	for (i = 0; i < 10000; i++)
+		gprs_lle_get_or_create(0xc0000000 | i, GPRS_SAPI_GMM);
+	for (i = 0; i < 10000; i++) {
+		llme = gprs_lle_get_or_create(0xc0000000 | i, 3)->llme;
+		if (llme->tlli != (0xc0000000 | i))
+			mismatches++;
+		gprs_llgmm_assign(llme, llme->tlli, 0xc1000000 | i,
+				  GPRS_ALGO_GEA0, NULL);
+	}
+	for (i = 0; i < 10000; i++) {
+		llme = gprs_lle_get_or_create(0xc1000000 | i, 3)->llme;
+		if (gprs_lle_get_or_create(0xc0000000 | i, 3)->llme != llme)
+			mismatches++;
+		gprs_llgmm_assign(llme, llme->tlli, 0xffffffff,
+				  GPRS_ALGO_GEA0, NULL);
+	}
+	printf("Checked 10000 LLMEs, %d mismatches\n", mismatches);
+	printf("LLMEs: %d\n", count_llmes());
+}
+
+/* bit-serial reference of the FCS polynomial, 04.64 Chapter 5.5a */
+static uint32_t crc24_bitwise(uint32_t fcs, const uint8_t *cp,
+			      unsigned int len)
+{
+	int i;
+
+	while (len--) {
+		fcs ^= *cp++;
+		for (i = 0; i < 8; i++)
+			fcs = (fcs & 1) ? (fcs >> 1) ^ 0xad85dd : fcs >> 1;
+	}
+	return fcs;
+}
+
+static void test_crc24()
+{
+	uint8_t buf[1600 + 8];
+	uint8_t digits[] = "123456789";
+	unsigned int len, off;
+	uint32_t init;
+	int i, j, mismatches = 0;
+
+	printf("Testing CRC-24.\n");
+
+	printf("FCS(123456789) = 0x%06x\n",
+	       ~crc24_calc(INIT_CRC24, digits, 9) & 0xffffff);
+
+	srand(1);
+	for (i = 0; i < 10000; i++) {
+		len = rand() % 1600;
+		off = rand() % 8;
+		init = (i & 1) ? INIT_CRC24 : rand() & 0xffffff;
+		for (j = 0; j < len + off; j++)
+			buf[j] = rand();
+		if (crc24_calc(init, buf + off, len) !=
+		    crc24_bitwise(init, buf + off, len))
+			mismatches++;
+	}
+	printf("Checked 10000 frames, %d mismatches\n", mismatches);
+}
+
+#ifdef BENCHMARK
+/* the byte-at-a-time table loop crc24_calc() used before */
+static uint32_t crc24_bytewise(uint32_t fcs, const uint8_t *cp,
+			       unsigned int len)
+{
+	static uint32_t tbl[256];
+	uint8_t b;
+	int i;
+
+	if (!tbl[1]) {
+		for (i = 0; i < 256; i++) {
+			b = i;
+			tbl[i] = crc24_bitwise(0, &b, 1);
+		}
+	}
+
+	while (len--)
+		fcs = (fcs >> 8) ^ tbl[(fcs ^ *cp++) & 0xff];
+	return fcs;
+}
+
+#define CRC24_BENCH_FRAMES	200000
+
+static void bench_crc24()
+{
+	/* N201-U of SAPI 2, 1, 3 and N201-I */
+	const unsigned int sizes[] = { 270, 400, 500, 1503 };
+	uint8_t buf[1503 + 3];
+	struct timeval start, end, diff;
+	uint32_t fcs = 0;
+	double secs;
+	int i, j, k;
+
+	for (i = 0; i < sizeof(buf); i++)
+		buf[i] = i;
+
+	for (k = 0; k < 2; k++) {
+		for (i = 0; i < ARRAY_SIZE(sizes); i++) {
+			gettimeofday(&start, NULL);
+			for (j = 0; j < CRC24_BENCH_FRAMES; j++) {
+				buf[0] = j;
+				if (k == 0)
+					fcs ^= crc24_bytewise(INIT_CRC24, buf,
+							      sizes[i] + 3);
+				else
+					fcs ^= crc24_calc(INIT_CRC24, buf,
+							  sizes[i] + 3);
+			}
+			gettimeofday(&end, NULL);
+
+			timersub(&end, &start, &diff);
+			secs = diff.tv_sec + diff.tv_usec / 1000000.0;
+			fprintf(stderr, "FCS of %u frames of %u bytes (%s) "
+				"in %.3f s: %.0f frames/s\n",
+				CRC24_BENCH_FRAMES, sizes[i],
+				k ? "sliced" : "bytewise", secs,
+				secs > 0 ? CRC24_BENCH_FRAMES / secs : 0);
+		}
+	}
+	fprintf(stderr, "(FCS checksum 0x%06x)\n", fcs);
+}
+#endif
+
+static void put_tcp_pkt(uint8_t *pkt, unsigned int len, uint16_t id,
+			uint16_t sport, uint32_t seq, uint32_t ack,
+			uint16_t win, uint8_t flags)
+{
+	uint32_t sum = 0;
+	int i;
+
+	memset(pkt, 0, 40);
+	pkt[0] = 0x45;
+	pkt[2] = len >> 8;
+	pkt[3] = len;
+	pkt[4] = id >> 8;
+	pkt[5] = id;
+	pkt[6] = 0x40;
+	pkt[8] = 64;
+	pkt[9] = 6;
+	memcpy(pkt + 12, "\x0a\x00\x00\x01\xc0\xa8\x00\x01", 8);
+	for (i = 0; i < 20; i += 2)
+		sum += (pkt[i] << 8) | pkt[i + 1];
+	sum = (sum & 0xffff) + (sum >> 16);
+	pkt[10] = ~sum >> 8;
+	pkt[11] = ~sum;
+
+	pkt[20] = sport >> 8;
+	pkt[21] = sport;
+	pkt[23] = 80;
+	for (i = 0; i < 4; i++) {
+		pkt[24 + i] = seq >> (24 - 8 * i);
+		pkt[28 + i] = ack >> (24 - 8 * i);
+	}
+	pkt[32] = 0x50;
+	pkt[33] = flags;
+	pkt[34] = win >> 8;
+	pkt[35] = win;
+	pkt[36] = id;
+	pkt[37] = sport;
+
+	for (i = 40; i < len; i++)
+		pkt[i] = i + id;
+}
+
+static void test_slhc()
+{
+	const char *type_names[] = { "IP", "uncompressed TCP",
+				     "compressed TCP" };
+	struct slhc tx, rx;
+	uint8_t pkt[1500], orig[1500], out[1500 + SLHC_MAX_HDR];
+	unsigned int num[3] = { 0, 0, 0 };
+	unsigned long bytes_in = 0, bytes_out = 0;
+	uint32_t seq[2] = { 1000, 5000 }, ack[2] = { 2000, 6000 };
+	uint16_t id[2] = { 1, 100 };
+	int i, c, len, mismatches = 0;
+
+	printf("Testing RFC 1144 header compression.\n");
+
+	slhc_init(&tx, 16);
+	slhc_init(&rx, 16);
+
+	for (i = 0; i < 200; i++) {
+		enum slhc_type type;
+		uint8_t *hdr, flags = 0x10;
+
+		/* a bulk transfer and an interactive connection */
+		c = i % 5 == 0;
+		len = c ? 41 : 540;
+		if (i < 2)
+			flags = 0x02;
+		else if (i % 7 == 0)
+			flags |= 0x08;
+		put_tcp_pkt(orig, len, id[c]++, 1024 + c, seq[c], ack[c],
+			    8192, flags);
+		seq[c] += len - 40;
+		if (c)
+			ack[c] += 1;
+
+		memcpy(pkt, orig, len);
+		type = slhc_compress(&tx, pkt, len, &hdr);
+		num[type]++;
+		bytes_in += len;
+		bytes_out += pkt + len - hdr;
+
+		if (slhc_uncompress(&rx, type, hdr, pkt + len - hdr, out)
+								!= len ||
+		    memcmp(out, orig, len))
+			mismatches++;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(num); i++)
+		printf("%s: %u\n", type_names[i], num[i]);
+	printf("Checked 200 packets, %d mismatches, %lu bytes saved\n",
+	       mismatches, bytes_in - bytes_out);
+}
+
+enum payload_type {
+	PAYLOAD_HTTP,
+	PAYLOAD_HTML,
+	PAYLOAD_RANDOM,
+};
+
+static const char *payload_names[] = { "HTTP", "HTML", "random" };
+
+/* fill buf with some typical user plane traffic */
+static void put_payload(enum payload_type type, uint8_t *buf,
+			unsigned int len, int seed)
+{
+	const char *words[] = { "the", "mobile", "network", "<b>", "</b>",
+				"GPRS", "and", "of", "to", "data", "page",
+				"<a href=\"/news/", "\">", "</a>", "cell" };
+	char tmp[200];
+	unsigned int pos = 0, n;
+
+	while (pos < len) {
+		switch (type) {
+		case PAYLOAD_HTTP:
+			n = snprintf(tmp, sizeof(tmp), "GET /images/"
+				"icon%d.png HTTP/1.1\r\nHost: www.example.com"
+				"\r\nUser-Agent: Mozilla/5.0\r\nAccept: "
+				"*/*\r\nCookie: id=%08x\r\n\r\n",
+				seed % 50, seed * 7919);
+			break;
+		case PAYLOAD_HTML:
+			n = snprintf(tmp, sizeof(tmp), "%s%s ",
+				     seed % 9 ? "" : "\n<p class=\"text\">",
+				     words[(seed * 31) % ARRAY_SIZE(words)]);
+			break;
+		default:
+			n = 1;
+			tmp[0] = rand();
+			break;
+		}
+		seed++;
+		if (n > len - pos)
+			n = len - pos;
+		memcpy(buf + pos, tmp, n);
+		pos += n;
+	}
+}
+
+static void test_v42bis()
+{
+	uint8_t buf[1400], comp[2 * 1400 + 32], decomp[1400];
+	struct v42bis *v;
+	unsigned long bytes_in, bytes_out;
+	int type, i, rc, mismatches;
+
+	printf("Testing V.42bis compression.\n");
+
+	srand(1);
+	for (type = 0; type < ARRAY_SIZE(payload_names); type++) {
+		v = v42bis_alloc(NULL, 2048, 20);
+		bytes_in = bytes_out = 0;
+		mismatches = 0;
+
+		for (i = 0; i < 200; i++) {
+			unsigned int len = 100 + (i * 37) % 1300;
+
+			put_payload(type, buf, len, i * 13);
+			rc = v42bis_compress(v, buf, len, comp, sizeof(comp));
+			OSMO_ASSERT(rc > 0);
+			bytes_in += len;
+			bytes_out += rc;
+
+			if (v42bis_decompress(v, comp, rc, decomp,
+					      sizeof(decomp)) != len ||
+			    memcmp(buf, decomp, len))
+				mismatches++;
+		}
+		printf("%s: %lu -> %lu bytes, %d mismatches\n",
+		       payload_names[type], bytes_in, bytes_out, mismatches);
+		talloc_free(v);
+	}
+}
+
+#define V42BIS_BENCH_BYTES	(8 * 1024 * 1024)
+
+#ifdef BENCHMARK
+static void bench_v42bis()
+{
+	uint8_t buf[1400], comp[2 * 1400 + 32], decomp[1400];
+	struct timeval start, end, diff[2];
+	struct v42bis *v;
+	unsigned long done;
+	int type, rc, i;
+
+	for (type = 0; type < ARRAY_SIZE(payload_names); type++) {
+		v = v42bis_alloc(NULL, 2048, 20);
+		timerclear(&diff[0]);
+		timerclear(&diff[1]);
+
+		for (done = 0, i = 0; done < V42BIS_BENCH_BYTES; i++) {
+			put_payload(type, buf, sizeof(buf), i);
+			done += sizeof(buf);
+
+			gettimeofday(&start, NULL);
+			rc = v42bis_compress(v, buf, sizeof(buf), comp,
+					     sizeof(comp));
+			gettimeofday(&end, NULL);
+			timersub(&end, &start, &end);
+			timeradd(&diff[0], &end, &diff[0]);
+
+			gettimeofday(&start, NULL);
+			v42bis_decompress(v, comp, rc, decomp, sizeof(decomp));
+			gettimeofday(&end, NULL);
+			timersub(&end, &start, &end);
+			timeradd(&diff[1], &end, &diff[1]);
+		}
+
+		fprintf(stderr, "V.42bis %s: compress %.1f ms/MB, "
+			"decompress %.1f ms/MB\n", payload_names[type],
+			(diff[0].tv_sec * 1000 + diff[0].tv_usec / 1000.0) /
+				(done / 1048576.0),
+			(diff[1].tv_sec * 1000 + diff[1].tv_usec / 1000.0) /
+				(done / 1048576.0));
+		talloc_free(v);
+	}
+}
+#endif
+
+/* N-PDU the SNDCP reassembly test expects next */
+static uint8_t defrag_npdu[1000];
+static int defrag_delivered;
+
+static const uint8_t defrag_cell_id[] = {
+	0x62, 0xf2, 0x24, 0x00, 0x01, 0x02, 0x00, 0x03,
+};
+
+static void send_segment(struct gprs_llc_lle *lle, uint16_t npdu_num,
+			 unsigned int seg_nr, unsigned int num_segs)
+{
+	struct msgb *msg = msgb_alloc(2048, "SNDCP test");
+	unsigned int seg_len = sizeof(defrag_npdu) / num_segs;
+	int first = seg_nr == 0, more = seg_nr + 1 < num_segs;
+	uint8_t *hdr;
+
+	msgb_bcid(msg) = (uint8_t *) defrag_cell_id;
+
+	hdr = msgb_put(msg, 1);
+	/* NSAPI 5, SN-UNITDATA */
+	hdr[0] = 5 | (more << 4) | (1 << 5) | (first << 6);
+	if (first)
+		*msgb_put(msg, 1) = 0;
+	*msgb_put(msg, 1) = (npdu_num >> 8) | (seg_nr << 4);
+	*msgb_put(msg, 1) = npdu_num & 0xff;
+	memcpy(msgb_put(msg, seg_len), defrag_npdu + seg_nr * seg_len, seg_len);
+
+	sndcp_llunitdata_ind(msg, lle, hdr, msg->len);
+	msgb_free(msg);
+}
+
+static void defrag_check(struct gprs_llc_lle *lle, uint16_t npdu_num,
+			 const char *order, int expected)
+{
+	struct gprs_sndcp_entity *sne;
+	const char *c;
+	int i;
+
+	for (i = 0; i < sizeof(defrag_npdu); i++)
+		defrag_npdu[i] = i * 7 + npdu_num;
+
+	defrag_delivered = 0;
+	for (c = order; *c; c++)
+		send_segment(lle, npdu_num, *c - '0', 4);
+
+	sne = llist_entry(gprs_sndcp_entities.next, struct gprs_sndcp_entity,
+			  list);
+	printf("N-PDU %u segments %s: delivered %d%s, timer %s\n", npdu_num,
+	       order, defrag_delivered, defrag_delivered == expected ?
+			"" : " (unexpected)",
+	       osmo_timer_pending(&sne->defrag.timer) ? "running" : "stopped");
+}
+
+static void test_sndcp_defrag()
+{
+	struct gprs_llc_lle *lle;
+	struct gprs_sndcp_entity *sne;
+
+	printf("Testing SNDCP reassembly\n");
+
+	lle = gprs_lle_get_or_create(0xc0000001, GPRS_SAPI_SNDCP3);
+	sndcp_sm_activate_ind(lle, 5, 0);
+	sne = llist_entry(gprs_sndcp_entities.next, struct gprs_sndcp_entity,
+			  list);
+
+	defrag_check(lle, 1, "0123", 1);
+	defrag_check(lle, 2, "3120", 1);
+	defrag_check(lle, 3, "20031", 1);
+	defrag_check(lle, 4, "3302", 0);
+	defrag_check(lle, 4, "1", 1);
+
+	/* the incomplete N-PDU is dropped by the next one */
+	defrag_check(lle, 5, "012", 0);
+	defrag_check(lle, 6, "1320", 1);
+
+	/* and by the reassembly timeout */
+	defrag_check(lle, 7, "03", 0);
+	sne->defrag.timer.cb(sne->defrag.timer.data);
+	defrag_check(lle, 7, "12", 0);
+	defrag_check(lle, 8, "0123", 1);
+
+	/* late duplicates of a delivered N-PDU are dropped, also while the
+	 * next one is being reassembled */
+	defrag_check(lle, 8, "2", 0);
+	defrag_check(lle, 9, "01", 0);
+	defrag_check(lle, 8, "3", 0);
+	defrag_check(lle, 9, "23", 1);
+
+	sndcp_sm_deactivate_ind(lle, 5);
+}
+
+static int gtpu_bench_mode;
+static unsigned long gtpu_rx_count;
+
+static void print_hex(const char *prefix, const uint8_t *data, int len)
+{
+	int i;
+
+	printf("%s", prefix);
+	for (i = 0; i < len; i++)
+		printf(" %02x", data[i]);
+	printf("\n");
+}
+
+static int gtpu_test_rx_cb(struct gtpu_ep *ep, const struct sockaddr_in *from,
+			   uint32_t teid, struct msgb *msg)
+{
+	gtpu_rx_count++;
+
+	if (!gtpu_bench_mode) {
+		printf("G-PDU TEID=0x%08x headroom %s:", teid,
+		       msgb_headroom(msg) >= GTPU_RX_HEADROOM ? "ok" : "short");
+		print_hex("", msg->data, msg->len);
+	}
+
+	msgb_free(msg);
+	return 0;
+}
+
+/* a pair of UDP sockets on the loopback interface, the GGSN side stands
+ * in for the GGSN */
+static int gtpu_socket(struct sockaddr_in *addr)
+{
+	socklen_t addr_len = sizeof(*addr);
+	int fd;
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	OSMO_ASSERT(fd >= 0);
+
+	memset(addr, 0, sizeof(*addr));
+	addr->sin_family = AF_INET;
+	addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	OSMO_ASSERT(bind(fd, (struct sockaddr *) addr, sizeof(*addr)) == 0);
+	OSMO_ASSERT(getsockname(fd, (struct sockaddr *) addr, &addr_len) == 0);
+
+	return fd;
+}
+
+static void test_gtpu()
+{
+	const uint8_t gpdu[] = {
+		0x30, 0xff, 0x00, 0x04, 0x00, 0x00, 0x00, 0x01,
+		0xde, 0xad, 0xbe, 0xef,
+	};
+	const uint8_t gpdu_seq[] = {
+		0x32, 0xff, 0x00, 0x08, 0x00, 0x00, 0x00, 0x02,
+		0x00, 0x05, 0x00, 0x00,
+		0x01, 0x02, 0x03, 0x04,
+	};
+	const uint8_t gpdu_ext[] = {
+		0x34, 0xff, 0x00, 0x0c, 0x00, 0x00, 0x00, 0x03,
+		0x00, 0x00, 0x00, 0x85,
+		0x01, 0xaa, 0xbb, 0x00,
+		0x11, 0x22, 0x33, 0x44,
+	};
+	const uint8_t echo_req[] = {
+		0x32, 0x01, 0x00, 0x04, 0x00, 0x00, 0x00, 0x00,
+		0x12, 0x34, 0x00, 0x00,
+	};
+	const uint8_t error_ind[] = {
+		0x30, 0x1a, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	};
+	const uint8_t gpdu_short[] = {
+		0x30, 0xff, 0x00, 0x10, 0x00, 0x00, 0x00, 0x04,
+		0x01, 0x02,
+	};
+	const uint8_t gpdu_bad_ext[] = {
+		0x34, 0xff, 0x00, 0x04, 0x00, 0x00, 0x00, 0x05,
+		0x00, 0x00, 0x00, 0x85,
+	};
+	const uint8_t *rx_pdus[] = {
+		gpdu, gpdu_seq, gpdu_ext, echo_req, error_ind, gpdu_short,
+		gpdu_bad_ext,
+	};
+	const unsigned int rx_lens[] = {
+		sizeof(gpdu), sizeof(gpdu_seq), sizeof(gpdu_ext),
+		sizeof(echo_req), sizeof(error_ind), sizeof(gpdu_short),
+		sizeof(gpdu_bad_ext),
+	};
+	const uint8_t npdu[] = { 0x45, 0x00, 0x00, 0x14 };
+	uint8_t big[GTPU_MAX_PDU + 1];
+	struct sockaddr_in sgsn_addr, ggsn_addr;
+	struct gtpu_ep ep;
+	uint8_t buf[2048];
+	int ggsn_fd, rc, i;
+
+	printf("Testing GTP-U\n");
+
+	memset(&ep, 0, sizeof(ep));
+	ep.rx_cb = gtpu_test_rx_cb;
+	ep.restart_ctr = 3;
+	OSMO_ASSERT(gtpu_ep_init(NULL, &ep, gtpu_socket(&sgsn_addr)) == 0);
+	ggsn_fd = gtpu_socket(&ggsn_addr);
+
+	for (i = 0; i < ARRAY_SIZE(rx_pdus); i++)
+		sendto(ggsn_fd, rx_pdus[i], rx_lens[i], 0,
+		       (struct sockaddr *) &sgsn_addr, sizeof(sgsn_addr));
+
+	rc = gtpu_rx(&ep);
+	printf("Received %d datagrams in %lu calls: %lu G-PDUs, "
+	       "%lu dropped\n", rc, ep.stats.rx_calls, ep.stats.rx_pkts,
+	       ep.stats.rx_dropped);
+
+	rc = recv(ggsn_fd, buf, sizeof(buf), 0);
+	print_hex("Echo Response:", buf, rc);
+
+	/* uplink G-PDUs are sent together */
+	gtpu_tx(&ep, &ggsn_addr, 0x11223344, -1, npdu, sizeof(npdu));
+	gtpu_tx(&ep, &ggsn_addr, 0x11223344, 7, npdu, sizeof(npdu));
+	gtpu_tx(&ep, &ggsn_addr, 0x55667788, 0xffff, npdu, 2);
+	rc = gtpu_tx(&ep, &ggsn_addr, 0x11223344, -1, big, sizeof(big));
+	printf("Oversized T-PDU: %s\n", rc == -EMSGSIZE ? "rejected" : "sent");
+	printf("Queued G-PDUs, %lu sent, flush %s\n", ep.stats.tx_pkts,
+	       osmo_timer_pending(&ep.tx_timer) ? "pending" : "not pending");
+
+	gtpu_tx_flush(&ep);
+	for (i = 0; i < ep.stats.tx_pkts; i++) {
+		rc = recv(ggsn_fd, buf, sizeof(buf), 0);
+		print_hex("Uplink:", buf, rc);
+	}
+	printf("Sent %lu G-PDUs, %lu dropped, flush %s\n", ep.stats.tx_pkts,
+	       ep.stats.tx_dropped,
+	       osmo_timer_pending(&ep.tx_timer) ? "pending" : "not pending");
+
+	osmo_fd_unregister(&ep.ofd);
+	close(ep.ofd.fd);
+	close(ggsn_fd);
+	talloc_free(ep.batch);
+}
+
+#ifdef BENCHMARK
+/* the GGSN stand-in sends bursts of G-PDUs and receives the same number
+ * of uplink G-PDUs, both over the loopback interface */
+static void bench_gtpu()
+{
+	const unsigned int num_pdus = 200000, pdu_len = 1400;
+	struct sockaddr_in sgsn_addr, ggsn_addr;
+	struct timeval start, end, diff;
+	unsigned int sent = 0, i;
+	uint8_t pdu[8 + 1400], buf[2048];
+	struct gtpu_ep ep;
+	int ggsn_fd;
+	double ms;
+
+	memset(&ep, 0, sizeof(ep));
+	ep.rx_cb = gtpu_test_rx_cb;
+	OSMO_ASSERT(gtpu_ep_init(NULL, &ep, gtpu_socket(&sgsn_addr)) == 0);
+	ggsn_fd = gtpu_socket(&ggsn_addr);
+
+	memset(pdu, 0x2b, sizeof(pdu));
+	pdu[0] = 0x30;
+	pdu[1] = 0xff;
+	pdu[2] = pdu_len >> 8;
+	pdu[3] = pdu_len & 0xff;
+
+	gtpu_bench_mode = 1;
+	gtpu_rx_count = 0;
+	gettimeofday(&start, NULL);
+	while (sent < num_pdus) {
+		for (i = 0; i < GTPU_BATCH; i++)
+			sendto(ggsn_fd, pdu, sizeof(pdu), 0,
+			       (struct sockaddr *) &sgsn_addr,
+			       sizeof(sgsn_addr));
+		sent += GTPU_BATCH;
+		while (gtpu_rx(&ep) > 0)
+			;
+
+		for (i = 0; i < GTPU_BATCH; i++)
+			gtpu_tx(&ep, &ggsn_addr, i, i, pdu + 8, pdu_len);
+		gtpu_tx_flush(&ep);
+		for (i = 0; i < GTPU_BATCH; i++)
+			recv(ggsn_fd, buf, sizeof(buf), MSG_DONTWAIT);
+	}
+	gettimeofday(&end, NULL);
+	gtpu_bench_mode = 0;
+
+	timersub(&end, &start, &diff);
+	ms = diff.tv_sec * 1000 + diff.tv_usec / 1000.0;
+	fprintf(stderr, "GTP-U: %lu downlink G-PDUs in %lu calls, %lu uplink "
+		"G-PDUs in %lu calls, %.1f ms, %.0f G-PDUs/s\n",
+		ep.stats.rx_pkts, ep.stats.rx_calls, ep.stats.tx_pkts,
+		ep.stats.tx_calls, ms,
+		(ep.stats.rx_pkts + ep.stats.tx_pkts) / (ms / 1000));
+
+	osmo_fd_unregister(&ep.ofd);
+	close(ep.ofd.fd);
+	close(ggsn_fd);
+	talloc_free(ep.batch);
+}
+#endif
+
+/* LLC acknowledged operation over a lossy radio link.  The MS side is
+ * modelled here, the frames the SGSN sends end up in abm_dl_queue. */
+#define ABM_TLLI	0xc0000abc
+#define ABM_NUM_PDUS	1000
+#define ABM_PDU_LEN	200
+#define ABM_LOSS_PCT	10
+
+static LLIST_HEAD(abm_dl_queue);
+static int abm_mode;
+static uint32_t abm_rand = 1;
+
+struct abm_ms {
+	int verbose;
+	int lossy;
+	/* next I frame expected in sequence, and the PDUs we hold
+	 * beyond it (index + 1) */
+	uint16_t v_r;
+	uint16_t have[512];
+	unsigned int delivered;
+	unsigned int out_of_seq;
+	unsigned int duplicates;
+	unsigned int ui_received;
+	unsigned int t201_expiries;
+	unsigned long air_frames;
+	unsigned long air_bytes;
+};
+
+int bssgp_tx_dl_ud(struct msgb *msg, uint16_t pdu_lifetime,
+		   struct bssgp_dl_ud_par *dup)
+{
+	msgb_enqueue(&abm_dl_queue, msg);
+	return 0;
+}
+
+/* deterministic loss pattern */
+static int abm_lost(struct abm_ms *ms)
+{
+	if (!ms->lossy)
+		return 0;
+	abm_rand = abm_rand * 1103515245 + 12345;
+	return ((abm_rand >> 16) % 100) < ABM_LOSS_PCT;
+}
+
+/* send a LLC frame of the MS, the FCS is appended here */
+static void abm_ms_tx(struct abm_ms *ms, const uint8_t *frame,
+		      unsigned int len)
+{
+	struct msgb *msg;
+	struct tlv_parsed tp;
+	uint8_t *llch;
+	uint32_t fcs;
+
+	ms->air_frames++;
+	ms->air_bytes += len + 3;
+	if (abm_lost(ms))
+		return;
+
+	msg = msgb_alloc(len + 3, "MS UL");
+	llch = msgb_put(msg, len + 3);
+	memcpy(llch, frame, len);
+	fcs = ~crc24_calc(INIT_CRC24, llch, len) & 0xffffff;
+	llch[len] = fcs & 0xff;
+	llch[len + 1] = (fcs >> 8) & 0xff;
+	llch[len + 2] = (fcs >> 16) & 0xff;
+
+	msgb_tlli(msg) = ABM_TLLI;
+	msgb_llch(msg) = llch;
+	memset(&tp, 0, sizeof(tp));
+	tp.lv[BSSGP_IE_LLC_PDU].len = len + 3;
+	tp.lv[BSSGP_IE_LLC_PDU].val = llch;
+
+	gprs_llc_rcvmsg(msg, &tp);
+	msgb_free(msg);
+}
+
+/* acknowledge the I frames received with a S frame */
+static void abm_ms_tx_sack(struct abm_ms *ms)
+{
+	uint8_t frame[3 + 8];
+	unsigned int n, len = 3;
+
+	memset(frame, 0, sizeof(frame));
+	frame[0] = 0x40 | GPRS_SAPI_SNDCP3;
+	frame[1] = 0x80 | (ms->v_r >> 6);
+	frame[2] = (ms->v_r & 0x3f) << 2;
+	for (n = 1; n < 64; n++) {
+		if (!ms->have[(ms->v_r + n) % 512])
+			continue;
+		frame[3 + (n - 1) / 8] |= 0x80 >> ((n - 1) % 8);
+		len = 3 + (n - 1) / 8 + 1;
+	}
+	if (len > 3)
+		frame[2] |= 3;
+
+	abm_ms_tx(ms, frame, len);
+}
+
+static void abm_ms_rx_i(struct abm_ms *ms, const uint8_t *llch)
+{
+	uint16_t ns = ((llch[1] & 0x1f) << 4) | (llch[2] >> 4);
+	uint16_t idx = (llch[4] << 8) | llch[5];
+
+	if (((ns - ms->v_r) & 0x1ff) >= 64 || ms->have[ns])
+		ms->duplicates++;
+	else
+		ms->have[ns] = idx + 1;
+
+	while (ms->have[ms->v_r]) {
+		if (ms->have[ms->v_r] - 1 != ms->delivered)
+			ms->out_of_seq++;
+		ms->have[ms->v_r] = 0;
+		ms->delivered++;
+		ms->v_r = (ms->v_r + 1) % 512;
+	}
+
+	if (llch[1] & 0x40)
+		abm_ms_tx_sack(ms);
+}
+
+/* process the next frame of the SGSN, 0 when there is none */
+static int abm_ms_rx(struct abm_ms *ms)
+{
+	struct msgb *msg = msgb_dequeue(&abm_dl_queue);
+	uint8_t *llch;
+
+	if (!msg)
+		return 0;
+
+	llch = msg->data;
+	ms->air_frames++;
+	ms->air_bytes += msg->len;
+	if (ms->verbose)
+		print_hex("DL:", msg->data, msg->len);
+
+	if (abm_lost(ms))
+		;
+	else if ((llch[1] & 0x80) == 0)
+		abm_ms_rx_i(ms, llch);
+	else if ((llch[1] & 0xe0) == 0xc0)
+		ms->ui_received++;
+
+	msgb_free(msg);
+	return 1;
+}
+
+/* run until the link is idle, T201 expires when nothing is received */
+static void abm_run(struct gprs_llc_lle *lle, struct abm_ms *ms)
+{
+	for (;;) {
+		while (abm_ms_rx(ms))
+			;
+		if (!osmo_timer_pending(&lle->t201))
+			break;
+		ms->t201_expiries++;
+		lle->t201.cb(lle->t201.data);
+	}
+}
+
+static struct msgb *abm_pdu(unsigned int idx)
+{
+	struct msgb *msg = msgb_alloc_headroom(ABM_PDU_LEN + 256, 128,
+					       "ABM test");
+
+	memset(msgb_put(msg, ABM_PDU_LEN), idx & 0xff, ABM_PDU_LEN);
+	msg->data[0] = idx >> 8;
+	msg->data[1] = idx & 0xff;
+	msgb_tlli(msg) = ABM_TLLI;
+	return msg;
+}
+
+static void test_llc_abm()
+{
+	/* SABM with kD = 32, kU = 4 */
+	const uint8_t sabm[] = { 0x03, 0xf7, 0x25, 0x20, 0x29, 0x04 };
+	/* SN-DATA PDUs of NSAPI 5 in I frames N(S) = 0, 2, 1 */
+	const uint8_t i_frames[3][8] = {
+		{ 0x03, 0x00, 0x00, 0x00, 0x45, 0x00, 0x00, 0xd0 },
+		{ 0x03, 0x00, 0x20, 0x00, 0x45, 0x00, 0x02, 0xd2 },
+		{ 0x03, 0x40, 0x10, 0x00, 0x45, 0x00, 0x01, 0xd1 },
+	};
+	const uint8_t ua[] = { 0x43, 0xf6 };
+	struct gprs_llc_llme *llme;
+	struct gprs_llc_lle *lle;
+	struct abm_ms ms;
+	double ui_goodput;
+	int i;
+
+	printf("Testing LLC acknowledged operation\n");
+
+	lle = gprs_lle_get_or_create(ABM_TLLI, GPRS_SAPI_SNDCP3);
+	llme = lle->llme;
+	gprs_llgmm_assign(llme, 0xffffffff, ABM_TLLI, GPRS_ALGO_GEA0, NULL);
+	sndcp_sm_activate_ind(lle, 5, 0);
+	abm_mode = 1;
+
+	memset(&ms, 0, sizeof(ms));
+	ms.verbose = 1;
+
+	/* the MS establishes ABM, the window sizes are negotiated */
+	abm_ms_tx(&ms, sabm, sizeof(sabm));
+	abm_run(lle, &ms);
+	printf("State %s, kD=%u kU=%u\n",
+	       lle->state == GPRS_LLES_ABM ? "ABM" : "not ABM",
+	       lle->params.kD, lle->params.kU);
+
+	/* uplink I frames are passed up in sequence */
+	for (i = 0; i < ARRAY_SIZE(i_frames); i++)
+		abm_ms_tx(&ms, i_frames[i], sizeof(i_frames[i]));
+	abm_run(lle, &ms);
+
+	/* downlink over a lossy link, first in unacknowledged mode */
+	memset(&ms, 0, sizeof(ms));
+	ms.lossy = 1;
+	for (i = 0; i < ABM_NUM_PDUS; i++) {
+		gprs_llc_tx_ui(abm_pdu(i), GPRS_SAPI_SNDCP3, 1, NULL);
+		abm_run(lle, &ms);
+	}
+	printf("UI: %u of %u N-PDUs delivered\n", ms.ui_received,
+	       ABM_NUM_PDUS);
+	ui_goodput = 100.0 * ms.ui_received * ABM_PDU_LEN / ms.air_bytes;
+	fprintf(stderr, "UI: %lu frames, %lu bytes on the air, goodput "
+		"%.1f%%\n", ms.air_frames, ms.air_bytes, ui_goodput);
+
+	/* and in acknowledged mode */
+	memset(&ms, 0, sizeof(ms));
+	ms.lossy = 1;
+	lle->params.n200 = 20;
+	for (i = 0; i < ABM_NUM_PDUS; i++)
+		OSMO_ASSERT(gprs_llc_tx_i(lle, abm_pdu(i), NULL) == 0);
+	abm_run(lle, &ms);
+	printf("ABM: %u of %u N-PDUs delivered, %u out of sequence, %s\n",
+	       ms.delivered, ABM_NUM_PDUS, ms.out_of_seq,
+	       lle->v_ack == lle->v_sent && !lle->abm->tx_queue_len ?
+			"all acknowledged" : "frames pending");
+	fprintf(stderr, "ABM: %lu frames, %lu bytes on the air, %lu "
+		"retransmissions, %u T201 expiries, %u duplicates, goodput "
+		"%.1f%% (UI %.1f%%)\n", ms.air_frames, ms.air_bytes,
+		lle->abm->stats.retransmissions, ms.t201_expiries,
+		ms.duplicates,
+		100.0 * ms.delivered * ABM_PDU_LEN / ms.air_bytes, ui_goodput);
+
+	/* release */
+	memset(&ms, 0, sizeof(ms));
+	ms.verbose = 1;
+	OSMO_ASSERT(gprs_llc_release(lle) == 0);
+	abm_run(lle, &ms);
+	abm_ms_tx(&ms, ua, sizeof(ua));
+	printf("State %s\n", lle->state == GPRS_LLES_ASSIGNED_ADM ?
+	       "ADM" : "not ADM");
+
+	abm_mode = 0;
+	sndcp_sm_deactivate_ind(lle, 5);
+	gprs_llgmm_assign(llme, ABM_TLLI, 0xffffffff, GPRS_ALGO_GEA0, NULL);
+}
+
+/* SNDCP acknowledged operation: the activation establishes ABM, the
+ * SN-DATA PDUs sent on the downlink are looped back into the uplink */
+static uint8_t ack_npdu[1200];
+static unsigned int ack_npdu_len;
+static int ack_mode;
+
+/* the MS answers the U frames of the SGSN and acknowledges its I frames */
+static void ack_loop_dl(struct gprs_llc_lle *lle, struct abm_ms *ms)
+{
+	const uint8_t ua[] = { 0x43, 0xf6 };
+	struct msgb *msg, *ul;
+	uint8_t *llch, *snh;
+	unsigned int len;
+
+	while ((msg = msgb_dequeue(&abm_dl_queue))) {
+		llch = msg->data;
+		if ((llch[1] & 0x80) == 0) {
+			/* strip the I frame header and the FCS */
+			snh = llch + 4;
+			len = msg->len - 7;
+			printf("SN-DATA NSAPI %u", snh[0] & 0xf);
+			if (snh[0] & 0x40)
+				printf(" F N-PDU %u", snh[2]);
+			printf("%s, %u octets\n", snh[0] & 0x10 ? " M" : "", len);
+
+			ul = msgb_alloc(len, "ACK UL");
+			memcpy(msgb_put(ul, len), snh, len);
+			sndcp_lldata_ind(ul, lle, ul->data, len);
+			msgb_free(ul);
+
+			ms->v_r = (ms->v_r + 1) % 512;
+			if (llch[1] & 0x40)
+				abm_ms_tx_sack(ms);
+		} else if ((llch[1] & 0xef) == 0xe7) {
+			printf("DL: SABM\n");
+			ms->v_r = 0;
+			abm_ms_tx(ms, ua, sizeof(ua));
+		} else if ((llch[1] & 0xef) == 0xe4) {
+			printf("DL: DISC\n");
+			abm_ms_tx(ms, ua, sizeof(ua));
+		} else if ((llch[1] & 0xef) == 0xe6)
+			printf("DL: UA\n");
+		msgb_free(msg);
+	}
+}
+
+static void ack_send(struct gprs_llc_lle *lle, unsigned int len)
+{
+	struct msgb *msg;
+	unsigned int i;
+
+	ack_npdu_len = len;
+	for (i = 0; i < len; i++)
+		ack_npdu[i] = i * 7;
+
+	msg = msgb_alloc_headroom(2048, 128, "ACK test");
+	memcpy(msgb_put(msg, len), ack_npdu, len);
+	msgb_tlli(msg) = ABM_TLLI;
+	OSMO_ASSERT(sndcp_unitdata_req(msg, lle, 5, NULL) == 0);
+}
+
+static const char *ack_state(struct gprs_llc_lle *lle)
+{
+	switch (lle->state) {
+	case GPRS_LLES_ASSIGNED_ADM:
+		return "ADM";
+	case GPRS_LLES_LOCAL_EST:
+		return "local establishment";
+	case GPRS_LLES_ABM:
+		return "ABM";
+	default:
+		return "other";
+	}
+}
+
+static void test_sndcp_ack()
+{
+	const uint8_t disc[] = { 0x03, 0xf4 };
+	const uint8_t dm[] = { 0x43, 0xf1 };
+	struct gprs_llc_llme *llme;
+	struct gprs_llc_lle *lle;
+	struct abm_ms ms;
+	struct msgb *msg;
+	uint8_t *llch;
+	uint32_t iov_i;
+
+	printf("Testing SNDCP acknowledged operation\n");
+
+	lle = gprs_lle_get_or_create(ABM_TLLI, GPRS_SAPI_SNDCP3);
+	llme = lle->llme;
+	gprs_llgmm_assign(llme, 0xffffffff, ABM_TLLI, GPRS_ALGO_GEA0, NULL);
+	lle->params.n201_i = 500;
+	memset(&ms, 0, sizeof(ms));
+	ack_mode = 1;
+
+	/* the activation establishes ABM */
+	OSMO_ASSERT(sndcp_sm_activate_ind(lle, 5, 1) == 0);
+	printf("State %s\n", ack_state(lle));
+	ack_loop_dl(lle, &ms);
+	printf("State %s\n", ack_state(lle));
+
+	/* a N-PDU in three SN-DATA PDUs and one in a single one */
+	ack_send(lle, 1200);
+	ack_loop_dl(lle, &ms);
+	ack_send(lle, 100);
+	ack_loop_dl(lle, &ms);
+	printf("%s\n", lle->v_ack == lle->v_sent ?
+	       "all acknowledged" : "frames pending");
+
+	/* the MS releases, the next N-PDU establishes ABM again */
+	abm_ms_tx(&ms, disc, sizeof(disc));
+	ack_loop_dl(lle, &ms);
+	printf("State %s\n", ack_state(lle));
+	ack_send(lle, 300);
+	ack_loop_dl(lle, &ms);
+	printf("State %s\n", ack_state(lle));
+
+	/* with ciphering, the SABM carries the IOV-I for the I frames */
+	abm_ms_tx(&ms, disc, sizeof(disc));
+	ack_loop_dl(lle, &ms);
+	llme->algo = GPRS_ALGO_GEA1;
+	OSMO_ASSERT(gprs_llc_establish(lle) == 0);
+	msg = msgb_dequeue(&abm_dl_queue);
+	llch = msg->data;
+	iov_i = (llch[4] << 24) | (llch[5] << 16) | (llch[6] << 8) | llch[7];
+	printf("SABM XID %02x %02x, IOV-I %s\n", llch[2], llch[3],
+	       iov_i == lle->iov_i ? "matches" : "differs");
+	msgb_free(msg);
+
+	/* the MS refuses ABM */
+	abm_ms_tx(&ms, dm, sizeof(dm));
+	printf("State %s\n", ack_state(lle));
+	llme->algo = GPRS_ALGO_GEA0;
+
+	ack_mode = 0;
+	sndcp_sm_deactivate_ind(lle, 5);
+	gprs_llgmm_assign(llme, ABM_TLLI, 0xffffffff, GPRS_ALGO_GEA0, NULL);
+}
+
+/* SNDCP header compression negotiated by XID, the downlink N-PDUs are
+ * looped back into the uplink to check the decompressor */
+#define PCOMP_TLLI	0xc0000bcd
+#define PCOMP_NUM_PDUS	20
+
+static uint8_t pcomp_npdu[1500];
+static unsigned int pcomp_npdu_len;
+static int pcomp_mode, pcomp_delivered, pcomp_mismatches;
+
+static struct gprs_sndcp_entity *pcomp_sne(struct gprs_llc_lle *lle,
+					   uint8_t nsapi)
+{
+	struct gprs_sndcp_entity *sne;
+
+	llist_for_each_entry(sne, &gprs_sndcp_entities, list) {
+		if (sne->lle == lle && sne->nsapi == nsapi)
+			return sne;
+	}
+	return NULL;
+}
+
+static void pcomp_print_sne(struct gprs_llc_lle *lle, uint8_t nsapi)
+{
+	struct gprs_sndcp_entity *sne = pcomp_sne(lle, nsapi);
+
+	if (sne->slhc)
+		printf("NSAPI %u: PCOMP %u/%u, %u slots\n", nsapi,
+		       sne->pcomp_utcp, sne->pcomp_ctcp, sne->slhc->num_slots);
+	else
+		printf("NSAPI %u: no header compression\n", nsapi);
+}
+
+/* feed the SN-PDUs sent on the downlink back in on the uplink */
+static void pcomp_loop_dl(struct gprs_llc_lle *lle, unsigned int *num)
+{
+	struct msgb *msg, *ul;
+	uint8_t *snh;
+	unsigned int len;
+
+	while ((msg = msgb_dequeue(&abm_dl_queue))) {
+		/* strip the LLC UI header and the FCS */
+		snh = msg->data + 3;
+		len = msg->len - 6;
+		if (snh[0] & 0x40)
+			num[snh[1] & 0xf]++;
+
+		ul = msgb_alloc(len, "PCOMP UL");
+		memcpy(msgb_put(ul, len), snh, len);
+		msgb_bcid(ul) = (uint8_t *) defrag_cell_id;
+		sndcp_llunitdata_ind(ul, lle, ul->data, len);
+		msgb_free(ul);
+		msgb_free(msg);
+	}
+}
+
+static void test_sndcp_pcomp()
+{
+	/* SNDCP version 0, RFC 1144 entity 0 with PCOMP 1/2 and 32 slots
+	 * on NSAPI 5, RFC 2507 entity 1 on NSAPI 6 */
+	const uint8_t xid[] = {
+		0x00, 0x01, 0x00,
+		0x02, 0x10,
+		0x80, 0x00, 0x04, 0x12, 0x00, 0x20, 0x1f,
+		0x81, 0x01, 0x06, 0x34, 0x56, 0x70, 0x00, 0x40, 0x00,
+	};
+	uint8_t resp[64];
+	unsigned int num[16];
+	uint32_t seq[2] = { 1000, 5000 }, ack[2] = { 2000, 6000 };
+	uint16_t id[2] = { 1, 100 };
+	struct gprs_llc_llme *llme;
+	struct gprs_llc_lle *lle;
+	struct gprs_sndcp_entity *sne;
+	struct msgb *msg;
+	int i, c, rc;
+
+	printf("Testing SNDCP header compression\n");
+
+	lle = gprs_lle_get_or_create(PCOMP_TLLI, GPRS_SAPI_SNDCP3);
+	llme = lle->llme;
+	gprs_llgmm_assign(llme, 0xffffffff, PCOMP_TLLI, GPRS_ALGO_GEA0, NULL);
+	sndcp_sm_activate_ind(lle, 5, 0);
+	sndcp_sm_activate_ind(lle, 6, 0);
+
+	/* the slots are limited, RFC 2507 is rejected */
+	rc = sndcp_llxid_ind(lle, xid, sizeof(xid), resp, sizeof(resp));
+	print_hex("XID:", resp, rc);
+	pcomp_print_sne(lle, 5);
+	pcomp_print_sne(lle, 6);
+
+	/* a bulk transfer that needs segmentation and an interactive
+	 * connection, like in test_slhc() */
+	pcomp_mode = 1;
+	memset(num, 0, sizeof(num));
+	for (i = 0; i < PCOMP_NUM_PDUS; i++) {
+		uint8_t flags = 0x10;
+
+		c = i % 5 == 0;
+		pcomp_npdu_len = c ? 41 : 540;
+		if (i < 2)
+			flags = 0x02;
+		else if (i % 7 == 0)
+			flags |= 0x08;
+		put_tcp_pkt(pcomp_npdu, pcomp_npdu_len, id[c]++, 1024 + c,
+			    seq[c], ack[c], 8192, flags);
+		seq[c] += pcomp_npdu_len - 40;
+		if (c)
+			ack[c] += 1;
+
+		msg = msgb_alloc_headroom(2048, 128, "PCOMP test");
+		memcpy(msgb_put(msg, pcomp_npdu_len), pcomp_npdu,
+		       pcomp_npdu_len);
+		msgb_tlli(msg) = PCOMP_TLLI;
+		OSMO_ASSERT(sndcp_unitdata_req(msg, lle, 5, NULL) == 0);
+		pcomp_loop_dl(lle, num);
+	}
+	pcomp_mode = 0;
+
+	sne = pcomp_sne(lle, 5);
+	printf("PCOMP 0: %u, PCOMP 1: %u, PCOMP 2: %u\n", num[0], num[1],
+	       num[2]);
+	printf("%d of %d N-PDUs delivered, %d mismatches, %lu compressed, "
+	       "bytes saved %s\n", pcomp_delivered, PCOMP_NUM_PDUS,
+	       pcomp_mismatches, sne->pcomp_stats.rx_pkts,
+	       sne->pcomp_stats.tx_bytes_saved ==
+			sne->pcomp_stats.rx_bytes_saved ? "match" : "differ");
+
+	sndcp_sm_deactivate_ind(lle, 6);
+	sndcp_sm_deactivate_ind(lle, 5);
+	gprs_llgmm_assign(llme, PCOMP_TLLI, 0xffffffff, GPRS_ALGO_GEA0, NULL);
+}
+
+/* the upper layers are not part of this test */
+int gsm0408_gprs_rcvmsg(struct msgb *msg, struct gprs_llc_llme *llme)
+{
+	abort();
+}
+
+int sgsn_rx_sndcp_ud_ind(struct gprs_ra_id *ra_id, int32_t tlli, uint8_t nsapi,
+			 struct msgb *msg, uint32_t npdu_len, uint8_t *npdu)
+{
+	if (abm_mode) {
+		print_hex("N-PDU:", npdu, npdu_len);
+		return 0;
+	}
+	if (ack_mode) {
+		printf("N-PDU: %u octets, %s\n", npdu_len,
+		       npdu_len == ack_npdu_len &&
+		       !memcmp(npdu, ack_npdu, npdu_len) ? "match" : "mismatch");
+		return 0;
+	}
+	if (pcomp_mode) {
+		if (npdu_len != pcomp_npdu_len ||
+		    memcmp(npdu, pcomp_npdu, npdu_len))
+			pcomp_mismatches++;
+		pcomp_delivered++;
+		return 0;
+	}
+	if (npdu_len != sizeof(defrag_npdu) ||
+	    memcmp(npdu, defrag_npdu, npdu_len))
+		printf("N-PDU mismatch (%u bytes)\n", npdu_len);
+	defrag_delivered++;
+	return 0;
+}
+
 int main(int argc, char **argv)
 {
+	osmo_init_logging(&log_info);
+
 	test_8_4_2();
+	test_llme_tlli_hash();
+	test_crc24();
+#ifdef BENCHMARK
+	bench_crc24();
+#endif
+	test_slhc();
+	test_v42bis();
+#ifdef BENCHMARK
+	bench_v42bis();
+#endif
+	test_sndcp_defrag();
+	test_gtpu();
+#ifdef BENCHMARK
+	bench_gtpu();
+#endif
+	test_llc_abm();
+	test_sndcp_pcomp();
+	test_sndcp_ack();
 
 	printf("Done.\n");
 	return EXIT_SUCCESS;
@@ -0,0 +1,586 @@
+/* Replay of recorded measurement results through the RSL receive path,
+ * checking the running averages, and the handover decisions of both
+ * algorithms driven to completion or failure */
+/*
+ * (C) 2026 by the OpenBSC contributors
+ * All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <osmocom/core/application.h>
+#include <osmocom/core/msgb.h>
+#include <osmocom/core/utils.h>
+
+#include <osmocom/core/signal.h>
+#include <osmocom/core/talloc.h>
+
+#include <openbsc/gsm_data.h>
+#include <openbsc/gsm_subscriber.h>
+#include <openbsc/signal.h>
+#include <openbsc/abis_rsl.h>
+#include <openbsc/chan_alloc.h>
+#include <openbsc/meas_rep.h>
+#include <openbsc/handover_decision.h>
+#include <openbsc/debug.h>
+
+#define BENCH_ROUNDS	5000
+
+static const uint16_t neigh_arfcns[] = { 10, 20, 30, 40, 50, 60, 70, 80 };
+
+/*
+ * RSL MEASUREMENT RESULT messages of a TCH/F on TS2 recorded while the
+ * MS moves away from the serving cell towards ARFCN 30.  Starting with
+ * NR=14 the downlink quality drops to RXQUAL 5.
+ */
+static const uint8_t meas_res[][37] = {
+	{
+		0x08, 0x28, 0x01, 0x0a, 0x1b, 0x00, 0x19, 0x03,
+		0x26, 0x25, 0x00, 0x04, 0x00, 0x0a, 0x50, 0x01,
+		0x0b, 0x00, 0x12, 0x06, 0x15, 0x28, 0x27, 0x01,
+		0x0f, 0x10, 0xaf, 0x00, 0x16, 0x48, 0x49, 0x85,
+		0x28, 0x00, 0x00, 0x00, 0x00,
+	},
+	{
+		0x08, 0x28, 0x01, 0x0a, 0x1b, 0x01, 0x19, 0x03,
+		0x25, 0x24, 0x00, 0x04, 0x00, 0x0a, 0x50, 0x01,
+		0x0b, 0x00, 0x12, 0x06, 0x15, 0x27, 0x26, 0x01,
+		0x11, 0x10, 0xaf, 0x00, 0x16, 0x88, 0x49, 0x86,
+		0x2c, 0x00, 0x00, 0x00, 0x00,
+	},
+	{
+		0x08, 0x28, 0x01, 0x0a, 0x1b, 0x02, 0x19, 0x03,
+		0x24, 0x23, 0x00, 0x04, 0x00, 0x0a, 0x50, 0x01,
+		0x0b, 0x00, 0x12, 0x06, 0x15, 0x26, 0x25, 0x01,
+		0x13, 0x10, 0xaf, 0x00, 0x16, 0xc8, 0x49, 0x87,
+		0x30, 0x00, 0x00, 0x00, 0x00,
+	},
+	{
+		0x08, 0x28, 0x01, 0x0a, 0x1b, 0x03, 0x19, 0x03,
+		0x23, 0x22, 0x00, 0x04, 0x00, 0x0a, 0x50, 0x01,
+		0x0b, 0x00, 0x12, 0x06, 0x15, 0x25, 0x24, 0x01,
+		0x15, 0x10, 0xaf, 0x00, 0x16, 0x48, 0x49, 0x85,
+		0x34, 0x00, 0x00, 0x00, 0x00,
+	},
+	{
+		0x08, 0x28, 0x01, 0x0a, 0x1b, 0x04, 0x19, 0x03,
+		0x22, 0x21, 0x00, 0x04, 0x00, 0x0a, 0x50, 0x01,
+		0x0b, 0x00, 0x12, 0x06, 0x15, 0x24, 0x23, 0x01,
+		0x17, 0x10, 0xaf, 0x00, 0x16, 0x88, 0x49, 0x86,
+		0x28, 0x00, 0x00, 0x00, 0x00,
+	},
+	{
+		0x08, 0x28, 0x01, 0x0a, 0x1b, 0x05, 0x19, 0x03,
+		0x21, 0x20, 0x00, 0x04, 0x00, 0x0a, 0x50, 0x01,
+		0x0b, 0x00, 0x12, 0x06, 0x15, 0x23, 0x22, 0x01,
+		0x19, 0x10, 0xaf, 0x00, 0x16, 0xc8, 0x49, 0x87,
+		0x2c, 0x00, 0x00, 0x00, 0x00,
+	},
+	{
+		0x08, 0x28, 0x01, 0x0a, 0x1b, 0x06, 0x19, 0x03,
+		0x20, 0x1f, 0x00, 0x04, 0x00, 0x0a, 0x50, 0x01,
+		0x0b, 0x00, 0x12, 0x06, 0x15, 0x22, 0x21, 0x01,
+		0x1b, 0x10, 0xaf, 0x00, 0x16, 0x48, 0x49, 0x85,
+		0x30, 0x00, 0x00, 0x00, 0x00,
+	},
+	{
+		0x08, 0x28, 0x01, 0x0a, 0x1b, 0x07, 0x19, 0x03,
+		0x1f, 0x1e, 0x00, 0x04, 0x00, 0x0a, 0x50, 0x01,
+		0x0b, 0x00, 0x12, 0x06, 0x15, 0x21, 0x20, 0x01,
+		0x1d, 0x10, 0xaf, 0x00, 0x16, 0x88, 0x49, 0x86,
+		0x34, 0x00, 0x00, 0x00, 0x00,
+	},
+	{
+		0x08, 0x28, 0x01, 0x0a, 0x1b, 0x08, 0x19, 0x03,
+		0x1e, 0x1d, 0x00, 0x04, 0x00, 0x0a, 0x50, 0x01,
+		0x0b, 0x00, 0x12, 0x06, 0x15, 0x20, 0x1f, 0x01,
+		0x1f, 0x10, 0xaf, 0x00, 0x16, 0xc8, 0x49, 0x87,
+		0x28, 0x00, 0x00, 0x00, 0x00,
+	},
+	{
+		0x08, 0x28, 0x01, 0x0a, 0x1b, 0x09, 0x19, 0x03,
+		0x1d, 0x1c, 0x00, 0x04, 0x00, 0x0a, 0x50, 0x01,
+		0x0b, 0x00, 0x12, 0x06, 0x15, 0x1f, 0x1e, 0x01,
+		0x21, 0x10, 0xaf, 0x00, 0x16, 0x48, 0x49, 0x85,
+		0x2c, 0x00, 0x00, 0x00, 0x00,
+	},
+	{
+		0x08, 0x28, 0x01, 0x0a, 0x1b, 0x0a, 0x19, 0x03,
+		0x1c, 0x1b, 0x00, 0x04, 0x00, 0x0a, 0x50, 0x01,
+		0x0b, 0x00, 0x12, 0x06, 0x15, 0x1e, 0x1d, 0x01,
+		0x23, 0x10, 0xaf, 0x00, 0x16, 0x88, 0x49, 0x86,
+		0x30, 0x00, 0x00, 0x00, 0x00,
+	},
+	{
+		0x08, 0x28, 0x01, 0x0a, 0x1b, 0x0b, 0x19, 0x03,
+		0x1b, 0x1a, 0x00, 0x04, 0x00, 0x0a, 0x50, 0x01,
+		0x0b, 0x00, 0x12, 0x06, 0x15, 0x1d, 0x1c, 0x01,
+		0x25, 0x10, 0xaf, 0x00, 0x16, 0xc8, 0x49, 0x87,
+		0x34, 0x00, 0x00, 0x00, 0x00,
+	},
+	{
+		0x08, 0x28, 0x01, 0x0a, 0x1b, 0x0c, 0x19, 0x03,
+		0x1a, 0x19, 0x00, 0x04, 0x00, 0x0a, 0x50, 0x01,
+		0x0b, 0x00, 0x12, 0x06, 0x15, 0x1c, 0x1b, 0x01,
+		0x27, 0x10, 0xaf, 0x00, 0x16, 0x48, 0x49, 0x85,
+		0x28, 0x00, 0x00, 0x00, 0x00,
+	},
+	{
+		0x08, 0x28, 0x01, 0x0a, 0x1b, 0x0d, 0x19, 0x03,
+		0x19, 0x18, 0x00, 0x04, 0x00, 0x0a, 0x50, 0x01,
+		0x0b, 0x00, 0x12, 0x06, 0x15, 0x1b, 0x1a, 0x01,
+		0x29, 0x10, 0xaf, 0x00, 0x16, 0x88, 0x49, 0x86,
+		0x2c, 0x00, 0x00, 0x00, 0x00,
+	},
+	{
+		0x08, 0x28, 0x01, 0x0a, 0x1b, 0x0e, 0x19, 0x03,
+		0x18, 0x17, 0x00, 0x04, 0x00, 0x0a, 0x50, 0x01,
+		0x0b, 0x00, 0x12, 0x06, 0x15, 0x1a, 0x19, 0x5b,
+		0x2b, 0x10, 0xaf, 0x00, 0x16, 0xc8, 0x49, 0x87,
+		0x30, 0x00, 0x00, 0x00, 0x00,
+	},
+	{
+		0x08, 0x28, 0x01, 0x0a, 0x1b, 0x0f, 0x19, 0x03,
+		0x17, 0x16, 0x00, 0x04, 0x00, 0x0a, 0x50, 0x01,
+		0x0b, 0x00, 0x12, 0x06, 0x15, 0x19, 0x18, 0x5b,
+		0x2d, 0x10, 0xaf, 0x00, 0x16, 0x48, 0x49, 0x85,
+		0x34, 0x00, 0x00, 0x00, 0x00,
+	},
+	{
+		0x08, 0x28, 0x01, 0x0a, 0x1b, 0x10, 0x19, 0x03,
+		0x16, 0x15, 0x00, 0x04, 0x00, 0x0a, 0x50, 0x01,
+		0x0b, 0x00, 0x12, 0x06, 0x15, 0x18, 0x17, 0x5b,
+		0x2f, 0x10, 0xaf, 0x00, 0x16, 0x88, 0x49, 0x86,
+		0x28, 0x00, 0x00, 0x00, 0x00,
+	},
+	{
+		0x08, 0x28, 0x01, 0x0a, 0x1b, 0x11, 0x19, 0x03,
+		0x15, 0x14, 0x00, 0x04, 0x00, 0x0a, 0x50, 0x01,
+		0x0b, 0x00, 0x12, 0x06, 0x15, 0x17, 0x16, 0x5b,
+		0x31, 0x10, 0xaf, 0x00, 0x16, 0xc8, 0x49, 0x87,
+		0x2c, 0x00, 0x00, 0x00, 0x00,
+	},
+	{
+		0x08, 0x28, 0x01, 0x0a, 0x1b, 0x12, 0x19, 0x03,
+		0x14, 0x13, 0x00, 0x04, 0x00, 0x0a, 0x50, 0x01,
+		0x0b, 0x00, 0x12, 0x06, 0x15, 0x16, 0x15, 0x5b,
+		0x33, 0x10, 0xaf, 0x00, 0x16, 0x48, 0x49, 0x85,
+		0x30, 0x00, 0x00, 0x00, 0x00,
+	},
+	{
+		0x08, 0x28, 0x01, 0x0a, 0x1b, 0x13, 0x19, 0x03,
+		0x13, 0x12, 0x00, 0x04, 0x00, 0x0a, 0x50, 0x01,
+		0x0b, 0x00, 0x12, 0x06, 0x15, 0x15, 0x14, 0x5b,
+		0x35, 0x10, 0xaf, 0x00, 0x16, 0x88, 0x49, 0x86,
+		0x34, 0x00, 0x00, 0x00, 0x00,
+	},
+};
+
+static struct e1inp_sign_link sign_link;
+
+/* the RSL messages towards the BTS are not looked at */
+int abis_rsl_sendmsg(struct msgb *msg)
+{
+	msgb_free(msg);
+	return 0;
+}
+
+static void replay(struct gsm_lchan *lchan, const uint8_t *data, int len)
+{
+	struct msgb *msg = msgb_alloc(128, "meas res");
+
+	msg->l2h = msgb_put(msg, len);
+	memcpy(msg->l2h, data, len);
+	msg->dst = &sign_link;
+
+	abis_rsl_rcvmsg(msg);
+}
+
+/* the average as calculated from the measurement report cache */
+static int cached_avg(struct gsm_lchan *lchan, unsigned int num)
+{
+	unsigned int i, idx;
+	int avg = 0;
+
+	idx = calc_initial_idx(ARRAY_SIZE(lchan->meas_rep),
+				lchan->meas_rep_idx, num);
+	for (i = 0; i < num; i++) {
+		int j = (idx + i) % ARRAY_SIZE(lchan->meas_rep);
+		avg += lchan->meas_rep[j].dl.full.rx_lev;
+	}
+
+	return avg / num;
+}
+
+static int neigh_avg(struct neigh_meas_tbl *nmt, int slot, unsigned int num)
+{
+	uint16_t sum, old = 0;
+
+	sum = nmt->rxlev_sum[nmt->rxlev_cnt % ARRAY_SIZE(nmt->rxlev_sum)][slot];
+	if (nmt->rxlev_cnt >= num)
+		old = nmt->rxlev_sum[(nmt->rxlev_cnt - num)
+					% ARRAY_SIZE(nmt->rxlev_sum)][slot];
+	return (uint16_t)(sum - old) / num;
+}
+
+static void test_meas_replay(struct gsm_lchan *lchan)
+{
+	struct neigh_meas_tbl *nmt = &lchan->neigh_meas;
+	int i;
+
+	printf("Testing measurement result replay\n");
+
+	for (i = 0; i < ARRAY_SIZE(meas_res); i++) {
+		struct gsm_meas_rep *mr;
+		int avg4, avg6;
+
+		replay(lchan, meas_res[i], sizeof(meas_res[i]));
+
+		mr = &lchan->meas_rep[calc_initial_idx(ARRAY_SIZE(lchan->meas_rep),
+						       lchan->meas_rep_idx, 1)];
+		avg4 = get_meas_rep_avg(lchan, MEAS_REP_DL_RXLEV_FULL, 4);
+		avg6 = get_meas_rep_avg(lchan, MEAS_REP_DL_RXLEV_FULL, 6);
+		printf("nr=%02u dl_full=%2u avg4=%2d avg6=%2d\n",
+			mr->nr, mr->dl.full.rx_lev, avg4, avg6);
+
+		if (avg4 != cached_avg(lchan, 4) || avg6 != cached_avg(lchan, 6))
+			printf("Average mismatch: %d/%d vs. %d/%d\n",
+				avg4, avg6, cached_avg(lchan, 4),
+				cached_avg(lchan, 6));
+	}
+
+	for (i = 0; i < MAX_NEIGH_MEAS; i++) {
+		if (!nmt->key[i])
+			continue;
+		printf("slot %d: ARFCN %u BSIC %u last_seen=%u avg=%d\n", i,
+			NEIGH_MEAS_KEY_ARFCN(nmt->key[i]),
+			NEIGH_MEAS_KEY_BSIC(nmt->key[i]),
+			nmt->last_seen_nr[i], neigh_avg(nmt, i, MAX_WIN_NEIGH_AVG));
+	}
+}
+
+static void test_tch_load(struct gsm_bts *bts)
+{
+	struct gsm_lchan *lchan[3];
+
+	printf("Testing TCH load accounting\n");
+	printf("total=%u used=%u\n", bts_tch_total(bts), bts->tch_used);
+
+	lchan[0] = lchan_alloc(bts, GSM_LCHAN_TCH_F, 0);
+	lchan[1] = lchan_alloc(bts, GSM_LCHAN_TCH_F, 0);
+	lchan[2] = lchan_alloc(bts, GSM_LCHAN_TCH_H, 0);
+	printf("total=%u used=%u\n", bts_tch_total(bts), bts->tch_used);
+
+	lchan_free(lchan[2]);
+	printf("total=%u used=%u\n", bts_tch_total(bts), bts->tch_used);
+
+	/* freeing twice must not account the channel twice */
+	lchan_free(lchan[2]);
+	lchan_free(lchan[0]);
+	lchan_free(lchan[1]);
+	printf("total=%u used=%u\n", bts_tch_total(bts), bts->tch_used);
+}
+
+static void lchan_signal(struct gsm_lchan *lchan, int signal)
+{
+	struct lchan_signal_data sig;
+
+	sig.lchan = lchan;
+	sig.mr = NULL;
+	osmo_signal_dispatch(SS_LCHAN, signal, &sig);
+}
+
+/* a call on a TCH/F of the given BTS */
+static struct gsm_subscriber_connection *call_start(struct gsm_bts *bts)
+{
+	struct gsm_subscriber_connection *conn;
+	struct gsm_lchan *lchan;
+
+	lchan = lchan_alloc(bts, GSM_LCHAN_TCH_F, 0);
+	rsl_lchan_set_state(lchan, LCHAN_S_ACTIVE);
+
+	conn = talloc_zero(NULL, struct gsm_subscriber_connection);
+	conn->subscr = subscr_alloc();
+	conn->subscr->net = bts->network;
+	conn->lchan = lchan;
+	lchan->conn = conn;
+
+	return conn;
+}
+
+/* the BTS acknowledged the release of the channel */
+static void rel_ack(struct gsm_lchan *lchan)
+{
+	rsl_lchan_set_state(lchan, LCHAN_S_NONE);
+	lchan_free(lchan);
+}
+
+static void call_end(struct gsm_subscriber_connection *conn)
+{
+	struct gsm_lchan *lchan = conn->lchan;
+
+	lchan->conn = NULL;
+	rel_ack(lchan);
+	subscr_put(conn->subscr);
+	talloc_free(conn);
+}
+
+/* feed a measurement report into the handover decision, every neighbor
+ * with a non-zero rxlev is reported */
+static void send_meas_rep(struct gsm_subscriber_connection *conn,
+			  uint8_t rxlev, uint8_t rxqual,
+			  struct gsm_bts **neigh, const uint8_t *neigh_rxlev,
+			  int num_neigh)
+{
+	struct gsm_lchan *lchan = conn->lchan;
+	struct lchan_signal_data sig;
+	struct gsm_meas_rep *mr;
+	int i;
+
+	mr = lchan_next_meas_rep(lchan);
+	mr->nr = lchan->meas_sums.num + 1;
+	mr->flags = MEAS_REP_F_DL_VALID;
+	mr->dl.full.rx_lev = mr->dl.sub.rx_lev = rxlev;
+	mr->dl.full.rx_qual = mr->dl.sub.rx_qual = rxqual;
+	mr->ul = mr->dl;
+
+	for (i = 0; i < num_neigh; i++) {
+		struct gsm_meas_rep_cell *mrc;
+
+		if (!neigh_rxlev[i])
+			continue;
+		mrc = &mr->cell[mr->num_cell++];
+		mrc->rxlev = neigh_rxlev[i];
+		mrc->arfcn = neigh[i]->c0->arfcn;
+		mrc->bsic = neigh[i]->bsic;
+		mrc->neigh_idx = i;
+	}
+
+	meas_rep_sums_add(&lchan->meas_sums, mr);
+
+	sig.lchan = lchan;
+	sig.mr = mr;
+	osmo_signal_dispatch(SS_LCHAN, S_LCHAN_MEAS_REP, &sig);
+}
+
+static void print_ho(const char *name, struct gsm_subscriber_connection *conn)
+{
+	printf("%s: on %s", name, gsm_lchan_name(conn->lchan));
+	if (conn->ho_lchan)
+		printf(", handover to %s", gsm_lchan_name(conn->ho_lchan));
+	printf("\n");
+}
+
+/* the batch timer of algorithm 2 has expired */
+static void ho_batch(struct gsm_network *net)
+{
+	net->handover.batch_timer.cb(net->handover.batch_timer.data);
+}
+
+/* the BTS activates the new channel and the MS arrives on it */
+static void ho_complete(struct gsm_subscriber_connection *conn)
+{
+	struct gsm_lchan *old_lchan = conn->lchan;
+	struct gsm_lchan *new_lchan = conn->ho_lchan;
+
+	rsl_lchan_set_state(new_lchan, LCHAN_S_ACTIVE);
+	lchan_signal(new_lchan, S_LCHAN_ACTIVATE_ACK);
+	lchan_signal(new_lchan, S_LCHAN_HANDOVER_COMPL);
+	rel_ack(old_lchan);
+}
+
+/* the BTS activates the new channel but the MS returns with HO FAIL */
+static void ho_fail(struct gsm_subscriber_connection *conn)
+{
+	struct gsm_lchan *new_lchan = conn->ho_lchan;
+
+	rsl_lchan_set_state(new_lchan, LCHAN_S_ACTIVE);
+	lchan_signal(new_lchan, S_LCHAN_ACTIVATE_ACK);
+	lchan_signal(conn->lchan, S_LCHAN_HANDOVER_FAIL);
+	rel_ack(new_lchan);
+}
+
+static const char *ho_reasons[_NUM_HO_REASON] = {
+	[HO_REASON_INTERFERENCE]	= "interference",
+	[HO_REASON_BAD_QUALITY]		= "bad quality",
+	[HO_REASON_LOW_LEVEL]		= "low level",
+	[HO_REASON_MAX_DISTANCE]	= "distance",
+	[HO_REASON_POWER_BUDGET]	= "power budget",
+	[HO_REASON_CONGESTION]		= "congestion",
+};
+
+/*
+ * The serving cell has two TCH/F, its two neighbors have four TCH/F
+ * each.  All averaging windows are a single report, so every decision
+ * is made on the last report.
+ */
+static void test_ho_decision(struct gsm_network *net, struct gsm_bts *bts,
+			     struct gsm_bts **neigh)
+{
+	struct gsm_subscriber_connection *a, *b, *c1, *c2;
+	int i;
+
+	printf("Testing handover decisions\n");
+
+	net->handover.active = 1;
+	net->handover.win_rxlev_avg = 1;
+	net->handover.win_rxlev_avg_neigh = 1;
+
+	/* algorithm 1: the quality drops in three out of four reports */
+	net->handover.algorithm = 1;
+	a = call_start(bts);
+	send_meas_rep(a, 20, 0, neigh, (const uint8_t []) { 30, 0 }, 2);
+	send_meas_rep(a, 20, 6, neigh, (const uint8_t []) { 30, 0 }, 2);
+	send_meas_rep(a, 20, 6, neigh, (const uint8_t []) { 30, 0 }, 2);
+	print_ho("a", a);
+	send_meas_rep(a, 20, 6, neigh, (const uint8_t []) { 30, 0 }, 2);
+	print_ho("a", a);
+	ho_complete(a);
+	print_ho("a", a);
+
+	/* algorithm 2: power budget, but the MS fails to reach the cell */
+	net->handover.algorithm = 2;
+	b = call_start(bts);
+	send_meas_rep(b, 20, 0, neigh, (const uint8_t []) { 0, 40 }, 2);
+	print_ho("b", b);
+	ho_batch(net);
+	print_ho("b", b);
+	ho_fail(b);
+	print_ho("b", b);
+	call_end(b);
+
+	/* algorithm 2: no neighbor is better, but the serving cell has to
+	 * keep half of its TCH free.  The call losing the least moves. */
+	net->handover.congestion_min_free = 50;
+	c1 = call_start(bts);
+	c2 = call_start(bts);
+	send_meas_rep(c1, 30, 0, neigh, (const uint8_t []) { 25, 20 }, 2);
+	send_meas_rep(c2, 30, 0, neigh, (const uint8_t []) { 28, 0 }, 2);
+	ho_batch(net);
+	print_ho("c1", c1);
+	print_ho("c2", c2);
+	ho_complete(c2);
+	print_ho("c2", c2);
+
+	/* the load is balanced now */
+	ho_batch(net);
+	print_ho("c1", c1);
+
+	osmo_timer_del(&net->handover.batch_timer);
+	net->handover.active = 0;
+
+	printf("attempted=%lu no_channel=%lu timeout=%lu completed=%lu "
+		"failed=%lu\n",
+		osmo_counter_get(net->stats.handover.attempted),
+		osmo_counter_get(net->stats.handover.no_channel),
+		osmo_counter_get(net->stats.handover.timeout),
+		osmo_counter_get(net->stats.handover.completed),
+		osmo_counter_get(net->stats.handover.failed));
+	for (i = 0; i < _NUM_HO_REASON; i++)
+		printf("%s: %lu completed, %lu failed\n", ho_reasons[i],
+			osmo_counter_get(net->stats.handover.reason_completed[i]),
+			osmo_counter_get(net->stats.handover.reason_failed[i]));
+}
+
+#ifdef BENCHMARK
+static void bench_meas_replay(struct gsm_lchan *lchan)
+{
+	struct timeval start, end, diff;
+	unsigned int num;
+	double secs;
+	int i, j;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < BENCH_ROUNDS; i++)
+		for (j = 0; j < ARRAY_SIZE(meas_res); j++)
+			replay(lchan, meas_res[j], sizeof(meas_res[j]));
+	gettimeofday(&end, NULL);
+
+	timersub(&end, &start, &diff);
+	secs = diff.tv_sec + diff.tv_usec / 1000000.0;
+	num = BENCH_ROUNDS * ARRAY_SIZE(meas_res);
+	fprintf(stderr, "Replayed %u measurement results in %.3f s: %.0f/s\n",
+		num, secs, secs > 0 ? num / secs : 0);
+}
+#endif
+
+static struct gsm_bts *alloc_bts(struct gsm_network *net, uint16_t arfcn,
+				 uint8_t bsic, int num_tch)
+{
+	struct gsm_bts *bts;
+	int i;
+
+	bts = gsm_bts_alloc_register(net, GSM_BTS_TYPE_UNKNOWN,
+				     HARDCODED_TSC, bsic);
+	bts->band = GSM_BAND_900;
+	bts->c0->arfcn = arfcn;
+	for (i = 1; i <= num_tch; i++)
+		bts->c0->ts[i].pchan = GSM_PCHAN_TCH_F;
+
+	return bts;
+}
+
+int main(int argc, char **argv)
+{
+	struct gsm_network *network;
+	struct gsm_bts *bts, *neigh[2];
+	struct gsm_lchan *lchan;
+	int i;
+
+	osmo_init_logging(&log_info);
+	log_set_log_level(osmo_stderr_target, LOGL_FATAL);
+
+	network = gsm_network_init(1, 1, NULL);
+	if (!network)
+		return EXIT_FAILURE;
+	bts = gsm_bts_alloc_register(network, GSM_BTS_TYPE_UNKNOWN,
+				     HARDCODED_TSC, HARDCODED_BSIC);
+	bts->band = GSM_BAND_900;
+	for (i = 0; i < ARRAY_SIZE(neigh_arfcns); i++)
+		bitvec_set_bit_pos(&bts->si_common.neigh_list,
+				   neigh_arfcns[i], 1);
+	sign_link.trx = bts->c0;
+
+	bts->c0->ts[2].pchan = GSM_PCHAN_TCH_F;
+	bts->c0->ts[3].pchan = GSM_PCHAN_TCH_F;
+	bts->c0->ts[4].pchan = GSM_PCHAN_TCH_F;
+	bts->c0->ts[5].pchan = GSM_PCHAN_TCH_H;
+	test_tch_load(bts);
+
+	lchan = &bts->c0->ts[2].lchan[0];
+	lchan->type = GSM_LCHAN_TCH_F;
+	lchan->state = LCHAN_S_ACTIVE;
+
+	on_dso_load_ho_dec();
+
+	test_meas_replay(lchan);
+
+	bts = alloc_bts(network, 100, 1, 2);
+	neigh[0] = alloc_bts(network, 110, 2, 4);
+	neigh[1] = alloc_bts(network, 120, 3, 4);
+	test_ho_decision(network, bts, neigh);
+
+#ifdef BENCHMARK
+	bench_meas_replay(lchan);
+#endif
+
+	printf("Done.\n");
+	return EXIT_SUCCESS;
+}
@@ -19,11 +19,18 @@
 
 #include <openbsc/mgcp.h>
 #include <openbsc/mgcp_internal.h>
+#include <openbsc/mgcp_transcode.h>
+#include <openbsc/mgcp_jitter.h>
+#include <openbsc/mgcp_capture.h>
 
 #include <osmocom/core/application.h>
 #include <osmocom/core/talloc.h>
 #include <string.h>
 #include <limits.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <arpa/inet.h>
 
 #define AUEP1	"AUEP 158663169 ds/e1-1/2@172.16.6.66 MGCP 1.0\r\n"
 #define AUEP1_RET "200 158663169 OK\r\n"
@@ -225,6 +232,755 @@ static void test_retransmission(void)
 	talloc_free(cfg);
 }
 
+static struct msgb *handle_str(struct mgcp_config *cfg, const char *str)
+{
+	struct msgb *inp, *msg;
+
+	inp = create_msg(str);
+	msg = mgcp_handle_message(cfg, inp);
+	msgb_free(inp);
+	return msg;
+}
+
+/* a re-transmission of any recent command is answered from the cache */
+static void test_retransmission_window(void)
+{
+	struct mgcp_config *cfg;
+	struct msgb *msg;
+	char rqnt[128];
+	int i;
+
+	printf("Testing re-transmission window\n");
+
+	cfg = mgcp_config_alloc();
+	cfg->trunk.number_endpoints = 64;
+	mgcp_endpoints_allocate(&cfg->trunk);
+
+	msgb_free(handle_str(cfg, CRCX));
+	msgb_free(handle_str(cfg, RQNT));
+	msgb_free(handle_str(cfg, MDCX3));
+
+	/* executing the CRCX again would fail, the endpoint is in use */
+	msg = handle_str(cfg, CRCX);
+	printf("CRCX after MDCX: %s\n",
+	       strcmp((char *) msg->data, CRCX_RET) == 0 ? "cached" : "executed");
+	msgb_free(msg);
+
+	for (i = 0; i < MGCP_TRANS_CACHE_SIZE; ++i) {
+		snprintf(rqnt, sizeof(rqnt),
+			 "RQNT %d 1@mgw MGCP 1.0\r\nX: B244F267488\r\n", 1000 + i);
+		msgb_free(handle_str(cfg, rqnt));
+	}
+
+	msg = handle_str(cfg, CRCX);
+	printf("CRCX after %d RQNT: %.10s\n", MGCP_TRANS_CACHE_SIZE,
+	       (char *) msg->data);
+	msgb_free(msg);
+
+	msgb_free(handle_str(cfg, DLCX));
+	msg = handle_str(cfg, DLCX);
+	printf("DLCX re-transmitted: %s\n",
+	       strcmp((char *) msg->data, DLCX_RET) == 0 ? "cached" : "executed");
+	msgb_free(msg);
+
+	talloc_free(cfg);
+}
+
+static uint32_t fuzz_rand(uint32_t *state)
+{
+	*state = *state * 1103515245 + 12345;
+	return *state >> 16;
+}
+
+#define FUZZ_CANARY	0xa5
+#define FUZZ_PAD	16
+
+/* check that the parser stays inside of the message */
+static int check_parsed(const struct mgcp_parsed *msg, unsigned int len)
+{
+	int i;
+
+	if (msg->len > len || msg->trans.length > MGCP_TRANS_MAX ||
+	    msg->num_params > MGCP_MAX_PARAMS)
+		return -1;
+	if (msg->trans.start + msg->trans.length > msg->len ||
+	    msg->endp.start + msg->endp.length > msg->len ||
+	    msg->verb.start + msg->verb.length > msg->len ||
+	    msg->sdp.start + msg->sdp.length > msg->len ||
+	    msg->conn_addr.start + msg->conn_addr.length > msg->len)
+		return -1;
+
+	for (i = 0; i < msg->num_params; ++i) {
+		const struct mgcp_param *param = &msg->params[i];
+
+		if (param->name.start + param->name.length > msg->len ||
+		    param->value.start + param->value.length > msg->len)
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Feed truncated, bit flipped and random messages to the parser and the
+ * command handling.  The messages are not NUL terminated and are followed
+ * by canary octets.
+ */
+static void test_parser_fuzz(void)
+{
+	struct mgcp_config *cfg;
+	uint8_t buf[4096 + FUZZ_PAD], orig[4096];
+	unsigned int num = 0, commands = 0, responses = 0, errors = 0, bad = 0;
+	uint32_t seed = 4711;
+	int i, j, round;
+
+	printf("Testing parser fuzzing\n");
+
+	cfg = mgcp_config_alloc();
+	cfg->trunk.number_endpoints = 64;
+	mgcp_endpoints_allocate(&cfg->trunk);
+	mgcp_endpoints_allocate(mgcp_trunk_alloc(cfg, 1));
+
+	for (i = 0; i < ARRAY_SIZE(tests) + 1; i++) {
+		const char *req = i < ARRAY_SIZE(tests) ? tests[i].req : MDCX3_RET;
+		unsigned int req_len = strlen(req);
+
+		for (round = 0; round < 3 * req_len + 64; ++round) {
+			struct mgcp_parsed parsed;
+			struct msgb *inp, *msg;
+			unsigned int len;
+			int rc;
+
+			memcpy(orig, req, req_len);
+			len = req_len;
+			if (round < req_len) {
+				/* every truncation */
+				len = round + 1;
+			} else if (round < 3 * req_len) {
+				/* flip a bit */
+				orig[round % req_len] ^= 1 << (fuzz_rand(&seed) % 8);
+			} else {
+				/* random octets, biased towards the separators */
+				len = fuzz_rand(&seed) % 256;
+				for (j = 0; j < len; ++j) {
+					uint32_t r = fuzz_rand(&seed);
+					orig[j] = (r & 3) == 0 ? " \r\n:"[(r >> 2) & 3] : r >> 8;
+				}
+			}
+
+			memcpy(buf, orig, len);
+			memset(buf + len, FUZZ_CANARY, FUZZ_PAD);
+
+			rc = mgcp_parse(&parsed, (const char *) buf, len);
+			if (rc == 0)
+				commands++;
+			else if (rc == 1)
+				responses++;
+			else
+				errors++;
+
+			if (check_parsed(&parsed, len) != 0 ||
+			    memcmp(buf, orig, len) != 0)
+				bad++;
+			for (j = 0; j < FUZZ_PAD; ++j)
+				if (buf[len + j] != FUZZ_CANARY)
+					bad++;
+
+			/* and the command handling with the same octets */
+			if (len < 4)
+				continue;
+			inp = msgb_alloc_headroom(4096, 128, "MGCP fuzz");
+			inp->l2h = msgb_put(inp, len);
+			memcpy(inp->l2h, orig, len);
+			msg = mgcp_handle_message(cfg, inp);
+			if (memcmp(inp->l2h, orig, len) != 0)
+				bad++;
+			msgb_free(inp);
+			msgb_free(msg);
+			num++;
+		}
+	}
+
+	printf("Fuzzed %u messages: %u commands, %u responses, %u errors, "
+	       "%u violations\n", num, commands, responses, errors, bad);
+	talloc_free(cfg);
+}
+
+#define PARSE_BENCH_ROUNDS	200000
+
+#ifdef BENCHMARK
+static void bench_parser(void)
+{
+	struct mgcp_config *cfg;
+	struct mgcp_parsed parsed;
+	struct timeval start, end, diff;
+	struct msgb *inp;
+	unsigned int params = 0;
+	double secs;
+	int i;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < PARSE_BENCH_ROUNDS; ++i) {
+		mgcp_parse(&parsed, CRCX, sizeof(CRCX) - 1);
+		params += parsed.num_params;
+	}
+	gettimeofday(&end, NULL);
+
+	timersub(&end, &start, &diff);
+	secs = diff.tv_sec + diff.tv_usec / 1000000.0;
+	fprintf(stderr, "Parsed %u CRCX (%u params) in %.3f s: %.0f msgs/s\n",
+		PARSE_BENCH_ROUNDS, params, secs,
+		secs > 0 ? PARSE_BENCH_ROUNDS / secs : 0);
+
+	/* the re-transmission of a MDCX is answered from the cache */
+	cfg = mgcp_config_alloc();
+	cfg->trunk.number_endpoints = 64;
+	mgcp_endpoints_allocate(&cfg->trunk);
+	msgb_free(handle_str(cfg, CRCX));
+	inp = create_msg(MDCX3);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < PARSE_BENCH_ROUNDS; ++i)
+		msgb_free(mgcp_handle_message(cfg, inp));
+	gettimeofday(&end, NULL);
+
+	timersub(&end, &start, &diff);
+	secs = diff.tv_sec + diff.tv_usec / 1000000.0;
+	fprintf(stderr, "Handled %u MDCX in %.3f s: %.0f msgs/s\n",
+		PARSE_BENCH_ROUNDS, secs,
+		secs > 0 ? PARSE_BENCH_ROUNDS / secs : 0);
+
+	msgb_free(inp);
+	talloc_free(cfg);
+}
+#endif
+
+#define MDCX_PCMA "MDCX 18983216 1@mgw MGCP 1.0\r\n"	\
+		 "C: 2\r\n"				\
+		 "\r\n"				\
+		 "c=IN IP4 123.12.12.123\r\n"		\
+		 "m=audio 5904 RTP/AVP 8\r\n"		\
+		 "a=rtpmap:8 PCMA/8000\r\n"
+
+#define MDCX_PCMA_30(trans) "MDCX " trans " 1@mgw MGCP 1.0\r\n"	\
+		 "C: 2\r\n"				\
+		 "\r\n"				\
+		 "c=IN IP4 123.12.12.123\r\n"		\
+		 "m=audio 5904 RTP/AVP 8\r\n"		\
+		 "a=rtpmap:8 PCMA/8000\r\n"		\
+		 "a=ptime:30\r\n"
+
+#define MDCX_EFR "MDCX 18983217 1@mgw MGCP 1.0\r\n"	\
+		 "C: 2\r\n"				\
+		 "\r\n"				\
+		 "c=IN IP4 123.12.12.123\r\n"		\
+		 "m=audio 5904 RTP/AVP 97\r\n"		\
+		 "a=rtpmap:97 GSM-EFR/8000\r\n"
+
+/* a RTP packet with all the 256 G.711 code words */
+static int create_rtp(char *buf, uint16_t seq, int padding)
+{
+	int i;
+
+	memset(buf, 0, 12);
+	buf[0] = 0x80 | (padding ? 0x20 : 0);
+	buf[1] = 8;
+	buf[2] = seq >> 8;
+	buf[3] = seq & 0xff;
+	buf[11] = 0x42;
+	for (i = 0; i < 256; ++i)
+		buf[12 + i] = i;
+	if (!padding)
+		return 12 + 256;
+
+	buf[12 + 256] = 0;
+	buf[12 + 256 + 1] = 2;
+	return 12 + 256 + 2;
+}
+
+static void print_path(const char *dir, struct mgcp_transcode_path *path)
+{
+	printf("%s %s to %s: in: %lu out: %lu dropped: %lu\n", dir,
+	       mgcp_codec_name(path->src), mgcp_codec_name(path->dst),
+	       path->stats.frames_in, path->stats.frames_out,
+	       path->stats.dropped);
+}
+
+static void test_transcoding(void)
+{
+	static const char *names[] = {
+		"GSM-EFR/8000", "gsm/8000", "PCMA", "PCMU/8000", "AMR/8000",
+	};
+	struct mgcp_config *cfg;
+	struct mgcp_endpoint *endp;
+	struct msgb *msg;
+	char in[512], out[512], back[512];
+	int i, len, rc, diff;
+
+	printf("Testing transcoding\n");
+
+	for (i = 0; i < ARRAY_SIZE(names); ++i)
+		printf("Codec of %s: %s\n", names[i], mgcp_codec_name(
+		       mgcp_codec_from_name(names[i], strlen(names[i]))));
+
+	cfg = mgcp_config_alloc();
+	cfg->trunk.number_endpoints = 64;
+	cfg->trunk.audio_payload = 0;
+	cfg->trunk.internal_transcoding = 1;
+	mgcp_endpoints_allocate(&cfg->trunk);
+	endp = &cfg->trunk.endpoints[1];
+
+	msgb_free(handle_str(cfg, CRCX));
+	msg = handle_str(cfg, MDCX_PCMA);
+	printf("MDCX PCMA: %.6s transcoding: %d\n", (char *) msg->data,
+	       endp->transcoding != NULL);
+	msgb_free(msg);
+	if (!endp->transcoding)
+		goto out;
+
+	/* A-law to u-law and back */
+	len = create_rtp(in, 1, 0);
+	rc = mgcp_transcoding_process_rtp(endp, 1, in, len, out, sizeof(out));
+	printf("Transcoded %d to %d octets, header %s\n", len, rc,
+	       memcmp(in, out, 12) == 0 ? "kept" : "changed");
+	rc = mgcp_transcoding_process_rtp(endp, 0, out, rc, back, sizeof(back));
+	for (i = 0, diff = 0; i < 256; ++i)
+		if (in[12 + i] != back[12 + i])
+			diff++;
+	printf("Back to %d octets, %d code words differ\n", rc, diff);
+
+	/* the padding is removed, short packets and small buffers dropped */
+	len = create_rtp(in, 2, 1);
+	rc = mgcp_transcoding_process_rtp(endp, 1, in, len, out, sizeof(out));
+	printf("Padded %d to %d octets, padding bit %d\n", len, rc,
+	       !!(out[0] & 0x20));
+	rc = mgcp_transcoding_process_rtp(endp, 1, in, 11, out, sizeof(out));
+	printf("Short packet: %d\n", rc);
+	rc = mgcp_transcoding_process_rtp(endp, 1, in, len, out, 100);
+	printf("Small buffer: %d\n", rc);
+
+	print_path("To BTS", &endp->transcoding->to_bts);
+	print_path("To net", &endp->transcoding->to_net);
+
+	/* G.711 to G.711 works with any ptime */
+	msg = handle_str(cfg, MDCX_PCMA_30("18983218"));
+	printf("MDCX PCMA 30ms: %.6s transcoding: %d\n", (char *) msg->data,
+	       endp->transcoding != NULL);
+	msgb_free(msg);
+
+	/* G.711 through GSM FR when it was built */
+	if (mgcp_codec_is_supported(MGCP_CODEC_GSM_FR)) {
+		mgcp_transcoding_setup(endp, MGCP_CODEC_GSM_FR, MGCP_CODEC_PCMA,
+				       20);
+		len = create_rtp(in, 3, 0);
+		rc = mgcp_transcoding_process_rtp(endp, 1, in, 12 + 160,
+						  out, sizeof(out));
+		if (rc != 12 + 33)
+			printf("FAIL: PCMA to GSM FR: %d\n", rc);
+		rc = mgcp_transcoding_process_rtp(endp, 0, out, rc,
+						  back, sizeof(back));
+		if (rc != 12 + 160)
+			printf("FAIL: GSM FR to PCMA: %d\n", rc);
+		rc = mgcp_transcoding_process_rtp(endp, 1, in, len,
+						  out, sizeof(out));
+		if (rc >= 0)
+			printf("FAIL: 256 samples are not 20ms frames\n");
+
+		/* GSM FR needs a multiple of 20ms on the G.711 side */
+		cfg->trunk.audio_payload = 3;
+		msg = handle_str(cfg, MDCX_PCMA_30("18983219"));
+		if (strncmp((char *) msg->data, "534", 3) != 0)
+			printf("FAIL: GSM FR with a ptime of 30ms: %.3s\n",
+			       (char *) msg->data);
+		msgb_free(msg);
+		cfg->trunk.audio_payload = 0;
+	}
+
+	/* there is no EFR codec */
+	msg = handle_str(cfg, MDCX_EFR);
+	printf("MDCX EFR: %.6s transcoding: %d\n", (char *) msg->data,
+	       endp->transcoding != NULL);
+	msgb_free(msg);
+
+	msgb_free(handle_str(cfg, DLCX));
+out:
+	talloc_free(cfg);
+}
+
+#define TRANSCODE_BENCH_ROUNDS	50000
+
+#ifdef BENCHMARK
+static void bench_transcoding(void)
+{
+	struct mgcp_config *cfg;
+	struct mgcp_endpoint *endp;
+	struct timeval start, end, diff;
+	char in[512], out[512];
+	double secs;
+	int i, len;
+
+	cfg = mgcp_config_alloc();
+	cfg->trunk.number_endpoints = 64;
+	mgcp_endpoints_allocate(&cfg->trunk);
+	endp = &cfg->trunk.endpoints[1];
+	mgcp_transcoding_setup(endp, MGCP_CODEC_PCMU, MGCP_CODEC_PCMA, 20);
+
+	/* 20ms packets */
+	len = create_rtp(in, 1, 0) - 96;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < TRANSCODE_BENCH_ROUNDS; ++i)
+		mgcp_transcoding_process_rtp(endp, i & 1, in, len,
+					     out, sizeof(out));
+	gettimeofday(&end, NULL);
+
+	timersub(&end, &start, &diff);
+	secs = diff.tv_sec + diff.tv_usec / 1000000.0;
+	fprintf(stderr, "Transcoded %u G.711 packets in %.3f s: %.0f/s, "
+		"codec CPU %llu us\n", TRANSCODE_BENCH_ROUNDS, secs,
+		secs > 0 ? TRANSCODE_BENCH_ROUNDS / secs : 0,
+		(unsigned long long) (endp->transcoding->to_bts.stats.cpu_ns +
+				      endp->transcoding->to_net.stats.cpu_ns) / 1000);
+
+	mgcp_free_endp(endp);
+	talloc_free(cfg);
+}
+#endif
+
+#define JITTER_PACKETS	60
+
+static uint16_t jitter_out_seq[4 * JITTER_PACKETS];
+static uint32_t jitter_out_ts[4 * JITTER_PACKETS];
+static int jitter_out_marker[4 * JITTER_PACKETS];
+static int jitter_out_count;
+
+static int jitter_output(struct mgcp_endpoint *endp, char *data, int len)
+{
+	const uint8_t *rtp = (const uint8_t *) data;
+
+	if (jitter_out_count < ARRAY_SIZE(jitter_out_seq)) {
+		jitter_out_seq[jitter_out_count] = (rtp[2] << 8) | rtp[3];
+		jitter_out_ts[jitter_out_count] = (rtp[4] << 24) |
+			(rtp[5] << 16) | (rtp[6] << 8) | rtp[7];
+		jitter_out_marker[jitter_out_count] = !!(rtp[1] & 0x80);
+		jitter_out_count++;
+	}
+	return len;
+}
+
+/* the packets that do not follow the previous one by frame_ts */
+static void print_jitter_output(uint32_t frame_ts)
+{
+	uint32_t delta;
+	int i, contiguous;
+
+	for (i = 1, contiguous = 1; i < jitter_out_count; ++i)
+		if ((uint16_t) (jitter_out_seq[i] - jitter_out_seq[i - 1]) != 1)
+			contiguous = 0;
+	printf("Emitted %d packets from seq %u, contiguous: %d\n",
+	       jitter_out_count, jitter_out_seq[0], contiguous);
+
+	for (i = 0; i < jitter_out_count; ++i) {
+		delta = i > 0 ? jitter_out_ts[i] - jitter_out_ts[i - 1] : 0;
+		if (i > 0 && delta == frame_ts && !jitter_out_marker[i])
+			continue;
+		printf("Packet %d: RTP time +%u ms%s\n", i, delta / 8,
+		       jitter_out_marker[i] ? ", marker" : "");
+	}
+}
+
+static int jitter_arrival(int i)
+{
+	switch (i) {
+	/* re-ordered */
+	case 10:
+		return 20 * 11 + 1;
+	case 11:
+		return 20 * 11;
+	/* lost */
+	case 20:
+		return -1;
+	/* late for its playout */
+	case 45:
+		return 20 * 45 + 200;
+	}
+
+	/* a burst after a stall */
+	if (i >= 30 && i <= 33)
+		return 20 * 33;
+	return 20 * i;
+}
+
+static void test_jitter_buffer(void)
+{
+	struct mgcp_config *cfg;
+	struct mgcp_endpoint *endp;
+	struct mgcp_jitter_buffer *jb;
+	char buf[512], stats[256];
+	int t, i, len;
+
+	printf("Testing jitter buffer\n");
+
+	cfg = mgcp_config_alloc();
+	cfg->trunk.number_endpoints = 64;
+	cfg->trunk.jitter_buffer = 1;
+	cfg->trunk.jitter_min_frames = 2;
+	cfg->trunk.jitter_max_frames = 6;
+	mgcp_endpoints_allocate(&cfg->trunk);
+	endp = &cfg->trunk.endpoints[1];
+
+	jb = mgcp_jitter_alloc(endp, jitter_output);
+	endp->jitter_buffer = jb;
+	jitter_out_count = 0;
+
+	/* the wheel serves the slot of the buffer every fourth 5ms step */
+	for (t = 0; t < 20 * JITTER_PACKETS + 300; t += 5) {
+		for (i = 0; i < JITTER_PACKETS; ++i) {
+			int arrival = jitter_arrival(i);
+
+			if (arrival < 0 || arrival < t - 5 || arrival >= t)
+				continue;
+			len = create_rtp(buf, 1000 + i, 0) - 96;
+			buf[4] = (i * 160) >> 24;
+			buf[5] = (i * 160) >> 16;
+			buf[6] = (i * 160) >> 8;
+			buf[7] = i * 160;
+			mgcp_jitter_put(jb, buf, len, arrival);
+			if (i == 40)
+				mgcp_jitter_put(jb, buf, len, arrival);
+		}
+		mgcp_jitter_wheel_advance(cfg->jitter_wheel);
+	}
+
+	print_jitter_output(160);
+	printf("Received %lu late %lu duplicates %lu concealed %lu "
+	       "discarded %lu underruns %lu resyncs %lu\n",
+	       jb->stats.received, jb->stats.late, jb->stats.duplicates,
+	       jb->stats.concealed, jb->stats.discarded, jb->stats.underruns,
+	       jb->stats.resyncs);
+
+	mgcp_format_stats(endp, stats, sizeof(stats));
+	printf("Stats: %s\n", stats + 2);
+
+	mgcp_free_endp(endp);
+
+	/* with a ptime of 40ms every other service plays out a frame */
+	endp = &cfg->trunk.endpoints[2];
+	endp->net_end.packet_duration_ms = 40;
+	jb = mgcp_jitter_alloc(endp, jitter_output);
+	endp->jitter_buffer = jb;
+	jitter_out_count = 0;
+
+	for (t = 0; t < 40 * 10 + 300; t += 5) {
+		i = t / 40;
+		if (t % 40 == 5 && i < 10) {
+			len = create_rtp(buf, 2000 + i, 0) - 96;
+			buf[4] = (i * 320) >> 24;
+			buf[5] = (i * 320) >> 16;
+			buf[6] = (i * 320) >> 8;
+			buf[7] = i * 320;
+			mgcp_jitter_put(jb, buf, len, t - 5);
+		}
+		mgcp_jitter_wheel_advance(cfg->jitter_wheel);
+	}
+	print_jitter_output(320);
+
+	mgcp_free_endp(endp);
+	printf("Buffers on the wheel: %u\n", cfg->jitter_wheel->count);
+	talloc_free(cfg);
+}
+
+static long file_size(const char *name)
+{
+	struct stat st;
+
+	if (stat(name, &st) != 0)
+		return -1;
+	return st.st_size;
+}
+
+static void test_capture(void)
+{
+	struct mgcp_config *cfg;
+	struct mgcp_endpoint *endp;
+	struct mgcp_capture *cap;
+	struct mgcp_capture_stats stats;
+	char pcap[64], rtpdump[64], buf[512], line[64];
+	uint8_t pkt[16 + 28 + 268];
+	uint32_t magic;
+	int i, len, written, dropped;
+	FILE *file;
+
+	printf("Testing capture\n");
+
+	snprintf(pcap, sizeof(pcap), "/tmp/mgcp_test_%d.pcap", getpid());
+	snprintf(rtpdump, sizeof(rtpdump), "/tmp/mgcp_test_%d.rtp", getpid());
+
+	cfg = mgcp_config_alloc();
+	cfg->trunk.number_endpoints = 64;
+	mgcp_endpoints_allocate(&cfg->trunk);
+	endp = &cfg->trunk.endpoints[1];
+	inet_aton("10.0.0.1", &endp->bts_end.addr);
+	endp->bts_end.rtp_port = htons(4000);
+	endp->bts_end.local_port = 16002;
+
+	/* pcap of the packets from the BTS */
+	cap = mgcp_capture_open(endp, MGCP_TAP_BTS_IN, MGCP_CAPTURE_PCAP, pcap);
+	len = create_rtp(buf, 1, 0);
+	for (i = 0; i < 10; ++i)
+		mgcp_capture_put(cap, buf, len);
+	mgcp_capture_close(cap);
+	mgcp_capture_sync(cfg);
+
+	file = fopen(pcap, "rb");
+	if (fread(&magic, sizeof(magic), 1, file) != 1 ||
+	    fseek(file, 24, SEEK_SET) != 0 ||
+	    fread(pkt, sizeof(pkt), 1, file) != 1)
+		printf("FAIL: short pcap\n");
+	fclose(file);
+	printf("pcap: %ld octets magic %x, from %u.%u.%u.%u:%u to port %u, "
+	       "payload %s\n", file_size(pcap), magic,
+	       pkt[28], pkt[29], pkt[30], pkt[31], (pkt[36] << 8) | pkt[37],
+	       (pkt[38] << 8) | pkt[39],
+	       memcmp(&pkt[44], buf, len) == 0 ? "kept" : "changed");
+
+	/* rtpdump with a RTCP packet */
+	cap = mgcp_capture_open(endp, MGCP_TAP_BTS_IN, MGCP_CAPTURE_RTPDUMP,
+				rtpdump);
+	for (i = 0; i < 5; ++i)
+		mgcp_capture_put(cap, buf, len);
+	buf[1] = 200;
+	mgcp_capture_put(cap, buf, 28);
+	mgcp_capture_close(cap);
+	mgcp_capture_sync(cfg);
+
+	file = fopen(rtpdump, "rb");
+	if (!fgets(line, sizeof(line), file))
+		line[0] = '\0';
+	fclose(file);
+	printf("rtpdump: %ld octets, %s", file_size(rtpdump), line);
+	mgcp_capture_stop(cfg);
+	talloc_free(cfg);
+
+	/* a small queue drops rather than waiting for the writer */
+	cfg = mgcp_config_alloc();
+	cfg->trunk.number_endpoints = 64;
+	cfg->capture_queue_kb = 16;
+	mgcp_endpoints_allocate(&cfg->trunk);
+	endp = &cfg->trunk.endpoints[1];
+
+	cap = mgcp_capture_open(endp, MGCP_TAP_NET_OUT, MGCP_CAPTURE_PCAP, pcap);
+	len = create_rtp(buf, 1, 0);
+	for (i = 0; i < 1000; ++i)
+		mgcp_capture_put(cap, buf, len);
+	mgcp_capture_sync(cfg);
+	mgcp_capture_get_stats(cap, &stats);
+	written = stats.packets;
+	dropped = stats.dropped;
+
+	/* the shutdown closes the file of the endpoint */
+	endp->taps[MGCP_TAP_NET_OUT].enabled = 1;
+	endp->taps[MGCP_TAP_NET_OUT].capture = cap;
+	mgcp_capture_shutdown(cfg);
+	if (cfg->capture_writer || endp->taps[MGCP_TAP_NET_OUT].capture)
+		printf("FAIL: the capture is still running\n");
+
+	printf("Overflow: written and dropped %d, file %s\n", written + dropped,
+	       file_size(pcap) == 24 + written * (16 + 28 + len) ? "ok" : "wrong");
+	fprintf(stderr, "Capture queue of 16 KiB: %d written, %d dropped\n",
+		written, dropped);
+
+	unlink(pcap);
+	unlink(rtpdump);
+	talloc_free(cfg);
+}
+
+static int count_columns(const char *line)
+{
+	int columns = 1, quoted = 0;
+
+	for (; *line; ++line) {
+		if (*line == '"')
+			quoted = !quoted;
+		else if (*line == ',' && !quoted)
+			columns++;
+	}
+	return columns;
+}
+
+static void test_quality_records(void)
+{
+	struct mgcp_config *cfg;
+	struct mgcp_endpoint *endp;
+	struct mgcp_rtp_quality *q;
+	struct mgcp_capture_stats stats;
+	char name[64], header[1024], line[1024];
+	char callid[] = "a,\"b\"", *old_callid;
+	uint32_t arrival = 1000, ts = 0;
+	FILE *file;
+	int i;
+
+	printf("Testing quality records\n");
+
+	snprintf(name, sizeof(name), "/tmp/mgcp_test_%d.csv", getpid());
+	unlink(name);
+
+	cfg = mgcp_config_alloc();
+	cfg->trunk.number_endpoints = 64;
+	cfg->quality_file = talloc_strdup(cfg, name);
+	mgcp_endpoints_allocate(&cfg->trunk);
+	endp = &cfg->trunk.endpoints[1];
+	msgb_free(handle_str(cfg, CRCX));
+
+	/* 20ms frames, a lost one, a late one and a new source */
+	q = &endp->bts_state.quality;
+	mgcp_quality_count(q, 1, 0, 1, arrival, ts);
+	for (i = 1; i < 20; ++i) {
+		arrival += i == 10 ? 60 : 20;
+		ts += 160;
+		mgcp_quality_count(q, 0, i == 15, i == 5 ? 2 : 1, arrival, ts);
+	}
+	mgcp_quality_count(q, 0, 0, 0xffff, arrival, ts - 160);
+	endp->bts_state.initialized = 1;
+	endp->bts_state.base_seq = 100;
+	endp->bts_state.max_seq = 120;
+	endp->bts_end.packets = 20;
+	endp->bts_end.octets = 20 * 33;
+
+	/* the callid is quoted, it might have a comma or a quote */
+	old_callid = endp->callid;
+	endp->callid = callid;
+	mgcp_format_quality(endp, line, sizeof(line));
+	endp->callid = old_callid;
+	printf("Quoted: %d columns, %.16s...\n", count_columns(line),
+	       strchr(line, ',') + 1);
+
+	msgb_free(handle_str(cfg, DLCX));
+
+	/* the writer thread appends the record */
+	mgcp_capture_sync(cfg);
+	mgcp_capture_get_line_stats(cfg, &stats);
+	printf("Quality records: %lu written, %lu errors\n",
+	       stats.packets, stats.errors);
+
+	file = fopen(name, "r");
+	if (!file || !fgets(header, sizeof(header), file) ||
+	    !fgets(line, sizeof(line), file)) {
+		printf("FAIL: no quality record\n");
+		goto out;
+	}
+	printf("Header: %d columns, %.31s...\n", count_columns(header), header);
+	printf("Record: %d columns, %s", count_columns(line),
+	       strchr(line, ',') + 1);
+
+out:
+	if (file)
+		fclose(file);
+	unlink(name);
+	mgcp_capture_stop(cfg);
+	talloc_free(cfg);
+}
+
 static int rqnt_cb(struct mgcp_endpoint *endp, char _tone)
 {
 	ptrdiff_t tone = _tone;
@@ -329,8 +1085,18 @@ int main(int argc, char **argv)
 
 	test_messages();
 	test_retransmission();
+	test_retransmission_window();
 	test_packet_loss_calc();
 	test_rqnt_cb();
+	test_parser_fuzz();
+	test_transcoding();
+	test_jitter_buffer();
+	test_capture();
+	test_quality_records();
+#ifdef BENCHMARK
+	bench_parser();
+	bench_transcoding();
+#endif
 
 	printf("Done\n");
 	return EXIT_SUCCESS;
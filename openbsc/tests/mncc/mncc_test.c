@@ -0,0 +1,316 @@
+/* The queue of the MNCC socket towards a slow call control application,
+ * driven over a socketpair: only voice frames are dropped, the call
+ * control always passes, and a partial batch is sent on later */
+/*
+ * (C) 2026 by the OpenBSC contributors
+ * All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <osmocom/core/application.h>
+#include <osmocom/core/msgb.h>
+#include <osmocom/core/select.h>
+#include <osmocom/core/talloc.h>
+#include <osmocom/core/utils.h>
+
+#include <openbsc/debug.h>
+#include <openbsc/gsm_data.h>
+#include <openbsc/gsm_04_08.h>
+#include <openbsc/mncc.h>
+
+#define NUM_PARTIAL	64
+
+void *tall_bsc_ctx;
+
+static int app_fd = -1;
+
+/* Replaces the call control: print what it is told */
+int mncc_tx_to_cc(struct gsm_network *net, int msg_type, void *arg)
+{
+	struct gsm_mncc *mncc = arg;
+
+	printf("  to CC: %s callref %u\n", get_mncc_name(msg_type),
+		mncc->callref);
+	return 0;
+}
+
+void gsm0408_clear_all_trans(struct gsm_network *net, int protocol)
+{
+	printf("  to CC: clear all transactions\n");
+}
+
+static struct gsm_network *network_alloc(void)
+{
+	struct gsm_network *net;
+
+	net = talloc_zero(tall_bsc_ctx, struct gsm_network);
+	INIT_LLIST_HEAD(&net->upqueue);
+	INIT_LLIST_HEAD(&net->trans_list);
+	net->mncc_sock.queue_limit = MNCC_SOCK_QUEUE_DEFAULT;
+	net->mncc_sock.voice_drop = MNCC_SOCK_DROP_NEWEST;
+
+	net->stats.mncc.rx = osmo_counter_alloc("net.mncc.rx");
+	net->stats.mncc.tx = osmo_counter_alloc("net.mncc.tx");
+	net->stats.mncc.rx_calls = osmo_counter_alloc("net.mncc.rx_calls");
+	net->stats.mncc.tx_calls = osmo_counter_alloc("net.mncc.tx_calls");
+	net->stats.mncc.voice_dropped =
+		osmo_counter_alloc("net.mncc.voice_dropped");
+	return net;
+}
+
+/* a fresh application connected over a socketpair, a small buffer
+ * makes the socket take only a part of a batch */
+static void app_connect(struct gsm_network *net, int small_buf)
+{
+	int sv[2], sndbuf = 1;
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) < 0) {
+		printf("socketpair failed\n");
+		abort();
+	}
+
+	/* the kernel rounds it up to its smallest buffer */
+	if (small_buf)
+		setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF,
+			   &sndbuf, sizeof(sndbuf));
+
+	OSMO_ASSERT(mncc_sock_attach(net, sv[0]) == 0);
+	app_fd = sv[1];
+}
+
+/* the application goes away, the socket notices on its next read */
+static void app_disconnect(void)
+{
+	close(app_fd);
+	app_fd = -1;
+	osmo_select_main(1);
+}
+
+static void from_cc(struct gsm_network *net, int msg_type, uint32_t callref)
+{
+	struct msgb *msg;
+
+	msg = msgb_alloc(sizeof(struct gsm_mncc), "mncc test");
+	if (msg_type == GSM_TCHF_FRAME) {
+		struct gsm_data_frame *frame;
+
+		frame = (struct gsm_data_frame *)
+			msgb_put(msg, sizeof(*frame) + 33);
+		memset(frame, 0, sizeof(*frame) + 33);
+		frame->msg_type = msg_type;
+		frame->callref = callref;
+	} else {
+		struct gsm_mncc *mncc;
+
+		mncc = (struct gsm_mncc *) msgb_put(msg, sizeof(*mncc));
+		memset(mncc, 0, sizeof(*mncc));
+		mncc->msg_type = msg_type;
+		mncc->callref = callref;
+	}
+
+	mncc_sock_from_cc(net, msg);
+}
+
+/* read what the application got so far, the callrefs are put into
+ * the array when it is given, the hello counts as callref 0 */
+static int app_read(int print, uint32_t *callrefs)
+{
+	uint8_t buf[sizeof(struct gsm_mncc) + 64];
+	struct gsm_data_frame *frame = (struct gsm_data_frame *) buf;
+	struct gsm_mncc_hello *hello = (struct gsm_mncc_hello *) buf;
+	uint32_t callref;
+	int num = 0, rc;
+
+	while ((rc = recv(app_fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+		if (frame->msg_type == MNCC_SOCKET_HELLO) {
+			callref = 0;
+			if (print)
+				printf("  to app: hello version %u\n",
+					hello->version);
+		} else {
+			callref = frame->callref;
+			if (print)
+				printf("  to app: %s callref %u\n",
+					get_mncc_name(frame->msg_type), callref);
+		}
+		if (callrefs)
+			callrefs[num] = callref;
+		num += 1;
+	}
+
+	return num;
+}
+
+/* let the socket write until nothing more arrives */
+static void flush(void)
+{
+	do {
+		osmo_select_main(1);
+	} while (app_read(1, NULL) > 0);
+}
+
+static void test_drop_newest(void)
+{
+	struct gsm_network *net = network_alloc();
+
+	printf("Testing dropping the newest voice frame.\n");
+
+	net->mncc_sock.queue_limit = 4;
+	app_connect(net, 0);
+
+	/* the hello is already queued */
+	from_cc(net, GSM_TCHF_FRAME, 1);
+	from_cc(net, GSM_TCHF_FRAME, 2);
+	from_cc(net, GSM_TCHF_FRAME, 3);
+	from_cc(net, GSM_TCHF_FRAME, 4);
+	from_cc(net, MNCC_SETUP_IND, 5);
+	from_cc(net, GSM_TCHF_FRAME, 6);
+	from_cc(net, MNCC_ALERT_IND, 7);
+	flush();
+
+	printf("  voice frames dropped: %lu\n",
+		osmo_counter_get(net->stats.mncc.voice_dropped));
+
+	app_disconnect();
+	talloc_free(net);
+}
+
+static void test_drop_oldest(void)
+{
+	struct gsm_network *net = network_alloc();
+
+	printf("Testing dropping the oldest voice frame.\n");
+
+	net->mncc_sock.queue_limit = 4;
+	net->mncc_sock.voice_drop = MNCC_SOCK_DROP_OLDEST;
+	app_connect(net, 0);
+
+	/* the hello is already queued */
+	from_cc(net, GSM_TCHF_FRAME, 1);
+	from_cc(net, MNCC_SETUP_IND, 2);
+	from_cc(net, GSM_TCHF_FRAME, 3);
+	from_cc(net, GSM_TCHF_FRAME, 4);
+	from_cc(net, GSM_TCHF_FRAME, 5);
+	from_cc(net, MNCC_ALERT_IND, 6);
+	from_cc(net, GSM_TCHF_FRAME, 7);
+	flush();
+
+	printf("  voice frames dropped: %lu\n",
+		osmo_counter_get(net->stats.mncc.voice_dropped));
+
+	app_disconnect();
+	talloc_free(net);
+}
+
+static void test_call_control_only(void)
+{
+	struct gsm_network *net = network_alloc();
+
+	printf("Testing a queue full of call control.\n");
+
+	net->mncc_sock.queue_limit = 2;
+	net->mncc_sock.voice_drop = MNCC_SOCK_DROP_OLDEST;
+	app_connect(net, 0);
+
+	/* nothing to make room with, the new voice frame is dropped */
+	from_cc(net, MNCC_SETUP_IND, 1);
+	from_cc(net, MNCC_CALL_CONF_IND, 2);
+	from_cc(net, GSM_TCHF_FRAME, 3);
+	from_cc(net, MNCC_ALERT_IND, 4);
+	flush();
+
+	printf("  voice frames dropped: %lu\n",
+		osmo_counter_get(net->stats.mncc.voice_dropped));
+
+	app_disconnect();
+	talloc_free(net);
+}
+
+static void test_partial_batch(void)
+{
+	struct gsm_network *net = network_alloc();
+	uint32_t callrefs[NUM_PARTIAL + 1];
+	int i, num, first, rounds = 0, in_order = 1;
+
+	printf("Testing a partially sent batch.\n");
+
+	app_connect(net, 1);
+	for (i = 0; i < NUM_PARTIAL; i++)
+		from_cc(net, i % 2 ? GSM_TCHF_FRAME : MNCC_SETUP_IND, i + 1);
+
+	/* the socket takes only a part, the rest waits for the next
+	 * write */
+	osmo_select_main(1);
+	num = first = app_read(0, callrefs);
+	while (num < NUM_PARTIAL + 1 && rounds++ < 1000) {
+		osmo_select_main(1);
+		num += app_read(0, &callrefs[num]);
+	}
+
+	for (i = 0; i < num; i++)
+		if (callrefs[i] != i)
+			in_order = 0;
+
+	printf("  first write partial: %d\n",
+		first > 0 && first < NUM_PARTIAL + 1);
+	printf("  received %d of %d, in order: %d\n", num,
+		NUM_PARTIAL + 1, in_order);
+	printf("  sent: %lu, voice frames dropped: %lu\n",
+		osmo_counter_get(net->stats.mncc.tx),
+		osmo_counter_get(net->stats.mncc.voice_dropped));
+
+	app_disconnect();
+	talloc_free(net);
+}
+
+static void test_socket_gone(void)
+{
+	struct gsm_network *net = network_alloc();
+
+	printf("Testing the socket going away.\n");
+
+	/* the queue is flushed and the calls are cleared, later the call
+	 * control is released, the voice is not */
+	app_connect(net, 0);
+	from_cc(net, MNCC_SETUP_IND, 1);
+	from_cc(net, GSM_TCHF_FRAME, 2);
+	app_disconnect();
+
+	from_cc(net, MNCC_SETUP_IND, 3);
+	from_cc(net, GSM_TCHF_FRAME, 4);
+
+	talloc_free(net);
+}
+
+int main(int argc, char **argv)
+{
+	osmo_init_logging(&log_info);
+
+	test_drop_newest();
+	test_drop_oldest();
+	test_call_control_only();
+	test_partial_batch();
+	test_socket_gone();
+
+	printf("Done.\n");
+	return EXIT_SUCCESS;
+}
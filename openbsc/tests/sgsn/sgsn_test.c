@@ -0,0 +1,229 @@
+/* Test the SGSN context handling */
+
+/*
+ * (C) 2026 by the OpenBSC contributors
+ *
+ * All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#include <osmocom/core/application.h>
+#include <osmocom/core/talloc.h>
+#include <osmocom/core/msgb.h>
+#include <osmocom/core/statistics.h>
+#include <osmocom/gprs/gprs_bssgp.h>
+
+#include <openbsc/debug.h>
+#include <openbsc/gprs_llc.h>
+#include <openbsc/gprs_sgsn.h>
+#include <openbsc/gprs_gmm.h>
+#include <openbsc/sgsn.h>
+
+void *tall_bsc_ctx;
+static struct sgsn_instance sgsn_inst;
+struct sgsn_instance *sgsn = &sgsn_inst;
+
+/* a small N-PDU in a buffer as big as the ones from the GTP socket */
+#define NPDU_BUF_SIZE	16000
+#define NPDU_LEN	10
+
+static int paged;
+
+/* stubs for the parts of the SGSN that are not under test */
+int gsm48_tx_gsm_deact_pdp_req(struct sgsn_pdp_ctx *pdp, uint8_t sm_cause)
+{
+	return 0;
+}
+
+int bssgp_tx_paging(uint16_t nsei, uint16_t ns_bvci,
+		    struct bssgp_paging_info *pinfo)
+{
+	printf("PS paging IMSI %s on BVCI %u\n", pinfo->imsi, pinfo->bvci);
+	paged++;
+	return 0;
+}
+
+int sndcp_unitdata_req(struct msgb *msg, struct gprs_llc_lle *lle,
+		       uint8_t nsapi, void *mmcontext)
+{
+	printf("SNDCP NSAPI %u TLLI %08x: N-PDU %u, %u bytes\n", nsapi,
+	       msgb_tlli(msg), msg->data[0], msg->len);
+	msgb_free(msg);
+	return 0;
+}
+
+static struct msgb *npdu(uint8_t id)
+{
+	struct msgb *msg = msgb_alloc(NPDU_BUF_SIZE, "N-PDU");
+
+	memset(msgb_put(msg, NPDU_LEN), id, NPDU_LEN);
+	return msg;
+}
+
+static void print_queue(const char *what, struct sgsn_pdp_ctx *pdp)
+{
+	printf("%s: %u queued, depth %lu, %s, paged %d, dropped %"PRIu64"\n",
+	       what, pdp->dl_queue_len, osmo_counter_get(sgsn_dl_queue_depth),
+	       osmo_timer_pending(&pdp->dl_timer) ? "timer running" :
+	       "timer stopped", paged,
+	       pdp->ctrg->ctr[PDP_CTR_PKTS_DL_DROPPED].current);
+}
+
+static void test_dl_queue(void)
+{
+	struct gprs_ra_id raid = { 1, 1, 1, 1 };
+	struct sgsn_mm_ctx *mm;
+	struct sgsn_pdp_ctx *pdp;
+	int i, rc;
+
+	printf("Testing the downlink queue of a suspended MS\n");
+
+	mm = sgsn_mm_ctx_alloc(0xc0001234, &raid);
+	mm->llme = talloc_zero(tall_bsc_ctx, struct gprs_llc_llme);
+	strcpy(mm->imsi, "001010000001234");
+	mm->bvci = 2;
+	mm->mm_state = GMM_REGISTERED_SUSPENDED;
+	pdp = sgsn_pdp_ctx_alloc(mm, 5);
+	pdp->sapi = 3;
+
+	/* the queue limit counts the buffers, not the payload */
+	for (i = 0; i < 5; i++) {
+		rc = sgsn_rx_gtp_data(pdp, npdu(i));
+		printf("N-PDU %d: %s\n", i, rc == -ENOBUFS ? "dropped" :
+		       rc == 0 ? "queued" : "error");
+	}
+	OSMO_ASSERT(pdp->dl_queue_bytes ==
+		    4 * (sizeof(struct msgb) + NPDU_BUF_SIZE));
+	print_queue("suspended", pdp);
+
+	/* the MS responded to paging */
+	mm->mm_state = GMM_REGISTERED_NORMAL;
+	mm->bvci = 3;
+	sgsn_mm_dl_flush(mm);
+	OSMO_ASSERT(pdp->dl_queue_bytes == 0);
+	print_queue("flushed", pdp);
+
+	/* resumed without a flush, the queue still goes first */
+	mm->mm_state = GMM_REGISTERED_SUSPENDED;
+	sgsn_rx_gtp_data(pdp, npdu(5));
+	mm->mm_state = GMM_REGISTERED_NORMAL;
+	sgsn_rx_gtp_data(pdp, npdu(6));
+	print_queue("resumed", pdp);
+
+	/* the MS did not respond to paging */
+	mm->mm_state = GMM_REGISTERED_SUSPENDED;
+	sgsn_rx_gtp_data(pdp, npdu(7));
+	sgsn_rx_gtp_data(pdp, npdu(8));
+	pdp->dl_timer.cb(pdp->dl_timer.data);
+	OSMO_ASSERT(pdp->dl_queue_bytes == 0);
+	print_queue("expired", pdp);
+
+	/* freeing the context drops the queue */
+	sgsn_rx_gtp_data(pdp, npdu(9));
+	printf("queued %u, depth %lu\n", pdp->dl_queue_len,
+	       osmo_counter_get(sgsn_dl_queue_depth));
+	talloc_free(mm->llme);
+	sgsn_mm_ctx_free(mm);
+	printf("freed, depth %lu\n", osmo_counter_get(sgsn_dl_queue_depth));
+}
+
+static void print_pdp(struct sgsn_mm_ctx *mm, uint8_t nsapi, uint8_t ti)
+{
+	struct sgsn_pdp_ctx *by_nsapi = sgsn_pdp_ctx_by_nsapi(mm, nsapi);
+	struct sgsn_pdp_ctx *by_tid = sgsn_pdp_ctx_by_tid(mm, ti);
+
+	printf("NSAPI %u: %s, TI %u: %s\n",
+	       nsapi, by_nsapi ? "found" : "none",
+	       ti, by_tid ? "found" : "none");
+	OSMO_ASSERT(!by_nsapi || by_nsapi->nsapi == nsapi);
+	OSMO_ASSERT(!by_tid || by_tid->ti == ti);
+}
+
+static void test_pdp_lookup(void)
+{
+	struct gprs_ra_id raid = { 1, 1, 1, 1 };
+	struct sgsn_mm_ctx *mm;
+	struct sgsn_pdp_ctx *pdp5, *pdp6;
+
+	printf("Testing the PDP context lookups\n");
+
+	mm = sgsn_mm_ctx_alloc(0xc0005678, &raid);
+	pdp5 = sgsn_pdp_ctx_alloc(mm, 5);
+	pdp6 = sgsn_pdp_ctx_alloc(mm, 6);
+	sgsn_pdp_ctx_set_ti(pdp5, 1);
+	sgsn_pdp_ctx_set_ti(pdp6, 2);
+	print_pdp(mm, 5, 1);
+	print_pdp(mm, 6, 2);
+	print_pdp(mm, 7, 3);
+
+	/* an NSAPI in use or out of range can't be allocated */
+	printf("NSAPI 5 again: %s\n",
+	       sgsn_pdp_ctx_alloc(mm, 5) ? "allocated" : "refused");
+	printf("NSAPI 16: %s\n",
+	       sgsn_pdp_ctx_alloc(mm, 16) ? "allocated" : "refused");
+
+	/* a new TI moves the entry */
+	sgsn_pdp_ctx_set_ti(pdp5, 3);
+	print_pdp(mm, 5, 1);
+	print_pdp(mm, 5, 3);
+
+	/* a freed context is gone from both */
+	sgsn_pdp_ctx_free(pdp5);
+	print_pdp(mm, 5, 3);
+	print_pdp(mm, 6, 2);
+
+	sgsn_mm_ctx_free(mm);
+}
+
+static void test_apn(void)
+{
+	static const uint8_t internet[] = "\x08internet\x02tc";
+	static const uint8_t unknown[] = "\x03foo";
+	static const uint8_t bad[] = "\x09internet";
+	struct apn_ctx *actx;
+
+	printf("Testing the GGSN selection by APN\n");
+
+	actx = apn_ctx_find_alloc("internet.tc");
+	actx->ggsn = sgsn_ggsn_ctx_find_alloc(1);
+	OSMO_ASSERT(apn_ctx_find_alloc("internet.tc") == actx);
+
+	actx = apn_ctx_by_ie(internet, sizeof(internet) - 1);
+	printf("internet.tc: %s, GGSN %d\n", actx ? actx->name : "none",
+	       actx ? (int) actx->ggsn->id : -1);
+	actx = apn_ctx_by_ie(unknown, sizeof(unknown) - 1);
+	printf("foo: %s\n", actx ? actx->name : "none");
+	actx = apn_ctx_by_ie(bad, sizeof(bad) - 1);
+	printf("bad label length: %s\n", actx ? actx->name : "none");
+}
+
+int main(int argc, char **argv)
+{
+	osmo_init_logging(&log_info);
+
+	test_dl_queue();
+	test_pdp_lookup();
+	test_apn();
+
+	printf("Done.\n");
+	return EXIT_SUCCESS;
+}
@@ -4,12 +4,25 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <sys/time.h>
+
 #include <openbsc/arfcn_range_encode.h>
+#include <openbsc/system_information.h>
+#include <openbsc/gsm_data.h>
+#include <openbsc/debug.h>
 
+#include <osmocom/core/application.h>
+#include <osmocom/core/msgb.h>
 #include <osmocom/core/utils.h>
+#include <osmocom/gsm/rsl.h>
 
 #define DBG(...)
 
+#define BENCH_ROUNDS	2000
+#define RANGE_ENC_SETS	10000
+#define RANGE_ENC_BENCH_SETS	64
+#define RANGE_ENC_BENCH_ROUNDS	2000
+
 #define VERIFY(res, cmp, wanted)					\
 	if (!(res cmp wanted)) {					\
 		printf("ASSERT failed: %s:%d Wanted: %d %s %d\n",	\
@@ -109,11 +122,367 @@ static void test_print_encoding()
 	printf("Range512: %s\n", osmo_hexdump(chan_list, ARRAY_SIZE(chan_list)));
 }
 
+static const uint8_t si_types[] = {
+	SYSINFO_TYPE_1, SYSINFO_TYPE_2, SYSINFO_TYPE_2bis, SYSINFO_TYPE_2ter,
+	SYSINFO_TYPE_3, SYSINFO_TYPE_4, SYSINFO_TYPE_13, SYSINFO_TYPE_5,
+	SYSINFO_TYPE_5bis, SYSINFO_TYPE_5ter, SYSINFO_TYPE_6,
+};
+
+/* DCS1800 neighbors that need the range encoding and two in GSM900 */
+static const uint16_t si_neigh_arfcns[] = {
+	12, 70, 520, 574, 634, 700, 764, 830,
+};
+
+static int generate_all_si(struct gsm_bts *bts)
+{
+	int i, rc;
+
+	for (i = 0; i < ARRAY_SIZE(si_types); i++) {
+		bts->si_valid |= (1 << si_types[i]);
+		rc = gsm_generate_si(bts, si_types[i]);
+		if (rc < 0) {
+			printf("Cannot generate SI%s: %d\n",
+				get_value_string(osmo_sitype_strs, si_types[i]),
+				rc);
+			return rc;
+		}
+	}
+
+	return 0;
+}
+
+static void print_changed_si(struct gsm_bts *bts,
+			     sysinfo_buf_t ref[_MAX_SYSINFO_TYPE])
+{
+	int i, n = 0;
+
+	printf("Changed:");
+	for (i = 0; i < ARRAY_SIZE(si_types); i++) {
+		if (!memcmp(ref[si_types[i]], bts->si_buf[si_types[i]],
+			    sizeof(sysinfo_buf_t)))
+			continue;
+		printf(" SI%s",
+			get_value_string(osmo_sitype_strs, si_types[i]));
+		n++;
+	}
+	printf("%s\n", n ? "" : " none");
+}
+
+#ifdef BENCHMARK
+static void bench_si(struct gsm_bts *bts, int cached)
+{
+	struct timeval start, end, diff;
+	double secs;
+	int i;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < BENCH_ROUNDS; i++) {
+		if (!cached) {
+			memset(bts->si_freq_cache, 0,
+			       sizeof(bts->si_freq_cache));
+			range_enc_memo_flush();
+		}
+		generate_all_si(bts);
+	}
+	gettimeofday(&end, NULL);
+
+	timersub(&end, &start, &diff);
+	secs = diff.tv_sec + diff.tv_usec / 1000000.0;
+	fprintf(stderr, "Generated %u SI sets (%s) in %.3f s: %.0f/s\n",
+		BENCH_ROUNDS, cached ? "cached" : "uncached", secs,
+		secs > 0 ? BENCH_ROUNDS / secs : 0);
+}
+#endif
+
+static void test_si_cache(void)
+{
+	static sysinfo_buf_t ref[_MAX_SYSINFO_TYPE];
+	static sysinfo_buf_t si13_ref;
+	struct gsm_network *net;
+	struct gsm_bts *bts, *bts2;
+	int i;
+
+	printf("Testing cached SI generation\n");
+
+	net = gsm_network_init(1, 1, NULL);
+	bts = gsm_bts_alloc_register(net, GSM_BTS_TYPE_UNKNOWN,
+				     HARDCODED_TSC, HARDCODED_BSIC);
+	bts2 = gsm_bts_alloc_register(net, GSM_BTS_TYPE_UNKNOWN,
+				      HARDCODED_TSC, HARDCODED_BSIC);
+	bts->band = GSM_BAND_1800;
+	bts->c0->arfcn = 600;
+	bts->gprs.mode = BTS_GPRS_GPRS;
+	bts->neigh_list_manual_mode = NL_MODE_MANUAL;
+	for (i = 0; i < ARRAY_SIZE(si_neigh_arfcns); i++)
+		bitvec_set_bit_pos(&bts->si_common.neigh_list,
+				   si_neigh_arfcns[i], 1);
+	bts2->band = GSM_BAND_1800;
+	bts2->c0->arfcn = 610;
+	bts2->gprs.mode = BTS_GPRS_EGPRS;
+
+	if (generate_all_si(bts) < 0)
+		return;
+	memcpy(ref, bts->si_buf, sizeof(ref));
+
+	/* the cached lists must match a fresh encoding */
+	generate_all_si(bts);
+	print_changed_si(bts, ref);
+	memset(bts->si_freq_cache, 0, sizeof(bts->si_freq_cache));
+	range_enc_memo_flush();
+	generate_all_si(bts);
+	print_changed_si(bts, ref);
+
+	/* a neighbor list change must show up despite the cache */
+	bitvec_set_bit_pos(&bts->si_common.neigh_list, 540, 1);
+	generate_all_si(bts);
+	print_changed_si(bts, ref);
+	bitvec_set_bit_pos(&bts->si_common.neigh_list, 540, 0);
+	generate_all_si(bts);
+	print_changed_si(bts, ref);
+
+	/* the selection parameters only end up in SI3 and SI4 */
+	bts->si_common.cell_ro_sel_par.present = 1;
+	bts->si_common.cell_ro_sel_par.penalty_time = 31;
+	generate_all_si(bts);
+	print_changed_si(bts, ref);
+	bts->si_common.cell_ro_sel_par.present = 0;
+	bts->si_common.cell_ro_sel_par.penalty_time = 0;
+
+	/* generating the SI of an EGPRS BTS must not leak into others */
+	memcpy(si13_ref, bts->si_buf[SYSINFO_TYPE_13], sizeof(si13_ref));
+	generate_all_si(bts2);
+	gsm_generate_si(bts, SYSINFO_TYPE_13);
+	printf("SI13 %s\n", memcmp(si13_ref, bts->si_buf[SYSINFO_TYPE_13],
+				   sizeof(si13_ref)) ? "differs" : "unchanged");
+
+#ifdef BENCHMARK
+	bench_si(bts, 0);
+	bench_si(bts, 1);
+#endif
+}
+
+/* print the SI updates sent to the BTS instead of sending them */
+int abis_rsl_sendmsg(struct msgb *msg)
+{
+	struct abis_rsl_common_hdr *ch = (struct abis_rsl_common_hdr *) msg->data;
+	struct tlv_parsed tp;
+	int hlen, info_ie;
+
+	if (ch->msg_type == RSL_MT_BCCH_INFO) {
+		hlen = sizeof(struct abis_rsl_dchan_hdr);
+		info_ie = RSL_IE_FULL_BCCH_INFO;
+	} else {
+		hlen = sizeof(*ch);
+		info_ie = RSL_IE_L3_INFO;
+	}
+	rsl_tlv_parse(&tp, msg->data + hlen, msgb_length(msg) - hlen);
+
+	printf("%s SI%s %s\n",
+		ch->msg_type == RSL_MT_BCCH_INFO ? "BCCH INFO" : "SACCH FILL",
+		get_value_string(osmo_sitype_strs,
+			osmo_rsl2sitype(*TLVP_VAL(&tp, RSL_IE_SYSINFO_TYPE))),
+		TLVP_PRESENT(&tp, info_ie) ? "sent" : "stopped");
+
+	msgb_free(msg);
+	return 0;
+}
+
+static void test_si_resend(void)
+{
+	static struct e1inp_sign_link sign_link;
+	struct gsm_network *net;
+	struct gsm_bts *bts;
+
+	printf("Testing SI resend\n");
+
+	net = gsm_network_init(1, 1, NULL);
+	bts = gsm_bts_alloc_register(net, GSM_BTS_TYPE_UNKNOWN,
+				     HARDCODED_TSC, HARDCODED_BSIC);
+	bts->band = GSM_BAND_900;
+	bts->c0->arfcn = 10;
+	bts->c0->rsl_link = &sign_link;
+	bts->neigh_list_manual_mode = NL_MODE_MANUAL;
+	bitvec_set_bit_pos(&bts->si_common.neigh_list, 20, 1);
+	bitvec_set_bit_pos(&bts->si_common.neigh_list, 30, 1);
+
+	/* the bootstrap only sends what is valid */
+	printf("Bootstrap:\n");
+	gsm_bts_trx_set_system_infos(bts->c0);
+
+	/* a neighbor in another band needs SI2ter/5ter, SI3 announces it */
+	printf("DCS1800 neighbor added:\n");
+	bitvec_set_bit_pos(&bts->si_common.neigh_list, 600, 1);
+	gsm_bts_set_system_infos(bts);
+
+	/* without it the BTS must stop broadcasting them */
+	printf("DCS1800 neighbor removed:\n");
+	bitvec_set_bit_pos(&bts->si_common.neigh_list, 600, 0);
+	gsm_bts_set_system_infos(bts);
+
+	printf("Nothing changed:\n");
+	gsm_bts_set_system_infos(bts);
+
+	/* the invalid SI2bis changes as well but must not be sent */
+	printf("Cell barred:\n");
+	bts->si_common.rach_control.cell_bar = 1;
+	gsm_bts_set_system_infos(bts);
+
+	/* SI3/SI4 announce GPRS, SI13 is only broadcast with it */
+	printf("GPRS on:\n");
+	bts->gprs.mode = BTS_GPRS_GPRS;
+	gsm_bts_set_system_infos(bts);
+
+	printf("GPRS off:\n");
+	bts->gprs.mode = BTS_GPRS_NONE;
+	gsm_bts_set_system_infos(bts);
+}
+
+static const int range_enc_ranges[] = {
+	ARFCN_RANGE_1024, ARFCN_RANGE_512, ARFCN_RANGE_256, ARFCN_RANGE_128,
+};
+
+/* the most ARFCNs each range can carry after F0 has been taken out */
+static const int range_enc_max_size[] = { 16, 17, 21, 28 };
+
+struct range_enc_set {
+	int range;
+	int size;
+	int arfcns[RANGE_ENC_MAX_ARFCNS];
+};
+
+static void random_range_enc_set(struct range_enc_set *set)
+{
+	int r = rand() % ARRAY_SIZE(range_enc_ranges);
+	int i, j, arfcn;
+
+	set->range = range_enc_ranges[r];
+	set->size = 1 + rand() % range_enc_max_size[r];
+
+	for (i = 0; i < set->size; ) {
+		arfcn = rand() % set->range;
+		for (j = 0; j < i; j++)
+			if (set->arfcns[j] == arfcn)
+				break;
+		if (j == i)
+			set->arfcns[i++] = arfcn;
+	}
+}
+
+static int int_cmp(const void *a, const void *b)
+{
+	return *(const int *) a - *(const int *) b;
+}
+
+static void test_range_enc_iter(void)
+{
+	struct range_enc_set set;
+	int w_rec[2 * RANGE_ENC_MAX_ARFCNS], w_iter[RANGE_ENC_MAX_ARFCNS];
+	int w_cached[RANGE_ENC_MAX_ARFCNS];
+	int sorted[RANGE_ENC_MAX_ARFCNS];
+	int i, j, n, rc, mismatch = 0;
+
+	printf("Testing iterative range encoding\n");
+
+	srand(1);
+	range_enc_memo_flush();
+	for (n = 0; n < RANGE_ENC_SETS; n++) {
+		random_range_enc_set(&set);
+
+		memset(w_rec, 0, sizeof(w_rec));
+		memset(w_iter, 0, sizeof(w_iter));
+		range_enc_arfcns(set.range, set.arfcns, set.size, w_rec, 0);
+		rc = range_enc_arfcns_iter(set.range, set.arfcns, set.size,
+					   w_iter);
+		VERIFY(rc, ==, 0);
+
+		for (i = RANGE_ENC_MAX_ARFCNS; i < ARRAY_SIZE(w_rec); i++)
+			VERIFY(w_rec[i], ==, 0);
+		if (memcmp(w_rec, w_iter, sizeof(w_iter))) {
+			printf("Mismatch for range %d with %d ARFCNs\n",
+				set.range, set.size);
+			mismatch++;
+			continue;
+		}
+
+		/* the memo encodes the sorted set, so the list and its
+		 * reverse both give the W(i) of the sorted set */
+		memcpy(sorted, set.arfcns, sizeof(sorted));
+		qsort(sorted, set.size, sizeof(*sorted), int_cmp);
+		memset(w_rec, 0, sizeof(w_rec));
+		range_enc_arfcns(set.range, sorted, set.size, w_rec, 0);
+
+		for (i = 0; i < 2; i++) {
+			rc = range_enc_arfcns_cached(set.range, set.arfcns,
+						     set.size, w_cached);
+			VERIFY(rc, ==, 0);
+			if (memcmp(w_rec, w_cached, sizeof(w_cached))) {
+				printf("Cached mismatch for range %d with "
+					"%d ARFCNs\n", set.range, set.size);
+				mismatch++;
+			}
+			for (j = 0; j < set.size; j++)
+				set.arfcns[j] = sorted[set.size - 1 - j];
+		}
+	}
+
+	printf("Checked %d random ARFCN sets, %d mismatches\n",
+		RANGE_ENC_SETS, mismatch);
+}
+
+#ifdef BENCHMARK
+static void bench_range_enc(void)
+{
+	static struct range_enc_set sets[RANGE_ENC_BENCH_SETS];
+	const char *names[] = { "recursive", "iterative", "cached" };
+	struct timeval start, end, diff;
+	int w[2 * RANGE_ENC_MAX_ARFCNS];
+	unsigned int num = RANGE_ENC_BENCH_SETS * RANGE_ENC_BENCH_ROUNDS;
+	double secs;
+	int i, j, k;
+
+	srand(2);
+	for (i = 0; i < ARRAY_SIZE(sets); i++)
+		random_range_enc_set(&sets[i]);
+
+	for (k = 0; k < ARRAY_SIZE(names); k++) {
+		range_enc_memo_flush();
+		gettimeofday(&start, NULL);
+		for (i = 0; i < RANGE_ENC_BENCH_ROUNDS; i++) {
+			for (j = 0; j < ARRAY_SIZE(sets); j++) {
+				memset(w, 0, sizeof(w));
+				if (k == 0)
+					range_enc_arfcns(sets[j].range,
+						sets[j].arfcns, sets[j].size,
+						w, 0);
+				else if (k == 1)
+					range_enc_arfcns_iter(sets[j].range,
+						sets[j].arfcns, sets[j].size,
+						w);
+				else
+					range_enc_arfcns_cached(sets[j].range,
+						sets[j].arfcns, sets[j].size,
+						w);
+			}
+		}
+		gettimeofday(&end, NULL);
+
+		timersub(&end, &start, &diff);
+		secs = diff.tv_sec + diff.tv_usec / 1000000.0;
+		fprintf(stderr, "Range encoded %u sets (%s) in %.3f s: "
+			"%.0f encodes/s\n", num, names[k], secs,
+			secs > 0 ? num / secs : 0);
+	}
+}
+#endif
+
 int main(int argc, char **argv)
 {
 	int ws[(sizeof(freqs1)/sizeof(freqs1[0]))];
 	int i, f0 = 0xFFFFFF;
 
+	osmo_init_logging(&log_info);
+	log_set_log_level(osmo_stderr_target, LOGL_FATAL);
+
 	memset(&ws[0], 0x23, sizeof(ws));
 
 	i = range_enc_find_index(1023, freqs1, ARRAY_SIZE(freqs1));
@@ -151,6 +520,12 @@ int main(int argc, char **argv)
 
 	test_arfcn_filter();
 	test_print_encoding();
+	test_si_cache();
+	test_si_resend();
+	test_range_enc_iter();
+#ifdef BENCHMARK
+	bench_range_enc();
+#endif
 
 	return 0;
 }